@@ -330,6 +330,7 @@
 330 stdcall NtReleaseMutant(long ptr)
 331 stdcall NtReleaseSemaphore(long long ptr)
 332 stdcall NtRemoveIoCompletion(ptr ptr ptr ptr ptr)
+@ stdcall NtRemoveIoCompletionEx(ptr ptr long ptr ptr long)
 333 stdcall NtRemoveProcessDebug(ptr ptr)
 334 stdcall NtRenameKey(ptr ptr)
 335 stdcall NtReplaceKey(ptr long ptr)
@@ -485,6 +486,7 @@
 484 stdcall RtlCheckRegistryKey(long ptr)
 485 stdcall RtlClearAllBits(ptr)
 486 stdcall RtlClearBits(ptr long long)
+@ stdcall RtlClearBitsSummary(ptr long long)
 487 stdcall RtlCloneMemoryStream(ptr ptr)
 488 stdcall RtlCommitMemoryStream(ptr long)
 489 stdcall RtlCompactHeap(long long)
@@ -617,6 +619,8 @@
 615 stdcall RtlFindCharInUnicodeString(long ptr ptr ptr)
 616 stdcall RtlFindClearBits(ptr long long)
 617 stdcall RtlFindClearBitsAndSet(ptr long long)
+@ stdcall RtlFindClearBitsAndSetSummary(ptr long long)
+@ stdcall RtlFindClearBitsSummary(ptr long long)
 618 stdcall RtlFindClearRuns(ptr ptr long long)
 619 stdcall RtlFindLastBackwardRunClear(ptr long ptr)
 620 stdcall RtlFindLeastSignificantBit(double)
@@ -697,6 +701,7 @@
 694 stdcall RtlInitUnicodeStringEx(ptr wstr)
 # stdcall RtlInitializeAtomPackage
 696 stdcall RtlInitializeBitMap(ptr long long)
+@ stdcall RtlInitializeBitMapSummary(ptr ptr ptr long)
 697 stdcall RtlInitializeContext(ptr ptr ptr ptr ptr)
 698 stdcall RtlInitializeCriticalSection(ptr)
 699 stdcall RtlInitializeCriticalSectionAndSpinCount(ptr long)
@@ -776,8 +781,8 @@
 771 stdcall RtlMultiAppendUnicodeStringBuffer(ptr long ptr)
 772 stdcall RtlMultiByteToUnicodeN(ptr long ptr ptr long)
 773 stdcall RtlMultiByteToUnicodeSize(ptr str long)
-# RtlMultipleAllocateHeap
-# RtlMultipleFreeHeap
+774 stdcall RtlMultipleAllocateHeap(ptr long ptr long ptr)
+775 stdcall RtlMultipleFreeHeap(ptr long long ptr)
 776 stdcall RtlNewInstanceSecurityObject(long long ptr ptr ptr ptr ptr long ptr ptr)
 777 stdcall RtlNewSecurityGrantedAccess(long ptr ptr ptr ptr ptr)
 778 stdcall RtlNewSecurityObject(ptr ptr ptr long ptr ptr)
@@ -790,6 +795,7 @@
 785 stdcall RtlNumberGenericTableElements(ptr)
 786 stdcall RtlNumberGenericTableElementsAvl(ptr)
 787 stdcall RtlNumberOfClearBits(ptr)
+@ stdcall RtlNumberOfClearBitsSummary(ptr)
 788 stdcall RtlNumberOfSetBits(ptr)
 789 stdcall RtlOemStringToUnicodeSize(ptr) RtlxOemStringToUnicodeSize
 790 stdcall RtlOemStringToUnicodeString(ptr ptr long)
@@ -854,6 +860,7 @@
 848 stdcall RtlSetAllBits(ptr)
 849 stdcall RtlSetAttributesSecurityDescriptor(ptr long ptr)
 850 stdcall RtlSetBits(ptr long long)
+@ stdcall RtlSetBitsSummary(ptr long long)
 851 stdcall RtlSetControlSecurityDescriptor(ptr long long)
 852 stdcall RtlSetCriticalSectionSpinCount(ptr long)
 853 stdcall RtlSetCurrentDirectory_U(ptr)
@@ -1175,6 +1182,7 @@
 1167 stdcall ZwReleaseMutant(long ptr) NtReleaseMutant
 1168 stdcall ZwReleaseSemaphore(long long ptr) NtReleaseSemaphore
 1169 stdcall ZwRemoveIoCompletion(ptr ptr ptr ptr ptr) NtRemoveIoCompletion
+@ stdcall ZwRemoveIoCompletionEx(ptr ptr long ptr ptr long) NtRemoveIoCompletionEx
 1170 stdcall ZwRemoveProcessDebug(ptr ptr) NtRemoveProcessDebug
 1171 stdcall ZwRenameKey(ptr ptr) NtRenameKey
 1172 stdcall ZwReplaceKey(ptr long ptr) NtReplaceKey
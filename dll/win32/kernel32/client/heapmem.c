@@ -190,8 +190,8 @@ HeapExtend(HANDLE hHeap,
 {
     NTSTATUS Status;
 
-    /* Call the RTL API. Gone in Vista, so commented out. */
-    Status = STATUS_NOT_IMPLEMENTED; //RtlExtendHeap(hHeap, dwFlags, BaseAddress, dwBytes);
+    /* Call the RTL API */
+    Status = RtlExtendHeap(hHeap, dwFlags, BaseAddress, dwBytes);
     if (!NT_SUCCESS(Status))
     {
         /* We failed */
@@ -237,8 +237,8 @@ HeapSummary(HANDLE hHeap,
     /* Fill in the length information */
     Usage.Length = sizeof(Usage);
 
-    /* Call RTL. Gone in Vista, so commented out */
-    Status = STATUS_NOT_IMPLEMENTED; //RtlUsageHeap(hHeap, dwFlags, &Usage);
+    /* Call RTL */
+    Status = RtlUsageHeap(hHeap, dwFlags, &Usage);
     if (!NT_SUCCESS(Status))
     {
         /* We failed */
@@ -264,8 +264,8 @@ HeapUsage(HANDLE hHeap,
 {
     NTSTATUS Status;
 
-    /* Call RTL. Gone in Vista, so commented out */
-    Status = STATUS_NOT_IMPLEMENTED; //RtlUsageHeap(hHeap, dwFlags, &Usage);
+    /* Call RTL */
+    Status = RtlUsageHeap(hHeap, dwFlags, Usage);
     if (!NT_SUCCESS(Status))
     {
         /* We failed */
@@ -291,18 +291,71 @@ WINAPI
 HeapWalk(HANDLE	hHeap,
          LPPROCESS_HEAP_ENTRY lpEntry)
 {
+    RTL_HEAP_WALK_ENTRY WalkEntry;
     NTSTATUS Status;
 
-    DPRINT1("Warning, HeapWalk is calling RtlWalkHeap with Win32 parameters\n");
-
-    Status = RtlWalkHeap(hHeap, lpEntry);
+    /* Rebuild the RTL walk position from the entry returned last time */
+    RtlZeroMemory(&WalkEntry, sizeof(WalkEntry));
+    WalkEntry.DataAddress = lpEntry->lpData;
+    if (lpEntry->lpData)
+    {
+        WalkEntry.DataSize = lpEntry->cbData;
+        WalkEntry.SegmentIndex = lpEntry->iRegionIndex;
+
+        if (lpEntry->wFlags & PROCESS_HEAP_REGION)
+            WalkEntry.Flags = RTL_HEAP_SEGMENT;
+        else if (lpEntry->wFlags & PROCESS_HEAP_UNCOMMITTED_RANGE)
+            WalkEntry.Flags = RTL_HEAP_UNCOMMITTED_RANGE;
+        else if (lpEntry->wFlags & PROCESS_HEAP_ENTRY_BUSY)
+            WalkEntry.Flags = RTL_HEAP_BUSY;
+    }
 
+    Status = RtlWalkHeap(hHeap, &WalkEntry);
     if (!NT_SUCCESS(Status))
     {
         SetLastError(RtlNtStatusToDosError(Status));
         return FALSE;
     }
 
+    /* Convert it back to the Win32 format */
+    lpEntry->lpData = WalkEntry.DataAddress;
+    lpEntry->cbData = (DWORD)WalkEntry.DataSize;
+    lpEntry->cbOverhead = WalkEntry.OverheadBytes;
+    lpEntry->iRegionIndex = WalkEntry.SegmentIndex;
+
+    if (WalkEntry.Flags & RTL_HEAP_SEGMENT)
+    {
+        lpEntry->wFlags = PROCESS_HEAP_REGION;
+        lpEntry->Region.dwCommittedSize = (DWORD)WalkEntry.Segment.CommittedSize;
+        lpEntry->Region.dwUnCommittedSize = (DWORD)WalkEntry.Segment.UnCommittedSize;
+        lpEntry->Region.lpFirstBlock = WalkEntry.Segment.FirstEntry;
+        lpEntry->Region.lpLastBlock = WalkEntry.Segment.LastEntry;
+    }
+    else if (WalkEntry.Flags & RTL_HEAP_UNCOMMITTED_RANGE)
+    {
+        lpEntry->wFlags = PROCESS_HEAP_UNCOMMITTED_RANGE;
+    }
+    else if (WalkEntry.Flags & RTL_HEAP_BUSY)
+    {
+        lpEntry->wFlags = PROCESS_HEAP_ENTRY_BUSY;
+        RtlZeroMemory(&lpEntry->Block, sizeof(lpEntry->Block));
+
+        /* Movable blocks remember their handle in the settable value */
+        if ((WalkEntry.Flags & RTL_HEAP_SETTABLE_VALUE) &&
+            (WalkEntry.Flags & (BASE_HEAP_FLAG_MOVABLE >> 4)))
+        {
+            lpEntry->wFlags |= PROCESS_HEAP_ENTRY_MOVEABLE;
+            lpEntry->Block.hMem = (HANDLE)WalkEntry.Block.Settable;
+        }
+
+        if (WalkEntry.Flags & (BASE_HEAP_FLAG_DDESHARE >> 4))
+            lpEntry->wFlags |= PROCESS_HEAP_ENTRY_DDESHARE;
+    }
+    else
+    {
+        lpEntry->wFlags = 0;
+    }
+
     return TRUE;
 }
 
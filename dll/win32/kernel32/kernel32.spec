@@ -439,6 +439,7 @@
 435 stdcall GetProfileStringA(str str str ptr long)
 436 stdcall GetProfileStringW(wstr wstr wstr ptr long)
 437 stdcall GetQueuedCompletionStatus(long ptr ptr ptr long)
+@ stdcall GetQueuedCompletionStatusEx(ptr ptr long ptr long long)
 438 stdcall GetShortPathNameA(str ptr long)
 439 stdcall GetShortPathNameW(wstr ptr long)
 440 stdcall GetStartupInfoA(ptr)
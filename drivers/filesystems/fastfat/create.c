@@ -772,7 +772,7 @@ VfatCreateFile(
 
                 if (PagingFileCreate)
                 {
-                    pFcb->Flags |= FCB_IS_PAGE_FILE;
+                    vfatSetPagingFileFCB(pFcb);
                 }
             }
             else
@@ -891,7 +891,7 @@ VfatCreateFile(
             }
             else
             {
-                pFcb->Flags |= FCB_IS_PAGE_FILE;
+                vfatSetPagingFileFCB(pFcb);
             }
         }
         else
@@ -639,6 +639,9 @@ FATAddEntry(
     CcSetDirtyPinnedData(Context, NULL);
     CcUnpinData(Context);
 
+    /* Make the new name known to the lookups in the parent */
+    vfatNameIndexAddEntry(DeviceExt, ParentFcb, DirContext.DirIndex);
+
     if (MoveContext != NULL)
     {
         /* We're modifying an existing FCB - likely rename/move */
@@ -835,6 +838,10 @@ FATDelEntry(
 
     DPRINT("delEntry PathName \'%wZ\'\n", &pFcb->PathNameU);
     DPRINT("delete entry: %u to %u\n", pFcb->startIndex, pFcb->dirIndex);
+
+    /* Forget about the name while the entry can still be read */
+    vfatNameIndexRemoveEntry(DeviceExt, pFcb->parentFcb, pFcb->dirIndex);
+
     Offset.u.HighPart = 0;
     for (i = pFcb->startIndex; i <= pFcb->dirIndex; i++)
     {
@@ -453,15 +453,8 @@ VfatMdlRead(
 {
     DPRINT("VfatMdlRead\n");
 
-    UNREFERENCED_PARAMETER(FileObject);
-    UNREFERENCED_PARAMETER(FileOffset);
-    UNREFERENCED_PARAMETER(Length);
-    UNREFERENCED_PARAMETER(LockKey);
-    UNREFERENCED_PARAMETER(MdlChain);
-    UNREFERENCED_PARAMETER(IoStatus);
-    UNREFERENCED_PARAMETER(DeviceObject);
-
-    return FALSE;
+    return FsRtlMdlReadDev(FileObject, FileOffset, Length, LockKey,
+                           MdlChain, IoStatus, DeviceObject);
 }
 
 static FAST_IO_MDL_READ_COMPLETE VfatMdlReadComplete;
@@ -476,11 +469,7 @@ VfatMdlReadComplete(
 {
     DPRINT("VfatMdlReadComplete\n");
 
-    UNREFERENCED_PARAMETER(FileObject);
-    UNREFERENCED_PARAMETER(MdlChain);
-    UNREFERENCED_PARAMETER(DeviceObject);
-
-    return FALSE;
+    return FsRtlMdlReadCompleteDev(FileObject, MdlChain, DeviceObject);
 }
 
 static FAST_IO_PREPARE_MDL_WRITE VfatPrepareMdlWrite;
@@ -499,15 +488,8 @@ VfatPrepareMdlWrite(
 {
     DPRINT("VfatPrepareMdlWrite\n");
 
-    UNREFERENCED_PARAMETER(FileObject);
-    UNREFERENCED_PARAMETER(FileOffset);
-    UNREFERENCED_PARAMETER(Length);
-    UNREFERENCED_PARAMETER(LockKey);
-    UNREFERENCED_PARAMETER(MdlChain);
-    UNREFERENCED_PARAMETER(IoStatus);
-    UNREFERENCED_PARAMETER(DeviceObject);
-
-    return FALSE;
+    return FsRtlPrepareMdlWriteDev(FileObject, FileOffset, Length, LockKey,
+                                   MdlChain, IoStatus, DeviceObject);
 }
 
 static FAST_IO_MDL_WRITE_COMPLETE VfatMdlWriteComplete;
@@ -523,12 +505,7 @@ VfatMdlWriteComplete(
 {
     DPRINT("VfatMdlWriteComplete\n");
 
-    UNREFERENCED_PARAMETER(FileObject);
-    UNREFERENCED_PARAMETER(FileOffset);
-    UNREFERENCED_PARAMETER(MdlChain);
-    UNREFERENCED_PARAMETER(DeviceObject);
-
-    return FALSE;
+    return FsRtlMdlWriteCompleteDev(FileObject, FileOffset, MdlChain, DeviceObject);
 }
 
 static FAST_IO_READ_COMPRESSED VfatFastIoReadCompressed;
@@ -19,8 +19,24 @@
 #define  CACHEPAGESIZE(pDeviceExt) ((pDeviceExt)->FatInfo.BytesPerCluster > PAGE_SIZE ? \
 		   (pDeviceExt)->FatInfo.BytesPerCluster : PAGE_SIZE)
 
+/* Each summary block of the free cluster bitmap covers 4096 clusters */
+#define FREE_CLUSTER_BLOCK_SHIFT 12
+
 /* FUNCTIONS ****************************************************************/
 
+/*
+ * FUNCTION: Records a used cluster while the free cluster bitmap is built
+ */
+FORCEINLINE
+VOID
+MarkClusterUsed(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG Cluster)
+{
+    if (DeviceExt->FreeClusterBitMap.Buffer)
+        DeviceExt->FreeClusterBitMap.Buffer[Cluster / 32] |= 1UL << (Cluster % 32);
+}
+
 /*
  * FUNCTION: Retrieve the next FAT32 cluster from the FAT table via a physical
  *           disk read
@@ -414,6 +430,8 @@ FAT12CountAvailableClusters(
 
         if (Entry == 0)
             ulCount++;
+        else
+            MarkClusterUsed(DeviceExt, i);
     }
 
     CcUnpinData(Context);
@@ -465,6 +483,8 @@ FAT16CountAvailableClusters(
         {
             if (*Block == 0)
                 ulCount++;
+            else
+                MarkClusterUsed(DeviceExt, i);
             Block++;
             i++;
         }
@@ -521,6 +541,8 @@ FAT32CountAvailableClusters(
         {
             if ((*Block & 0x0fffffff) == 0)
                 ulCount++;
+            else
+                MarkClusterUsed(DeviceExt, i);
             Block++;
             i++;
         }
@@ -556,6 +578,70 @@ CountAvailableClusters(
     return Status;
 }
 
+/*
+ * FUNCTION: Builds the in-memory free cluster bitmap with one scan of the FAT
+ */
+NTSTATUS
+InitializeFreeClusterBitMap(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    ULONG SizeOfBitMap;
+    ULONG BufferSize;
+    ULONG BlockCount;
+    PULONG Buffer;
+    LARGE_INTEGER Clusters;
+    NTSTATUS Status;
+
+    SizeOfBitMap = DeviceExt->FatInfo.NumberOfClusters + 2;
+    BufferSize = ROUND_UP(SizeOfBitMap, 32) / 8;
+    BlockCount = RTL_BITMAP_SUMMARY_BLOCKS(SizeOfBitMap, FREE_CLUSTER_BLOCK_SHIFT);
+
+    /* The summary counters live right behind the bitmap */
+    Buffer = ExAllocatePoolWithTag(PagedPool,
+                                   BufferSize + BlockCount * sizeof(ULONG),
+                                   TAG_BMAP);
+    if (Buffer == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlZeroMemory(Buffer, BufferSize);
+    RtlInitializeBitMap(&DeviceExt->FreeClusterBitMap, Buffer, SizeOfBitMap);
+
+    /* The first two entries don't describe clusters */
+    RtlSetBits(&DeviceExt->FreeClusterBitMap, 0, 2);
+
+    /* Counting the free clusters fills in the used ones */
+    DeviceExt->AvailableClustersValid = FALSE;
+    Status = CountAvailableClusters(DeviceExt, &Clusters);
+    if (!NT_SUCCESS(Status))
+    {
+        ReleaseFreeClusterBitMap(DeviceExt);
+        return Status;
+    }
+
+    RtlInitializeBitMapSummary(&DeviceExt->FreeClusterSummary,
+                               &DeviceExt->FreeClusterBitMap,
+                               Buffer + BufferSize / sizeof(ULONG),
+                               FREE_CLUSTER_BLOCK_SHIFT);
+
+    DPRINT("Free cluster bitmap built, %I64u of %u clusters available\n",
+           Clusters.QuadPart, DeviceExt->FatInfo.NumberOfClusters);
+    return STATUS_SUCCESS;
+}
+
+/*
+ * FUNCTION: Frees the free cluster bitmap, allocations go back to FAT scans
+ */
+VOID
+ReleaseFreeClusterBitMap(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    if (DeviceExt->FreeClusterBitMap.Buffer)
+    {
+        ExFreePoolWithTag(DeviceExt->FreeClusterBitMap.Buffer, TAG_BMAP);
+        DeviceExt->FreeClusterBitMap.Buffer = NULL;
+    }
+}
+
 
 /*
  * FUNCTION: Writes a cluster to the FAT12 physical and in-memory tables
@@ -706,6 +792,12 @@ WriteCluster(
 
     ExAcquireResourceExclusiveLite (&DeviceExt->FatResource, TRUE);
     Status = DeviceExt->WriteCluster(DeviceExt, ClusterToWrite, NewValue, &OldValue);
+    if (!NT_SUCCESS(Status))
+    {
+        ExReleaseResourceLite(&DeviceExt->FatResource);
+        return Status;
+    }
+
     if (DeviceExt->AvailableClustersValid)
     {
         if (OldValue && NewValue == 0)
@@ -713,6 +805,144 @@ WriteCluster(
         else if (OldValue == 0 && NewValue)
             InterlockedDecrement((PLONG)&DeviceExt->AvailableClusters);
     }
+
+    /* Keep the free cluster bitmap in sync with the FAT */
+    if (DeviceExt->FreeClusterBitMap.Buffer &&
+        ClusterToWrite >= 2 && ClusterToWrite < DeviceExt->FreeClusterBitMap.SizeOfBitMap)
+    {
+        if (OldValue && NewValue == 0)
+            RtlClearBitsSummary(&DeviceExt->FreeClusterSummary, ClusterToWrite, 1);
+        else if (OldValue == 0 && NewValue)
+            RtlSetBitsSummary(&DeviceExt->FreeClusterSummary, ClusterToWrite, 1);
+    }
+    ExReleaseResourceLite(&DeviceExt->FatResource);
+    return Status;
+}
+
+/*
+ * FUNCTION: Frees clusters that were chained by AllocateClusters
+ */
+static
+VOID
+FreeAllocatedClusters(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG FirstCluster,
+    ULONG ClusterCount)
+{
+    ULONG Cluster, NextCluster;
+
+    for (Cluster = FirstCluster; ClusterCount > 0; ClusterCount--)
+    {
+        if (!NT_SUCCESS(DeviceExt->GetNextCluster(DeviceExt, Cluster, &NextCluster)))
+            NextCluster = 0xffffffff;
+        WriteCluster(DeviceExt, Cluster, 0);
+        if (NextCluster == 0xffffffff)
+            break;
+        Cluster = NextCluster;
+    }
+}
+
+/*
+ * FUNCTION: Allocates ClusterCount clusters in as few contiguous runs as
+ *           possible and appends them to the chain ending at LastCluster, or
+ *           starts a new chain if LastCluster is 0. Either all clusters are
+ *           allocated or none.
+ */
+NTSTATUS
+AllocateClusters(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG LastCluster,
+    ULONG ClusterCount,
+    PULONG FirstCluster)
+{
+    ULONG Previous = LastCluster;
+    ULONG Allocated = 0;
+    ULONG Start = 0, Run, Hint, i;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    *FirstCluster = 0;
+    if (ClusterCount == 0)
+        return STATUS_SUCCESS;
+
+    ExAcquireResourceExclusiveLite(&DeviceExt->FatResource, TRUE);
+
+    /* Fail early rather than allocating a part of the request */
+    if (DeviceExt->AvailableClustersValid && DeviceExt->AvailableClusters < ClusterCount)
+    {
+        ExReleaseResourceLite(&DeviceExt->FatResource);
+        return STATUS_DISK_FULL;
+    }
+
+    while (Allocated < ClusterCount)
+    {
+        if (DeviceExt->FreeClusterBitMap.Buffer)
+        {
+            /* Look for the longest run we still need, right behind the chain if possible */
+            Hint = Previous ? Previous + 1 : DeviceExt->LastAvailableCluster;
+            Run = ClusterCount - Allocated;
+            while (Run > 0)
+            {
+                Start = RtlFindClearBitsSummary(&DeviceExt->FreeClusterSummary, Run, Hint);
+                if (Start != MAXULONG)
+                    break;
+                Run /= 2;
+            }
+            if (Run == 0)
+            {
+                Status = STATUS_DISK_FULL;
+                break;
+            }
+
+            /* Chain the run, its last cluster ends the file */
+            for (i = Start; i < Start + Run; i++)
+            {
+                Status = WriteCluster(DeviceExt, i, (i + 1 < Start + Run) ? i + 1 : 0xffffffff);
+                if (!NT_SUCCESS(Status))
+                    break;
+            }
+            if (!NT_SUCCESS(Status))
+            {
+                while (i-- > Start)
+                    WriteCluster(DeviceExt, i, 0);
+                break;
+            }
+        }
+        else
+        {
+            /* Without the bitmap, the FAT is scanned for every cluster */
+            Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &Start);
+            if (!NT_SUCCESS(Status))
+                break;
+            Run = 1;
+        }
+
+        /* Link the run behind the chain */
+        if (Previous)
+        {
+            Status = WriteCluster(DeviceExt, Previous, Start);
+            if (!NT_SUCCESS(Status))
+            {
+                FreeAllocatedClusters(DeviceExt, Start, Run);
+                break;
+            }
+        }
+        if (*FirstCluster == 0)
+            *FirstCluster = Start;
+
+        Previous = Start + Run - 1;
+        Allocated += Run;
+        DeviceExt->LastAvailableCluster = Previous;
+    }
+
+    if (!NT_SUCCESS(Status) && Allocated > 0)
+    {
+        /* Give back what was allocated and end the chain where it was */
+        if (LastCluster)
+            WriteCluster(DeviceExt, LastCluster, 0xffffffff);
+        FreeAllocatedClusters(DeviceExt, *FirstCluster, Allocated);
+        *FirstCluster = 0;
+    }
+
     ExReleaseResourceLite(&DeviceExt->FatResource);
     return Status;
 }
@@ -782,7 +1012,7 @@ GetNextClusterExtend(
      */
     if (CurrentCluster == 0)
     {
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        Status = AllocateClusters(DeviceExt, 0, 1, &NewCluster);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
@@ -799,18 +1029,13 @@ GetNextClusterExtend(
     if ((*NextCluster) == 0xFFFFFFFF)
     {
         /* We are after last existing cluster, we must add one to file */
-        /* Firstly, find the next available open allocation unit and
-           mark it as end of file */
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        Status = AllocateClusters(DeviceExt, CurrentCluster, 1, &NewCluster);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
             return Status;
         }
 
-        /* Now, write the AU of the LastCluster with the value of the newly
-           found AU */
-        WriteCluster(DeviceExt, CurrentCluster, NewCluster);
         *NextCluster = NewCluster;
     }
 
@@ -24,6 +24,9 @@
 
 #define TAG_FCB 'BCFV'
 
+/* Directories with fewer entries are simply scanned */
+#define VFAT_NAME_INDEX_MIN_ENTRIES 256
+
 /*  --------------------------------------------------------  PUBLICS  */
 
 static
@@ -146,7 +149,7 @@ vfatNewFCB(
     ExInitializeResourceLite(&rcFCB->PagingIoResource);
     ExInitializeResourceLite(&rcFCB->MainResource);
     FsRtlInitializeFileLock(&rcFCB->FileLock, NULL, NULL);
-    ExInitializeFastMutex(&rcFCB->LastMutex);
+    FsRtlInitializeLargeMcb(&rcFCB->ClusterMcb, PagedPool);
     rcFCB->RFCB.PagingIoResource = &rcFCB->PagingIoResource;
     rcFCB->RFCB.Resource = &rcFCB->MainResource;
     rcFCB->RFCB.IsFastIoPossible = FastIoIsNotPossible;
@@ -265,6 +268,11 @@ vfatDestroyFCB(
     PVFATFCB pFCB)
 {
     FsRtlUninitializeFileLock(&pFCB->FileLock);
+    FsRtlUninitializeLargeMcb(&pFCB->ClusterMcb);
+    if (pFCB->NameIndex)
+    {
+        ExFreePoolWithTag(pFCB->NameIndex, TAG_NIDX);
+    }
     if (!vfatFCBIsRoot(pFCB) &&
         !BooleanFlagOn(pFCB->Flags, FCB_IS_FAT) && !BooleanFlagOn(pFCB->Flags, FCB_IS_VOLUME))
     {
@@ -277,6 +285,19 @@ vfatDestroyFCB(
     ExFreeToNPagedLookasideList(&VfatGlobalData->FcbLookasideList, pFCB);
 }
 
+/*
+ * The paging file is read and written while paging, so its cluster map has
+ * to stay resident. Whatever was mapped so far is only a cache and dropped.
+ */
+VOID
+vfatSetPagingFileFCB(
+    PVFATFCB pFCB)
+{
+    pFCB->Flags |= FCB_IS_PAGE_FILE;
+    FsRtlUninitializeLargeMcb(&pFCB->ClusterMcb);
+    FsRtlInitializeLargeMcb(&pFCB->ClusterMcb, NonPagedPool);
+}
+
 BOOLEAN
 vfatFCBIsRoot(
     PVFATFCB FCB)
@@ -760,6 +781,475 @@ vfatAttachFCBToFileObject(
     return STATUS_SUCCESS;
 }
 
+static
+ULONG
+vfatNameIndexHash(
+    PUNICODE_STRING NameU)
+{
+    ULONG Hash = 2166136261UL;
+    USHORT i;
+
+    /* Names are matched without case, so they must be hashed that way */
+    for (i = 0; i < NameU->Length / sizeof(WCHAR); i++)
+    {
+        Hash = (Hash ^ RtlUpcaseUnicodeChar(NameU->Buffer[i])) * 16777619UL;
+    }
+    return Hash;
+}
+
+static
+VOID
+vfatNameIndexFree(
+    PVFATFCB pDirectoryFCB)
+{
+    if (pDirectoryFCB->NameIndex)
+    {
+        ExFreePoolWithTag(pDirectoryFCB->NameIndex, TAG_NIDX);
+        pDirectoryFCB->NameIndex = NULL;
+    }
+}
+
+static
+PVFAT_NAME_INDEX
+vfatNameIndexAllocate(
+    ULONG Size)
+{
+    PVFAT_NAME_INDEX Index;
+    ULONG i;
+
+    Index = ExAllocatePoolWithTag(PagedPool,
+                                  FIELD_OFFSET(VFAT_NAME_INDEX, Entries[Size]),
+                                  TAG_NIDX);
+    if (Index == NULL)
+    {
+        return NULL;
+    }
+
+    Index->Size = Size;
+    Index->Count = 0;
+    for (i = 0; i < Size; i++)
+    {
+        Index->Entries[i].DirIndex = VFAT_NAME_INDEX_FREE;
+    }
+    return Index;
+}
+
+static
+VOID
+vfatNameIndexInsert(
+    PVFAT_NAME_INDEX Index,
+    ULONG Hash,
+    ULONG DirIndex)
+{
+    ULONG Slot = Hash & (Index->Size - 1);
+
+    while (Index->Entries[Slot].DirIndex != VFAT_NAME_INDEX_FREE)
+    {
+        Slot = (Slot + 1) & (Index->Size - 1);
+    }
+
+    Index->Entries[Slot].Hash = Hash;
+    Index->Entries[Slot].DirIndex = DirIndex;
+    Index->Count++;
+}
+
+static
+BOOLEAN
+vfatNameIndexAdd(
+    PVFATFCB pDirectoryFCB,
+    PUNICODE_STRING NameU,
+    ULONG DirIndex)
+{
+    PVFAT_NAME_INDEX Index = pDirectoryFCB->NameIndex;
+    PVFAT_NAME_INDEX NewIndex;
+    ULONG i;
+
+    /* Keep the table at most half full so that probe sequences stay short */
+    if ((Index->Count + 1) * 2 > Index->Size)
+    {
+        NewIndex = vfatNameIndexAllocate(Index->Size * 2);
+        if (NewIndex == NULL)
+        {
+            return FALSE;
+        }
+
+        for (i = 0; i < Index->Size; i++)
+        {
+            if (Index->Entries[i].DirIndex != VFAT_NAME_INDEX_FREE)
+            {
+                vfatNameIndexInsert(NewIndex, Index->Entries[i].Hash, Index->Entries[i].DirIndex);
+            }
+        }
+        ExFreePoolWithTag(Index, TAG_NIDX);
+        pDirectoryFCB->NameIndex = Index = NewIndex;
+    }
+
+    vfatNameIndexInsert(Index, vfatNameIndexHash(NameU), DirIndex);
+    return TRUE;
+}
+
+static
+BOOLEAN
+vfatNameIndexDelete(
+    PVFAT_NAME_INDEX Index,
+    PUNICODE_STRING NameU,
+    ULONG DirIndex)
+{
+    ULONG Mask = Index->Size - 1;
+    ULONG Hash = vfatNameIndexHash(NameU);
+    ULONG Slot, Next, Home;
+
+    for (Slot = Hash & Mask;
+         Index->Entries[Slot].DirIndex != VFAT_NAME_INDEX_FREE;
+         Slot = (Slot + 1) & Mask)
+    {
+        if (Index->Entries[Slot].Hash == Hash && Index->Entries[Slot].DirIndex == DirIndex)
+        {
+            break;
+        }
+    }
+    if (Index->Entries[Slot].DirIndex == VFAT_NAME_INDEX_FREE)
+    {
+        return FALSE;
+    }
+
+    /* Move back the following entries which can't be found anymore past the hole */
+    for (Next = (Slot + 1) & Mask;
+         Index->Entries[Next].DirIndex != VFAT_NAME_INDEX_FREE;
+         Next = (Next + 1) & Mask)
+    {
+        Home = Index->Entries[Next].Hash & Mask;
+        if ((Next > Slot && (Home <= Slot || Home > Next)) ||
+            (Next < Slot && (Home <= Slot && Home > Next)))
+        {
+            Index->Entries[Slot] = Index->Entries[Next];
+            Slot = Next;
+        }
+    }
+    Index->Entries[Slot].DirIndex = VFAT_NAME_INDEX_FREE;
+    Index->Count--;
+    return TRUE;
+}
+
+/*
+ * Entries which vfatDirFindFile never matches are not indexed
+ */
+static
+BOOLEAN
+vfatNameIndexIsIndexed(
+    PVFAT_DIRENTRY_CONTEXT DirContext)
+{
+    return !FAT_ENTRY_VOLUME(&DirContext->DirEntry.Fat) &&
+           DirContext->LongNameU.Length != 0 &&
+           DirContext->ShortNameU.Length != 0;
+}
+
+/*
+ * Read the names of the file whose short name entry is at DirIndex
+ */
+static
+NTSTATUS
+vfatNameIndexReadEntry(
+    PDEVICE_EXTENSION pDeviceExt,
+    PVFATFCB pDirectoryFCB,
+    ULONG DirIndex,
+    PVFAT_DIRENTRY_CONTEXT DirContext,
+    PVOID *pContext,
+    PVOID *pPage)
+{
+    NTSTATUS Status;
+
+    /* The entry may be on another page than the one which is mapped */
+    if (*pContext)
+    {
+        CcUnpinData(*pContext);
+        *pContext = NULL;
+    }
+
+    DirContext->DirIndex = DirIndex;
+    Status = VfatGetNextDirEntry(pDeviceExt, pContext, pPage, pDirectoryFCB, DirContext, TRUE);
+    if (NT_SUCCESS(Status) && DirContext->DirIndex != DirIndex)
+    {
+        /* There is no file at this index */
+        Status = STATUS_NOT_FOUND;
+    }
+    return Status;
+}
+
+static
+VOID
+vfatNameIndexBuild(
+    PDEVICE_EXTENSION pDeviceExt,
+    PVFATFCB pDirectoryFCB)
+{
+    NTSTATUS Status;
+    PVOID Context = NULL;
+    PVOID Page = NULL;
+    BOOLEAN First = TRUE;
+    VFAT_DIRENTRY_CONTEXT DirContext;
+    WCHAR LongNameBuffer[260];
+    WCHAR ShortNameBuffer[13];
+    ULONG Size;
+
+    Size = VFAT_NAME_INDEX_MIN_ENTRIES;
+    while (Size < pDirectoryFCB->RFCB.FileSize.u.LowPart / sizeof(FAT_DIR_ENTRY))
+    {
+        Size *= 2;
+    }
+    pDirectoryFCB->NameIndex = vfatNameIndexAllocate(Size);
+    if (pDirectoryFCB->NameIndex == NULL)
+    {
+        return;
+    }
+
+    DirContext.DirIndex = 0;
+    DirContext.LongNameU.Buffer = LongNameBuffer;
+    DirContext.LongNameU.Length = 0;
+    DirContext.LongNameU.MaximumLength = sizeof(LongNameBuffer);
+    DirContext.ShortNameU.Buffer = ShortNameBuffer;
+    DirContext.ShortNameU.Length = 0;
+    DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
+
+    while (TRUE)
+    {
+        Status = VfatGetNextDirEntry(pDeviceExt, &Context, &Page, pDirectoryFCB, &DirContext, First);
+        First = FALSE;
+        if (Status == STATUS_NO_MORE_ENTRIES)
+        {
+            Status = STATUS_SUCCESS;
+            break;
+        }
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
+
+        if (vfatNameIndexIsIndexed(&DirContext))
+        {
+            if (!vfatNameIndexAdd(pDirectoryFCB, &DirContext.LongNameU, DirContext.DirIndex) ||
+                (!RtlEqualUnicodeString(&DirContext.LongNameU, &DirContext.ShortNameU, TRUE) &&
+                 !vfatNameIndexAdd(pDirectoryFCB, &DirContext.ShortNameU, DirContext.DirIndex)))
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+        }
+        DirContext.DirIndex++;
+    }
+
+    if (Context)
+    {
+        CcUnpinData(Context);
+    }
+    if (!NT_SUCCESS(Status))
+    {
+        vfatNameIndexFree(pDirectoryFCB);
+    }
+}
+
+/*
+ * Look a name up in the index of a directory, building the index first if
+ * needed. Returns FALSE if the directory has no index and must be scanned.
+ * Otherwise, on success, DirContext describes the entry and *pContext holds
+ * its page.
+ */
+static
+BOOLEAN
+vfatNameIndexLookup(
+    PDEVICE_EXTENSION pDeviceExt,
+    PVFATFCB pDirectoryFCB,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext,
+    PVOID *pContext,
+    PVOID *pPage,
+    NTSTATUS *pStatus)
+{
+    PVFAT_NAME_INDEX Index;
+    ULONG Hash, Slot;
+    ULONG Found = VFAT_NAME_INDEX_FREE;
+    NTSTATUS Status;
+
+    if (pDirectoryFCB->NameIndex == NULL)
+    {
+        if (vfatVolumeIsFatX(pDeviceExt) ||
+            pDirectoryFCB->RFCB.FileSize.u.LowPart / sizeof(FAT_DIR_ENTRY) < VFAT_NAME_INDEX_MIN_ENTRIES)
+        {
+            return FALSE;
+        }
+
+        vfatNameIndexBuild(pDeviceExt, pDirectoryFCB);
+        if (pDirectoryFCB->NameIndex == NULL)
+        {
+            return FALSE;
+        }
+    }
+
+    Index = pDirectoryFCB->NameIndex;
+    Hash = vfatNameIndexHash(FileToFindU);
+
+    /* Names may match more than one file, a scan would stop at the first one */
+    for (Slot = Hash & (Index->Size - 1);
+         Index->Entries[Slot].DirIndex != VFAT_NAME_INDEX_FREE;
+         Slot = (Slot + 1) & (Index->Size - 1))
+    {
+        if (Index->Entries[Slot].Hash != Hash || Index->Entries[Slot].DirIndex >= Found)
+        {
+            continue;
+        }
+
+        Status = vfatNameIndexReadEntry(pDeviceExt, pDirectoryFCB, Index->Entries[Slot].DirIndex,
+                                        DirContext, pContext, pPage);
+        if (!NT_SUCCESS(Status) || !vfatNameIndexIsIndexed(DirContext))
+        {
+            DPRINT1("Name index of '%wZ' is out of date\n", &pDirectoryFCB->PathNameU);
+            if (*pContext)
+            {
+                CcUnpinData(*pContext);
+                *pContext = NULL;
+            }
+            vfatNameIndexFree(pDirectoryFCB);
+            return FALSE;
+        }
+
+        if (RtlEqualUnicodeString(FileToFindU, &DirContext->LongNameU, TRUE) ||
+            RtlEqualUnicodeString(FileToFindU, &DirContext->ShortNameU, TRUE))
+        {
+            Found = Index->Entries[Slot].DirIndex;
+        }
+    }
+
+    if (Found == VFAT_NAME_INDEX_FREE)
+    {
+        if (*pContext)
+        {
+            CcUnpinData(*pContext);
+            *pContext = NULL;
+        }
+        *pStatus = STATUS_OBJECT_NAME_NOT_FOUND;
+        return TRUE;
+    }
+
+    if (DirContext->DirIndex != Found)
+    {
+        /* The entry was read before, but reading it again may still fail */
+        Status = vfatNameIndexReadEntry(pDeviceExt, pDirectoryFCB, Found, DirContext, pContext, pPage);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Failed to read entry %u of '%wZ' again\n", Found, &pDirectoryFCB->PathNameU);
+            if (*pContext)
+            {
+                CcUnpinData(*pContext);
+                *pContext = NULL;
+            }
+            vfatNameIndexFree(pDirectoryFCB);
+            return FALSE;
+        }
+    }
+    *pStatus = STATUS_SUCCESS;
+    return TRUE;
+}
+
+/*
+ * Add the file whose short name entry is at DirIndex to the name index of
+ * the directory, once it has been written to the directory
+ */
+VOID
+vfatNameIndexAddEntry(
+    PDEVICE_EXTENSION pVCB,
+    PVFATFCB pDirectoryFCB,
+    ULONG DirIndex)
+{
+    NTSTATUS Status;
+    PVOID Context = NULL;
+    PVOID Page = NULL;
+    VFAT_DIRENTRY_CONTEXT DirContext;
+    WCHAR LongNameBuffer[260];
+    WCHAR ShortNameBuffer[13];
+
+    if (pDirectoryFCB->NameIndex == NULL)
+    {
+        return;
+    }
+
+    DirContext.LongNameU.Buffer = LongNameBuffer;
+    DirContext.LongNameU.MaximumLength = sizeof(LongNameBuffer);
+    DirContext.ShortNameU.Buffer = ShortNameBuffer;
+    DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
+
+    /* Index the names as they were stored, the lookups compare against those */
+    Status = vfatNameIndexReadEntry(pVCB, pDirectoryFCB, DirIndex, &DirContext, &Context, &Page);
+    if (NT_SUCCESS(Status) && vfatNameIndexIsIndexed(&DirContext))
+    {
+        if (!vfatNameIndexAdd(pDirectoryFCB, &DirContext.LongNameU, DirIndex) ||
+            (!RtlEqualUnicodeString(&DirContext.LongNameU, &DirContext.ShortNameU, TRUE) &&
+             !vfatNameIndexAdd(pDirectoryFCB, &DirContext.ShortNameU, DirIndex)))
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    if (Context)
+    {
+        CcUnpinData(Context);
+    }
+
+    /* An index which misses the file would hide it, drop it instead */
+    if (!NT_SUCCESS(Status))
+    {
+        vfatNameIndexFree(pDirectoryFCB);
+    }
+}
+
+/*
+ * Remove the file whose short name entry is at DirIndex from the name index
+ * of the directory, before it is deleted from the directory
+ */
+VOID
+vfatNameIndexRemoveEntry(
+    PDEVICE_EXTENSION pVCB,
+    PVFATFCB pDirectoryFCB,
+    ULONG DirIndex)
+{
+    NTSTATUS Status;
+    PVOID Context = NULL;
+    PVOID Page = NULL;
+    VFAT_DIRENTRY_CONTEXT DirContext;
+    WCHAR LongNameBuffer[260];
+    WCHAR ShortNameBuffer[13];
+
+    if (pDirectoryFCB->NameIndex == NULL)
+    {
+        return;
+    }
+
+    DirContext.LongNameU.Buffer = LongNameBuffer;
+    DirContext.LongNameU.MaximumLength = sizeof(LongNameBuffer);
+    DirContext.ShortNameU.Buffer = ShortNameBuffer;
+    DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
+
+    Status = vfatNameIndexReadEntry(pVCB, pDirectoryFCB, DirIndex, &DirContext, &Context, &Page);
+    if (NT_SUCCESS(Status) && vfatNameIndexIsIndexed(&DirContext))
+    {
+        if (!vfatNameIndexDelete(pDirectoryFCB->NameIndex, &DirContext.LongNameU, DirIndex) ||
+            (!RtlEqualUnicodeString(&DirContext.LongNameU, &DirContext.ShortNameU, TRUE) &&
+             !vfatNameIndexDelete(pDirectoryFCB->NameIndex, &DirContext.ShortNameU, DirIndex)))
+        {
+            Status = STATUS_NOT_FOUND;
+        }
+    }
+
+    if (Context)
+    {
+        CcUnpinData(Context);
+    }
+
+    /* A stale entry would point to whatever reuses the slot, drop the index */
+    if (!NT_SUCCESS(Status))
+    {
+        vfatNameIndexFree(pDirectoryFCB);
+    }
+}
+
 NTSTATUS
 vfatDirFindFile(
     PDEVICE_EXTENSION pDeviceExt,
@@ -788,7 +1278,6 @@ vfatDirFindFile(
            pDeviceExt, pDirectoryFCB, FileToFindU);
     DPRINT("Dir Path:%wZ\n", &pDirectoryFCB->PathNameU);
 
-    DirContext.DirIndex = 0;
     DirContext.LongNameU.Buffer = LongNameBuffer;
     DirContext.LongNameU.Length = 0;
     DirContext.LongNameU.MaximumLength = sizeof(LongNameBuffer);
@@ -796,6 +1285,22 @@ vfatDirFindFile(
     DirContext.ShortNameU.Length = 0;
     DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
 
+    /* Large directories are searched through their name index */
+    if (vfatNameIndexLookup(pDeviceExt, pDirectoryFCB, FileToFindU, &DirContext, &Context, &Page, &status))
+    {
+        if (NT_SUCCESS(status))
+        {
+            status = vfatMakeFCBFromDirEntry(pDeviceExt,
+                pDirectoryFCB,
+                &DirContext,
+                pFoundFCB);
+            CcUnpinData(Context);
+        }
+        return status;
+    }
+
+    DirContext.DirIndex = 0;
+
     while (TRUE)
     {
         status = VfatGetNextDirEntry(pDeviceExt,
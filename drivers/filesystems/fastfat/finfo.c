@@ -1259,6 +1259,7 @@ VfatSetAllocationSizeInformation(
     ULONG ClusterSize = DeviceExt->FatInfo.BytesPerCluster;
     ULONG NewSize = AllocationSize->u.LowPart;
     ULONG NCluster;
+    ULONG ClusterCount;
     BOOLEAN AllocSizeChanged = FALSE, IsFatX = vfatVolumeIsFatX(DeviceExt);
 
     DPRINT("VfatSetAllocationSizeInformation(File <%wZ>, AllocationSize %d %u)\n",
@@ -1286,36 +1287,16 @@ VfatSetAllocationSizeInformation(
         AllocSizeChanged = TRUE;
         if (FirstCluster == 0)
         {
-            Fcb->LastCluster = Fcb->LastOffset = 0;
-            Status = NextCluster(DeviceExt, FirstCluster, &FirstCluster, TRUE);
+            /* Allocate the whole chain at once */
+            Status = AllocateClusters(DeviceExt, 0,
+                                      (NewSize - 1) / ClusterSize + 1,
+                                      &FirstCluster);
             if (!NT_SUCCESS(Status))
             {
-                DPRINT1("NextCluster failed. Status = %x\n", Status);
+                DPRINT1("AllocateClusters failed. Status = %x\n", Status);
                 return Status;
             }
 
-            if (FirstCluster == 0xffffffff)
-            {
-                return STATUS_DISK_FULL;
-            }
-
-            Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                     ROUND_DOWN(NewSize - 1, ClusterSize),
-                                     &NCluster, TRUE);
-            if (NCluster == 0xffffffff || !NT_SUCCESS(Status))
-            {
-                /* disk is full */
-                NCluster = Cluster = FirstCluster;
-                Status = STATUS_SUCCESS;
-                while (NT_SUCCESS(Status) && Cluster != 0xffffffff && Cluster > 1)
-                {
-                    Status = NextCluster(DeviceExt, FirstCluster, &NCluster, FALSE);
-                    WriteCluster(DeviceExt, Cluster, 0);
-                    Cluster = NCluster;
-                }
-                return STATUS_DISK_FULL;
-            }
-
             if (IsFatX)
             {
                 Fcb->entry.FatX.FirstCluster = FirstCluster;
@@ -1336,54 +1317,23 @@ VfatSetAllocationSizeInformation(
         }
         else
         {
-            if (Fcb->LastCluster > 0)
-            {
-                if (Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize == Fcb->LastOffset)
-                {
-                    Cluster = Fcb->LastCluster;
-                    Status = STATUS_SUCCESS;
-                }
-                else
-                {
-                    Status = OffsetToCluster(DeviceExt, Fcb->LastCluster,
-                                             Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize - Fcb->LastOffset,
-                                             &Cluster, FALSE);
-                }
-            }
-            else
-            {
-                Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                         Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize,
-                                         &Cluster, FALSE);
-            }
-
+            Status = OffsetToClusterRun(DeviceExt, Fcb,
+                                        Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize,
+                                        1, &Cluster, &ClusterCount);
             if (!NT_SUCCESS(Status))
             {
                 return Status;
             }
 
-            Fcb->LastCluster = Cluster;
-            Fcb->LastOffset = Fcb->RFCB.AllocationSize.u.LowPart - ClusterSize;
-
-            /* FIXME: Check status */
-            /* Cluster points now to the last cluster within the chain */
-            Status = OffsetToCluster(DeviceExt, Cluster,
-                                     ROUND_DOWN(NewSize - 1, ClusterSize) - Fcb->LastOffset,
-                                     &NCluster, TRUE);
-            if (NCluster == 0xffffffff || !NT_SUCCESS(Status))
+            /* Cluster points now to the last cluster within the chain,
+               append the missing clusters behind it at once */
+            Status = AllocateClusters(DeviceExt, Cluster,
+                                      (NewSize - 1) / ClusterSize + 1 -
+                                      Fcb->RFCB.AllocationSize.u.LowPart / ClusterSize,
+                                      &NCluster);
+            if (!NT_SUCCESS(Status))
             {
-                /* disk is full */
-                NCluster = Cluster;
-                Status = NextCluster(DeviceExt, FirstCluster, &NCluster, FALSE);
-                WriteCluster(DeviceExt, Cluster, 0xffffffff);
-                Cluster = NCluster;
-                while (NT_SUCCESS(Status) && Cluster != 0xffffffff && Cluster > 1)
-                {
-                    Status = NextCluster(DeviceExt, FirstCluster, &NCluster, FALSE);
-                    WriteCluster(DeviceExt, Cluster, 0);
-                    Cluster = NCluster;
-                }
-                return STATUS_DISK_FULL;
+                return Status;
             }
         }
         UpdateFileSize(FileObject, Fcb, NewSize, ClusterSize, vfatVolumeIsFatX(DeviceExt));
@@ -1400,14 +1350,12 @@ VfatSetAllocationSizeInformation(
         DPRINT("Can set file size\n");
 
         AllocSizeChanged = TRUE;
-        /* FIXME: Use the cached cluster/offset better way. */
-        Fcb->LastCluster = Fcb->LastOffset = 0;
         UpdateFileSize(FileObject, Fcb, NewSize, ClusterSize, vfatVolumeIsFatX(DeviceExt));
         if (NewSize > 0)
         {
-            Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                     ROUND_DOWN(NewSize - 1, ClusterSize),
-                                     &Cluster, FALSE);
+            Status = OffsetToClusterRun(DeviceExt, Fcb,
+                                        ROUND_DOWN(NewSize - 1, ClusterSize),
+                                        1, &Cluster, &ClusterCount);
 
             NCluster = Cluster;
             Status = NextCluster(DeviceExt, FirstCluster, &NCluster, FALSE);
@@ -1437,6 +1385,9 @@ VfatSetAllocationSizeInformation(
             Status = STATUS_SUCCESS;
         }
 
+        /* Forget about the clusters which are freed now */
+        FsRtlTruncateLargeMcb(&Fcb->ClusterMcb, NewSize > 0 ? (NewSize - 1) / ClusterSize + 1 : 0);
+
         while (NT_SUCCESS(Status) && 0xffffffff != Cluster && Cluster > 1)
         {
             Status = NextCluster(DeviceExt, FirstCluster, &NCluster, FALSE);
@@ -749,6 +749,13 @@ VfatMount(
     VolumeFcb->RFCB.AllocationSize = VolumeFcb->RFCB.FileSize;
     DeviceExt->VolumeFcb = VolumeFcb;
 
+    /* Build the free cluster bitmap, allocations scan the FAT without it */
+    Status = InitializeFreeClusterBitMap(DeviceExt);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Failed to build the free cluster bitmap (Status %lx)\n", Status);
+    }
+
     ExAcquireResourceExclusiveLite(&VfatGlobalData->VolumeListLock, TRUE);
     InsertHeadList(&VfatGlobalData->VolumeListHead, &DeviceExt->VolumeListEntry);
     ExReleaseResourceLite(&VfatGlobalData->VolumeListLock);
@@ -1204,6 +1211,7 @@ VfatDismountVolume(
     ExDeleteResourceLite(&DeviceExt->DirResource);
     ExDeleteResourceLite(&DeviceExt->FatResource);
     ObDereferenceObject(DeviceExt->FATFileObject);
+    ReleaseFreeClusterBitMap(DeviceExt);
 
     return STATUS_SUCCESS;
 }
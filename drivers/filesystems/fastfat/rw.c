@@ -15,11 +15,10 @@
 #include <debug.h>
 
 /*
- * Uncomment to enable strict verification of cluster/offset pair
- * caching. If this option is enabled you lose all the benefits of
- * the caching and the read/write operations will actually be
- * slower. It's meant only for debugging!!!
- * - Filip Navara, 26/07/2004
+ * Uncomment to enable strict verification of the cluster map of the
+ * FCBs. If this option is enabled you lose all the benefits of the
+ * caching and the read/write operations will actually be slower.
+ * It's meant only for debugging!!!
  */
 /* #define DEBUG_VERIFY_OFFSET_CACHING */
 
@@ -106,6 +105,153 @@ OffsetToCluster(
    }
 }
 
+/*
+ * Add a run of clusters to the cluster map of a file. On failure the map
+ * may have been emptied, so nothing further must be added to it.
+ */
+static
+BOOLEAN
+MapClusterRun(
+    PVFATFCB Fcb,
+    ULONG Index,
+    ULONG Cluster,
+    ULONG Count)
+{
+    BOOLEAN Mapped;
+
+    /* The map is only a cache, failing to extend it is not fatal */
+    _SEH2_TRY
+    {
+        Mapped = FsRtlAddLargeMcbEntry(&Fcb->ClusterMcb, Index, Cluster, Count);
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        /* The MCB raises when it runs out of pool, forget what it holds */
+        FsRtlResetLargeMcb(&Fcb->ClusterMcb, FALSE);
+        Mapped = FALSE;
+    }
+    _SEH2_END;
+
+    if (!Mapped)
+    {
+        DPRINT1("Failed to map clusters %u-%u of '%wZ'\n", Index, Index + Count - 1, &Fcb->PathNameU);
+    }
+    return Mapped;
+}
+
+/*
+ * Return the cluster holding the given offset of a file and how many of
+ * the clusters that follow it, up to MaxClusters, are contiguous on the
+ * disk. The FAT chain is only walked beyond the part which is already
+ * known in the cluster map of the FCB, and everything found on the way is
+ * added to the map. The map always covers a prefix of the chain.
+ */
+NTSTATUS
+OffsetToClusterRun(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FileOffset,
+    ULONG MaxClusters,
+    PULONG Cluster,
+    PULONG ClusterCount)
+{
+    ULONG FirstCluster;
+    ULONG CurrentCluster;
+    ULONG NextCluster;
+    ULONG Index;
+    ULONG RunIndex;
+    ULONG RunCluster;
+    LONGLONG Vbn;
+    LONGLONG Lbn;
+    LONGLONG Count;
+    BOOLEAN Mapping = TRUE;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    ASSERT(MaxClusters > 0);
+
+    FirstCluster = vfatDirEntryGetFirstCluster(DeviceExt, &Fcb->entry);
+    ASSERT(FirstCluster > 1);
+    Index = FileOffset / DeviceExt->FatInfo.BytesPerCluster;
+
+    if (FsRtlLookupLargeMcbEntry(&Fcb->ClusterMcb, Index, &Lbn, &Count, NULL, NULL, NULL) &&
+        Lbn != -1)
+    {
+        *Cluster = (ULONG)Lbn;
+        *ClusterCount = (ULONG)min(Count, MaxClusters);
+#ifdef DEBUG_VERIFY_OFFSET_CACHING
+        /* DEBUG VERIFICATION */
+        {
+            ULONG CorrectCluster;
+            OffsetToCluster(DeviceExt, FirstCluster,
+                            ROUND_DOWN(FileOffset, DeviceExt->FatInfo.BytesPerCluster),
+                            &CorrectCluster, FALSE);
+            if (CorrectCluster != *Cluster)
+                KeBugCheck(FAT_FILE_SYSTEM);
+        }
+#endif
+        return STATUS_SUCCESS;
+    }
+
+    /* Resume the walk at the last known cluster */
+    if (FsRtlLookupLastLargeMcbEntry(&Fcb->ClusterMcb, &Vbn, &Lbn))
+    {
+        ASSERT(Vbn < Index);
+        RunIndex = (ULONG)Vbn;
+        RunCluster = (ULONG)Lbn;
+    }
+    else
+    {
+        RunIndex = 0;
+        RunCluster = FirstCluster;
+    }
+
+    /* Follow the chain to the wanted cluster and past it as long as it stays contiguous */
+    CurrentCluster = RunCluster;
+    *Cluster = 0xffffffff;
+    *ClusterCount = 0;
+    for (;;)
+    {
+        if (RunIndex + (CurrentCluster - RunCluster) == Index)
+        {
+            *Cluster = CurrentCluster;
+        }
+        if (*Cluster != 0xffffffff && ++(*ClusterCount) == MaxClusters)
+        {
+            break;
+        }
+
+        Status = GetNextCluster(DeviceExt, CurrentCluster, &NextCluster);
+        if (!NT_SUCCESS(Status) || NextCluster == 0xffffffff)
+        {
+            break;
+        }
+
+        if (NextCluster != CurrentCluster + 1)
+        {
+            /* The run ends here, stop mapping once the map failed to keep it a prefix */
+            if (Mapping)
+            {
+                Mapping = MapClusterRun(Fcb, RunIndex, RunCluster, CurrentCluster - RunCluster + 1);
+            }
+            RunIndex += CurrentCluster - RunCluster + 1;
+            RunCluster = NextCluster;
+            if (*Cluster != 0xffffffff)
+            {
+                /* Record where the next run starts too */
+                CurrentCluster = NextCluster;
+                break;
+            }
+        }
+        CurrentCluster = NextCluster;
+    }
+    if (Mapping)
+    {
+        MapClusterRun(Fcb, RunIndex, RunCluster, CurrentCluster - RunCluster + 1);
+    }
+
+    return Status;
+}
+
 /*
  * FUNCTION: Reads data from a file
  */
@@ -117,20 +263,16 @@ VfatReadFileData(
     LARGE_INTEGER ReadOffset,
     PULONG LengthRead)
 {
-    ULONG CurrentCluster;
     ULONG FirstCluster;
     ULONG StartCluster;
     ULONG ClusterCount;
     LARGE_INTEGER StartOffset;
     PDEVICE_EXTENSION DeviceExt;
-    BOOLEAN First = TRUE;
     PVFATFCB Fcb;
     NTSTATUS Status;
     ULONG BytesDone;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -187,8 +329,7 @@ VfatReadFileData(
     }
 
     /* Find the first cluster */
-    FirstCluster =
-    CurrentCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
+    FirstCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
 
     if (FirstCluster == 1)
     {
@@ -208,87 +349,24 @@ VfatReadFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
-    /* Find the cluster to start the read from */
-    if (LastCluster > 0 && ReadOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
-#ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
-    {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
-    }
-
-    if (!NT_SUCCESS(Status))
-    {
-        return Status;
-    }
-
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (ReadOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     KeInitializeEvent(&IrpContext->Event, NotificationEvent, FALSE);
     IrpContext->RefCount = 1;
 
-    while (Length > 0 && CurrentCluster != 0xffffffff)
+    while (Length > 0)
     {
-        StartCluster = CurrentCluster;
-        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector;
-        BytesDone = 0;
-        ClusterCount = 0;
-
-        do
+        /* Find the next run of contiguous clusters, it is transferred at once */
+        Status = OffsetToClusterRun(DeviceExt, Fcb, ReadOffset.u.LowPart,
+                                    (ReadOffset.u.LowPart % BytesPerCluster + Length - 1) / BytesPerCluster + 1,
+                                    &StartCluster, &ClusterCount);
+        if (!NT_SUCCESS(Status) || StartCluster == 0xffffffff)
         {
-            ClusterCount++;
-            if (First)
-            {
-                BytesDone =  min (Length, BytesPerCluster - (ReadOffset.u.LowPart % BytesPerCluster));
-                StartOffset.QuadPart += ReadOffset.u.LowPart % BytesPerCluster;
-                First = FALSE;
-            }
-            else
-            {
-                if (Length - BytesDone > BytesPerCluster)
-                {
-                    BytesDone += BytesPerCluster;
-                }
-                else
-                {
-                    BytesDone = Length;
-                }
-            }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
+            break;
         }
-        while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
-        DPRINT("start %08x, next %08x, count %u\n",
-               StartCluster, CurrentCluster, ClusterCount);
 
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
+        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector +
+                               ReadOffset.u.LowPart % BytesPerCluster;
+        BytesDone = min(Length, ClusterCount * BytesPerCluster - ReadOffset.u.LowPart % BytesPerCluster);
+        DPRINT("start %08x, count %u\n", StartCluster, ClusterCount);
 
         /* Fire up the read command */
         Status = VfatReadDiskPartial (IrpContext, &StartOffset, BytesDone, *LengthRead, FALSE);
@@ -332,18 +410,14 @@ VfatWriteFileData(
     PVFATFCB Fcb;
     ULONG Count;
     ULONG FirstCluster;
-    ULONG CurrentCluster;
     ULONG BytesDone;
     ULONG StartCluster;
     ULONG ClusterCount;
     NTSTATUS Status = STATUS_SUCCESS;
-    BOOLEAN First = TRUE;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
     LARGE_INTEGER StartOffset;
     ULONG BufferOffset;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -408,8 +482,7 @@ VfatWriteFileData(
     /*
      * Find the first cluster
      */
-    FirstCluster =
-    CurrentCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
+    FirstCluster = vfatDirEntryGetFirstCluster (DeviceExt, &Fcb->entry);
 
     if (FirstCluster == 1)
     {
@@ -421,89 +494,24 @@ VfatWriteFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
-    /*
-     * Find the cluster to start the write from
-     */
-    if (LastCluster > 0 && WriteOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
-#ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
-    {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
-    }
-
-    if (!NT_SUCCESS(Status))
-    {
-        return Status;
-    }
-
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (WriteOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     IrpContext->RefCount = 1;
     BufferOffset = 0;
 
-    while (Length > 0 && CurrentCluster != 0xffffffff)
+    while (Length > 0)
     {
-        StartCluster = CurrentCluster;
-        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector;
-        BytesDone = 0;
-        ClusterCount = 0;
-
-        do
+        /* Find the next run of contiguous clusters, it is transferred at once */
+        Status = OffsetToClusterRun(DeviceExt, Fcb, WriteOffset.u.LowPart,
+                                    (WriteOffset.u.LowPart % BytesPerCluster + Length - 1) / BytesPerCluster + 1,
+                                    &StartCluster, &ClusterCount);
+        if (!NT_SUCCESS(Status) || StartCluster == 0xffffffff)
         {
-            ClusterCount++;
-            if (First)
-            {
-                BytesDone =  min (Length, BytesPerCluster - (WriteOffset.u.LowPart % BytesPerCluster));
-                StartOffset.QuadPart += WriteOffset.u.LowPart % BytesPerCluster;
-                First = FALSE;
-            }
-            else
-            {
-                if (Length - BytesDone > BytesPerCluster)
-                {
-                    BytesDone += BytesPerCluster;
-                }
-                else
-                {
-                    BytesDone = Length;
-                }
-            }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
+            break;
         }
-        while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
-        DPRINT("start %08x, next %08x, count %u\n",
-               StartCluster, CurrentCluster, ClusterCount);
 
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
+        StartOffset.QuadPart = ClusterToSector(DeviceExt, StartCluster) * BytesPerSector +
+                               WriteOffset.u.LowPart % BytesPerCluster;
+        BytesDone = min(Length, ClusterCount * BytesPerCluster - WriteOffset.u.LowPart % BytesPerCluster);
+        DPRINT("start %08x, count %u\n", StartCluster, ClusterCount);
 
         // Fire up the write command
         Status = VfatWriteDiskPartial (IrpContext, &StartOffset, BytesDone, BufferOffset, FALSE);
@@ -572,6 +580,14 @@ VfatRead(
     Fcb = IrpContext->FileObject->FsContext;
     ASSERT(Fcb);
 
+    if (BooleanFlagOn(IrpContext->MinorFunction, IRP_MN_COMPLETE))
+    {
+        /* Give back the cache pages handed out by an earlier MDL read */
+        CcMdlReadComplete(IrpContext->FileObject, IrpContext->Irp->MdlAddress);
+        IrpContext->Irp->MdlAddress = NULL;
+        return STATUS_SUCCESS;
+    }
+
     IsVolume = BooleanFlagOn(Fcb->Flags, FCB_IS_VOLUME);
 
     if (BooleanFlagOn(Fcb->Flags, FCB_IS_PAGE_FILE))
@@ -622,6 +638,13 @@ VfatRead(
 
     if (NoCache || PagingIo || IsVolume)
     {
+        // MDL reads hand out cache pages, there are none to hand out here
+        if (BooleanFlagOn(IrpContext->MinorFunction, IRP_MN_MDL))
+        {
+            Status = STATUS_INVALID_DEVICE_REQUEST;
+            goto ByeBye;
+        }
+
         if (ByteOffset.u.LowPart % BytesPerSector != 0 || Length % BytesPerSector != 0)
         {
             DPRINT("%u %u\n", ByteOffset.u.LowPart, Length);
@@ -687,12 +710,27 @@ VfatRead(
                                      Fcb);
             }
 
-            if (!CcCopyRead(IrpContext->FileObject,
-                            &ByteOffset,
-                            Length,
-                            CanWait,
-                            Buffer,
-                            &IrpContext->Irp->IoStatus))
+            if (BooleanFlagOn(IrpContext->MinorFunction, IRP_MN_MDL))
+            {
+                // CcMdlRead always waits for the data
+                if (!CanWait)
+                {
+                    Status = STATUS_PENDING;
+                    goto ByeBye;
+                }
+
+                CcMdlRead(IrpContext->FileObject,
+                          &ByteOffset,
+                          Length,
+                          &IrpContext->Irp->MdlAddress,
+                          &IrpContext->Irp->IoStatus);
+            }
+            else if (!CcCopyRead(IrpContext->FileObject,
+                                 &ByteOffset,
+                                 Length,
+                                 CanWait,
+                                 Buffer,
+                                 &IrpContext->Irp->IoStatus))
             {
                 ASSERT(!CanWait);
                 Status = STATUS_PENDING;
@@ -751,7 +789,11 @@ ByeBye:
 
     if (Status == STATUS_PENDING)
     {
-        Status = VfatLockUserBuffer(IrpContext->Irp, Length, IoWriteAccess);
+        // MDL reads have no user buffer to lock
+        if (BooleanFlagOn(IrpContext->MinorFunction, IRP_MN_MDL))
+            Status = STATUS_SUCCESS;
+        else
+            Status = VfatLockUserBuffer(IrpContext->Irp, Length, IoWriteAccess);
         if (NT_SUCCESS(Status))
         {
             Status = VfatMarkIrpContextForQueue(IrpContext);
@@ -812,6 +854,16 @@ VfatWrite(
     Fcb = IrpContext->FileObject->FsContext;
     ASSERT(Fcb);
 
+    if (BooleanFlagOn(IrpContext->MinorFunction, IRP_MN_COMPLETE))
+    {
+        /* The caller filled the cache pages from an earlier MDL write */
+        CcMdlWriteComplete(IrpContext->FileObject,
+                           &IrpContext->Stack->Parameters.Write.ByteOffset,
+                           IrpContext->Irp->MdlAddress);
+        IrpContext->Irp->MdlAddress = NULL;
+        return STATUS_SUCCESS;
+    }
+
     IsVolume = BooleanFlagOn(Fcb->Flags, FCB_IS_VOLUME);
     IsFAT = BooleanFlagOn(Fcb->Flags, FCB_IS_FAT);
 
@@ -863,6 +915,13 @@ VfatWrite(
 
     if (PagingIo || NoCache || IsVolume)
     {
+        // MDL writes hand out cache pages, there are none to hand out here
+        if (BooleanFlagOn(IrpContext->MinorFunction, IRP_MN_MDL))
+        {
+            Status = STATUS_INVALID_DEVICE_REQUEST;
+            goto ByeBye;
+        }
+
         if (ByteOffset.u.LowPart % BytesPerSector != 0 || Length % BytesPerSector != 0)
         {
             // non cached write must be sector aligned
@@ -895,6 +954,18 @@ VfatWrite(
         }
     }
 
+    // let the lazy writer catch up before adding more dirty data, this
+    // must be done before taking locks that the lazy writer needs. A write
+    // posted because of throttling retries ahead of the other writers
+    if (!PagingIo && !NoCache && !IsVolume &&
+        !CcCanIWrite(IrpContext->FileObject, Length, CanWait,
+                     BooleanFlagOn(IrpContext->Flags, IRPCONTEXT_DEFERRED_WRITE)))
+    {
+        IrpContext->Flags |= IRPCONTEXT_DEFERRED_WRITE;
+        Status = STATUS_PENDING;
+        goto ByeBye;
+    }
+
     if (IsVolume)
     {
         Resource = &IrpContext->DeviceExt->DirResource;
@@ -939,7 +1010,9 @@ VfatWrite(
 
     if (!CanWait && !IsVolume)
     {
-        if (ByteOffset.u.LowPart + Length > Fcb->RFCB.AllocationSize.u.LowPart)
+        // CcPrepareMdlWrite always waits for the data
+        if (ByteOffset.u.LowPart + Length > Fcb->RFCB.AllocationSize.u.LowPart ||
+            BooleanFlagOn(IrpContext->MinorFunction, IRP_MN_MDL))
         {
             Status = STATUS_PENDING;
             goto ByeBye;
@@ -984,11 +1057,20 @@ VfatWrite(
                 CcZeroData(IrpContext->FileObject, &OldFileSize, &ByteOffset, TRUE);
             }
 
-            if (CcCopyWrite(IrpContext->FileObject,
-                            &ByteOffset,
-                            Length,
-                            TRUE /*CanWait*/,
-                            Buffer))
+            if (BooleanFlagOn(IrpContext->MinorFunction, IRP_MN_MDL))
+            {
+                CcPrepareMdlWrite(IrpContext->FileObject,
+                                  &ByteOffset,
+                                  Length,
+                                  &IrpContext->Irp->MdlAddress,
+                                  &IrpContext->Irp->IoStatus);
+                Status = IrpContext->Irp->IoStatus.Status;
+            }
+            else if (CcCopyWrite(IrpContext->FileObject,
+                                 &ByteOffset,
+                                 Length,
+                                 TRUE /*CanWait*/,
+                                 Buffer))
             {
                 IrpContext->Irp->IoStatus.Information = Length;
                 Status = STATUS_SUCCESS;
@@ -1090,7 +1172,11 @@ ByeBye:
 
     if (Status == STATUS_PENDING)
     {
-        Status = VfatLockUserBuffer(IrpContext->Irp, Length, IoReadAccess);
+        // MDL writes have no user buffer to lock
+        if (BooleanFlagOn(IrpContext->MinorFunction, IRP_MN_MDL))
+            Status = STATUS_SUCCESS;
+        else
+            Status = VfatLockUserBuffer(IrpContext->Irp, Length, IoReadAccess);
         if (NT_SUCCESS(Status))
         {
             Status = VfatMarkIrpContextForQueue(IrpContext);
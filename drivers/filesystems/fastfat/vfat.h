@@ -3,6 +3,7 @@
 
 #include <ntifs.h>
 #include <ntdddisk.h>
+#include <ndk/rtlfuncs.h>
 #include <dos.h>
 #include <pseh/pseh2.h>
 
@@ -270,6 +271,23 @@ typedef struct _HASHENTRY
 }
 HASHENTRY;
 
+/* Slot of a directory name index, DirIndex is the short name entry of the file */
+typedef struct _VFAT_NAME_INDEX_ENTRY
+{
+    ULONG Hash;
+    ULONG DirIndex;
+} VFAT_NAME_INDEX_ENTRY, *PVFAT_NAME_INDEX_ENTRY;
+
+#define VFAT_NAME_INDEX_FREE 0xffffffff
+
+/* Open addressed hash of the long and short names found in a directory */
+typedef struct _VFAT_NAME_INDEX
+{
+    ULONG Size;
+    ULONG Count;
+    VFAT_NAME_INDEX_ENTRY Entries[ANYSIZE_ARRAY];
+} VFAT_NAME_INDEX, *PVFAT_NAME_INDEX;
+
 typedef struct DEVICE_EXTENSION *PDEVICE_EXTENSION;
 
 typedef NTSTATUS (*PGET_NEXT_CLUSTER)(PDEVICE_EXTENSION,ULONG,PULONG);
@@ -313,6 +331,9 @@ typedef struct DEVICE_EXTENSION
     ULONG LastAvailableCluster;
     ULONG AvailableClusters;
     BOOLEAN AvailableClustersValid;
+    /* In-memory copy of the FAT allocation state, a set bit is a used cluster */
+    RTL_BITMAP FreeClusterBitMap;
+    RTL_BITMAP_SUMMARY FreeClusterSummary;
     ULONG Flags;
     struct _VFATFCB *VolumeFcb;
     PSTATISTICS Statistics;
@@ -486,13 +507,18 @@ typedef struct _VFATFCB
     FILE_LOCK FileLock;
 
     /*
-     * Optimization: caching of last read/write cluster+offset pair. Can't
-     * be in VFATCCB because it must be reset everytime the allocated clusters
-     * change.
+     * Map of the cluster chain: cluster index in the file to cluster number.
+     * Filled lazily as the chain is walked, it always covers a prefix of
+     * the chain and must be truncated whenever clusters are freed.
+     */
+    LARGE_MCB ClusterMcb;
+
+    /*
+     * Name index of a directory, built by the first lookup which misses the
+     * FCB table and kept current when entries are added or deleted. NULL
+     * for small directories and FATX volumes.
      */
-    FAST_MUTEX LastMutex;
-    ULONG LastCluster;
-    ULONG LastOffset;
+    PVFAT_NAME_INDEX NameIndex;
 } VFATFCB, *PVFATFCB;
 
 #define CCB_DELETE_ON_CLOSE     0x0001
@@ -511,6 +537,8 @@ typedef struct _VFATCCB
 #define TAG_FCB  'BCFV'
 #define TAG_IRP  'PRIV'
 #define TAG_VFAT 'TAFV'
+#define TAG_BMAP 'MBFV'
+#define TAG_NIDX 'XINV'
 
 #define ENTRIES_PER_SECTOR (BLOCKSIZE / sizeof(FATDirEntry))
 
@@ -534,6 +562,7 @@ DOSDATE, *PDOSDATE;
 #define IRPCONTEXT_COMPLETE         0x0002
 #define IRPCONTEXT_QUEUE            0x0004
 #define IRPCONTEXT_PENDINGRETURNED  0x0008
+#define IRPCONTEXT_DEFERRED_WRITE   0x0010
 
 typedef struct
 {
@@ -852,11 +881,26 @@ GetNextClusterExtend(
     ULONG CurrentCluster,
     PULONG NextCluster);
 
+NTSTATUS
+AllocateClusters(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG LastCluster,
+    ULONG ClusterCount,
+    PULONG FirstCluster);
+
 NTSTATUS
 CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt,
     PLARGE_INTEGER Clusters);
 
+NTSTATUS
+InitializeFreeClusterBitMap(
+    PDEVICE_EXTENSION DeviceExt);
+
+VOID
+ReleaseFreeClusterBitMap(
+    PDEVICE_EXTENSION DeviceExt);
+
 NTSTATUS
 WriteCluster(
     PDEVICE_EXTENSION DeviceExt,
@@ -887,6 +931,10 @@ VOID
 vfatDestroyFCB(
     PVFATFCB pFCB);
 
+VOID
+vfatSetPagingFileFCB(
+    PVFATFCB pFCB);
+
 VOID
 vfatDestroyCCB(
     PVFATCCB pCcb);
@@ -935,6 +983,18 @@ vfatDirFindFile(
     PUNICODE_STRING FileToFindU,
     PVFATFCB *fileFCB);
 
+VOID
+vfatNameIndexAddEntry(
+    PDEVICE_EXTENSION pVCB,
+    PVFATFCB pDirectoryFCB,
+    ULONG DirIndex);
+
+VOID
+vfatNameIndexRemoveEntry(
+    PDEVICE_EXTENSION pVCB,
+    PVFATFCB pDirectoryFCB,
+    ULONG DirIndex);
+
 NTSTATUS
 vfatGetFCBForFile(
     PDEVICE_EXTENSION pVCB,
@@ -1056,6 +1116,15 @@ NextCluster(
     PULONG CurrentCluster,
     BOOLEAN Extend);
 
+NTSTATUS
+OffsetToClusterRun(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FileOffset,
+    ULONG MaxClusters,
+    PULONG Cluster,
+    PULONG ClusterCount);
+
 /* shutdown.c */
 
 DRIVER_DISPATCH
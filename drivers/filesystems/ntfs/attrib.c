@@ -97,6 +97,7 @@ static
 NTSTATUS
 InternalReadNonResidentAttributes(PFIND_ATTR_CONTXT Context)
 {
+    NTSTATUS Status;
     ULONGLONG ListSize;
     PNTFS_ATTR_RECORD Attribute;
     PNTFS_ATTR_CONTEXT ListContext;
@@ -118,7 +119,12 @@ InternalReadNonResidentAttributes(PFIND_ATTR_CONTXT Context)
         return STATUS_FILE_CORRUPT_ERROR;
     }
 
-    ListContext = PrepareAttributeContext(Attribute);
+    Status = PrepareAttributeContext(Attribute, &ListContext);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
     ListSize = AttributeDataLength(&ListContext->Record);
     if (ListSize > 0xFFFFFFFF)
     {
@@ -189,6 +189,63 @@ NtfsQueryMftZoneReservation(VOID)
 }
 
 
+/*
+ * Loads the $UpCase table of the volume, the $I30 indexes are sorted with it.
+ * FileRecord is a scratch buffer for the $UpCase file record.
+ */
+static
+NTSTATUS
+NtfsLoadUpcaseTable(PDEVICE_EXTENSION DeviceExt,
+                    PFILE_RECORD_HEADER FileRecord)
+{
+    NTSTATUS Status;
+    PNTFS_ATTR_CONTEXT DataContext;
+    ULONGLONG DataLength;
+    ULONG Length;
+
+    Status = ReadFileRecord(DeviceExt, NTFS_FILE_UPCASE, FileRecord);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    Status = FindAttribute(DeviceExt, FileRecord, AttributeData, L"", 0, &DataContext);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    /* The table maps the whole UCS-2 range at most */
+    DataLength = AttributeDataLength(&DataContext->Record);
+    Length = (ULONG)min(DataLength, 0x10000 * sizeof(WCHAR)) & ~(sizeof(WCHAR) - 1);
+    if (Length == 0)
+    {
+        ReleaseAttributeContext(DataContext);
+        return STATUS_FILE_CORRUPT_ERROR;
+    }
+
+    DeviceExt->UpcaseTable = ExAllocatePoolWithTag(PagedPool, Length, TAG_NTFS);
+    if (DeviceExt->UpcaseTable == NULL)
+    {
+        ReleaseAttributeContext(DataContext);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (ReadAttribute(DeviceExt, DataContext, 0, (PCHAR)DeviceExt->UpcaseTable, Length) != Length)
+    {
+        ExFreePoolWithTag(DeviceExt->UpcaseTable, TAG_NTFS);
+        DeviceExt->UpcaseTable = NULL;
+        ReleaseAttributeContext(DataContext);
+        return STATUS_FILE_CORRUPT_ERROR;
+    }
+
+    DeviceExt->UpcaseTableLength = Length / sizeof(WCHAR);
+    ReleaseAttributeContext(DataContext);
+
+    return STATUS_SUCCESS;
+}
+
+
 static
 NTSTATUS
 NtfsGetVolumeData(PDEVICE_OBJECT DeviceObject,
@@ -390,6 +447,12 @@ NtfsGetVolumeData(PDEVICE_OBJECT DeviceObject,
     if (NT_SUCCESS(Status))
     {
         ReleaseAttributeContext(AttrCtxt);
+
+        /* Lookups fall back to the system table without it */
+        if (!NT_SUCCESS(NtfsLoadUpcaseTable(DeviceExt, VolumeRecord)))
+        {
+            DPRINT1("Failed loading the $UpCase table\n");
+        }
     }
 
     ExFreePool(VolumeRecord);
@@ -550,6 +613,9 @@ ByeBye:
         if (Ccb)
             ExFreePool(Ccb);
 
+        if (Vcb && Vcb->UpcaseTable)
+            ExFreePoolWithTag(Vcb->UpcaseTable, TAG_NTFS);
+
         if (NewDeviceObject)
             IoDeleteDevice(NewDeviceObject);
     }
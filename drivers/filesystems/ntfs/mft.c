@@ -35,46 +35,93 @@
 
 /* FUNCTIONS ****************************************************************/
 
-PNTFS_ATTR_CONTEXT
-PrepareAttributeContext(PNTFS_ATTR_RECORD AttrRecord)
+NTSTATUS
+PrepareAttributeContext(PNTFS_ATTR_RECORD AttrRecord,
+                        PNTFS_ATTR_CONTEXT *AttrCtx)
 {
+    NTSTATUS Status = STATUS_SUCCESS;
     PNTFS_ATTR_CONTEXT Context;
 
     Context = ExAllocatePoolWithTag(NonPagedPool,
                                     FIELD_OFFSET(NTFS_ATTR_CONTEXT, Record) + AttrRecord->Length,
                                     TAG_NTFS);
+    if (Context == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
     RtlCopyMemory(&Context->Record, AttrRecord, AttrRecord->Length);
     if (AttrRecord->IsNonResident)
     {
+        PUCHAR DataRun, DataRunEnd;
         LONGLONG DataRunOffset;
         ULONGLONG DataRunLength;
+        LONGLONG LastLCN = 0;
+
+        /* Decode the mapping pairs once, reads then look the runs up in the MCB */
+        FsRtlInitializeLargeMcb(&Context->DataRunsMcb, NonPagedPool);
+        Context->DataRunsLength = 0;
+
+        DataRun = (PUCHAR)&Context->Record + Context->Record.NonResident.MappingPairsOffset;
+        DataRunEnd = (PUCHAR)&Context->Record + Context->Record.Length;
 
-        Context->CacheRun = (PUCHAR)&Context->Record + Context->Record.NonResident.MappingPairsOffset;
-        Context->CacheRunOffset = 0;
-        Context->CacheRun = DecodeRun(Context->CacheRun, &DataRunOffset, &DataRunLength);
-        Context->CacheRunLength = DataRunLength;
-        if (DataRunOffset != -1)
+        /* The MCB raises when it can't allocate its nodes */
+        _SEH2_TRY
         {
-            /* Normal run. */
-            Context->CacheRunStartLCN =
-            Context->CacheRunLastLCN = DataRunOffset;
+            while (DataRun < DataRunEnd && *DataRun != 0)
+            {
+                DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
+                if (DataRun > DataRunEnd || DataRunLength == 0)
+                {
+                    DPRINT1("Corrupted mapping pairs!\n");
+                    Status = STATUS_FILE_CORRUPT_ERROR;
+                    break;
+                }
+
+                if (DataRunOffset != -1)
+                {
+                    /* Normal run. */
+                    LastLCN += DataRunOffset;
+                    if (!FsRtlAddLargeMcbEntry(&Context->DataRunsMcb, Context->DataRunsLength, LastLCN, DataRunLength))
+                    {
+                        DPRINT1("Overlapping run %I64x-%I64x\n", LastLCN, LastLCN + DataRunLength - 1);
+                        Status = STATUS_FILE_CORRUPT_ERROR;
+                        break;
+                    }
+                }
+
+                /* Sparse runs are left unmapped */
+                Context->DataRunsLength += DataRunLength;
+            }
         }
-        else
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
         {
-            /* Sparse run. */
-            Context->CacheRunStartLCN = -1;
-            Context->CacheRunLastLCN = 0;
+            DPRINT1("Failed to map the runs of the attribute\n");
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+
+        if (!NT_SUCCESS(Status))
+        {
+            FsRtlUninitializeLargeMcb(&Context->DataRunsMcb);
+            ExFreePoolWithTag(Context, TAG_NTFS);
+            return Status;
         }
-        Context->CacheRunCurrentOffset = 0;
     }
 
-    return Context;
+    *AttrCtx = Context;
+    return STATUS_SUCCESS;
 }
 
 
 VOID
 ReleaseAttributeContext(PNTFS_ATTR_CONTEXT Context)
 {
+    if (Context->Record.IsNonResident)
+    {
+        FsRtlUninitializeLargeMcb(&Context->DataRunsMcb);
+    }
+
     ExFreePoolWithTag(Context, TAG_NTFS);
 }
 
@@ -120,9 +167,9 @@ FindAttribute(PDEVICE_EXTENSION Vcb,
             {
                 /* Found it, fill up the context and return. */
                 DPRINT("Found context\n");
-                *AttrCtx = PrepareAttributeContext(Attribute);
+                Status = PrepareAttributeContext(Attribute, AttrCtx);
                 FindCloseAttribute(&Context);
-                return STATUS_SUCCESS;
+                return Status;
             }
         }
 
@@ -161,12 +208,10 @@ ReadAttribute(PDEVICE_EXTENSION Vcb,
               PCHAR Buffer,
               ULONG Length)
 {
-    ULONGLONG LastLCN;
-    PUCHAR DataRun;
-    LONGLONG DataRunOffset;
-    ULONGLONG DataRunLength;
-    LONGLONG DataRunStartLCN;
-    ULONGLONG CurrentOffset;
+    ULONGLONG Vcn;
+    LONGLONG Lcn;
+    LONGLONG ClusterCount;
+    ULONGLONG RunOffset;
     ULONG ReadLength;
     ULONG AlreadyRead;
     NTSTATUS Status;
@@ -185,150 +230,45 @@ ReadAttribute(PDEVICE_EXTENSION Vcb,
      * Non-resident attribute
      */
 
-    /*
-     * I. Find the corresponding start data run.
-     */
-
     AlreadyRead = 0;
-
-    // FIXME: Cache seems to be non-working. Disable it for now
-    //if(Context->CacheRunOffset <= Offset && Offset < Context->CacheRunOffset + Context->CacheRunLength * Volume->ClusterSize)
-    if (0)
-    {
-        DataRun = Context->CacheRun;
-        LastLCN = Context->CacheRunLastLCN;
-        DataRunStartLCN = Context->CacheRunStartLCN;
-        DataRunLength = Context->CacheRunLength;
-        CurrentOffset = Context->CacheRunCurrentOffset;
-    }
-    else
+    while (Length > 0)
     {
-        LastLCN = 0;
-        DataRun = (PUCHAR)&Context->Record + Context->Record.NonResident.MappingPairsOffset;
-        CurrentOffset = 0;
+        /* Find the run holding the offset and the number of clusters left in it */
+        Vcn = Offset / Vcb->NtfsInfo.BytesPerCluster;
+        if (Vcn >= Context->DataRunsLength)
+            break;
 
-        while (1)
+        if (!FsRtlLookupLargeMcbEntry(&Context->DataRunsMcb, Vcn, &Lcn, &ClusterCount, NULL, NULL, NULL))
         {
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != -1)
-            {
-                /* Normal data run. */
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-            {
-                /* Sparse data run. */
-                DataRunStartLCN = -1;
-            }
-
-            if (Offset >= CurrentOffset &&
-                Offset < CurrentOffset + (DataRunLength * Vcb->NtfsInfo.BytesPerCluster))
-            {
-                break;
-            }
-
-            if (*DataRun == 0)
-            {
-                return AlreadyRead;
-            }
-
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
+            /* Trailing sparse run */
+            Lcn = -1;
+            ClusterCount = Context->DataRunsLength - Vcn;
         }
-    }
-
-    /*
-     * II. Go through the run list and read the data
-     */
 
-    ReadLength = (ULONG)min(DataRunLength * Vcb->NtfsInfo.BytesPerCluster - (Offset - CurrentOffset), Length);
-    if (DataRunStartLCN == -1)
-    {
-        RtlZeroMemory(Buffer, ReadLength);
-        Status = STATUS_SUCCESS;
-    }
-    else
-    {
-        Status = NtfsReadDisk(Vcb->StorageDevice,
-                              DataRunStartLCN * Vcb->NtfsInfo.BytesPerCluster + Offset - CurrentOffset,
-                              ReadLength,
-                              Vcb->NtfsInfo.BytesPerSector,
-                              (PVOID)Buffer,
-                              FALSE);
-    }
-    if (NT_SUCCESS(Status))
-    {
-        Length -= ReadLength;
-        Buffer += ReadLength;
-        AlreadyRead += ReadLength;
-
-        if (ReadLength == DataRunLength * Vcb->NtfsInfo.BytesPerCluster - (Offset - CurrentOffset))
+        /* Contiguous runs were merged in the MCB, so they are read at once */
+        RunOffset = Offset - Vcn * Vcb->NtfsInfo.BytesPerCluster;
+        ReadLength = (ULONG)min(ClusterCount * Vcb->NtfsInfo.BytesPerCluster - RunOffset, Length);
+        if (Lcn == -1)
         {
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != (ULONGLONG)-1)
-            {
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-                DataRunStartLCN = -1;
+            RtlZeroMemory(Buffer, ReadLength);
         }
-
-        while (Length > 0)
+        else
         {
-            ReadLength = (ULONG)min(DataRunLength * Vcb->NtfsInfo.BytesPerCluster, Length);
-            if (DataRunStartLCN == -1)
-                RtlZeroMemory(Buffer, ReadLength);
-            else
-            {
-                Status = NtfsReadDisk(Vcb->StorageDevice,
-                                      DataRunStartLCN * Vcb->NtfsInfo.BytesPerCluster,
-                                      ReadLength,
-                                      Vcb->NtfsInfo.BytesPerSector,
-                                      (PVOID)Buffer,
-                                      FALSE);
-                if (!NT_SUCCESS(Status))
-                    break;
-            }
-
-            Length -= ReadLength;
-            Buffer += ReadLength;
-            AlreadyRead += ReadLength;
-
-            /* We finished this request, but there still data in this data run. */
-            if (Length == 0 && ReadLength != DataRunLength * Vcb->NtfsInfo.BytesPerCluster)
+            Status = NtfsReadDisk(Vcb->StorageDevice,
+                                  Lcn * Vcb->NtfsInfo.BytesPerCluster + RunOffset,
+                                  ReadLength,
+                                  Vcb->NtfsInfo.BytesPerSector,
+                                  (PVOID)Buffer,
+                                  FALSE);
+            if (!NT_SUCCESS(Status))
                 break;
+        }
 
-            /*
-             * Go to next run in the list.
-             */
-
-            if (*DataRun == 0)
-                break;
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != -1)
-            {
-                /* Normal data run. */
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-            {
-                /* Sparse data run. */
-                DataRunStartLCN = -1;
-            }
-        } /* while */
-
-    } /* if Disk */
-
-    Context->CacheRun = DataRun;
-    Context->CacheRunOffset = Offset + AlreadyRead;
-    Context->CacheRunStartLCN = DataRunStartLCN;
-    Context->CacheRunLength = DataRunLength;
-    Context->CacheRunLastLCN = LastLCN;
-    Context->CacheRunCurrentOffset = CurrentOffset;
+        Length -= ReadLength;
+        Buffer += ReadLength;
+        Offset += ReadLength;
+        AlreadyRead += ReadLength;
+    }
 
     return AlreadyRead;
 }
@@ -558,6 +498,220 @@ BrowseIndexEntries(PDEVICE_EXTENSION Vcb,
     return Status;    
 }
 
+static
+WCHAR
+NtfsUpcaseChar(PDEVICE_EXTENSION Vcb,
+               WCHAR Char)
+{
+    if (Vcb->UpcaseTable == NULL)
+        return RtlUpcaseUnicodeChar(Char);
+
+    if (Char < Vcb->UpcaseTableLength)
+        return Vcb->UpcaseTable[Char];
+
+    return Char;
+}
+
+/*
+ * Collates a file name against an index entry the way the $I30 index is
+ * sorted: by characters upcased with the volume $UpCase table, then by length.
+ */
+static
+LONG
+CollateFileName(PDEVICE_EXTENSION Vcb,
+                PUNICODE_STRING FileName,
+                PINDEX_ENTRY_ATTRIBUTE IndexEntry)
+{
+    ULONG i, Length, EntryLength;
+    WCHAR Char, EntryChar;
+
+    Length = FileName->Length / sizeof(WCHAR);
+    EntryLength = IndexEntry->FileName.NameLength;
+
+    for (i = 0; i < min(Length, EntryLength); i++)
+    {
+        Char = NtfsUpcaseChar(Vcb, FileName->Buffer[i]);
+        EntryChar = NtfsUpcaseChar(Vcb, IndexEntry->FileName.Name[i]);
+        if (Char != EntryChar)
+        {
+            return (Char < EntryChar) ? -1 : 1;
+        }
+    }
+
+    if (Length != EntryLength)
+    {
+        return (Length < EntryLength) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static
+BOOLEAN
+IsAsciiFileName(PUNICODE_STRING FileName)
+{
+    ULONG i;
+
+    for (i = 0; i < FileName->Length / sizeof(WCHAR); i++)
+    {
+        if (FileName->Buffer[i] > 0x7F)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static
+NTSTATUS
+ReadIndexSubnode(PDEVICE_EXTENSION Vcb,
+                 PNTFS_ATTR_CONTEXT IndexAllocationCtx,
+                 ULONG IndexBlockSize,
+                 PINDEX_ENTRY_ATTRIBUTE IndexEntry,
+                 PCHAR IndexRecord)
+{
+    NTSTATUS Status;
+    ULONGLONG Vcn;
+    ULONGLONG RecordOffset;
+    PINDEX_BUFFER IndexBuffer;
+
+    if (IndexAllocationCtx == NULL ||
+        IndexEntry->Length < FIELD_OFFSET(INDEX_ENTRY_ATTRIBUTE, FileName) + sizeof(ULONGLONG))
+    {
+        DPRINT1("Corrupted filesystem!\n");
+        return STATUS_FILE_CORRUPT_ERROR;
+    }
+
+    /* The subnode VCN is stored in the last 8 bytes of the entry */
+    Vcn = *(ULONGLONG *)((PCHAR)IndexEntry + IndexEntry->Length - sizeof(ULONGLONG));
+
+    /* Index blocks smaller than a cluster are addressed in 512 bytes units */
+    if (IndexBlockSize >= Vcb->NtfsInfo.BytesPerCluster)
+        RecordOffset = Vcn * Vcb->NtfsInfo.BytesPerCluster;
+    else
+        RecordOffset = Vcn * 512;
+
+    if (RecordOffset + IndexBlockSize > AttributeDataLength(&IndexAllocationCtx->Record) ||
+        ReadAttribute(Vcb, IndexAllocationCtx, RecordOffset, IndexRecord, IndexBlockSize) != IndexBlockSize)
+    {
+        DPRINT1("Failed to read index block at VCN %I64x\n", Vcn);
+        return STATUS_FILE_CORRUPT_ERROR;
+    }
+
+    Status = FixupUpdateSequenceArray(Vcb, &((PFILE_RECORD_HEADER)IndexRecord)->Ntfs);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    IndexBuffer = (PINDEX_BUFFER)IndexRecord;
+    if (IndexBuffer->Ntfs.Type != NRH_INDX_TYPE ||
+        IndexBuffer->VCN != Vcn ||
+        IndexBuffer->Header.FirstEntryOffset > IndexBuffer->Header.TotalSizeOfEntries ||
+        IndexBuffer->Header.TotalSizeOfEntries > IndexBlockSize - FIELD_OFFSET(INDEX_BUFFER, Header))
+    {
+        DPRINT1("Corrupted index block at VCN %I64x\n", Vcn);
+        return STATUS_FILE_CORRUPT_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Looks a file name up by walking down the $I30 B+tree: in each node, stop at
+ * the first entry which doesn't collate before the name, and only follow its
+ * subnode. Equal keys (case variants of POSIX names, DOS names) may spread
+ * over the subnode and the following entries, so these are all checked.
+ */
+static
+NTSTATUS
+SearchIndexEntries(PDEVICE_EXTENSION Vcb,
+                   PNTFS_ATTR_CONTEXT IndexAllocationCtx,
+                   ULONG IndexBlockSize,
+                   PINDEX_ENTRY_ATTRIBUTE FirstEntry,
+                   PINDEX_ENTRY_ATTRIBUTE LastEntry,
+                   PUNICODE_STRING FileName,
+                   ULONG Depth,
+                   ULONGLONG *OutMFTIndex)
+{
+    NTSTATUS Status;
+    LONG Collation;
+    PCHAR IndexRecord;
+    PINDEX_BUFFER IndexBuffer;
+    PINDEX_ENTRY_ATTRIBUTE IndexEntry;
+
+    DPRINT("SearchIndexEntries(%p, %p, %u, %p, %p, %wZ, %u, %p)\n", Vcb, IndexAllocationCtx, IndexBlockSize, FirstEntry, LastEntry, FileName, Depth, OutMFTIndex);
+
+    if (Depth > NTFS_MAX_INDEX_DEPTH)
+    {
+        DPRINT1("Index is too deep, corrupted filesystem?\n");
+        return STATUS_FILE_CORRUPT_ERROR;
+    }
+
+    IndexEntry = FirstEntry;
+    while (IndexEntry < LastEntry)
+    {
+        if (IndexEntry->Length < FIELD_OFFSET(INDEX_ENTRY_ATTRIBUTE, FileName))
+        {
+            DPRINT1("Corrupted filesystem!\n");
+            return STATUS_FILE_CORRUPT_ERROR;
+        }
+
+        if (IndexEntry->Flags & NTFS_INDEX_ENTRY_END)
+            Collation = -1;
+        else
+            Collation = CollateFileName(Vcb, FileName, IndexEntry);
+
+        if (Collation <= 0 && (IndexEntry->Flags & NTFS_INDEX_ENTRY_NODE))
+        {
+            IndexRecord = ExAllocatePoolWithTag(NonPagedPool, IndexBlockSize, TAG_NTFS);
+            if (IndexRecord == NULL)
+            {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            Status = ReadIndexSubnode(Vcb, IndexAllocationCtx, IndexBlockSize, IndexEntry, IndexRecord);
+            if (NT_SUCCESS(Status))
+            {
+                IndexBuffer = (PINDEX_BUFFER)IndexRecord;
+                Status = SearchIndexEntries(Vcb,
+                                            IndexAllocationCtx,
+                                            IndexBlockSize,
+                                            (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)&IndexBuffer->Header + IndexBuffer->Header.FirstEntryOffset),
+                                            (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)&IndexBuffer->Header + IndexBuffer->Header.TotalSizeOfEntries),
+                                            FileName,
+                                            Depth + 1,
+                                            OutMFTIndex);
+            }
+
+            ExFreePoolWithTag(IndexRecord, TAG_NTFS);
+
+            if (Collation < 0 || Status != STATUS_OBJECT_PATH_NOT_FOUND)
+            {
+                return Status;
+            }
+        }
+
+        /* All the remaining entries collate after the name */
+        if (Collation < 0)
+        {
+            break;
+        }
+
+        if (Collation == 0 &&
+            (IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK) > 0x10 &&
+            IndexEntry->FileName.NameType != NTFS_FILE_NAME_DOS &&
+            CompareFileName(FileName, IndexEntry, FALSE))
+        {
+            *OutMFTIndex = (IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK);
+            return STATUS_SUCCESS;
+        }
+
+        IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((PCHAR)IndexEntry + IndexEntry->Length);
+    }
+
+    return STATUS_OBJECT_PATH_NOT_FOUND;
+}
+
 NTSTATUS
 NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
                   ULONGLONG MFTIndex,
@@ -567,7 +721,7 @@ NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
                   ULONGLONG *OutMFTIndex)
 {
     PFILE_RECORD_HEADER MftRecord;
-    PNTFS_ATTR_CONTEXT IndexRootCtx;
+    PNTFS_ATTR_CONTEXT IndexRootCtx, IndexAllocationCtx;
     PINDEX_ROOT_ATTRIBUTE IndexRoot;
     PCHAR IndexRecord;
     PINDEX_ENTRY_ATTRIBUTE IndexEntry, IndexEntryEnd;
@@ -616,7 +770,36 @@ NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
 
     DPRINT("IndexRecordSize: %x IndexBlockSize: %x\n", Vcb->NtfsInfo.BytesPerIndexRecord, IndexRoot->SizeOfEntry);
 
-    Status = BrowseIndexEntries(Vcb, MftRecord, IndexRecord, IndexRoot->SizeOfEntry, IndexEntry, IndexEntryEnd, FileName, FirstEntry, &CurrentEntry, DirSearch, OutMFTIndex);
+    if (DirSearch)
+    {
+        Status = BrowseIndexEntries(Vcb, MftRecord, IndexRecord, IndexRoot->SizeOfEntry, IndexEntry, IndexEntryEnd, FileName, FirstEntry, &CurrentEntry, DirSearch, OutMFTIndex);
+    }
+    else
+    {
+        /* Small directories have no index allocation */
+        if (!NT_SUCCESS(FindAttribute(Vcb, MftRecord, AttributeIndexAllocation, L"$I30", 4, &IndexAllocationCtx)))
+        {
+            IndexAllocationCtx = NULL;
+        }
+
+        Status = SearchIndexEntries(Vcb, IndexAllocationCtx, IndexRoot->SizeOfEntry, IndexEntry, IndexEntryEnd, FileName, 0, OutMFTIndex);
+
+        if (IndexAllocationCtx != NULL)
+        {
+            ReleaseAttributeContext(IndexAllocationCtx);
+        }
+
+        /*
+         * Without the $UpCase table, the system one may not collate non-ASCII
+         * names the way the index was sorted: scan it before giving up.
+         */
+        if (Status == STATUS_OBJECT_PATH_NOT_FOUND &&
+            Vcb->UpcaseTable == NULL &&
+            !IsAsciiFileName(FileName))
+        {
+            Status = BrowseIndexEntries(Vcb, MftRecord, IndexRecord, IndexRoot->SizeOfEntry, IndexEntry, IndexEntryEnd, FileName, FirstEntry, &CurrentEntry, DirSearch, OutMFTIndex);
+        }
+    }
 
     ExFreePoolWithTag(IndexRecord, TAG_NTFS);
     ExFreePoolWithTag(MftRecord, TAG_NTFS);
@@ -114,6 +114,10 @@ typedef struct
     struct _FILE_RECORD_HEADER* MasterFileTable;
     struct _FCB *VolumeFcb;
 
+    /* $UpCase table, used to collate the $I30 index names */
+    PWCHAR UpcaseTable;
+    ULONG UpcaseTableLength;
+
     NTFS_INFO NtfsInfo;
 
     ULONG Flags;
@@ -204,6 +208,9 @@ typedef enum
 #define NTFS_INDEX_ENTRY_NODE            1
 #define NTFS_INDEX_ENTRY_END            2
 
+/* Bound on the $I30 B+tree depth, to survive loops in corrupted indexes */
+#define NTFS_MAX_INDEX_DEPTH            32
+
 #define NTFS_FILE_NAME_POSIX            0
 #define NTFS_FILE_NAME_WIN32            1
 #define NTFS_FILE_NAME_DOS            2
@@ -427,12 +434,9 @@ typedef struct
 
 typedef struct _NTFS_ATTR_CONTEXT
 {
-    PUCHAR            CacheRun;
-    ULONGLONG            CacheRunOffset;
-    LONGLONG            CacheRunStartLCN;
-    ULONGLONG            CacheRunLength;
-    LONGLONG            CacheRunLastLCN;
-    ULONGLONG            CacheRunCurrentOffset;
+    /* VCN to LCN mapping of a non-resident attribute, sparse runs are holes */
+    LARGE_MCB            DataRunsMcb;
+    ULONGLONG            DataRunsLength;
     NTFS_ATTR_RECORD    Record;
 } NTFS_ATTR_CONTEXT, *PNTFS_ATTR_CONTEXT;
 
@@ -470,6 +474,9 @@ typedef struct _FCB
     ULONGLONG MFTIndex;
     USHORT LinkCount;
 
+    /* Data stream runs, built on the first read */
+    PNTFS_ATTR_CONTEXT DataContext;
+
     FILENAME_ATTRIBUTE Entry;
 
 } NTFS_FCB, *PNTFS_FCB;
@@ -728,8 +735,9 @@ NtfsFileSystemControl(PNTFS_IRP_CONTEXT IrpContext);
 
 
 /* mft.c */
-PNTFS_ATTR_CONTEXT
-PrepareAttributeContext(PNTFS_ATTR_RECORD AttrRecord);
+NTSTATUS
+PrepareAttributeContext(PNTFS_ATTR_RECORD AttrRecord,
+                        PNTFS_ATTR_CONTEXT *AttrCtx);
 
 VOID
 ReleaseAttributeContext(PNTFS_ATTR_CONTEXT Context);
@@ -35,54 +35,43 @@
 /* FUNCTIONS ****************************************************************/
 
 /*
- * FUNCTION: Reads data from a file
+ * FUNCTION: Returns the data stream context of a file, which is built on the
+ * first read and kept on the FCB: the volume is read-only, so its runs never
+ * change.
  */
 static
 NTSTATUS
-NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
-             PFILE_OBJECT FileObject,
-             PUCHAR Buffer,
-             ULONG Length,
-             ULONG ReadOffset,
-             ULONG IrpFlags,
-             PULONG LengthRead)
+NtfsGetDataContext(PDEVICE_EXTENSION DeviceExt,
+                   PNTFS_FCB Fcb,
+                   PNTFS_ATTR_CONTEXT *DataContext)
 {
     NTSTATUS Status = STATUS_SUCCESS;
-    PNTFS_FCB Fcb;
     PFILE_RECORD_HEADER FileRecord;
-    PNTFS_ATTR_CONTEXT DataContext;
-    ULONG RealLength;
-    ULONG RealReadOffset;
-    ULONG RealLengthRead;
-    ULONG ToRead;
-    BOOLEAN AllocatedBuffer = FALSE;
-    PCHAR ReadBuffer = (PCHAR)Buffer;
-    ULONGLONG StreamSize;
-
-    DPRINT1("NtfsReadFile(%p, %p, %p, %u, %u, %x, %p)\n", DeviceExt, FileObject, Buffer, Length, ReadOffset, IrpFlags, LengthRead);
-
-    *LengthRead = 0;
+    PNTFS_ATTR_CONTEXT Context;
 
-    if (Length == 0)
+    /* The context is published fully built, see below */
+    Context = Fcb->DataContext;
+    if (Context != NULL)
     {
-        DPRINT1("Null read!\n");
+        *DataContext = Context;
         return STATUS_SUCCESS;
     }
 
-    Fcb = (PNTFS_FCB)FileObject->FsContext;
+    KeEnterCriticalRegion();
+    ExAcquireResourceExclusiveLite(&Fcb->MainResource, TRUE);
 
-    if (NtfsFCBIsCompressed(Fcb))
+    /* Another read may have built it meanwhile */
+    if (Fcb->DataContext != NULL)
     {
-        DPRINT1("Compressed file!\n");
-        UNIMPLEMENTED;
-        return STATUS_NOT_IMPLEMENTED;
+        goto ByeBye;
     }
 
     FileRecord = ExAllocatePoolWithTag(NonPagedPool, DeviceExt->NtfsInfo.BytesPerFileRecord, TAG_NTFS);
     if (FileRecord == NULL)
     {
         DPRINT1("Not enough memory!\n");
-        return STATUS_INSUFFICIENT_RESOURCES;
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto ByeBye;
     }
 
     Status = ReadFileRecord(DeviceExt, Fcb->MFTIndex, FileRecord);
@@ -90,12 +79,17 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
     {
         DPRINT1("Can't find record!\n");
         ExFreePoolWithTag(FileRecord, TAG_NTFS);
-        return Status;
+        goto ByeBye;
     }
 
-
-    Status = FindAttribute(DeviceExt, FileRecord, AttributeData, Fcb->Stream, wcslen(Fcb->Stream), &DataContext);
-    if (!NT_SUCCESS(Status))
+    Status = FindAttribute(DeviceExt, FileRecord, AttributeData, Fcb->Stream, wcslen(Fcb->Stream), &Context);
+    if (NT_SUCCESS(Status))
+    {
+        /* Readers check the pointer without the lock, so make the context
+         * visible before the pointer to it */
+        InterlockedExchangePointer((PVOID *)&Fcb->DataContext, Context);
+    }
+    else
     {
         NTSTATUS BrowseStatus;
         FIND_ATTR_CONTXT Context;
@@ -119,9 +113,66 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
             BrowseStatus = FindNextAttribute(&Context, &Attribute);
         }
         FindCloseAttribute(&Context);
+    }
 
-        ReleaseAttributeContext(DataContext);
-        ExFreePoolWithTag(FileRecord, TAG_NTFS);
+    ExFreePoolWithTag(FileRecord, TAG_NTFS);
+
+ByeBye:
+    *DataContext = Fcb->DataContext;
+
+    ExReleaseResourceLite(&Fcb->MainResource);
+    KeLeaveCriticalRegion();
+
+    return Status;
+}
+
+
+/*
+ * FUNCTION: Reads data from a file
+ */
+static
+NTSTATUS
+NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
+             PFILE_OBJECT FileObject,
+             PUCHAR Buffer,
+             ULONG Length,
+             ULONG ReadOffset,
+             ULONG IrpFlags,
+             PULONG LengthRead)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PNTFS_FCB Fcb;
+    PNTFS_ATTR_CONTEXT DataContext;
+    ULONG RealLength;
+    ULONG RealReadOffset;
+    ULONG RealLengthRead;
+    ULONG ToRead;
+    BOOLEAN AllocatedBuffer = FALSE;
+    PCHAR ReadBuffer = (PCHAR)Buffer;
+    ULONGLONG StreamSize;
+
+    DPRINT1("NtfsReadFile(%p, %p, %p, %u, %u, %x, %p)\n", DeviceExt, FileObject, Buffer, Length, ReadOffset, IrpFlags, LengthRead);
+
+    *LengthRead = 0;
+
+    if (Length == 0)
+    {
+        DPRINT1("Null read!\n");
+        return STATUS_SUCCESS;
+    }
+
+    Fcb = (PNTFS_FCB)FileObject->FsContext;
+
+    if (NtfsFCBIsCompressed(Fcb))
+    {
+        DPRINT1("Compressed file!\n");
+        UNIMPLEMENTED;
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    Status = NtfsGetDataContext(DeviceExt, Fcb, &DataContext);
+    if (!NT_SUCCESS(Status))
+    {
         return Status;
     }
 
@@ -129,8 +180,6 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
     if (ReadOffset >= StreamSize)
     {
         DPRINT1("Reading beyond stream end!\n");
-        ReleaseAttributeContext(DataContext);
-        ExFreePoolWithTag(FileRecord, TAG_NTFS);
         return STATUS_END_OF_FILE;
     }
 
@@ -157,8 +206,6 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
         if (ReadBuffer == NULL)
         {
             DPRINT1("Not enough memory!\n");
-            ReleaseAttributeContext(DataContext);
-            ExFreePoolWithTag(FileRecord, TAG_NTFS);
             return STATUS_INSUFFICIENT_RESOURCES;
         }
         AllocatedBuffer = TRUE;
@@ -169,8 +216,6 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
     if (RealLengthRead == 0)
     {
         DPRINT1("Read failure!\n");
-        ReleaseAttributeContext(DataContext);
-        ExFreePoolWithTag(FileRecord, TAG_NTFS);
         if (AllocatedBuffer)
         {
             ExFreePoolWithTag(ReadBuffer, TAG_NTFS);
@@ -178,9 +223,6 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
         return Status;
     }
 
-    ReleaseAttributeContext(DataContext);
-    ExFreePoolWithTag(FileRecord, TAG_NTFS);
-
     *LengthRead = ToRead;
 
     DPRINT1("%lu got read\n", *LengthRead);
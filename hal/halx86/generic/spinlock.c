@@ -86,7 +86,7 @@ KeAcquireQueuedSpinLock(IN KSPIN_LOCK_QUEUE_NUMBER LockNumber)
     KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
 
     /* Acquire the lock */
-    KxAcquireSpinLock(KeGetCurrentPrcb()->LockQueue[LockNumber].Lock); // HACK
+    KxAcquireQueuedSpinLock(&KeGetCurrentPrcb()->LockQueue[LockNumber]);
     return OldIrql;
 }
 
@@ -103,7 +103,7 @@ KeAcquireQueuedSpinLockRaiseToSynch(IN KSPIN_LOCK_QUEUE_NUMBER LockNumber)
     KeRaiseIrql(SYNCH_LEVEL, &OldIrql);
 
     /* Acquire the lock */
-    KxAcquireSpinLock(KeGetCurrentPrcb()->LockQueue[LockNumber].Lock); // HACK
+    KxAcquireQueuedSpinLock(&KeGetCurrentPrcb()->LockQueue[LockNumber]);
     return OldIrql;
 }
 
@@ -123,7 +123,7 @@ KeAcquireInStackQueuedSpinLock(IN PKSPIN_LOCK SpinLock,
     KeRaiseIrql(DISPATCH_LEVEL, &LockHandle->OldIrql);
 
     /* Acquire the lock */
-    KxAcquireSpinLock(LockHandle->LockQueue.Lock); // HACK
+    KxAcquireQueuedSpinLock(&LockHandle->LockQueue);
 }
 
 /*
@@ -142,7 +142,7 @@ KeAcquireInStackQueuedSpinLockRaiseToSynch(IN PKSPIN_LOCK SpinLock,
     KeRaiseIrql(SYNCH_LEVEL, &LockHandle->OldIrql);
 
     /* Acquire the lock */
-    KxAcquireSpinLock(LockHandle->LockQueue.Lock); // HACK
+    KxAcquireQueuedSpinLock(&LockHandle->LockQueue);
 }
 
 /*
@@ -154,7 +154,7 @@ KeReleaseQueuedSpinLock(IN KSPIN_LOCK_QUEUE_NUMBER LockNumber,
                         IN KIRQL OldIrql)
 {
     /* Release the lock */
-    KxReleaseSpinLock(KeGetCurrentPrcb()->LockQueue[LockNumber].Lock); // HACK
+    KxReleaseQueuedSpinLock(&KeGetCurrentPrcb()->LockQueue[LockNumber]);
 
     /* Lower IRQL back */
     KeLowerIrql(OldIrql);
@@ -167,8 +167,8 @@ VOID
 FASTCALL
 KeReleaseInStackQueuedSpinLock(IN PKLOCK_QUEUE_HANDLE LockHandle)
 {
-    /* Simply lower IRQL back */
-    KxReleaseSpinLock(LockHandle->LockQueue.Lock); // HACK
+    /* Release the lock and lower IRQL back */
+    KxReleaseQueuedSpinLock(&LockHandle->LockQueue);
     KeLowerIrql(LockHandle->OldIrql);
 }
 
@@ -180,19 +180,17 @@ FASTCALL
 KeTryToAcquireQueuedSpinLockRaiseToSynch(IN KSPIN_LOCK_QUEUE_NUMBER LockNumber,
                                          IN PKIRQL OldIrql)
 {
-#ifdef CONFIG_SMP
-    ERROR_DBGBREAK("FIXME: Unused\n"); // FIXME: Unused
-    return FALSE;
-#endif
-
-    /* Simply raise to synch */
+    /* Raise to synch */
     KeRaiseIrql(SYNCH_LEVEL, OldIrql);
 
-    /* Add an explicit memory barrier to prevent the compiler from reordering
-       memory accesses across the borders of spinlocks */
-    KeMemoryBarrierWithoutFence();
+    /* Try to acquire the lock, and lower IRQL back if somebody holds it */
+    if (!KxTryToAcquireQueuedSpinLock(&KeGetCurrentPrcb()->LockQueue[LockNumber]))
+    {
+        KeLowerIrql(*OldIrql);
+        return FALSE;
+    }
 
-    /* Always return true on UP Machines */
+    /* We own the lock */
     return TRUE;
 }
 
@@ -204,19 +202,17 @@ FASTCALL
 KeTryToAcquireQueuedSpinLock(IN KSPIN_LOCK_QUEUE_NUMBER LockNumber,
                              OUT PKIRQL OldIrql)
 {
-#ifdef CONFIG_SMP
-    ERROR_DBGBREAK("FIXME: Unused\n"); // FIXME: Unused
-    return FALSE;
-#endif
-
-    /* Simply raise to dispatch */
+    /* Raise to dispatch */
     KeRaiseIrql(DISPATCH_LEVEL, OldIrql);
 
-    /* Add an explicit memory barrier to prevent the compiler from reordering
-       memory accesses across the borders of spinlocks */
-    KeMemoryBarrierWithoutFence();
+    /* Try to acquire the lock, and lower IRQL back if somebody holds it */
+    if (!KxTryToAcquireQueuedSpinLock(&KeGetCurrentPrcb()->LockQueue[LockNumber]))
+    {
+        KeLowerIrql(*OldIrql);
+        return FALSE;
+    }
 
-    /* Always return true on UP Machines */
+    /* We own the lock */
     return TRUE;
 }
 
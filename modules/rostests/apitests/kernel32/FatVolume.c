@@ -0,0 +1,537 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Tests for the FAT file system driver
+ */
+
+#include <apitest.h>
+
+#include <strsafe.h>
+
+#define FAT_MAX_FILES       64
+#define FAT_MAX_FILE_SIZE   0x40000000
+#define FAT_FRAGMENTS       32
+#define FAT_DIRECTORY_FILES 300
+
+typedef struct _FAT_VOLUME
+{
+    HANDLE Handle;
+    WCHAR Root[4];
+    ULONG BytesPerSector;
+    ULONG BytesPerCluster;
+    ULONG FatOffset;
+    ULONG FatSize;
+    ULONG ClusterCount;
+    ULONG FatType;
+} FAT_VOLUME, *PFAT_VOLUME;
+
+#define READ_USHORT(p)  ((ULONG)(p)[0] | ((ULONG)(p)[1] << 8))
+#define READ_ULONG(p)   (READ_USHORT(p) | (READ_USHORT((p) + 2) << 16))
+
+static
+BOOL
+OpenFatVolume(
+    PFAT_VOLUME Volume)
+{
+    WCHAR Path[MAX_PATH], FileSystem[MAX_PATH], Device[] = L"\\\\.\\X:";
+    ULONG SectorsPerCluster, RootSectors, TotalSectors, FatSectors;
+    PUCHAR Boot;
+    DWORD Read;
+    BOOL Ret;
+
+    /* Work on the volume of the current directory if it is a FAT one */
+    if (!GetCurrentDirectoryW(MAX_PATH, Path) || Path[1] != L':')
+        return FALSE;
+    StringCbPrintfW(Volume->Root, sizeof(Volume->Root), L"%c:\\", Path[0]);
+    if (!GetVolumeInformationW(Volume->Root, NULL, 0, NULL, NULL, NULL, FileSystem, MAX_PATH) ||
+        wcsncmp(FileSystem, L"FAT", 3) != 0)
+    {
+        return FALSE;
+    }
+
+    Device[4] = Path[0];
+    Volume->Handle = CreateFileW(Device,
+                                 GENERIC_READ | GENERIC_WRITE,
+                                 FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                 NULL,
+                                 OPEN_EXISTING,
+                                 0,
+                                 NULL);
+    if (Volume->Handle == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    /* Volume reads are not cached, so they must span whole sectors */
+    Boot = VirtualAlloc(NULL, 4096, MEM_COMMIT, PAGE_READWRITE);
+    if (!Boot)
+    {
+        CloseHandle(Volume->Handle);
+        return FALSE;
+    }
+    Ret = ReadFile(Volume->Handle, Boot, 4096, &Read, NULL) && Read == 4096;
+
+    Volume->BytesPerSector = READ_USHORT(Boot + 0x0B);
+    SectorsPerCluster = Boot[0x0D];
+    Volume->BytesPerCluster = Volume->BytesPerSector * SectorsPerCluster;
+    Volume->FatOffset = READ_USHORT(Boot + 0x0E) * Volume->BytesPerSector;
+    RootSectors = (READ_USHORT(Boot + 0x11) * 32 + Volume->BytesPerSector - 1) / Volume->BytesPerSector;
+    TotalSectors = READ_USHORT(Boot + 0x13) ? READ_USHORT(Boot + 0x13) : READ_ULONG(Boot + 0x20);
+    FatSectors = READ_USHORT(Boot + 0x16) ? READ_USHORT(Boot + 0x16) : READ_ULONG(Boot + 0x24);
+    Volume->FatSize = FatSectors * Volume->BytesPerSector;
+    Volume->ClusterCount = (TotalSectors - Volume->FatOffset / Volume->BytesPerSector -
+                            Boot[0x10] * FatSectors - RootSectors) / SectorsPerCluster;
+    Volume->FatType = (Volume->ClusterCount < 4085) ? 12 :
+                      (Volume->ClusterCount < 65525) ? 16 : 32;
+    VirtualFree(Boot, 0, MEM_RELEASE);
+
+    if (!Ret)
+        CloseHandle(Volume->Handle);
+    return Ret;
+}
+
+static
+ULONG
+QueryFreeClusters(
+    PFAT_VOLUME Volume)
+{
+    DWORD SectorsPerCluster, BytesPerSector, FreeClusters, TotalClusters;
+
+    if (!GetDiskFreeSpaceW(Volume->Root, &SectorsPerCluster, &BytesPerSector, &FreeClusters, &TotalClusters))
+        return MAXULONG;
+    return FreeClusters;
+}
+
+static
+ULONG
+CountFreeClustersInFat(
+    PFAT_VOLUME Volume)
+{
+    LARGE_INTEGER Offset;
+    ULONG Cluster, Entry, Free = 0;
+    PUCHAR Fat;
+    DWORD Read;
+
+    /* Write the cached FAT back to the disk first */
+    ok(FlushFileBuffers(Volume->Handle), "FlushFileBuffers failed with %lu\n", GetLastError());
+
+    Fat = VirtualAlloc(NULL, Volume->FatSize, MEM_COMMIT, PAGE_READWRITE);
+    if (!Fat)
+        return MAXULONG;
+
+    Offset.QuadPart = Volume->FatOffset;
+    if (!SetFilePointerEx(Volume->Handle, Offset, NULL, FILE_BEGIN) ||
+        !ReadFile(Volume->Handle, Fat, Volume->FatSize, &Read, NULL) ||
+        Read != Volume->FatSize)
+    {
+        ok(0, "Failed to read the FAT: %lu\n", GetLastError());
+        VirtualFree(Fat, 0, MEM_RELEASE);
+        return MAXULONG;
+    }
+
+    for (Cluster = 2; Cluster < Volume->ClusterCount + 2; Cluster++)
+    {
+        if (Volume->FatType == 32)
+        {
+            Entry = READ_ULONG(Fat + Cluster * 4) & 0x0FFFFFFF;
+        }
+        else if (Volume->FatType == 16)
+        {
+            Entry = READ_USHORT(Fat + Cluster * 2);
+        }
+        else
+        {
+            Entry = READ_USHORT(Fat + Cluster * 3 / 2);
+            Entry = (Cluster & 1) ? (Entry >> 4) : (Entry & 0xFFF);
+        }
+        Free += (Entry == 0);
+    }
+
+    VirtualFree(Fat, 0, MEM_RELEASE);
+    return Free;
+}
+
+static
+HANDLE
+CreateTestFile(
+    ULONG Index,
+    DWORD Flags)
+{
+    WCHAR Name[MAX_PATH];
+
+    /* Every test file goes away with its last handle */
+    StringCbPrintfW(Name, sizeof(Name), L"FatTest%03lu.tmp", Index);
+    return CreateFileW(Name,
+                       GENERIC_READ | GENERIC_WRITE,
+                       0,
+                       NULL,
+                       CREATE_ALWAYS,
+                       FILE_FLAG_DELETE_ON_CLOSE | Flags,
+                       NULL);
+}
+
+static
+BOOL
+SetTestFileSize(
+    HANDLE File,
+    ULONGLONG Size)
+{
+    LARGE_INTEGER Offset;
+
+    Offset.QuadPart = Size;
+    return SetFilePointerEx(File, Offset, NULL, FILE_BEGIN) && SetEndOfFile(File);
+}
+
+static
+BOOL
+WriteClusters(
+    PFAT_VOLUME Volume,
+    HANDLE File,
+    ULONG First,
+    ULONG Count,
+    ULONG Seed)
+{
+    LARGE_INTEGER Offset;
+    PULONG Buffer;
+    DWORD Written;
+    ULONG i;
+    BOOL Ret;
+
+    Buffer = VirtualAlloc(NULL, Count * Volume->BytesPerCluster, MEM_COMMIT, PAGE_READWRITE);
+    if (!Buffer)
+        return FALSE;
+
+    /* Every ULONG of the range holds its own value */
+    for (i = 0; i < Count * Volume->BytesPerCluster / sizeof(ULONG); i++)
+        Buffer[i] = Seed + First * Volume->BytesPerCluster / sizeof(ULONG) + i;
+
+    Offset.QuadPart = (ULONGLONG)First * Volume->BytesPerCluster;
+    Ret = SetFilePointerEx(File, Offset, NULL, FILE_BEGIN) &&
+          WriteFile(File, Buffer, Count * Volume->BytesPerCluster, &Written, NULL) &&
+          Written == Count * Volume->BytesPerCluster;
+
+    VirtualFree(Buffer, 0, MEM_RELEASE);
+    return Ret;
+}
+
+static
+ULONG
+CheckClusters(
+    PFAT_VOLUME Volume,
+    HANDLE File,
+    ULONG First,
+    ULONG Count,
+    ULONG Seed)
+{
+    LARGE_INTEGER Offset;
+    PULONG Buffer;
+    DWORD Read;
+    ULONG i, Wrong = 0;
+
+    Buffer = VirtualAlloc(NULL, Count * Volume->BytesPerCluster, MEM_COMMIT, PAGE_READWRITE);
+    if (!Buffer)
+        return Count;
+
+    /* Read the whole range at once, so that it spans several runs */
+    Offset.QuadPart = (ULONGLONG)First * Volume->BytesPerCluster;
+    if (!SetFilePointerEx(File, Offset, NULL, FILE_BEGIN) ||
+        !ReadFile(File, Buffer, Count * Volume->BytesPerCluster, &Read, NULL) ||
+        Read != Count * Volume->BytesPerCluster)
+    {
+        VirtualFree(Buffer, 0, MEM_RELEASE);
+        return Count;
+    }
+
+    /* Count the clusters holding anything else than what was written */
+    for (i = 0; i < Count * Volume->BytesPerCluster / sizeof(ULONG); i++)
+    {
+        if (Buffer[i] != Seed + First * Volume->BytesPerCluster / sizeof(ULONG) + i)
+        {
+            Wrong++;
+            i |= Volume->BytesPerCluster / sizeof(ULONG) - 1;
+        }
+    }
+
+    VirtualFree(Buffer, 0, MEM_RELEASE);
+    return Wrong;
+}
+
+static
+VOID
+TestFreeClusters(
+    PFAT_VOLUME Volume)
+{
+    HANDLE Files[FAT_MAX_FILES], Extra;
+    ULONG Free, Clusters, i;
+
+    Free = QueryFreeClusters(Volume);
+    ok(Free == CountFreeClustersInFat(Volume), "%lu free clusters do not match the FAT\n", Free);
+    if ((ULONGLONG)Free * Volume->BytesPerCluster > (ULONGLONG)(FAT_MAX_FILES / 2) * FAT_MAX_FILE_SIZE)
+    {
+        skip("The volume is too large to be filled\n");
+        return;
+    }
+
+    /* Leave holes in the free space: allocate small files and free every other one */
+    for (i = 0; i < FAT_MAX_FILES; i++)
+    {
+        Files[i] = CreateTestFile(i, 0);
+        if (Files[i] != INVALID_HANDLE_VALUE &&
+            !SetTestFileSize(Files[i], 3 * Volume->BytesPerCluster))
+        {
+            CloseHandle(Files[i]);
+            Files[i] = INVALID_HANDLE_VALUE;
+        }
+    }
+    for (i = 1; i < FAT_MAX_FILES; i += 2)
+    {
+        if (Files[i] != INVALID_HANDLE_VALUE)
+            CloseHandle(Files[i]);
+        Files[i] = INVALID_HANDLE_VALUE;
+    }
+    ok(QueryFreeClusters(Volume) == CountFreeClustersInFat(Volume), "Free clusters do not match the FAT\n");
+
+    /* Fill the volume, the first files have to use up the holes */
+    for (i = 1; i < FAT_MAX_FILES; i += 2)
+    {
+        Files[i] = CreateTestFile(i, 0);
+        if (Files[i] == INVALID_HANDLE_VALUE)
+            break;
+        Clusters = min(QueryFreeClusters(Volume), FAT_MAX_FILE_SIZE / Volume->BytesPerCluster);
+        if (!Clusters)
+            break;
+        ok(SetTestFileSize(Files[i], (ULONGLONG)Clusters * Volume->BytesPerCluster),
+           "Failed to allocate %lu clusters: %lu\n", Clusters, GetLastError());
+    }
+    ok(QueryFreeClusters(Volume) == 0, "The volume still has %lu free clusters\n", QueryFreeClusters(Volume));
+    ok(CountFreeClustersInFat(Volume) == 0, "The FAT still has free clusters\n");
+
+    /* Nothing is left to allocate */
+    Extra = CreateTestFile(FAT_MAX_FILES, 0);
+    if (Extra != INVALID_HANDLE_VALUE)
+    {
+        ok(!SetTestFileSize(Extra, Volume->BytesPerCluster), "Allocated a cluster on a full volume\n");
+        ok(GetLastError() == ERROR_DISK_FULL, "Got error %lu\n", GetLastError());
+        CloseHandle(Extra);
+    }
+
+    /* Give half of it back and then everything */
+    for (i = 0; i < FAT_MAX_FILES; i++)
+    {
+        if (Files[i] != INVALID_HANDLE_VALUE)
+            SetTestFileSize(Files[i], (GetFileSize(Files[i], NULL) / 2) & ~(Volume->BytesPerCluster - 1));
+    }
+    ok(QueryFreeClusters(Volume) == CountFreeClustersInFat(Volume), "Free clusters do not match the FAT\n");
+    for (i = 0; i < FAT_MAX_FILES; i++)
+    {
+        if (Files[i] != INVALID_HANDLE_VALUE)
+            CloseHandle(Files[i]);
+    }
+    ok(QueryFreeClusters(Volume) == CountFreeClustersInFat(Volume), "Free clusters do not match the FAT\n");
+    ok(QueryFreeClusters(Volume) == Free, "%lu clusters were free before, now %lu\n", Free, QueryFreeClusters(Volume));
+}
+
+static
+VOID
+TestClusterMap(
+    PFAT_VOLUME Volume)
+{
+    HANDLE File, Other, Third;
+    ULONG i;
+
+    /* Bypass the cache so that every transfer maps the file to clusters */
+    File = CreateTestFile(0, FILE_FLAG_NO_BUFFERING);
+    Other = CreateTestFile(1, FILE_FLAG_NO_BUFFERING);
+    Third = CreateTestFile(2, FILE_FLAG_NO_BUFFERING);
+    if (File == INVALID_HANDLE_VALUE || Other == INVALID_HANDLE_VALUE || Third == INVALID_HANDLE_VALUE)
+    {
+        skip("Failed to create the test files: %lu\n", GetLastError());
+        goto Cleanup;
+    }
+
+    /* Grow two files in turns, so that each of their clusters is a run of its own */
+    for (i = 1; i <= FAT_FRAGMENTS; i++)
+    {
+        if (!SetTestFileSize(File, i * Volume->BytesPerCluster) ||
+            !SetTestFileSize(Other, i * Volume->BytesPerCluster))
+        {
+            skip("Failed to extend the test files: %lu\n", GetLastError());
+            goto Cleanup;
+        }
+    }
+    ok(WriteClusters(Volume, File, 0, FAT_FRAGMENTS, 1), "Write failed with %lu\n", GetLastError());
+    ok(WriteClusters(Volume, Other, 0, FAT_FRAGMENTS, 2), "Write failed with %lu\n", GetLastError());
+    ok(CheckClusters(Volume, File, 0, FAT_FRAGMENTS, 1) == 0, "The fragmented file is corrupted\n");
+    ok(CheckClusters(Volume, Other, 1, FAT_FRAGMENTS - 2, 2) == 0, "The fragmented file is corrupted\n");
+
+    /* Hand most clusters of the file to another one, then grow the file again */
+    ok(SetTestFileSize(File, 2 * Volume->BytesPerCluster), "Truncate failed with %lu\n", GetLastError());
+    ok(SetTestFileSize(Third, FAT_FRAGMENTS * Volume->BytesPerCluster), "Extend failed with %lu\n", GetLastError());
+    ok(WriteClusters(Volume, Third, 0, FAT_FRAGMENTS, 4), "Write failed with %lu\n", GetLastError());
+    ok(SetTestFileSize(File, FAT_FRAGMENTS * Volume->BytesPerCluster), "Extend failed with %lu\n", GetLastError());
+    ok(WriteClusters(Volume, File, 2, FAT_FRAGMENTS - 2, 3), "Write failed with %lu\n", GetLastError());
+
+    /* Writes through a stale map would have landed in the clusters of the others */
+    ok(CheckClusters(Volume, File, 0, 2, 1) == 0, "The kept clusters are corrupted\n");
+    ok(CheckClusters(Volume, File, 2, FAT_FRAGMENTS - 2, 3) == 0, "The new clusters are corrupted\n");
+    ok(CheckClusters(Volume, Other, 0, FAT_FRAGMENTS, 2) == 0, "The other file is corrupted\n");
+    ok(CheckClusters(Volume, Third, 0, FAT_FRAGMENTS, 4) == 0, "The third file is corrupted\n");
+
+Cleanup:
+    if (File != INVALID_HANDLE_VALUE)
+        CloseHandle(File);
+    if (Other != INVALID_HANDLE_VALUE)
+        CloseHandle(Other);
+    if (Third != INVALID_HANDLE_VALUE)
+        CloseHandle(Third);
+}
+
+static
+DWORD
+OpenTestPath(
+    PCWSTR Path,
+    PBY_HANDLE_FILE_INFORMATION Information)
+{
+    HANDLE File;
+    DWORD Error = ERROR_SUCCESS;
+
+    File = CreateFileW(Path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+    if (File == INVALID_HANDLE_VALUE)
+        return GetLastError();
+    if (Information && !GetFileInformationByHandle(File, Information))
+        Error = GetLastError();
+    CloseHandle(File);
+    return Error;
+}
+
+static
+VOID
+TestLargeDirectory(VOID)
+{
+    BY_HANDLE_FILE_INFORMATION Information, ShortInformation;
+    WCHAR Path[MAX_PATH], ShortPath[MAX_PATH], NewPath[MAX_PATH];
+    ULONG Created, Failed, i;
+    HANDLE File;
+
+    if (!CreateDirectoryW(L"FatTestDir.tmp", NULL))
+    {
+        skip("Failed to create the test directory: %lu\n", GetLastError());
+        return;
+    }
+
+    /* Long names take several entries each, so the directory gets indexed */
+    for (Created = 0; Created < FAT_DIRECTORY_FILES; Created++)
+    {
+        StringCbPrintfW(Path, sizeof(Path), L"FatTestDir.tmp\\LongFileName%04lu.txt", Created);
+        File = CreateFileW(Path, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL);
+        if (File == INVALID_HANDLE_VALUE)
+        {
+            skip("Failed to create %ls: %lu\n", Path, GetLastError());
+            goto Cleanup;
+        }
+        CloseHandle(File);
+    }
+
+    for (i = 0, Failed = 0; i < FAT_DIRECTORY_FILES; i++)
+    {
+        StringCbPrintfW(Path, sizeof(Path), L"FatTestDir.tmp\\LONGFILENAME%04lu.TXT", i);
+        Failed += (OpenTestPath(Path, NULL) != ERROR_SUCCESS);
+    }
+    ok(Failed == 0, "%lu files were not found\n", Failed);
+
+    /* Names that are not there are not found */
+    ok(OpenTestPath(L"FatTestDir.tmp\\LongFileName9999.txt", NULL) == ERROR_FILE_NOT_FOUND,
+       "Found a file which does not exist\n");
+    ok(OpenTestPath(L"FatTestDir.tmp\\LongFileName0000.tx", NULL) == ERROR_FILE_NOT_FOUND,
+       "Found a file which does not exist\n");
+
+    /* The short name of a file finds the same file as its long name */
+    StringCbPrintfW(Path, sizeof(Path), L"FatTestDir.tmp\\LongFileName%04lu.txt", FAT_DIRECTORY_FILES - 1);
+    if (GetShortPathNameW(Path, ShortPath, MAX_PATH) &&
+        OpenTestPath(Path, &Information) == ERROR_SUCCESS)
+    {
+        ok(OpenTestPath(ShortPath, &ShortInformation) == ERROR_SUCCESS, "Failed to open %ls\n", ShortPath);
+        ok(Information.nFileIndexLow == ShortInformation.nFileIndexLow &&
+           Information.nFileIndexHigh == ShortInformation.nFileIndexHigh,
+           "%ls is not %ls\n", ShortPath, Path);
+
+        /* A new long name can't be the short name of another file */
+        File = CreateFileW(ShortPath, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL);
+        ok(File == INVALID_HANDLE_VALUE, "Created %ls twice\n", ShortPath);
+        ok(GetLastError() == ERROR_FILE_EXISTS, "Got error %lu\n", GetLastError());
+        if (File != INVALID_HANDLE_VALUE)
+            CloseHandle(File);
+    }
+    else
+    {
+        skip("Failed to get the short name of %ls: %lu\n", Path, GetLastError());
+    }
+
+    /* Deleted names are gone, the others stay */
+    for (i = 0; i < FAT_DIRECTORY_FILES; i += 2)
+    {
+        StringCbPrintfW(Path, sizeof(Path), L"FatTestDir.tmp\\LongFileName%04lu.txt", i);
+        ok(DeleteFileW(Path), "Failed to delete %ls: %lu\n", Path, GetLastError());
+    }
+    for (i = 0, Failed = 0; i < FAT_DIRECTORY_FILES; i++)
+    {
+        StringCbPrintfW(Path, sizeof(Path), L"FatTestDir.tmp\\LongFileName%04lu.txt", i);
+        Failed += (OpenTestPath(Path, NULL) != ((i & 1) ? ERROR_SUCCESS : ERROR_FILE_NOT_FOUND));
+    }
+    ok(Failed == 0, "%lu lookups failed after deleting\n", Failed);
+
+    /* Renamed files are only found under their new name */
+    for (i = 1; i < FAT_DIRECTORY_FILES; i += 4)
+    {
+        StringCbPrintfW(Path, sizeof(Path), L"FatTestDir.tmp\\LongFileName%04lu.txt", i);
+        StringCbPrintfW(NewPath, sizeof(NewPath), L"FatTestDir.tmp\\Renamed%04lu.txt", i);
+        ok(MoveFileW(Path, NewPath), "Failed to rename %ls: %lu\n", Path, GetLastError());
+    }
+    StringCbPrintfW(Path, sizeof(Path), L"FatTestDir.tmp\\LongFileName%04lu.txt", 3);
+    StringCbPrintfW(NewPath, sizeof(NewPath), L"FatTestDir.tmp\\Renamed%04lu.txt", 1);
+    ok(!MoveFileW(Path, NewPath), "Renamed a file over another one\n");
+    for (i = 1, Failed = 0; i < FAT_DIRECTORY_FILES; i += 2)
+    {
+        StringCbPrintfW(Path, sizeof(Path), L"FatTestDir.tmp\\LongFileName%04lu.txt", i);
+        StringCbPrintfW(NewPath, sizeof(NewPath), L"FatTestDir.tmp\\Renamed%04lu.txt", i);
+        Failed += (OpenTestPath(Path, NULL) != ((i % 4 == 1) ? ERROR_FILE_NOT_FOUND : ERROR_SUCCESS));
+        Failed += (OpenTestPath(NewPath, NULL) != ((i % 4 == 1) ? ERROR_SUCCESS : ERROR_FILE_NOT_FOUND));
+    }
+    ok(Failed == 0, "%lu lookups failed after renaming\n", Failed);
+
+    /* Names created again in the freed entries are found */
+    for (i = 0, Failed = 0; i < FAT_DIRECTORY_FILES; i += 2)
+    {
+        StringCbPrintfW(Path, sizeof(Path), L"FatTestDir.tmp\\LongFileName%04lu.txt", i);
+        File = CreateFileW(Path, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL);
+        if (File != INVALID_HANDLE_VALUE)
+            CloseHandle(File);
+        Failed += (OpenTestPath(Path, NULL) != ERROR_SUCCESS);
+    }
+    ok(Failed == 0, "%lu files were not found after creating them again\n", Failed);
+
+Cleanup:
+    for (i = 0; i < FAT_DIRECTORY_FILES; i++)
+    {
+        StringCbPrintfW(Path, sizeof(Path), L"FatTestDir.tmp\\LongFileName%04lu.txt", i);
+        DeleteFileW(Path);
+        StringCbPrintfW(Path, sizeof(Path), L"FatTestDir.tmp\\Renamed%04lu.txt", i);
+        DeleteFileW(Path);
+    }
+    ok(RemoveDirectoryW(L"FatTestDir.tmp"), "Failed to remove the test directory: %lu\n", GetLastError());
+}
+
+START_TEST(FatVolume)
+{
+    FAT_VOLUME Volume;
+
+    if (!OpenFatVolume(&Volume))
+    {
+        skip("The current directory is not on a FAT volume that can be opened\n");
+        return;
+    }
+
+    TestFreeClusters(&Volume);
+    TestClusterMap(&Volume);
+    TestLargeDirectory();
+
+    CloseHandle(Volume.Handle);
+}
@@ -0,0 +1,190 @@
+/*
+ * PROJECT:         ReactOS API tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Test and microbenchmark for GetQueuedCompletionStatusEx
+ */
+
+#include <apitest.h>
+
+#if (_WIN32_WINNT < 0x0600)
+typedef struct _OVERLAPPED_ENTRY
+{
+    ULONG_PTR lpCompletionKey;
+    LPOVERLAPPED lpOverlapped;
+    ULONG_PTR Internal;
+    DWORD dwNumberOfBytesTransferred;
+} OVERLAPPED_ENTRY, *LPOVERLAPPED_ENTRY;
+#endif
+
+#define PACKET_COUNT 10000
+#define PACKET_ROUNDS 10
+#define BATCH_SIZE 64
+
+static BOOL (WINAPI *pGetQueuedCompletionStatusEx)(HANDLE, LPOVERLAPPED_ENTRY, ULONG, PULONG, DWORD, BOOL);
+
+static OVERLAPPED_ENTRY Entries[BATCH_SIZE];
+static LONG ApcCount;
+
+static
+VOID
+CALLBACK
+ApcRoutine(
+    ULONG_PTR Parameter)
+{
+    InterlockedIncrement(&ApcCount);
+}
+
+static
+VOID
+PostPackets(
+    HANDLE Port,
+    ULONG Count)
+{
+    ULONG i;
+
+    for (i = 0; i < Count; i++)
+        PostQueuedCompletionStatus(Port, i, i + 1, (LPOVERLAPPED)(ULONG_PTR)(i * 8));
+}
+
+static
+VOID
+TestBatch(
+    HANDLE Port)
+{
+    ULONG Removed, Total = 0, i;
+    BOOLEAN InOrder = TRUE;
+    BOOL Ret;
+
+    PostPackets(Port, 100);
+    while (Total < 100)
+    {
+        Removed = 0xdeadbeef;
+        Ret = pGetQueuedCompletionStatusEx(Port, Entries, 16, &Removed, 0, FALSE);
+        ok(Ret == TRUE, "GetQueuedCompletionStatusEx failed with %lu\n", GetLastError());
+        if (!Ret)
+            break;
+        ok(Removed >= 1 && Removed <= 16, "Removed %lu entries\n", Removed);
+
+        for (i = 0; i < Removed; i++, Total++)
+        {
+            if ((Entries[i].lpCompletionKey != Total + 1) ||
+                (Entries[i].lpOverlapped != (LPOVERLAPPED)(ULONG_PTR)(Total * 8)) ||
+                (Entries[i].dwNumberOfBytesTransferred != Total) ||
+                (Entries[i].Internal != 0))
+            {
+                InOrder = FALSE;
+            }
+        }
+    }
+    ok(Total == 100, "Removed %lu packets\n", Total);
+    ok(InOrder, "Packets were not returned in order\n");
+
+    /* The port is empty now */
+    Removed = 0xdeadbeef;
+    SetLastError(0xdeadbeef);
+    Ret = pGetQueuedCompletionStatusEx(Port, Entries, 16, &Removed, 0, FALSE);
+    ok(Ret == FALSE, "GetQueuedCompletionStatusEx returned %d\n", Ret);
+    ok(GetLastError() == WAIT_TIMEOUT, "Got error %lu\n", GetLastError());
+    ok(Removed == 0, "Removed %lu entries\n", Removed);
+
+    /* An empty array is rejected */
+    SetLastError(0xdeadbeef);
+    Ret = pGetQueuedCompletionStatusEx(Port, Entries, 0, &Removed, 0, FALSE);
+    ok(Ret == FALSE, "GetQueuedCompletionStatusEx returned %d\n", Ret);
+    ok(GetLastError() == ERROR_INVALID_PARAMETER, "Got error %lu\n", GetLastError());
+}
+
+static
+VOID
+TestAlertable(
+    HANDLE Port)
+{
+    ULONG Removed;
+    BOOL Ret;
+
+    /* A queued APC interrupts an alertable wait */
+    ApcCount = 0;
+    ok(QueueUserAPC(ApcRoutine, GetCurrentThread(), 0), "QueueUserAPC failed\n");
+    Removed = 0xdeadbeef;
+    SetLastError(0xdeadbeef);
+    Ret = pGetQueuedCompletionStatusEx(Port, Entries, BATCH_SIZE, &Removed, INFINITE, TRUE);
+    ok(Ret == FALSE, "GetQueuedCompletionStatusEx returned %d\n", Ret);
+    ok(GetLastError() == WAIT_IO_COMPLETION, "Got error %lu\n", GetLastError());
+    ok(Removed == 0, "Removed %lu entries\n", Removed);
+    ok(ApcCount == 1, "APC ran %ld times\n", ApcCount);
+
+    /* But not a non-alertable one */
+    ApcCount = 0;
+    ok(QueueUserAPC(ApcRoutine, GetCurrentThread(), 0), "QueueUserAPC failed\n");
+    Ret = pGetQueuedCompletionStatusEx(Port, Entries, BATCH_SIZE, &Removed, 50, FALSE);
+    ok(Ret == FALSE && GetLastError() == WAIT_TIMEOUT, "Got %d, error %lu\n", Ret, GetLastError());
+    ok(ApcCount == 0, "APC ran %ld times\n", ApcCount);
+    SleepEx(0, TRUE);
+    ok(ApcCount == 1, "APC ran %ld times\n", ApcCount);
+}
+
+static
+VOID
+BenchmarkBatch(
+    HANDLE Port)
+{
+    LARGE_INTEGER Frequency, Start, Middle, End;
+    ULONG Round, Total, Removed;
+    DWORD Bytes;
+    ULONG_PTR Key;
+    LPOVERLAPPED Overlapped;
+
+    QueryPerformanceFrequency(&Frequency);
+
+    QueryPerformanceCounter(&Start);
+    for (Round = 0; Round < PACKET_ROUNDS; Round++)
+    {
+        PostPackets(Port, PACKET_COUNT);
+        for (Total = 0; Total < PACKET_COUNT; Total++)
+        {
+            if (!GetQueuedCompletionStatus(Port, &Bytes, &Key, &Overlapped, 0))
+                break;
+        }
+    }
+    QueryPerformanceCounter(&Middle);
+    for (Round = 0; Round < PACKET_ROUNDS; Round++)
+    {
+        PostPackets(Port, PACKET_COUNT);
+        for (Total = 0; Total < PACKET_COUNT; Total += Removed)
+        {
+            if (!pGetQueuedCompletionStatusEx(Port, Entries, BATCH_SIZE, &Removed, 0, FALSE))
+                break;
+        }
+    }
+    QueryPerformanceCounter(&End);
+
+    trace("%u packets: single %6lu us, batch of %u %6lu us\n",
+          PACKET_COUNT,
+          (ULONG)((Middle.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart / PACKET_ROUNDS),
+          BATCH_SIZE,
+          (ULONG)((End.QuadPart - Middle.QuadPart) * 1000000 / Frequency.QuadPart / PACKET_ROUNDS));
+}
+
+START_TEST(GetQueuedCompletionStatusEx)
+{
+    HANDLE Port;
+
+    pGetQueuedCompletionStatusEx = (void *)GetProcAddress(GetModuleHandleA("kernel32.dll"),
+                                                          "GetQueuedCompletionStatusEx");
+    if (!pGetQueuedCompletionStatusEx)
+    {
+        skip("GetQueuedCompletionStatusEx is not available\n");
+        return;
+    }
+
+    Port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    ok(Port != NULL, "CreateIoCompletionPort failed with %lu\n", GetLastError());
+    if (!Port)
+        return;
+
+    TestBatch(Port);
+    TestAlertable(Port);
+    BenchmarkBatch(Port);
+
+    CloseHandle(Port);
+}
@@ -0,0 +1,135 @@
+/*
+ * PROJECT:         ReactOS API tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Test for SetFileCompletionNotificationModes
+ */
+
+#include <apitest.h>
+
+#if (_WIN32_WINNT < 0x0600)
+#define FILE_SKIP_COMPLETION_PORT_ON_SUCCESS 0x1
+#define FILE_SKIP_SET_EVENT_ON_HANDLE        0x2
+#endif
+
+static BOOL (WINAPI *pSetFileCompletionNotificationModes)(HANDLE, UCHAR);
+
+static
+BOOL
+CreateOverlappedPipe(
+    PHANDLE Server,
+    PHANDLE Client)
+{
+    *Server = CreateNamedPipeA("\\\\.\\pipe\\SetFileCompletionNotificationModes",
+                               PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+                               PIPE_TYPE_BYTE | PIPE_WAIT,
+                               1, 4096, 4096, 0, NULL);
+    if (*Server == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    *Client = CreateFileA("\\\\.\\pipe\\SetFileCompletionNotificationModes",
+                          GENERIC_READ | GENERIC_WRITE,
+                          0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    if (*Client == INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(*Server);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+TestSkipPort(
+    BOOL Skip)
+{
+    HANDLE Server, Client, Port;
+    OVERLAPPED Overlapped;
+    LPOVERLAPPED Completed;
+    ULONG_PTR Key;
+    DWORD Bytes;
+    BOOL Ret;
+
+    if (!CreateOverlappedPipe(&Server, &Client))
+    {
+        skip("Failed to create the pipe: %lu\n", GetLastError());
+        return;
+    }
+
+    Port = CreateIoCompletionPort(Client, NULL, 0x1234, 1);
+    ok(Port != NULL, "CreateIoCompletionPort failed with %lu\n", GetLastError());
+    if (Skip)
+    {
+        Ret = pSetFileCompletionNotificationModes(Client,
+                                                  FILE_SKIP_COMPLETION_PORT_ON_SUCCESS |
+                                                  FILE_SKIP_SET_EVENT_ON_HANDLE);
+        ok(Ret == TRUE, "SetFileCompletionNotificationModes failed with %lu\n", GetLastError());
+    }
+
+    /* The pipe has enough quota for this write to complete right away */
+    RtlZeroMemory(&Overlapped, sizeof(Overlapped));
+    Ret = WriteFile(Client, "Hello", 5, &Bytes, &Overlapped);
+    if (!Ret)
+    {
+        ok(GetLastError() == ERROR_IO_PENDING, "WriteFile failed with %lu\n", GetLastError());
+        skip("The write did not complete synchronously\n");
+    }
+    else
+    {
+        Completed = NULL;
+        Ret = GetQueuedCompletionStatus(Port, &Bytes, &Key, &Completed, 0);
+        if (Skip)
+        {
+            ok(Ret == FALSE && Completed == NULL, "A packet was queued for a synchronous success\n");
+            ok(GetLastError() == WAIT_TIMEOUT, "Got error %lu\n", GetLastError());
+        }
+        else
+        {
+            ok(Ret == TRUE, "GetQueuedCompletionStatus failed with %lu\n", GetLastError());
+            ok(Completed == &Overlapped, "Got overlapped %p, expected %p\n", Completed, &Overlapped);
+            ok(Key == 0x1234, "Got key %Ix\n", Key);
+            ok(Bytes == 5, "Got %lu bytes\n", Bytes);
+        }
+    }
+
+    CloseHandle(Port);
+    CloseHandle(Client);
+    CloseHandle(Server);
+}
+
+START_TEST(SetFileCompletionNotificationModes)
+{
+    HANDLE Server, Client;
+    BOOL Ret;
+
+    pSetFileCompletionNotificationModes = (void *)GetProcAddress(GetModuleHandleA("kernel32.dll"),
+                                                                 "SetFileCompletionNotificationModes");
+    if (!pSetFileCompletionNotificationModes)
+    {
+        skip("SetFileCompletionNotificationModes is not available\n");
+        return;
+    }
+
+    /* Unknown modes are rejected */
+    SetLastError(0xdeadbeef);
+    Ret = pSetFileCompletionNotificationModes(GetCurrentProcess(), 0x80);
+    ok(Ret == FALSE, "SetFileCompletionNotificationModes returned %d\n", Ret);
+    ok(GetLastError() == ERROR_INVALID_PARAMETER, "Got error %lu\n", GetLastError());
+
+    /* Only file handles carry the modes */
+    SetLastError(0xdeadbeef);
+    Ret = pSetFileCompletionNotificationModes(GetCurrentProcess(), FILE_SKIP_SET_EVENT_ON_HANDLE);
+    ok(Ret == FALSE, "SetFileCompletionNotificationModes returned %d\n", Ret);
+    ok(GetLastError() == ERROR_INVALID_HANDLE, "Got error %lu\n", GetLastError());
+
+    if (CreateOverlappedPipe(&Server, &Client))
+    {
+        Ret = pSetFileCompletionNotificationModes(Client, 0);
+        ok(Ret == TRUE, "SetFileCompletionNotificationModes failed with %lu\n", GetLastError());
+        CloseHandle(Client);
+        CloseHandle(Server);
+    }
+
+    TestSkipPort(FALSE);
+    TestSkipPort(TRUE);
+}
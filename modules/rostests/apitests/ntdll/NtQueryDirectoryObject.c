@@ -0,0 +1,294 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Test and microbenchmark for object directories
+ */
+
+#include "precomp.h"
+
+#define EVENT_COUNT 8192
+#define LOOKUP_COUNT 20000
+#define STABLE_COUNT 200
+
+static HANDLE Events[EVENT_COUNT];
+
+static
+VOID
+InitEventName(
+    PUNICODE_STRING Name,
+    PWCHAR Buffer,
+    SIZE_T Size,
+    PCWSTR Format,
+    ULONG Index)
+{
+    StringCbPrintfW(Buffer, Size, Format, Index);
+    RtlInitUnicodeString(Name, Buffer);
+}
+
+static
+NTSTATUS
+OpenEvent(
+    HANDLE Directory,
+    PCWSTR Format,
+    ULONG Index,
+    ULONG Attributes,
+    PHANDLE Handle)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING Name;
+    WCHAR Buffer[32];
+
+    InitEventName(&Name, Buffer, sizeof(Buffer), Format, Index);
+    InitializeObjectAttributes(&ObjectAttributes, &Name, Attributes, Directory, NULL);
+    return NtOpenEvent(Handle, EVENT_ALL_ACCESS, &ObjectAttributes);
+}
+
+static
+ULONG
+CreateEvents(
+    HANDLE Directory,
+    ULONG First,
+    ULONG Last)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING Name;
+    WCHAR Buffer[32];
+    NTSTATUS Status;
+    ULONG i;
+
+    for (i = First; i < Last; i++)
+    {
+        InitEventName(&Name, Buffer, sizeof(Buffer), L"Event%lu", i);
+        InitializeObjectAttributes(&ObjectAttributes, &Name, 0, Directory, NULL);
+        Status = NtCreateEvent(&Events[i], EVENT_ALL_ACCESS, &ObjectAttributes, NotificationEvent, FALSE);
+        if (!NT_SUCCESS(Status))
+        {
+            ok_ntstatus(Status, STATUS_SUCCESS);
+            Events[i] = NULL;
+            return i;
+        }
+    }
+
+    return Last;
+}
+
+static
+VOID
+BenchmarkLookup(
+    HANDLE Directory,
+    ULONG Count)
+{
+    LARGE_INTEGER Frequency, Start, End;
+    HANDLE Handle;
+    NTSTATUS Status;
+    ULONG i, Failed = 0;
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+    for (i = 0; i < LOOKUP_COUNT; i++)
+    {
+        Status = OpenEvent(Directory, L"Event%lu", (i * 7919) % Count, 0, &Handle);
+        if (!NT_SUCCESS(Status))
+        {
+            Failed++;
+            continue;
+        }
+        NtClose(Handle);
+    }
+    QueryPerformanceCounter(&End);
+
+    ok(Failed == 0, "%lu lookups failed in a directory of %lu objects\n", Failed, Count);
+    trace("%5lu objects: %lu ns per open\n",
+          Count,
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000000000 / Frequency.QuadPart / LOOKUP_COUNT));
+}
+
+static
+ULONG
+CountEntries(
+    HANDLE Directory)
+{
+    POBJECT_DIRECTORY_INFORMATION Info;
+    UNICODE_STRING EventType = RTL_CONSTANT_STRING(L"Event");
+    ULONG Context = 0, Entries = 0, i;
+    BOOLEAN Restart = TRUE;
+    NTSTATUS Status;
+    PVOID Buffer;
+
+    Buffer = RtlAllocateHeap(RtlGetProcessHeap(), 0, 0x10000);
+    if (!Buffer)
+    {
+        skip("Failed to allocate the buffer\n");
+        return 0;
+    }
+
+    /* The last batch with entries succeeds, only the next one is empty */
+    for (;;)
+    {
+        Status = NtQueryDirectoryObject(Directory, Buffer, 0x10000, FALSE, Restart, &Context, NULL);
+        Restart = FALSE;
+        if (!NT_SUCCESS(Status))
+            break;
+
+        for (Info = Buffer, i = 0; Info[i].Name.Length; i++, Entries++)
+        {
+            ok(RtlEqualUnicodeString(&Info[i].TypeName, &EventType, FALSE),
+               "Entry %lu has type %wZ\n", Entries, &Info[i].TypeName);
+        }
+    }
+    ok_ntstatus(Status, STATUS_NO_MORE_ENTRIES);
+
+    RtlFreeHeap(RtlGetProcessHeap(), 0, Buffer);
+    return Entries;
+}
+
+static
+VOID
+TestStableEnumeration(VOID)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    POBJECT_DIRECTORY_INFORMATION Info;
+    UNICODE_STRING EventPrefix = RTL_CONSTANT_STRING(L"Event");
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[32];
+    UCHAR Seen[STABLE_COUNT];
+    HANDLE Directory, Added[STABLE_COUNT];
+    ULONG Context = 0, Duplicates = 0, Missing = 0, Index, i;
+    NTSTATUS Status;
+    PVOID Buffer;
+
+    InitializeObjectAttributes(&ObjectAttributes, NULL, 0, NULL, NULL);
+    Status = NtCreateDirectoryObject(&Directory, DIRECTORY_ALL_ACCESS, &ObjectAttributes);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    Buffer = RtlAllocateHeap(RtlGetProcessHeap(), 0, 0x1000);
+    if (!Buffer)
+    {
+        skip("Failed to allocate the buffer\n");
+        NtClose(Directory);
+        return;
+    }
+
+    RtlZeroMemory(Events, sizeof(HANDLE) * STABLE_COUNT);
+    RtlZeroMemory(Added, sizeof(Added));
+    RtlZeroMemory(Seen, sizeof(Seen));
+    if (CreateEvents(Directory, 0, STABLE_COUNT) != STABLE_COUNT)
+        goto Cleanup;
+
+    /* Grow the table while enumerating one entry at a time */
+    for (i = 0; ; i++)
+    {
+        Status = NtQueryDirectoryObject(Directory, Buffer, 0x1000, TRUE, i == 0, &Context, NULL);
+        if (Status != STATUS_SUCCESS)
+            break;
+
+        /* Event names carry their index after the prefix */
+        Info = Buffer;
+        Name = Info->Name;
+        if (RtlPrefixUnicodeString(&EventPrefix, &Name, FALSE))
+        {
+            Name.Buffer += EventPrefix.Length / sizeof(WCHAR);
+            Name.Length -= EventPrefix.Length;
+        }
+        if (NT_SUCCESS(RtlUnicodeStringToInteger(&Name, 10, &Index)) && Index < STABLE_COUNT)
+        {
+            Duplicates += (Seen[Index] != 0);
+            Seen[Index] = 1;
+        }
+
+        if (i < STABLE_COUNT)
+        {
+            InitEventName(&Name, NameBuffer, sizeof(NameBuffer), L"Added%lu", i);
+            InitializeObjectAttributes(&ObjectAttributes, &Name, 0, Directory, NULL);
+            Status = NtCreateEvent(&Added[i], EVENT_ALL_ACCESS, &ObjectAttributes, NotificationEvent, FALSE);
+            ok_ntstatus(Status, STATUS_SUCCESS);
+        }
+    }
+    ok_ntstatus(Status, STATUS_NO_MORE_ENTRIES);
+
+    for (i = 0; i < STABLE_COUNT; i++)
+        Missing += !Seen[i];
+    ok(Duplicates == 0, "%lu entries were returned twice\n", Duplicates);
+    ok(Missing == 0, "%lu entries were not returned\n", Missing);
+
+Cleanup:
+    for (i = 0; i < STABLE_COUNT; i++)
+    {
+        if (Events[i])
+            NtClose(Events[i]);
+        Events[i] = NULL;
+        if (Added[i])
+            NtClose(Added[i]);
+    }
+    RtlFreeHeap(RtlGetProcessHeap(), 0, Buffer);
+    NtClose(Directory);
+}
+
+START_TEST(NtQueryDirectoryObject)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    HANDLE Directory, Handle;
+    NTSTATUS Status;
+    ULONG Count, Size, Found, Missing, i;
+
+    InitializeObjectAttributes(&ObjectAttributes, NULL, 0, NULL, NULL);
+    Status = NtCreateDirectoryObject(&Directory, DIRECTORY_ALL_ACCESS, &ObjectAttributes);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    /* Lookup time should not depend on how many objects the directory holds */
+    for (Count = 0, Size = 32; Size <= EVENT_COUNT; Size *= 4)
+    {
+        Count = CreateEvents(Directory, Count, Size);
+        if (Count != Size)
+            break;
+        BenchmarkLookup(Directory, Count);
+    }
+
+    /* Every object is still enumerated once after the table grew */
+    ok(CountEntries(Directory) == Count, "Directory does not hold %lu entries\n", Count);
+
+    /* Names are still matched with and without case sensitivity */
+    Status = OpenEvent(Directory, L"EVENT%lu", Count - 1, OBJ_CASE_INSENSITIVE, &Handle);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (NT_SUCCESS(Status))
+        NtClose(Handle);
+    Status = OpenEvent(Directory, L"EVENT%lu", Count - 1, 0, &Handle);
+    ok_ntstatus(Status, STATUS_OBJECT_NAME_NOT_FOUND);
+
+    /* Closing the last handle removes the name from the directory */
+    for (i = 0; i < Count; i += 2)
+    {
+        NtClose(Events[i]);
+        Events[i] = NULL;
+    }
+    for (i = 0, Found = 0, Missing = 0; i < Count; i++)
+    {
+        Status = OpenEvent(Directory, L"Event%lu", i, 0, &Handle);
+        if (NT_SUCCESS(Status))
+        {
+            Found += (Events[i] != NULL);
+            NtClose(Handle);
+        }
+        else if (Status == STATUS_OBJECT_NAME_NOT_FOUND)
+        {
+            Missing += (Events[i] == NULL);
+        }
+    }
+    ok(Found == Count / 2, "Found %lu events, expected %lu\n", Found, Count / 2);
+    ok(Missing == (Count + 1) / 2, "Missed %lu events, expected %lu\n", Missing, (Count + 1) / 2);
+    ok(CountEntries(Directory) == Count / 2, "Directory does not hold %lu entries\n", Count / 2);
+
+    for (i = 0; i < Count; i++)
+    {
+        if (Events[i])
+            NtClose(Events[i]);
+    }
+    NtClose(Directory);
+
+    /* Resuming an enumeration neither skips nor repeats entries */
+    TestStableEnumeration();
+}
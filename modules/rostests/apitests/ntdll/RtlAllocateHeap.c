@@ -9,6 +9,154 @@
 
 PVOID Buffers[0x100];
 
+#define LFH_THREADS 4
+#define LFH_ITERATIONS 100000
+
+static
+DWORD
+WINAPI
+LfhWorker(
+    PVOID Parameter)
+{
+    HANDLE hHeap = Parameter;
+    PUCHAR Blocks[64] = { NULL };
+    ULONG Sizes[64];
+    ULONG Seed = GetCurrentThreadId(), i, j, Errors = 0;
+
+    for (i = 0; i < LFH_ITERATIONS; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        j = (Seed >> 16) % RTL_NUMBER_OF(Blocks);
+
+        if (Blocks[j])
+        {
+            if (Blocks[j][0] != (UCHAR)Sizes[j] || Blocks[j][Sizes[j] - 1] != (UCHAR)Sizes[j])
+                Errors++;
+            if (!RtlFreeHeap(hHeap, 0, Blocks[j]))
+                Errors++;
+            Blocks[j] = NULL;
+        }
+        else
+        {
+            Sizes[j] = (Seed >> 8) % 512 + 1;
+            Blocks[j] = RtlAllocateHeap(hHeap, 0, Sizes[j]);
+            if (!Blocks[j])
+            {
+                Errors++;
+                continue;
+            }
+            RtlFillMemory(Blocks[j], Sizes[j], (UCHAR)Sizes[j]);
+        }
+    }
+
+    for (j = 0; j < RTL_NUMBER_OF(Blocks); j++)
+    {
+        if (Blocks[j])
+            RtlFreeHeap(hHeap, 0, Blocks[j]);
+    }
+
+    return Errors;
+}
+
+static
+VOID
+TestLowFragmentationHeap(VOID)
+{
+    HANDLE hHeap, Threads[LFH_THREADS];
+    ULONG HeapInfo, i, Mode;
+    SIZE_T ReturnLength;
+    NTSTATUS Status;
+    PUCHAR Block, NewBlock;
+    DWORD ExitCode;
+    LARGE_INTEGER Frequency, Start, End;
+
+    hHeap = RtlCreateHeap(HEAP_GROWABLE, NULL, 0, 0, NULL, NULL);
+    ok(hHeap != NULL, "RtlCreateHeap failed\n");
+    if (!hHeap)
+        return;
+
+    Status = RtlQueryHeapInformation(hHeap, HeapCompatibilityInformation, &HeapInfo, sizeof(HeapInfo), &ReturnLength);
+    ok_hex(Status, STATUS_SUCCESS);
+    ok_long(HeapInfo, 0);
+
+    /* Only the LFH can be turned on */
+    Mode = 1;
+    Status = RtlSetHeapInformation(hHeap, HeapCompatibilityInformation, &Mode, sizeof(Mode));
+    ok_hex(Status, STATUS_UNSUCCESSFUL);
+
+    Mode = 2;
+    Status = RtlSetHeapInformation(hHeap, HeapCompatibilityInformation, &Mode, sizeof(Mode));
+    ok_hex(Status, STATUS_SUCCESS);
+
+    Status = RtlQueryHeapInformation(hHeap, HeapCompatibilityInformation, &HeapInfo, sizeof(HeapInfo), &ReturnLength);
+    ok_hex(Status, STATUS_SUCCESS);
+    ok_long(HeapInfo, 2);
+    ok_size_t(ReturnLength, sizeof(ULONG));
+
+    /* Enough allocations of one size to activate its bucket */
+    for (i = 0; i < RTL_NUMBER_OF(Buffers); i++)
+    {
+        Buffers[i] = RtlAllocateHeap(hHeap, HEAP_ZERO_MEMORY, 24);
+        ok(Buffers[i] != NULL, "Allocation %lu failed\n", i);
+        if (!Buffers[i])
+            break;
+        ok(RtlSizeHeap(hHeap, 0, Buffers[i]) == 24, "Unexpected size %Iu\n", RtlSizeHeap(hHeap, 0, Buffers[i]));
+        ok(((PULONG)Buffers[i])[5] == 0, "Memory not zeroed\n");
+        ok(((ULONG_PTR)Buffers[i] & (sizeof(PVOID) * 2 - 1)) == 0, "Misaligned block %p\n", Buffers[i]);
+    }
+    ok(RtlValidateHeap(hHeap, 0, NULL), "Heap is invalid\n");
+    ok(RtlValidateHeap(hHeap, 0, Buffers[RTL_NUMBER_OF(Buffers) - 1]), "Block is invalid\n");
+
+    /* Growing within the block and out of it keeps the contents */
+    Block = Buffers[RTL_NUMBER_OF(Buffers) - 1];
+    RtlFillMemory(Block, 24, 0x5A);
+    NewBlock = RtlReAllocateHeap(hHeap, HEAP_ZERO_MEMORY, Block, 1000);
+    ok(NewBlock != NULL, "RtlReAllocateHeap failed\n");
+    if (NewBlock)
+    {
+        ok(NewBlock[0] == 0x5A && NewBlock[23] == 0x5A, "Contents lost\n");
+        ok(NewBlock[24] == 0 && NewBlock[999] == 0, "Memory not zeroed\n");
+        ok(RtlSizeHeap(hHeap, 0, NewBlock) == 1000, "Unexpected size %Iu\n", RtlSizeHeap(hHeap, 0, NewBlock));
+        Buffers[RTL_NUMBER_OF(Buffers) - 1] = NewBlock;
+    }
+
+    for (i = 0; i < RTL_NUMBER_OF(Buffers); i++)
+        ok(RtlFreeHeap(hHeap, 0, Buffers[i]), "Free %lu failed\n", i);
+
+    /* Contend on the heap from several threads */
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+    for (i = 0; i < LFH_THREADS; i++)
+        Threads[i] = CreateThread(NULL, 0, LfhWorker, hHeap, 0, NULL);
+    for (i = 0; i < LFH_THREADS; i++)
+    {
+        if (!Threads[i])
+        {
+            skip("CreateThread failed\n");
+            continue;
+        }
+        WaitForSingleObject(Threads[i], INFINITE);
+        GetExitCodeThread(Threads[i], &ExitCode);
+        ok(ExitCode == 0, "Thread %lu saw %lu errors\n", i, ExitCode);
+        CloseHandle(Threads[i]);
+    }
+    QueryPerformanceCounter(&End);
+    trace("LFH: %u threads x %u operations in %lu ms\n", LFH_THREADS, LFH_ITERATIONS,
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000 / Frequency.QuadPart));
+
+    ok(RtlValidateHeap(hHeap, 0, NULL), "Heap is invalid\n");
+    RtlDestroyHeap(hHeap);
+
+    /* Unserialized heaps can't have the LFH */
+    hHeap = RtlCreateHeap(HEAP_GROWABLE | HEAP_NO_SERIALIZE, NULL, 0, 0, NULL, NULL);
+    if (hHeap)
+    {
+        Status = RtlSetHeapInformation(hHeap, HeapCompatibilityInformation, &Mode, sizeof(Mode));
+        ok_hex(Status, STATUS_UNSUCCESSFUL);
+        RtlDestroyHeap(hHeap);
+    }
+}
+
 START_TEST(RtlAllocateHeap)
 {
     USHORT i;
@@ -71,4 +219,6 @@ START_TEST(RtlAllocateHeap)
     _SEH2_END;
 
     ok(hHeap == NULL, "Unexpected heap value: %p\n", hHeap);
+
+    TestLowFragmentationHeap();
 }
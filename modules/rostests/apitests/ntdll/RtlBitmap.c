@@ -417,6 +417,12 @@ Test_RtlFindClearBits(void)
     ok_int(RtlFindClearBits(&BitMapHeader, 10, 0), -1);
     Buffer[1] = 0xFF303F30;
     ok_int(RtlFindClearBits(&BitMapHeader, 1, 56), 1);
+
+    /* A run that ends with the bitmap */
+    Buffer[0] = 0x7FFFFFFF;
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 32);
+    ok_int(RtlFindClearBits(&BitMapHeader, 1, 0), 31);
+    ok_int(RtlFindClearBits(&BitMapHeader, 1, 31), 31);
     FreeGuarded(Buffer);
 }
 
@@ -608,13 +614,252 @@ Test_RtlFindLastBackwardRunClear(void)
 void
 Test_RtlFindClearRuns(void)
 {
+    RTL_BITMAP BitMapHeader;
+    RTL_BITMAP_RUN Runs[4];
+    ULONG *Buffer;
+
+    Buffer = AllocateGuarded(2 * sizeof(*Buffer));
+    Buffer[0] = 0xF9F078B2;
+    Buffer[1] = 0x3F303F30;
+
+    /* Clear runs: 0/1, 2/2, 6/1, 8/3, 15/5, 25/2, 32/4, 38/2, 46/6, 54/2, 62/2 */
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 64);
+    ok_int(RtlFindClearRuns(&BitMapHeader, Runs, 3, FALSE), 3);
+    ok_int(Runs[0].StartingIndex, 0);
+    ok_int(Runs[0].NumberOfBits, 1);
+    ok_int(Runs[1].StartingIndex, 2);
+    ok_int(Runs[1].NumberOfBits, 2);
+    ok_int(Runs[2].StartingIndex, 6);
+    ok_int(Runs[2].NumberOfBits, 1);
+
+    /* The longest runs replace the shortest ones found so far */
+    ok_int(RtlFindClearRuns(&BitMapHeader, Runs, 3, TRUE), 3);
+    ok_int(Runs[0].StartingIndex, 46);
+    ok_int(Runs[0].NumberOfBits, 6);
+    ok_int(Runs[1].StartingIndex, 32);
+    ok_int(Runs[1].NumberOfBits, 4);
+    ok_int(Runs[2].StartingIndex, 15);
+    ok_int(Runs[2].NumberOfBits, 5);
+
+    /* Fewer runs than requested */
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 8);
+    ok_int(RtlFindClearRuns(&BitMapHeader, Runs, 4, TRUE), 3);
+
+    Buffer[0] = 0xFFFFFFFF;
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 32);
+    ok_int(RtlFindClearRuns(&BitMapHeader, Runs, 4, FALSE), 0);
+    FreeGuarded(Buffer);
 }
 
 void
 Test_RtlFindLongestRunClear(void)
 {
+    RTL_BITMAP BitMapHeader;
+    ULONG *Buffer;
+    ULONG Index;
+
+    Buffer = AllocateGuarded(2 * sizeof(*Buffer));
+    Buffer[0] = 0xF9F078B2;
+    Buffer[1] = 0x3F303F30;
+
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 64);
+    ok_int(RtlFindLongestRunClear(&BitMapHeader, &Index), 6);
+    ok_int(Index, 46);
+
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 32);
+    ok_int(RtlFindLongestRunClear(&BitMapHeader, &Index), 5);
+    ok_int(Index, 15);
+
+    /* The first of equally long runs wins */
+    Buffer[0] = 0xF0F0F0F0;
+    ok_int(RtlFindLongestRunClear(&BitMapHeader, &Index), 4);
+    ok_int(Index, 0);
+
+    /* A run that ends with the bitmap */
+    Buffer[1] = 0x00000001;
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 64);
+    ok_int(RtlFindLongestRunClear(&BitMapHeader, &Index), 31);
+    ok_int(Index, 33);
+
+    Buffer[0] = Buffer[1] = 0xFFFFFFFF;
+    ok_int(RtlFindLongestRunClear(&BitMapHeader, &Index), 0);
+    FreeGuarded(Buffer);
+}
+
+#define BENCH_BITS (256 * 1024 * 1024)
+
+static
+VOID
+BenchmarkBitmap(
+    _In_ PRTL_BITMAP BitMapHeader,
+    _In_ PCSTR Name)
+{
+    LARGE_INTEGER Frequency, Start, End;
+    RTL_BITMAP_RUN Runs[64];
+    ULONG Result, Index;
+
+    QueryPerformanceFrequency(&Frequency);
+
+    QueryPerformanceCounter(&Start);
+    Result = RtlNumberOfSetBits(BitMapHeader);
+    QueryPerformanceCounter(&End);
+    trace("%-6s RtlNumberOfSetBits     %9lu %6lu us\n", Name, Result,
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart));
+
+    /* Nothing this long is free, so the whole bitmap is searched */
+    QueryPerformanceCounter(&Start);
+    Result = RtlFindClearBits(BitMapHeader, BENCH_BITS / 2, BENCH_BITS / 3);
+    QueryPerformanceCounter(&End);
+    trace("%-6s RtlFindClearBits       %9ld %6lu us\n", Name, (LONG)Result,
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart));
+
+    QueryPerformanceCounter(&Start);
+    Result = RtlFindLongestRunClear(BitMapHeader, &Index);
+    QueryPerformanceCounter(&End);
+    trace("%-6s RtlFindLongestRunClear %9lu %6lu us\n", Name, Result,
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart));
+
+    QueryPerformanceCounter(&Start);
+    Result = RtlFindClearRuns(BitMapHeader, Runs, RTL_NUMBER_OF(Runs), TRUE);
+    QueryPerformanceCounter(&End);
+    trace("%-6s RtlFindClearRuns       %9lu %6lu us\n", Name, Result,
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart));
 }
 
+void
+Test_Benchmark(void)
+{
+    RTL_BITMAP BitMapHeader;
+    ULONG *Buffer;
+    ULONG Seed = 1, i;
+
+    Buffer = AllocateGuarded(BENCH_BITS / 8);
+    if (!Buffer)
+    {
+        skip("Failed to allocate the benchmark bitmap\n");
+        return;
+    }
+    RtlInitializeBitMap(&BitMapHeader, Buffer, BENCH_BITS);
+
+    /* A nearly empty volume */
+    RtlClearAllBits(&BitMapHeader);
+    for (i = 0; i < 2000; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        RtlSetBits(&BitMapHeader, (Seed >> 4) % (BENCH_BITS - 16), (Seed >> 20) % 16 + 1);
+    }
+    BenchmarkBitmap(&BitMapHeader, "sparse");
+
+    /* A nearly full volume */
+    RtlSetAllBits(&BitMapHeader);
+    for (i = 0; i < 2000; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        RtlClearBits(&BitMapHeader, (Seed >> 4) % (BENCH_BITS - 16), (Seed >> 20) % 16 + 1);
+    }
+    BenchmarkBitmap(&BitMapHeader, "dense");
+
+    FreeGuarded(Buffer);
+}
+
+
+/* The summary routines are ReactOS extensions, Windows doesn't export them */
+static VOID (NTAPI *pRtlInitializeBitMapSummary)(PRTL_BITMAP_SUMMARY, PRTL_BITMAP, PULONG, ULONG);
+static VOID (NTAPI *pRtlClearBitsSummary)(PRTL_BITMAP_SUMMARY, ULONG, ULONG);
+static VOID (NTAPI *pRtlSetBitsSummary)(PRTL_BITMAP_SUMMARY, ULONG, ULONG);
+static ULONG (NTAPI *pRtlFindClearBitsSummary)(PRTL_BITMAP_SUMMARY, ULONG, ULONG);
+static ULONG (NTAPI *pRtlFindClearBitsAndSetSummary)(PRTL_BITMAP_SUMMARY, ULONG, ULONG);
+static ULONG (NTAPI *pRtlNumberOfClearBitsSummary)(PRTL_BITMAP_SUMMARY);
+
+void
+Test_RtlBitmapSummary(void)
+{
+    RTL_BITMAP BitMapHeader;
+    RTL_BITMAP_SUMMARY Summary;
+    LARGE_INTEGER Frequency, Start, Middle, End;
+    static ULONG ClearCount[RTL_BITMAP_SUMMARY_BLOCKS(BENCH_BITS, 12)];
+    HMODULE hNtdll = GetModuleHandleW(L"ntdll.dll");
+    ULONG *Buffer;
+    ULONG Plain, Indexed;
+
+    pRtlInitializeBitMapSummary = (PVOID)GetProcAddress(hNtdll, "RtlInitializeBitMapSummary");
+    pRtlClearBitsSummary = (PVOID)GetProcAddress(hNtdll, "RtlClearBitsSummary");
+    pRtlSetBitsSummary = (PVOID)GetProcAddress(hNtdll, "RtlSetBitsSummary");
+    pRtlFindClearBitsSummary = (PVOID)GetProcAddress(hNtdll, "RtlFindClearBitsSummary");
+    pRtlFindClearBitsAndSetSummary = (PVOID)GetProcAddress(hNtdll, "RtlFindClearBitsAndSetSummary");
+    pRtlNumberOfClearBitsSummary = (PVOID)GetProcAddress(hNtdll, "RtlNumberOfClearBitsSummary");
+    if (!pRtlInitializeBitMapSummary ||
+        !pRtlClearBitsSummary ||
+        !pRtlSetBitsSummary ||
+        !pRtlFindClearBitsSummary ||
+        !pRtlFindClearBitsAndSetSummary ||
+        !pRtlNumberOfClearBitsSummary)
+    {
+        skip("Bitmap summary routines not available\n");
+        return;
+    }
+
+    Buffer = AllocateGuarded(4 * sizeof(*Buffer));
+    Buffer[0] = 0xF9F078B2;
+    Buffer[1] = 0x3F303F30;
+    Buffer[2] = 0xFFFFFFFF;
+    Buffer[3] = 0x0000FFFF;
+
+    /* Blocks of 32 bits, the last one is cut short */
+    RtlInitializeBitMap(&BitMapHeader, Buffer, 120);
+    pRtlInitializeBitMapSummary(&Summary, &BitMapHeader, ClearCount, 5);
+    ok_int(Summary.NumberOfBlocks, 4);
+    ok_int(ClearCount[0], 14);
+    ok_int(ClearCount[1], 16);
+    ok_int(ClearCount[2], 0);
+    ok_int(ClearCount[3], 8);
+    ok_int(pRtlNumberOfClearBitsSummary(&Summary), RtlNumberOfClearBits(&BitMapHeader));
+
+    /* Searches give the same answers as without the summary */
+    ok_int(pRtlFindClearBitsSummary(&Summary, 5, 0), 15);
+    ok_int(pRtlFindClearBitsSummary(&Summary, 6, 0), 46);
+    ok_int(pRtlFindClearBitsSummary(&Summary, 8, 0), 112);
+    ok_int(pRtlFindClearBitsSummary(&Summary, 1, 64), 112);
+    ok_int(pRtlFindClearBitsSummary(&Summary, 9, 0), -1);
+
+    /* Only the bits that change are accounted */
+    pRtlSetBitsSummary(&Summary, 40, 40);
+    ok_int(ClearCount[1], 6);
+    ok_int(ClearCount[2], 0);
+    ok_hex(Buffer[1], 0xFFFFFF30);
+    pRtlClearBitsSummary(&Summary, 60, 40);
+    ok_int(ClearCount[1], 10);
+    ok_int(ClearCount[2], 32);
+    ok_int(ClearCount[3], 12);
+    ok_int(pRtlFindClearBitsAndSetSummary(&Summary, 30, 0), 60);
+    ok_int(pRtlNumberOfClearBitsSummary(&Summary), RtlNumberOfClearBits(&BitMapHeader));
+    FreeGuarded(Buffer);
+
+    /* A nearly full volume, with the free space at the end */
+    Buffer = AllocateGuarded(BENCH_BITS / 8);
+    if (!Buffer)
+    {
+        skip("Failed to allocate the benchmark bitmap\n");
+        return;
+    }
+    RtlInitializeBitMap(&BitMapHeader, Buffer, BENCH_BITS);
+    RtlSetAllBits(&BitMapHeader);
+    RtlClearBits(&BitMapHeader, BENCH_BITS - 100, 16);
+    pRtlInitializeBitMapSummary(&Summary, &BitMapHeader, ClearCount, 12);
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+    Plain = RtlFindClearBits(&BitMapHeader, 8, 0);
+    QueryPerformanceCounter(&Middle);
+    Indexed = pRtlFindClearBitsSummary(&Summary, 8, 0);
+    QueryPerformanceCounter(&End);
+
+    ok_int(Indexed, Plain);
+    trace("full   RtlFindClearBits %6lu us, with summary %6lu us\n",
+          (ULONG)((Middle.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart),
+          (ULONG)((End.QuadPart - Middle.QuadPart) * 1000000 / Frequency.QuadPart));
+    FreeGuarded(Buffer);
+}
 
 START_TEST(RtlBitmap)
 {
@@ -638,5 +883,7 @@ START_TEST(RtlBitmap)
     Test_RtlFindLastBackwardRunClear();
     Test_RtlFindClearRuns();
     Test_RtlFindLongestRunClear();
+    Test_Benchmark();
+    Test_RtlBitmapSummary();
 }
 
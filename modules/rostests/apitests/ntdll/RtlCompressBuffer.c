@@ -0,0 +1,282 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Round-trip, known-answer and throughput tests for the RtlCompressBuffer formats
+ */
+
+#include "precomp.h"
+
+#define CORPUS_SIZE (1024 * 1024)
+
+typedef struct _FORMAT
+{
+    USHORT FormatAndEngine;
+    PCSTR Name;
+    ULONG MaxRandomPercent;
+} FORMAT, *PFORMAT;
+
+static FORMAT Formats[] =
+{
+    { COMPRESSION_FORMAT_LZNT1 | COMPRESSION_ENGINE_STANDARD,        "LZNT1",           101 },
+    { COMPRESSION_FORMAT_LZNT1 | COMPRESSION_ENGINE_MAXIMUM,         "LZNT1/max",       101 },
+    /* plain XPRESS has no raw mode, every literal costs an extra flag bit */
+    { COMPRESSION_FORMAT_XPRESS | COMPRESSION_ENGINE_STANDARD,       "XPRESS",          113 },
+    { COMPRESSION_FORMAT_XPRESS | COMPRESSION_ENGINE_MAXIMUM,        "XPRESS/max",      113 },
+    { COMPRESSION_FORMAT_XPRESS_HUFF | COMPRESSION_ENGINE_STANDARD,  "XPRESS_HUFF",     101 },
+    { COMPRESSION_FORMAT_XPRESS_HUFF | COMPRESSION_ENGINE_MAXIMUM,   "XPRESS_HUFF/max", 101 },
+};
+
+typedef struct _CORPUS
+{
+    PCSTR Name;
+    PUCHAR Data;
+    ULONG Size;
+} CORPUS, *PCORPUS;
+
+static
+ULONG
+NextRandom(
+    PULONG Seed)
+{
+    *Seed = *Seed * 1103515245 + 12345;
+    return *Seed >> 16;
+}
+
+static
+PUCHAR
+GenerateText(
+    ULONG Size)
+{
+    static PCSTR Words[] = { "the ", "a ", "of ", "compression ", "chunk ", "buffer ", "NTSTATUS ",
+                             "return ", "if (", ") ", "{\r\n", "}\r\n", "    ", "Status", " = ", ";\r\n",
+                             "ReactOS ", "kernel ", "file ", "system " };
+    PUCHAR Buffer;
+    ULONG Seed = 1, i = 0;
+    PCSTR Word;
+
+    Buffer = RtlAllocateHeap(RtlGetProcessHeap(), 0, Size);
+    if (!Buffer)
+        return NULL;
+
+    while (i < Size)
+    {
+        Word = Words[NextRandom(&Seed) % RTL_NUMBER_OF(Words)];
+        while (*Word && i < Size)
+            Buffer[i++] = *Word++;
+    }
+    return Buffer;
+}
+
+static
+PUCHAR
+GenerateBytes(
+    ULONG Size,
+    ULONG Range)
+{
+    PUCHAR Buffer;
+    ULONG Seed = 7, i;
+
+    Buffer = RtlAllocateHeap(RtlGetProcessHeap(), 0, Size);
+    if (!Buffer)
+        return NULL;
+
+    for (i = 0; i < Size; i++)
+        Buffer[i] = Range ? (UCHAR)(NextRandom(&Seed) % Range) : 0;
+    return Buffer;
+}
+
+static
+PUCHAR
+CopyImage(
+    PCWSTR ModuleName,
+    PULONG Size)
+{
+    PVOID ImageBase = GetModuleHandleW(ModuleName);
+    PIMAGE_NT_HEADERS NtHeaders;
+    PUCHAR Buffer;
+
+    NtHeaders = ImageBase ? RtlImageNtHeader(ImageBase) : NULL;
+    if (!NtHeaders)
+        return NULL;
+
+    *Size = min(NtHeaders->OptionalHeader.SizeOfImage, CORPUS_SIZE);
+    Buffer = RtlAllocateHeap(RtlGetProcessHeap(), 0, *Size);
+    if (Buffer)
+        RtlCopyMemory(Buffer, ImageBase, *Size);
+    return Buffer;
+}
+
+static
+VOID
+TestFormat(
+    USHORT FormatAndEngine,
+    PCSTR FormatName,
+    PCORPUS Corpus,
+    ULONG MaxPercent)
+{
+    ULONG CompressWorkSpace, FragmentWorkSpace;
+    ULONG CompressedSize, FinalSize;
+    LARGE_INTEGER Frequency, Start, Middle, End;
+    PUCHAR WorkSpace, Compressed, Decompressed;
+    ULONG CompressedBufferSize;
+    NTSTATUS Status;
+
+    Status = RtlGetCompressionWorkSpaceSize(FormatAndEngine, &CompressWorkSpace, &FragmentWorkSpace);
+    if (Status == STATUS_UNSUPPORTED_COMPRESSION)
+    {
+        /* the XPRESS formats appeared in Windows 8 */
+        skip("[%s/%s] Format not supported\n", FormatName, Corpus->Name);
+        return;
+    }
+    ok_hex(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    /* leave room for the framing overhead of incompressible data */
+    CompressedBufferSize = Corpus->Size + Corpus->Size / 4 + 0x1000;
+    WorkSpace = RtlAllocateHeap(RtlGetProcessHeap(), 0, CompressWorkSpace);
+    Compressed = RtlAllocateHeap(RtlGetProcessHeap(), 0, CompressedBufferSize);
+    Decompressed = RtlAllocateHeap(RtlGetProcessHeap(), 0, Corpus->Size + 1);
+    if (!WorkSpace || !Compressed || !Decompressed)
+    {
+        skip("Out of memory\n");
+        goto Cleanup;
+    }
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+    Status = RtlCompressBuffer(FormatAndEngine,
+                               Corpus->Data,
+                               Corpus->Size,
+                               Compressed,
+                               CompressedBufferSize,
+                               0x1000,
+                               &CompressedSize,
+                               WorkSpace);
+    QueryPerformanceCounter(&Middle);
+    ok(Status == STATUS_SUCCESS, "[%s/%s] RtlCompressBuffer returned 0x%lx\n", FormatName, Corpus->Name, Status);
+    if (!NT_SUCCESS(Status))
+        goto Cleanup;
+
+    Decompressed[Corpus->Size] = 0x5A;
+    Status = RtlDecompressBuffer(FormatAndEngine & 0xFF,
+                                 Decompressed,
+                                 Corpus->Size,
+                                 Compressed,
+                                 CompressedSize,
+                                 &FinalSize);
+    QueryPerformanceCounter(&End);
+    ok(Status == STATUS_SUCCESS, "[%s/%s] RtlDecompressBuffer returned 0x%lx\n", FormatName, Corpus->Name, Status);
+    ok(FinalSize == Corpus->Size, "[%s/%s] FinalSize = %lu, expected %lu\n", FormatName, Corpus->Name, FinalSize, Corpus->Size);
+    ok(RtlCompareMemory(Decompressed, Corpus->Data, Corpus->Size) == Corpus->Size,
+       "[%s/%s] Round-trip data mismatch\n", FormatName, Corpus->Name);
+    ok(Decompressed[Corpus->Size] == 0x5A, "[%s/%s] Buffer overrun\n", FormatName, Corpus->Name);
+    ok((ULONGLONG)CompressedSize * 100 <= (ULONGLONG)Corpus->Size * MaxPercent,
+       "[%s/%s] Compressed %lu bytes to %lu\n", FormatName, Corpus->Name, Corpus->Size, CompressedSize);
+
+    trace("%-16s %-8s %7lu -> %7lu (%3lu%%), compress %6lu us, decompress %6lu us\n",
+          FormatName, Corpus->Name, Corpus->Size, CompressedSize,
+          (ULONG)((ULONGLONG)CompressedSize * 100 / Corpus->Size),
+          (ULONG)((Middle.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart),
+          (ULONG)((End.QuadPart - Middle.QuadPart) * 1000000 / Frequency.QuadPart));
+
+Cleanup:
+    if (Decompressed) RtlFreeHeap(RtlGetProcessHeap(), 0, Decompressed);
+    if (Compressed) RtlFreeHeap(RtlGetProcessHeap(), 0, Compressed);
+    if (WorkSpace) RtlFreeHeap(RtlGetProcessHeap(), 0, WorkSpace);
+}
+
+/* the plain LZ77 examples of [MS-XCA] 3.1 */
+static const UCHAR XpressAlphabet[] =
+{
+    0x3f, 0x00, 0x00, 0x00, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c,
+    0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a
+};
+
+static const UCHAR XpressRepeat[] =
+{
+    0xff, 0xff, 0xff, 0x1f, 0x61, 0x62, 0x63, 0x17, 0x00, 0x0f, 0xff, 0x26, 0x01
+};
+
+static
+VOID
+TestXpressVector(
+    PCSTR Name,
+    const UCHAR *Compressed,
+    ULONG CompressedSize,
+    PCSTR Pattern,
+    ULONG Size)
+{
+    UCHAR Decompressed[512];
+    ULONG FinalSize = 0xdeadbeef, PatternLength, i;
+    NTSTATUS Status;
+
+    Status = RtlDecompressBuffer(COMPRESSION_FORMAT_XPRESS,
+                                 Decompressed,
+                                 sizeof(Decompressed),
+                                 (PUCHAR)Compressed,
+                                 CompressedSize,
+                                 &FinalSize);
+    if (Status == STATUS_UNSUPPORTED_COMPRESSION)
+    {
+        skip("[%s] XPRESS not supported\n", Name);
+        return;
+    }
+    ok(Status == STATUS_SUCCESS, "[%s] RtlDecompressBuffer returned 0x%lx\n", Name, Status);
+    ok(FinalSize == Size, "[%s] FinalSize = %lu, expected %lu\n", Name, FinalSize, Size);
+    if (!NT_SUCCESS(Status) || FinalSize != Size)
+        return;
+
+    PatternLength = (ULONG)strlen(Pattern);
+    for (i = 0; i < Size; i++)
+    {
+        if (Decompressed[i] != (UCHAR)Pattern[i % PatternLength])
+            break;
+    }
+    ok(i == Size, "[%s] Mismatch at offset %lu\n", Name, i);
+}
+
+START_TEST(RtlCompressBuffer)
+{
+    CORPUS Corpus[5];
+    ULONG i, j, ImageSize = 0;
+
+    TestXpressVector("alphabet", XpressAlphabet, sizeof(XpressAlphabet), "abcdefghijklmnopqrstuvwxyz", 26);
+    TestXpressVector("repeat", XpressRepeat, sizeof(XpressRepeat), "abc", 300);
+
+    Corpus[0].Name = "text";
+    Corpus[0].Data = GenerateText(CORPUS_SIZE);
+    Corpus[0].Size = CORPUS_SIZE;
+    Corpus[1].Name = "image";
+    Corpus[1].Data = CopyImage(L"ntdll.dll", &ImageSize);
+    Corpus[1].Size = ImageSize;
+    Corpus[2].Name = "zeros";
+    Corpus[2].Data = GenerateBytes(CORPUS_SIZE, 0);
+    Corpus[2].Size = CORPUS_SIZE;
+    Corpus[3].Name = "skewed";
+    Corpus[3].Data = GenerateBytes(CORPUS_SIZE, 4);
+    Corpus[3].Size = CORPUS_SIZE;
+    Corpus[4].Name = "random";
+    Corpus[4].Data = GenerateBytes(CORPUS_SIZE, 256);
+    Corpus[4].Size = CORPUS_SIZE;
+
+    for (i = 0; i < RTL_NUMBER_OF(Corpus); i++)
+    {
+        if (!Corpus[i].Data)
+        {
+            skip("No data for corpus '%s'\n", Corpus[i].Name);
+            continue;
+        }
+
+        /* random data may grow by the framing overhead, everything else has to shrink */
+        for (j = 0; j < RTL_NUMBER_OF(Formats); j++)
+        {
+            TestFormat(Formats[j].FormatAndEngine,
+                       Formats[j].Name,
+                       &Corpus[i],
+                       i == 4 ? Formats[j].MaxRandomPercent : 90);
+        }
+
+        RtlFreeHeap(RtlGetProcessHeap(), 0, Corpus[i].Data);
+    }
+}
@@ -0,0 +1,120 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Test and microbenchmark for RtlMultipleAllocateHeap / RtlMultipleFreeHeap
+ */
+
+#include "precomp.h"
+
+#define BATCH_COUNT 10000
+#define BATCH_ROUNDS 20
+
+static PVOID Blocks[BATCH_COUNT];
+
+static
+VOID
+TestBatch(
+    HANDLE hHeap,
+    SIZE_T Size)
+{
+    ULONG Count, i;
+    SIZE_T j;
+    BOOLEAN Zeroed = TRUE, Sized = TRUE;
+
+    Count = RtlMultipleAllocateHeap(hHeap, HEAP_ZERO_MEMORY, Size, BATCH_COUNT, Blocks);
+    ok(Count == BATCH_COUNT, "[%Iu] Allocated %lu blocks\n", Size, Count);
+
+    for (i = 0; i < Count; i++)
+    {
+        if (RtlSizeHeap(hHeap, 0, Blocks[i]) != Size)
+            Sized = FALSE;
+        for (j = 0; j < Size; j++)
+        {
+            if (((PUCHAR)Blocks[i])[j] != 0)
+                Zeroed = FALSE;
+        }
+        RtlFillMemory(Blocks[i], Size, 0xA5);
+    }
+    ok(Sized, "[%Iu] Unexpected block size\n", Size);
+    ok(Zeroed, "[%Iu] Memory not zeroed\n", Size);
+    ok(RtlValidateHeap(hHeap, 0, NULL), "[%Iu] Heap is invalid after the batch allocation\n", Size);
+
+    /* Punch a few holes so that the batch free has to handle broken runs */
+    for (i = 0; i < Count; i += 7)
+    {
+        RtlFreeHeap(hHeap, 0, Blocks[i]);
+        Blocks[i] = NULL;
+    }
+    for (i = 0, j = 0; i < Count; i++)
+    {
+        if (Blocks[i])
+            Blocks[j++] = Blocks[i];
+    }
+
+    i = RtlMultipleFreeHeap(hHeap, 0, (ULONG)j, Blocks);
+    ok(i == j, "[%Iu] Freed %lu of %Iu blocks\n", Size, i, j);
+    ok(RtlValidateHeap(hHeap, 0, NULL), "[%Iu] Heap is invalid after the batch free\n", Size);
+}
+
+static
+VOID
+BenchmarkBatch(
+    HANDLE hHeap,
+    SIZE_T Size)
+{
+    LARGE_INTEGER Frequency, Start, Middle, End;
+    ULONG Round, i;
+
+    QueryPerformanceFrequency(&Frequency);
+
+    QueryPerformanceCounter(&Start);
+    for (Round = 0; Round < BATCH_ROUNDS; Round++)
+    {
+        for (i = 0; i < BATCH_COUNT; i++)
+            Blocks[i] = RtlAllocateHeap(hHeap, 0, Size);
+        for (i = 0; i < BATCH_COUNT; i++)
+            RtlFreeHeap(hHeap, 0, Blocks[i]);
+    }
+    QueryPerformanceCounter(&Middle);
+    for (Round = 0; Round < BATCH_ROUNDS; Round++)
+    {
+        i = RtlMultipleAllocateHeap(hHeap, 0, Size, BATCH_COUNT, Blocks);
+        RtlMultipleFreeHeap(hHeap, 0, i, Blocks);
+    }
+    QueryPerformanceCounter(&End);
+
+    trace("%4Iu bytes x %u: single %6lu us, batch %6lu us\n",
+          Size, BATCH_COUNT,
+          (ULONG)((Middle.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart / BATCH_ROUNDS),
+          (ULONG)((End.QuadPart - Middle.QuadPart) * 1000000 / Frequency.QuadPart / BATCH_ROUNDS));
+}
+
+START_TEST(RtlMultipleAllocateHeap)
+{
+    static const SIZE_T Sizes[] = { 0, 1, 16, 24, 100, 256, 1000, 4000 };
+    HANDLE hHeap;
+    ULONG i;
+
+    hHeap = RtlCreateHeap(HEAP_GROWABLE, NULL, 0, 0, NULL, NULL);
+    ok(hHeap != NULL, "RtlCreateHeap failed\n");
+    if (!hHeap)
+        return;
+
+    for (i = 0; i < RTL_NUMBER_OF(Sizes); i++)
+        TestBatch(hHeap, Sizes[i]);
+
+    for (i = 2; i < RTL_NUMBER_OF(Sizes); i += 2)
+        BenchmarkBatch(hHeap, Sizes[i]);
+
+    /* A failed batch reports how far it got */
+    RtlDestroyHeap(hHeap);
+    hHeap = RtlCreateHeap(0, NULL, 0x10000, 0x10000, NULL, NULL);
+    if (hHeap)
+    {
+        i = RtlMultipleAllocateHeap(hHeap, 0, 100, BATCH_COUNT, Blocks);
+        ok(i > 0 && i < BATCH_COUNT, "Allocated %lu blocks from a fixed size heap\n", i);
+        ok(RtlMultipleFreeHeap(hHeap, 0, i, Blocks) == i, "Batch free failed\n");
+        ok(RtlValidateHeap(hHeap, 0, NULL), "Heap is invalid\n");
+        RtlDestroyHeap(hHeap);
+    }
+}
@@ -0,0 +1,238 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Test for RtlWalkHeap, heap tags, RtlUsageHeap and RtlExtendHeap
+ */
+
+#include "precomp.h"
+
+#define BLOCK_COUNT 200
+
+typedef struct _WALK_STATS
+{
+    ULONG Segments;
+    ULONG UnCommittedRanges;
+    ULONG BusyBlocks;
+    ULONG FreeBlocks;
+    SIZE_T BusyBytes;
+} WALK_STATS, *PWALK_STATS;
+
+static
+NTSTATUS
+WalkHeap(
+    HANDLE hHeap,
+    PWALK_STATS Stats)
+{
+    RTL_HEAP_WALK_ENTRY Entry;
+    NTSTATUS Status;
+
+    RtlZeroMemory(Stats, sizeof(*Stats));
+    RtlZeroMemory(&Entry, sizeof(Entry));
+
+    while (NT_SUCCESS(Status = RtlWalkHeap(hHeap, &Entry)))
+    {
+        if (Entry.Flags & RTL_HEAP_SEGMENT)
+        {
+            Stats->Segments++;
+            ok(Entry.Segment.FirstEntry != NULL, "Segment %u has no first entry\n", Entry.SegmentIndex);
+        }
+        else if (Entry.Flags & RTL_HEAP_UNCOMMITTED_RANGE)
+        {
+            Stats->UnCommittedRanges++;
+        }
+        else if (Entry.Flags & RTL_HEAP_BUSY)
+        {
+            Stats->BusyBlocks++;
+            Stats->BusyBytes += Entry.DataSize;
+        }
+        else
+        {
+            Stats->FreeBlocks++;
+        }
+    }
+
+    return Status;
+}
+
+static
+VOID
+TestWalk(
+    HANDLE hHeap)
+{
+    PVOID Blocks[BLOCK_COUNT], BigBlock;
+    WALK_STATS Stats;
+    SIZE_T Expected = 0;
+    NTSTATUS Status;
+    ULONG i, Busy = 0;
+
+    for (i = 0; i < BLOCK_COUNT; i++)
+        Blocks[i] = RtlAllocateHeap(hHeap, 0, i * 13 + 1);
+    for (i = 0; i < BLOCK_COUNT; i += 3)
+    {
+        RtlFreeHeap(hHeap, 0, Blocks[i]);
+        Blocks[i] = NULL;
+    }
+    for (i = 0; i < BLOCK_COUNT; i++)
+    {
+        if (!Blocks[i]) continue;
+        Busy++;
+        Expected += i * 13 + 1;
+    }
+
+    /* Big blocks are reported after the segments */
+    BigBlock = RtlAllocateHeap(hHeap, 0, 0x200000);
+    ok(BigBlock != NULL, "Failed to allocate a big block\n");
+    if (BigBlock)
+    {
+        Busy++;
+        Expected += 0x200000;
+    }
+
+    Status = WalkHeap(hHeap, &Stats);
+    ok_hex(Status, STATUS_NO_MORE_ENTRIES);
+    ok(Stats.Segments >= 1, "Found %lu segments\n", Stats.Segments);
+    ok(Stats.UnCommittedRanges >= 1, "Found %lu uncommitted ranges\n", Stats.UnCommittedRanges);
+    ok(Stats.BusyBlocks == Busy, "Found %lu busy blocks, expected %lu\n", Stats.BusyBlocks, Busy);
+    ok(Stats.FreeBlocks >= 1, "Found %lu free blocks\n", Stats.FreeBlocks);
+    ok(Stats.BusyBytes == Expected, "Busy blocks hold %Iu bytes, expected %Iu\n", Stats.BusyBytes, Expected);
+
+    for (i = 0; i < BLOCK_COUNT; i++)
+    {
+        if (Blocks[i])
+            RtlFreeHeap(hHeap, 0, Blocks[i]);
+    }
+    if (BigBlock)
+        RtlFreeHeap(hHeap, 0, BigBlock);
+}
+
+static
+VOID
+TestTags(
+    HANDLE hHeap)
+{
+    RTL_HEAP_TAG_INFO Info;
+    PVOID Small, Big;
+    PWSTR TagName;
+    ULONG Tag;
+
+    Tag = RtlCreateTagHeap(hHeap, 0, L"Test!", L"Blocks");
+    ok(Tag != 0, "RtlCreateTagHeap failed\n");
+    if (!Tag)
+        return;
+    ok(RtlCreateTagHeap(hHeap, 0, L"Test!", L"Other") != Tag, "Tags are not unique\n");
+
+    Small = RtlAllocateHeap(hHeap, Tag, 100);
+    Big = RtlAllocateHeap(hHeap, Tag, 0x100000);
+    ok(Small != NULL && Big != NULL, "Tagged allocation failed\n");
+
+    RtlZeroMemory(&Info, sizeof(Info));
+    TagName = RtlQueryTagHeap(hHeap, 0, (USHORT)(Tag >> HEAP_TAG_SHIFT), FALSE, &Info);
+    ok(TagName != NULL && wcscmp(TagName, L"Test!Blocks") == 0, "Got tag name %S\n", TagName);
+    ok(Info.NumberOfAllocations == 2, "Got %lu allocations\n", Info.NumberOfAllocations);
+    ok(Info.NumberOfFrees == 0, "Got %lu frees\n", Info.NumberOfFrees);
+    ok(Info.BytesAllocated >= 0x100000 + 100, "Got %Iu bytes\n", Info.BytesAllocated);
+
+    /* Reallocation moves the charge along with the block */
+    Small = RtlReAllocateHeap(hHeap, 0, Small, 5000);
+    ok(Small != NULL, "Reallocation failed\n");
+    RtlFreeHeap(hHeap, 0, Big);
+
+    RtlQueryTagHeap(hHeap, 0, (USHORT)(Tag >> HEAP_TAG_SHIFT), FALSE, &Info);
+    ok(Info.BytesAllocated >= 5000 && Info.BytesAllocated < 0x100000, "Got %Iu bytes\n", Info.BytesAllocated);
+
+    RtlFreeHeap(hHeap, 0, Small);
+    RtlQueryTagHeap(hHeap, 0, (USHORT)(Tag >> HEAP_TAG_SHIFT), TRUE, &Info);
+    ok(Info.NumberOfAllocations == Info.NumberOfFrees, "Got %lu allocations and %lu frees\n",
+       Info.NumberOfAllocations, Info.NumberOfFrees);
+    ok(Info.BytesAllocated == 0, "Got %Iu bytes\n", Info.BytesAllocated);
+
+    /* A reset clears the counters but not the bytes in use */
+    RtlQueryTagHeap(hHeap, 0, (USHORT)(Tag >> HEAP_TAG_SHIFT), FALSE, &Info);
+    ok(Info.NumberOfAllocations == 0, "Got %lu allocations\n", Info.NumberOfAllocations);
+    ok(Info.NumberOfFrees == 0, "Got %lu frees\n", Info.NumberOfFrees);
+}
+
+static
+VOID
+TestUsage(
+    HANDLE hHeap)
+{
+    RTL_HEAP_USAGE Usage;
+    NTSTATUS Status;
+    PVOID Block;
+
+    RtlZeroMemory(&Usage, sizeof(Usage));
+    Status = RtlUsageHeap(hHeap, 0, &Usage);
+    ok_hex(Status, STATUS_INFO_LENGTH_MISMATCH);
+
+    Block = RtlAllocateHeap(hHeap, 0, 0x10000);
+    Usage.Length = sizeof(Usage);
+    Status = RtlUsageHeap(hHeap, 0, &Usage);
+    ok_hex(Status, STATUS_SUCCESS);
+    ok(Usage.BytesAllocated >= 0x10000, "BytesAllocated = %Iu\n", Usage.BytesAllocated);
+    ok(Usage.BytesCommitted >= Usage.BytesAllocated, "Committed %Iu < allocated %Iu\n",
+       Usage.BytesCommitted, Usage.BytesAllocated);
+    ok(Usage.BytesReserved >= Usage.BytesCommitted, "Reserved %Iu < committed %Iu\n",
+       Usage.BytesReserved, Usage.BytesCommitted);
+    RtlFreeHeap(hHeap, 0, Block);
+
+    /* RtlCompactHeap reports the largest free block */
+    ok(RtlCompactHeap(hHeap, 0) >= 0x10000, "Largest free block is %lu bytes\n", RtlCompactHeap(hHeap, 0));
+}
+
+static
+VOID
+TestExtend(
+    HANDLE hHeap)
+{
+    WALK_STATS Before, After;
+    PVOID Memory, Block;
+    NTSTATUS Status;
+
+    Memory = VirtualAlloc(NULL, 0x40000, MEM_RESERVE, PAGE_READWRITE);
+    ok(Memory != NULL, "VirtualAlloc failed\n");
+    if (!Memory)
+        return;
+
+    WalkHeap(hHeap, &Before);
+    Status = RtlExtendHeap(hHeap, 0, Memory, 0x40000);
+    ok_hex(Status, STATUS_SUCCESS);
+    WalkHeap(hHeap, &After);
+    ok(After.Segments == Before.Segments + 1, "Got %lu segments, expected %lu\n",
+       After.Segments, Before.Segments + 1);
+
+    /* The new segment grows on demand like any other */
+    Block = RtlAllocateHeap(hHeap, 0, 0x20000);
+    ok(Block != NULL, "Allocation failed\n");
+    ok(RtlValidateHeap(hHeap, 0, NULL), "Heap is invalid after the extension\n");
+    if (Block)
+        RtlFreeHeap(hHeap, 0, Block);
+
+    /* Unaligned memory is rejected */
+    Status = RtlExtendHeap(hHeap, 0, (PUCHAR)Memory + 8, 0x1000);
+    ok_hex(Status, STATUS_INVALID_PARAMETER);
+}
+
+START_TEST(RtlWalkHeap)
+{
+    HANDLE hHeap;
+
+    hHeap = RtlCreateHeap(HEAP_GROWABLE, NULL, 0x100000, 0x1000, NULL, NULL);
+    ok(hHeap != NULL, "RtlCreateHeap failed\n");
+    if (!hHeap)
+        return;
+
+    TestWalk(hHeap);
+    TestTags(hHeap);
+    TestUsage(hHeap);
+    RtlDestroyHeap(hHeap);
+
+    /* A fixed size heap can only grow through RtlExtendHeap */
+    hHeap = RtlCreateHeap(0, NULL, 0x10000, 0x10000, NULL, NULL);
+    ok(hHeap != NULL, "RtlCreateHeap failed\n");
+    if (!hHeap)
+        return;
+
+    TestExtend(hHeap);
+    RtlDestroyHeap(hHeap);
+}
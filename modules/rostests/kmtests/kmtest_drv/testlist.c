@@ -15,6 +15,7 @@ KMT_TESTFUNC Test_ExFastMutex;
 KMT_TESTFUNC Test_ExHardError;
 KMT_TESTFUNC Test_ExHardErrorInteractive;
 KMT_TESTFUNC Test_ExInterlocked;
+KMT_TESTFUNC Test_ExLookaside;
 KMT_TESTFUNC Test_ExPools;
 KMT_TESTFUNC Test_ExResource;
 KMT_TESTFUNC Test_ExSequencedList;
@@ -64,6 +65,7 @@ KMT_TESTFUNC Test_PsNotify;
 KMT_TESTFUNC Test_SeInheritance;
 KMT_TESTFUNC Test_SeQueryInfoToken;
 KMT_TESTFUNC Test_RtlAvlTree;
+KMT_TESTFUNC Test_RtlCompressChunks;
 KMT_TESTFUNC Test_RtlException;
 KMT_TESTFUNC Test_RtlIntSafe;
 KMT_TESTFUNC Test_RtlIsValidOemCharacter;
@@ -86,6 +88,7 @@ const KMT_TEST TestList[] =
     { "ExHardError",                        Test_ExHardError },
     { "-ExHardErrorInteractive",            Test_ExHardErrorInteractive },
     { "ExInterlocked",                      Test_ExInterlocked },
+    { "ExLookaside",                        Test_ExLookaside },
     { "ExPools",                            Test_ExPools },
     { "ExResource",                         Test_ExResource },
     { "ExSequencedList",                    Test_ExSequencedList },
@@ -134,6 +137,7 @@ const KMT_TEST TestList[] =
     { "ObTypes",                            Test_ObTypes },
     { "PsNotify",                           Test_PsNotify },
     { "RtlAvlTreeKM",                       Test_RtlAvlTree },
+    { "RtlCompressChunks",                  Test_RtlCompressChunks },
     { "RtlExceptionKM",                     Test_RtlException },
     { "RtlIntSafeKM",                       Test_RtlIntSafe },
     { "RtlIsValidOemCharacter",             Test_RtlIsValidOemCharacter },
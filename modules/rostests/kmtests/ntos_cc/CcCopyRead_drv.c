@@ -15,6 +15,7 @@ typedef struct _TEST_FCB
     FSRTL_ADVANCED_FCB_HEADER Header;
     SECTION_OBJECT_POINTERS SectionObjectPointers;
     FAST_MUTEX HeaderMutex;
+    BOOLEAN ReportCached;
 } TEST_FCB, *PTEST_FCB;
 
 static PFILE_OBJECT TestFileObject;
@@ -195,6 +196,21 @@ TestIrpHandler(
             Fcb->Header.FileSize.QuadPart = 1004;
             Fcb->Header.ValidDataLength.QuadPart = 1004;
         }
+        else if (IoStack->FileObject->FileName.Length >= 2 * sizeof(WCHAR) &&
+                 IoStack->FileObject->FileName.Buffer[1] == 'H')
+        {
+            Fcb->Header.AllocationSize.QuadPart = 0x4000000;
+            Fcb->Header.FileSize.QuadPart = 0x4000000;
+            Fcb->Header.ValidDataLength.QuadPart = 0x4000000;
+        }
+        else if (IoStack->FileObject->FileName.Length >= 2 * sizeof(WCHAR) &&
+                 IoStack->FileObject->FileName.Buffer[1] == 'V')
+        {
+            Fcb->Header.AllocationSize.QuadPart = 0x40000000;
+            Fcb->Header.FileSize.QuadPart = 0x40000000;
+            Fcb->Header.ValidDataLength.QuadPart = 0x40000000;
+            Fcb->ReportCached = TRUE;
+        }
         else if (IoStack->FileObject->FileName.Length >= 2 * sizeof(WCHAR) &&
                  IoStack->FileObject->FileName.Buffer[1] == 'R')
         {
@@ -222,6 +238,7 @@ TestIrpHandler(
     else if (IoStack->MajorFunction == IRP_MJ_READ)
     {
         BOOLEAN Ret;
+        BOOLEAN Cached;
         ULONG Length;
         PVOID Buffer;
         LARGE_INTEGER Offset;
@@ -241,11 +258,26 @@ TestIrpHandler(
             Buffer = Irp->AssociatedIrp.SystemBuffer;
             ok(Buffer != NULL, "Null pointer!\n");
 
+            Cached = FALSE;
             _SEH2_TRY
             {
-                Ret = CcCopyRead(IoStack->FileObject, &Offset, Length, TRUE, Buffer,
-                                 &Irp->IoStatus);
-                ok_bool_true(Ret, "CcCopyRead");
+                /* A read that can't wait only succeeds if all its views are cached */
+                if (Fcb->ReportCached)
+                {
+                    Cached = CcCopyRead(IoStack->FileObject, &Offset, Length, FALSE, Buffer,
+                                        &Irp->IoStatus);
+                }
+                /* Reads with a key only probe the cache and map nothing */
+                if (IoStack->Parameters.Read.Key == 0)
+                {
+                    Ret = CcCopyRead(IoStack->FileObject, &Offset, Length, TRUE, Buffer,
+                                     &Irp->IoStatus);
+                    ok_bool_true(Ret, "CcCopyRead");
+                }
+                else
+                {
+                    Irp->IoStatus.Status = STATUS_SUCCESS;
+                }
             }
             _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
             {
@@ -255,7 +287,7 @@ TestIrpHandler(
 
             Status = Irp->IoStatus.Status;
 
-            if (NT_SUCCESS(Status))
+            if (NT_SUCCESS(Status) && (Cached || IoStack->Parameters.Read.Key == 0))
             {
                 if (Offset.QuadPart <= 1000LL && Offset.QuadPart + Length > 1000LL)
                 {
@@ -266,6 +298,12 @@ TestIrpHandler(
                     ok_eq_hex(*(PUSHORT)Buffer, 0xBABA);
                 }
             }
+
+            /* Tell the caller whether the data was already cached */
+            if (NT_SUCCESS(Status) && Fcb->ReportCached)
+            {
+                ((PUCHAR)Buffer)[Length - 1] = Cached;
+            }
         }
         else
         {
@@ -7,6 +7,132 @@
 
 #include <kmt_test.h>
 
+#define BENCH_FILE_SIZE 0x4000000
+#define BENCH_VIEW_SIZE 0x40000
+#define BENCH_READS 20000
+#define BENCH_MAX_THREADS 8
+
+#define VIEW_TEST_VIEW_SIZE 0x40000
+
+static HANDLE BenchHandle;
+
+/* The driver sets the last byte of the read to whether it was cached */
+static
+BOOLEAN
+IsViewCached(
+    _In_ HANDLE Handle,
+    _In_ ULONG View,
+    _In_ ULONG Offset)
+{
+    LARGE_INTEGER ByteOffset;
+    IO_STATUS_BLOCK IoStatusBlock;
+    UCHAR Buffer[10];
+    NTSTATUS Status;
+
+    ByteOffset.QuadPart = (LONGLONG)View * VIEW_TEST_VIEW_SIZE + Offset;
+    Status = NtReadFile(Handle, NULL, NULL, NULL, &IoStatusBlock, Buffer, sizeof(Buffer), &ByteOffset, NULL);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    ok_eq_hex(*(PUSHORT)Buffer, 0xBABA);
+    return Buffer[sizeof(Buffer) - 1];
+}
+
+/* Same, but the driver only looks in the cache and maps nothing */
+static
+BOOLEAN
+IsViewCachedNoRead(
+    _In_ HANDLE Handle,
+    _In_ ULONG View)
+{
+    LARGE_INTEGER ByteOffset;
+    IO_STATUS_BLOCK IoStatusBlock;
+    UCHAR Buffer[10];
+    ULONG Key = 1;
+    NTSTATUS Status;
+
+    ByteOffset.QuadPart = (LONGLONG)View * VIEW_TEST_VIEW_SIZE + 3;
+    Status = NtReadFile(Handle, NULL, NULL, NULL, &IoStatusBlock, Buffer, sizeof(Buffer), &ByteOffset, &Key);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    return Buffer[sizeof(Buffer) - 1];
+}
+
+/* Read ahead is asynchronous, give it some time */
+static
+BOOLEAN
+WaitForViewCached(
+    _In_ HANDLE Handle,
+    _In_ ULONG View)
+{
+    ULONG i;
+
+    for (i = 0; i < 50; i++)
+    {
+        if (IsViewCachedNoRead(Handle, View))
+            return TRUE;
+        Sleep(100);
+    }
+
+    return FALSE;
+}
+
+static
+DWORD
+WINAPI
+BenchReader(
+    _In_ PVOID Parameter)
+{
+    ULONG Seed = (ULONG)(ULONG_PTR)Parameter;
+    LARGE_INTEGER ByteOffset;
+    IO_STATUS_BLOCK IoStatusBlock;
+    UCHAR Buffer[10];
+    NTSTATUS Status;
+    ULONG i, Failures = 0;
+
+    for (i = 0; i < BENCH_READS; i++)
+    {
+        /* Unaligned reads spread over the whole file, so that every lookup
+         * has to find one view out of many */
+        ByteOffset.QuadPart = (RtlRandom(&Seed) % (BENCH_FILE_SIZE / BENCH_VIEW_SIZE)) * BENCH_VIEW_SIZE + 3;
+        Status = NtReadFile(BenchHandle, NULL, NULL, NULL, &IoStatusBlock, Buffer, sizeof(Buffer), &ByteOffset, NULL);
+        if (!NT_SUCCESS(Status) || *(PUSHORT)Buffer != 0xBABA)
+            Failures++;
+    }
+
+    return Failures;
+}
+
+static
+VOID
+BenchmarkReaders(
+    _In_ ULONG ThreadCount)
+{
+    HANDLE Threads[BENCH_MAX_THREADS];
+    LARGE_INTEGER Frequency, Start, End;
+    DWORD Failures;
+    ULONG i;
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+    for (i = 0; i < ThreadCount; i++)
+    {
+        Threads[i] = CreateThread(NULL, 0, BenchReader, UlongToPtr(i + 1), 0, NULL);
+        ok(Threads[i] != NULL, "CreateThread failed\n");
+    }
+    for (i = 0; i < ThreadCount; i++)
+    {
+        if (!Threads[i])
+            continue;
+        WaitForSingleObject(Threads[i], INFINITE);
+        GetExitCodeThread(Threads[i], &Failures);
+        ok_eq_ulong(Failures, 0LU);
+        CloseHandle(Threads[i]);
+    }
+    QueryPerformanceCounter(&End);
+
+    trace("%lu reader(s) x %u reads over %u views: %lu ms\n",
+          ThreadCount, BENCH_READS, BENCH_FILE_SIZE / BENCH_VIEW_SIZE,
+          (ULONG)((End.QuadPart - Start.QuadPart) * 1000 / Frequency.QuadPart));
+}
+
 START_TEST(CcCopyRead)
 {
     HANDLE Handle;
@@ -18,7 +144,10 @@ START_TEST(CcCopyRead)
     UNICODE_STRING BigAlignmentTest = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcCopyRead\\BigAlignmentTest");
     UNICODE_STRING SmallAlignmentTest = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcCopyRead\\SmallAlignmentTest");
     UNICODE_STRING ReallySmallAlignmentTest = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcCopyRead\\ReallySmallAlignmentTest");
-    
+    UNICODE_STRING HugeFileTest = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcCopyRead\\HugeFileTest");
+    UNICODE_STRING ViewIndexTest = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcCopyRead\\ViewIndexTest");
+    ULONG i;
+
     KmtLoadDriver(L"CcCopyRead", FALSE);
     KmtOpenDriver();
 
@@ -89,6 +218,90 @@ START_TEST(CcCopyRead)
 
     NtClose(Handle);
 
+    /* Readers share a single asynchronous handle so that they aren't
+     * serialized on the file object lock */
+    InitializeObjectAttributes(&ObjectAttributes, &HugeFileTest, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtOpenFile(&BenchHandle, FILE_ALL_ACCESS, &ObjectAttributes, &IoStatusBlock, 0, FILE_NON_DIRECTORY_FILE);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (NT_SUCCESS(Status))
+    {
+        /* Bring every view in the cache first */
+        for (ByteOffset.QuadPart = 3; ByteOffset.QuadPart < BENCH_FILE_SIZE; ByteOffset.QuadPart += BENCH_VIEW_SIZE)
+        {
+            Status = NtReadFile(BenchHandle, NULL, NULL, NULL, &IoStatusBlock, Buffer, 10, &ByteOffset, NULL);
+            ok_eq_hex(Status, STATUS_SUCCESS);
+        }
+
+        for (i = 1; i <= BENCH_MAX_THREADS; i *= 2)
+            BenchmarkReaders(i);
+
+        NtClose(BenchHandle);
+    }
+
+    /* 4096 views, with views mapped in different leaves of the cache
+     * map index. Reads are never sequential, so no read ahead maps
+     * views behind our back. */
+    InitializeObjectAttributes(&ObjectAttributes, &ViewIndexTest, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtOpenFile(&Handle, FILE_ALL_ACCESS, &ObjectAttributes, &IoStatusBlock, 0, FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (NT_SUCCESS(Status))
+    {
+        /* Nothing is mapped yet */
+        ok_bool_false(IsViewCached(Handle, 1000, 3), "View 1000 cached before any read");
+        ok_bool_false(IsViewCached(Handle, 5, 3), "View 5 cached before any read");
+        ok_bool_false(IsViewCached(Handle, 3000, 3), "View 3000 cached before any read");
+        ok_bool_false(IsViewCached(Handle, 200, 3), "View 200 cached before any read");
+
+        /* At mapped views */
+        ok_bool_true(IsViewCached(Handle, 3000, 100), "View 3000 not cached");
+        ok_bool_true(IsViewCached(Handle, 5, 100), "View 5 not cached");
+        ok_bool_true(IsViewCached(Handle, 1000, 100), "View 1000 not cached");
+        ok_bool_true(IsViewCached(Handle, 200, 100), "View 200 not cached");
+
+        /* Between mapped views, in the same leaf and in leaves without views */
+        ok_bool_false(IsViewCached(Handle, 0, 3), "View 0 cached");
+        ok_bool_false(IsViewCached(Handle, 6, 3), "View 6 cached");
+        ok_bool_false(IsViewCached(Handle, 199, 3), "View 199 cached");
+        ok_bool_false(IsViewCached(Handle, 500, 3), "View 500 cached");
+        ok_bool_false(IsViewCached(Handle, 1001, 3), "View 1001 cached");
+        ok_bool_false(IsViewCached(Handle, 2999, 3), "View 2999 cached");
+
+        /* Beyond the last mapped view */
+        ok_bool_false(IsViewCached(Handle, 3001, 3), "View 3001 cached");
+        ok_bool_false(IsViewCached(Handle, 4095, 3), "View 4095 cached");
+
+        /* Views mapped by the lookups above are found too */
+        ok_bool_true(IsViewCached(Handle, 6, 100), "View 6 not cached");
+        ok_bool_true(IsViewCached(Handle, 4095, 100), "View 4095 not cached");
+        ok_bool_true(IsViewCached(Handle, 5, 200), "View 5 not cached");
+
+        NtClose(Handle);
+    }
+
+    /* Sequential reads get the next view read ahead, other reads don't */
+    Status = NtOpenFile(&Handle, FILE_ALL_ACCESS, &ObjectAttributes, &IoStatusBlock, 0, FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (NT_SUCCESS(Status))
+    {
+        ok_bool_false(IsViewCachedNoRead(Handle, 1), "View 1 cached before any read");
+
+        /* The first read of a file counts as sequential */
+        ok_bool_false(IsViewCached(Handle, 0, 3), "View 0 cached before any read");
+        ok_bool_true(WaitForViewCached(Handle, 1), "View 1 not read ahead");
+        ok_bool_false(IsViewCachedNoRead(Handle, 2), "View 2 read ahead");
+
+        /* A seek doesn't read ahead */
+        ok_bool_false(IsViewCached(Handle, 100, 3), "View 100 cached before any read");
+        Sleep(1000);
+        ok_bool_false(IsViewCachedNoRead(Handle, 101), "View 101 read ahead after a seek");
+
+        /* Reading on from there does */
+        ok_bool_true(IsViewCached(Handle, 100, 13), "View 100 not cached");
+        ok_bool_true(WaitForViewCached(Handle, 101), "View 101 not read ahead");
+
+        NtClose(Handle);
+    }
+
     RtlFreeHeap(RtlGetProcessHeap(), 0, Buffer);
     KmtCloseDriver();
     KmtUnloadDriver();
@@ -0,0 +1,15 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite CcCopyWrite test declarations
+ */
+
+#ifndef _KMTEST_CCCOPYWRITE_H_
+#define _KMTEST_CCCOPYWRITE_H_
+
+#define IOCTL_BLOCK_LAZY_WRITE      1
+#define IOCTL_DEFER_WRITE           2
+#define IOCTL_GET_DEFERRED_POSTED   3
+#define IOCTL_GET_PAGING_WRITES     4
+
+#endif /* !defined _KMTEST_CCCOPYWRITE_H_ */
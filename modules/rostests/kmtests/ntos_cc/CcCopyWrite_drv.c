@@ -0,0 +1,332 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Test driver for CcCopyWrite and write throttling
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#include "CcCopyWrite.h"
+
+typedef struct _TEST_FCB
+{
+    FSRTL_ADVANCED_FCB_HEADER Header;
+    SECTION_OBJECT_POINTERS SectionObjectPointers;
+    FAST_MUTEX HeaderMutex;
+} TEST_FCB, *PTEST_FCB;
+
+static PFILE_OBJECT TestFileObject;
+static KMT_IRP_HANDLER TestIrpHandler;
+static KMT_MESSAGE_HANDLER TestMessageHandler;
+static FAST_IO_DISPATCH TestFastIoDispatch;
+
+/* Lets the test keep dirty data in the cache */
+static BOOLEAN BlockLazyWrite;
+static LONG DeferredWritesPosted;
+static LONG PagingWrites;
+
+static
+BOOLEAN
+NTAPI
+FastIoWrite(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ PLARGE_INTEGER FileOffset,
+    _In_ ULONG Length,
+    _In_ BOOLEAN Wait,
+    _In_ ULONG LockKey,
+    _In_ PVOID Buffer,
+    _Out_ PIO_STATUS_BLOCK IoStatus,
+    _In_ PDEVICE_OBJECT DeviceObject)
+{
+    IoStatus->Status = STATUS_NOT_SUPPORTED;
+    return FALSE;
+}
+
+NTSTATUS
+TestEntry(
+    _In_ PDRIVER_OBJECT DriverObject,
+    _In_ PCUNICODE_STRING RegistryPath,
+    _Out_ PCWSTR *DeviceName,
+    _Inout_ INT *Flags)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(RegistryPath);
+
+    *DeviceName = L"CcCopyWrite";
+    *Flags = TESTENTRY_NO_EXCLUSIVE_DEVICE |
+             TESTENTRY_BUFFERED_IO_DEVICE |
+             TESTENTRY_NO_READONLY_DEVICE;
+
+    KmtRegisterIrpHandler(IRP_MJ_CLEANUP, NULL, TestIrpHandler);
+    KmtRegisterIrpHandler(IRP_MJ_CREATE, NULL, TestIrpHandler);
+    KmtRegisterIrpHandler(IRP_MJ_READ, NULL, TestIrpHandler);
+    KmtRegisterIrpHandler(IRP_MJ_WRITE, NULL, TestIrpHandler);
+    KmtRegisterMessageHandler(0, NULL, TestMessageHandler);
+
+    TestFastIoDispatch.FastIoWrite = FastIoWrite;
+    DriverObject->FastIoDispatch = &TestFastIoDispatch;
+
+    return Status;
+}
+
+VOID
+TestUnload(
+    _In_ PDRIVER_OBJECT DriverObject)
+{
+    PAGED_CODE();
+}
+
+BOOLEAN
+NTAPI
+AcquireForLazyWrite(
+    _In_ PVOID Context,
+    _In_ BOOLEAN Wait)
+{
+    return !BlockLazyWrite;
+}
+
+VOID
+NTAPI
+ReleaseFromLazyWrite(
+    _In_ PVOID Context)
+{
+    return;
+}
+
+BOOLEAN
+NTAPI
+AcquireForReadAhead(
+    _In_ PVOID Context,
+    _In_ BOOLEAN Wait)
+{
+    return TRUE;
+}
+
+VOID
+NTAPI
+ReleaseFromReadAhead(
+    _In_ PVOID Context)
+{
+    return;
+}
+
+static CACHE_MANAGER_CALLBACKS Callbacks = {
+    AcquireForLazyWrite,
+    ReleaseFromLazyWrite,
+    AcquireForReadAhead,
+    ReleaseFromReadAhead,
+};
+
+static
+VOID
+NTAPI
+PostDeferredWrite(
+    _In_ PVOID Context1,
+    _In_ PVOID Context2)
+{
+    ok_eq_pointer(Context1, TestFileObject);
+    ok_eq_pointer(Context2, &DeferredWritesPosted);
+    InterlockedIncrement(&DeferredWritesPosted);
+}
+
+static
+NTSTATUS
+TestMessageHandler(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ ULONG ControlCode,
+    _In_opt_ PVOID Buffer,
+    _In_ SIZE_T InLength,
+    _Inout_ PSIZE_T OutLength)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    switch (ControlCode)
+    {
+        case IOCTL_BLOCK_LAZY_WRITE:
+            ok(Buffer != NULL && InLength == sizeof(ULONG), "Bad input\n");
+            if (Buffer == NULL || InLength != sizeof(ULONG))
+                return STATUS_INVALID_PARAMETER;
+            BlockLazyWrite = (*(PULONG)Buffer != 0);
+            break;
+        case IOCTL_DEFER_WRITE:
+            ok(TestFileObject != NULL, "No test file open\n");
+            if (TestFileObject == NULL)
+                return STATUS_INVALID_DEVICE_STATE;
+            CcDeferWrite(TestFileObject, PostDeferredWrite, TestFileObject, &DeferredWritesPosted, PAGE_SIZE, FALSE);
+            break;
+        case IOCTL_GET_DEFERRED_POSTED:
+        case IOCTL_GET_PAGING_WRITES:
+            if (Buffer == NULL || *OutLength < sizeof(ULONG))
+                return STATUS_BUFFER_TOO_SMALL;
+            *(PULONG)Buffer = (ControlCode == IOCTL_GET_DEFERRED_POSTED) ? DeferredWritesPosted : PagingWrites;
+            *OutLength = sizeof(ULONG);
+            break;
+        default:
+            ok(0, "Got an unknown message! DeviceObject=%p, ControlCode=%lu, Buffer=%p, In=%lu, Out=%lu bytes\n",
+                    DeviceObject, ControlCode, Buffer, InLength, *OutLength);
+            Status = STATUS_NOT_IMPLEMENTED;
+            break;
+    }
+
+    return Status;
+}
+
+static
+NTSTATUS
+TestIrpHandler(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION IoStack)
+{
+    NTSTATUS Status;
+    PTEST_FCB Fcb;
+    CACHE_UNINITIALIZE_EVENT CacheUninitEvent;
+
+    PAGED_CODE();
+
+    DPRINT("IRP %x/%x\n", IoStack->MajorFunction, IoStack->MinorFunction);
+    ASSERT(IoStack->MajorFunction == IRP_MJ_CLEANUP ||
+           IoStack->MajorFunction == IRP_MJ_CREATE ||
+           IoStack->MajorFunction == IRP_MJ_READ ||
+           IoStack->MajorFunction == IRP_MJ_WRITE);
+
+    Status = STATUS_NOT_SUPPORTED;
+    Irp->IoStatus.Information = 0;
+
+    if (IoStack->MajorFunction == IRP_MJ_CREATE)
+    {
+        /* Only the test file is cached, not the handle of the test framework */
+        if (IoStack->FileObject->FileName.Length >= 2 * sizeof(WCHAR))
+        {
+            Fcb = ExAllocatePoolWithTag(NonPagedPool, sizeof(*Fcb), 'FwrI');
+            if (Fcb == NULL)
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto Complete;
+            }
+            RtlZeroMemory(Fcb, sizeof(*Fcb));
+            ExInitializeFastMutex(&Fcb->HeaderMutex);
+            FsRtlSetupAdvancedHeader(&Fcb->Header, &Fcb->HeaderMutex);
+            Fcb->Header.AllocationSize.QuadPart = 0x400000;
+            Fcb->Header.FileSize.QuadPart = 0x400000;
+            Fcb->Header.ValidDataLength.QuadPart = 0x400000;
+            Fcb->Header.IsFastIoPossible = FastIoIsNotPossible;
+            IoStack->FileObject->FsContext = Fcb;
+            IoStack->FileObject->SectionObjectPointer = &Fcb->SectionObjectPointers;
+
+            CcInitializeCacheMap(IoStack->FileObject,
+                                 (PCC_FILE_SIZES)&Fcb->Header.AllocationSize,
+                                 FALSE, &Callbacks, NULL);
+
+            /* Two views worth of dirty pages */
+            CcSetDirtyPageThreshold(IoStack->FileObject, 2 * 0x40000 / PAGE_SIZE);
+            ok(BooleanFlagOn(Fcb->Header.Flags, FSRTL_FLAG_LIMIT_MODIFIED_PAGES), "Modified pages aren't limited\n");
+
+            TestFileObject = IoStack->FileObject;
+        }
+
+        Irp->IoStatus.Information = FILE_OPENED;
+        Status = STATUS_SUCCESS;
+    }
+    else if (IoStack->MajorFunction == IRP_MJ_READ ||
+             IoStack->MajorFunction == IRP_MJ_WRITE)
+    {
+        LARGE_INTEGER Offset;
+        ULONG Length;
+        PVOID Buffer;
+        BOOLEAN Ret;
+
+        ok_eq_pointer(IoStack->FileObject, TestFileObject);
+
+        if (IoStack->MajorFunction == IRP_MJ_READ)
+        {
+            Offset = IoStack->Parameters.Read.ByteOffset;
+            Length = IoStack->Parameters.Read.Length;
+        }
+        else
+        {
+            Offset = IoStack->Parameters.Write.ByteOffset;
+            Length = IoStack->Parameters.Write.Length;
+        }
+
+        if (FlagOn(Irp->Flags, IRP_NOCACHE))
+        {
+            /* The cache reads views before partly writing them, and the
+             * lazy writer writes them back */
+            ok((Irp->Flags & IRP_PAGING_IO) != 0, "Non paging IO\n");
+            ok(Offset.QuadPart % PAGE_SIZE == 0, "Offset is not aligned: %I64i\n", Offset.QuadPart);
+            if (IoStack->MajorFunction == IRP_MJ_READ)
+            {
+                Buffer = MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority);
+                ok(Buffer != NULL, "Null pointer!\n");
+                if (Buffer != NULL)
+                    RtlZeroMemory(Buffer, Length);
+            }
+            else
+            {
+                ok_bool_false(BlockLazyWrite, "BlockLazyWrite");
+                InterlockedIncrement(&PagingWrites);
+            }
+            Irp->IoStatus.Information = Length;
+            Status = STATUS_SUCCESS;
+        }
+        else if (IoStack->MajorFunction == IRP_MJ_WRITE)
+        {
+            Buffer = Irp->AssociatedIrp.SystemBuffer;
+            ok(Buffer != NULL, "Null pointer!\n");
+
+            /* Report throttled writes instead of waiting for the lazy writer */
+            if (!CcCanIWrite(IoStack->FileObject, Length, FALSE, FALSE))
+            {
+                Status = STATUS_CANT_WAIT;
+                goto Complete;
+            }
+
+            Status = STATUS_SUCCESS;
+            _SEH2_TRY
+            {
+                Ret = CcCopyWrite(IoStack->FileObject, &Offset, Length, TRUE, Buffer);
+                ok_bool_true(Ret, "CcCopyWrite");
+            }
+            _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+            {
+                Status = _SEH2_GetExceptionCode();
+            }
+            _SEH2_END;
+
+            if (NT_SUCCESS(Status))
+            {
+                Irp->IoStatus.Information = Length;
+            }
+        }
+    }
+    else if (IoStack->MajorFunction == IRP_MJ_CLEANUP)
+    {
+        Fcb = IoStack->FileObject->FsContext;
+        if (Fcb != NULL)
+        {
+            BlockLazyWrite = FALSE;
+            KeInitializeEvent(&CacheUninitEvent.Event, NotificationEvent, FALSE);
+            CcUninitializeCacheMap(IoStack->FileObject, NULL, &CacheUninitEvent);
+            KeWaitForSingleObject(&CacheUninitEvent.Event, Executive, KernelMode, FALSE, NULL);
+            ExFreePoolWithTag(Fcb, 'FwrI');
+            IoStack->FileObject->FsContext = NULL;
+            TestFileObject = NULL;
+        }
+        Status = STATUS_SUCCESS;
+    }
+
+Complete:
+    Irp->IoStatus.Status = Status;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return Status;
+}
@@ -0,0 +1,87 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite CcCopyWrite test user-mode part
+ */
+
+#include <kmt_test.h>
+
+#include "CcCopyWrite.h"
+
+#define VIEW_SIZE 0x40000
+
+static
+NTSTATUS
+WriteAt(
+    _In_ HANDLE Handle,
+    _In_ LONGLONG Offset)
+{
+    LARGE_INTEGER ByteOffset;
+    IO_STATUS_BLOCK IoStatusBlock;
+    UCHAR Buffer[10];
+
+    RtlFillMemory(Buffer, sizeof(Buffer), 0xBA);
+    ByteOffset.QuadPart = Offset;
+    return NtWriteFile(Handle, NULL, NULL, NULL, &IoStatusBlock, Buffer, sizeof(Buffer), &ByteOffset, NULL);
+}
+
+static
+ULONG
+GetCounter(
+    _In_ DWORD ControlCode)
+{
+    ULONG Value = -1;
+    DWORD Length = sizeof(Value);
+
+    ok_eq_ulong(KmtSendBufferToDriver(ControlCode, &Value, 0, &Length), (ULONG)ERROR_SUCCESS);
+    return Value;
+}
+
+START_TEST(CcCopyWrite)
+{
+    HANDLE Handle;
+    NTSTATUS Status;
+    IO_STATUS_BLOCK IoStatusBlock;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING ThrottleTest = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcCopyWrite\\ThrottleTest");
+    ULONG i;
+
+    KmtLoadDriver(L"CcCopyWrite", FALSE);
+    KmtOpenDriver();
+
+    InitializeObjectAttributes(&ObjectAttributes, &ThrottleTest, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtOpenFile(&Handle, FILE_ALL_ACCESS, &ObjectAttributes, &IoStatusBlock, 0, FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (!skip(NT_SUCCESS(Status), "No test file\n"))
+    {
+        /* The file may have two dirty views, and nothing gets written back for now */
+        ok_eq_ulong(KmtSendUlongToDriver(IOCTL_BLOCK_LAZY_WRITE, TRUE), (ULONG)ERROR_SUCCESS);
+        ok_eq_hex(WriteAt(Handle, 3), STATUS_SUCCESS);
+        ok_eq_hex(WriteAt(Handle, VIEW_SIZE + 3), STATUS_SUCCESS);
+        ok_eq_hex(WriteAt(Handle, 2 * VIEW_SIZE + 3), STATUS_CANT_WAIT);
+        ok_eq_hex(WriteAt(Handle, 3 * VIEW_SIZE + 3), STATUS_CANT_WAIT);
+
+        /* A deferred write waits for the lazy writer */
+        ok_eq_ulong(KmtSendToDriver(IOCTL_DEFER_WRITE), (ULONG)ERROR_SUCCESS);
+        Sleep(2000);
+        ok_eq_ulong(GetCounter(IOCTL_GET_DEFERRED_POSTED), 0LU);
+        ok_eq_ulong(GetCounter(IOCTL_GET_PAGING_WRITES), 0LU);
+
+        /* Once the dirty views are written back, it is posted */
+        ok_eq_ulong(KmtSendUlongToDriver(IOCTL_BLOCK_LAZY_WRITE, FALSE), (ULONG)ERROR_SUCCESS);
+        for (i = 0; i < 100 && GetCounter(IOCTL_GET_DEFERRED_POSTED) == 0; i++)
+        {
+            Sleep(100);
+        }
+        ok_eq_ulong(GetCounter(IOCTL_GET_DEFERRED_POSTED), 1LU);
+        ok(GetCounter(IOCTL_GET_PAGING_WRITES) != 0, "Nothing was written back\n");
+
+        /* And writers aren't throttled anymore */
+        ok_eq_hex(WriteAt(Handle, 2 * VIEW_SIZE + 3), STATUS_SUCCESS);
+
+        NtClose(Handle);
+    }
+
+    KmtCloseDriver();
+    KmtUnloadDriver();
+}
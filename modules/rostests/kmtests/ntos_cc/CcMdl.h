@@ -0,0 +1,20 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite CcMdl test declarations
+ */
+
+#ifndef _KMTEST_CCMDL_H_
+#define _KMTEST_CCMDL_H_
+
+#define IOCTL_MDL_READ              1
+#define IOCTL_MDL_WRITE             2
+#define IOCTL_MDL_WRITE_ABORT       3
+
+typedef struct _TEST_MDL_RANGE
+{
+    ULONG Offset;
+    ULONG Length;
+} TEST_MDL_RANGE, *PTEST_MDL_RANGE;
+
+#endif /* !defined _KMTEST_CCMDL_H_ */
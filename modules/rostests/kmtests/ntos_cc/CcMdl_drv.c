@@ -0,0 +1,431 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Test driver for CcMdlRead and CcPrepareMdlWrite
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#include "CcMdl.h"
+
+#define TEST_FILE_SIZE 0x400000
+#define WRITE_PATTERN 0xAB
+
+typedef struct _TEST_FCB
+{
+    FSRTL_ADVANCED_FCB_HEADER Header;
+    SECTION_OBJECT_POINTERS SectionObjectPointers;
+    FAST_MUTEX HeaderMutex;
+} TEST_FCB, *PTEST_FCB;
+
+static PFILE_OBJECT TestFileObject;
+static KMT_IRP_HANDLER TestIrpHandler;
+static KMT_MESSAGE_HANDLER TestMessageHandler;
+
+/* Paging reads return the page number in each byte */
+static
+UCHAR
+PatternAt(
+    _In_ LONGLONG Offset)
+{
+    return (UCHAR)(Offset / PAGE_SIZE);
+}
+
+NTSTATUS
+TestEntry(
+    _In_ PDRIVER_OBJECT DriverObject,
+    _In_ PCUNICODE_STRING RegistryPath,
+    _Out_ PCWSTR *DeviceName,
+    _Inout_ INT *Flags)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(RegistryPath);
+
+    *DeviceName = L"CcMdl";
+    *Flags = TESTENTRY_NO_EXCLUSIVE_DEVICE |
+             TESTENTRY_BUFFERED_IO_DEVICE |
+             TESTENTRY_NO_READONLY_DEVICE;
+
+    KmtRegisterIrpHandler(IRP_MJ_CLEANUP, NULL, TestIrpHandler);
+    KmtRegisterIrpHandler(IRP_MJ_CREATE, NULL, TestIrpHandler);
+    KmtRegisterIrpHandler(IRP_MJ_READ, NULL, TestIrpHandler);
+    KmtRegisterIrpHandler(IRP_MJ_WRITE, NULL, TestIrpHandler);
+    KmtRegisterMessageHandler(0, NULL, TestMessageHandler);
+
+    return Status;
+}
+
+VOID
+TestUnload(
+    _In_ PDRIVER_OBJECT DriverObject)
+{
+    PAGED_CODE();
+}
+
+BOOLEAN
+NTAPI
+AcquireForLazyWrite(
+    _In_ PVOID Context,
+    _In_ BOOLEAN Wait)
+{
+    return TRUE;
+}
+
+VOID
+NTAPI
+ReleaseFromLazyWrite(
+    _In_ PVOID Context)
+{
+    return;
+}
+
+BOOLEAN
+NTAPI
+AcquireForReadAhead(
+    _In_ PVOID Context,
+    _In_ BOOLEAN Wait)
+{
+    return TRUE;
+}
+
+VOID
+NTAPI
+ReleaseFromReadAhead(
+    _In_ PVOID Context)
+{
+    return;
+}
+
+static CACHE_MANAGER_CALLBACKS Callbacks = {
+    AcquireForLazyWrite,
+    ReleaseFromLazyWrite,
+    AcquireForReadAhead,
+    ReleaseFromReadAhead,
+};
+
+/* Walks a chain returned by the cache manager and checks that it describes
+ * the requested range, optionally comparing or filling its contents */
+static
+VOID
+CheckMdlChain(
+    _In_ PMDL MdlChain,
+    _In_ LONGLONG Offset,
+    _In_ ULONG Length,
+    _In_ BOOLEAN CheckPattern,
+    _In_ BOOLEAN Fill)
+{
+    PMDL Mdl;
+    PUCHAR Buffer;
+    ULONG Total = 0;
+    ULONG Count;
+    ULONG i;
+    ULONG Mismatches = 0;
+
+    for (Mdl = MdlChain; Mdl != NULL; Mdl = Mdl->Next)
+    {
+        Count = MmGetMdlByteCount(Mdl);
+        ok(Count != 0, "Empty MDL in the chain\n");
+        ok(Mdl->MdlFlags & MDL_PAGES_LOCKED, "MDL %p is not locked, flags %x\n", Mdl, Mdl->MdlFlags);
+        ok_eq_ulong(MmGetMdlByteOffset(Mdl), (ULONG)((Offset + Total) % PAGE_SIZE));
+
+        Buffer = MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority);
+        ok(Buffer != NULL, "Null pointer!\n");
+        if (Buffer != NULL)
+        {
+            if (Fill)
+            {
+                RtlFillMemory(Buffer, Count, WRITE_PATTERN);
+            }
+            else if (CheckPattern)
+            {
+                for (i = 0; i < Count; i++)
+                {
+                    if (Buffer[i] != PatternAt(Offset + Total + i))
+                        Mismatches++;
+                }
+            }
+        }
+
+        Total += Count;
+    }
+
+    ok_eq_ulong(Total, Length);
+    ok_eq_ulong(Mismatches, 0LU);
+}
+
+static
+VOID
+TestMdlRead(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ PLARGE_INTEGER Offset,
+    _In_ ULONG Length)
+{
+    PMDL MdlChain = NULL;
+    IO_STATUS_BLOCK IoStatus;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    RtlFillMemory(&IoStatus, sizeof(IoStatus), 0x55);
+    _SEH2_TRY
+    {
+        CcMdlRead(FileObject, Offset, Length, &MdlChain, &IoStatus);
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    ok_eq_hex(IoStatus.Status, STATUS_SUCCESS);
+    ok_eq_ulongptr(IoStatus.Information, Length);
+    ok(MdlChain != NULL, "No MDL chain\n");
+    if (MdlChain == NULL)
+        return;
+
+    CheckMdlChain(MdlChain, Offset->QuadPart, Length, TRUE, FALSE);
+    CcMdlReadComplete(FileObject, MdlChain);
+}
+
+static
+VOID
+TestMdlWrite(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ PLARGE_INTEGER Offset,
+    _In_ ULONG Length,
+    _In_ BOOLEAN Abort)
+{
+    PMDL MdlChain = NULL;
+    IO_STATUS_BLOCK IoStatus;
+    NTSTATUS Status = STATUS_SUCCESS;
+    PUCHAR Buffer;
+    ULONG i;
+    ULONG Mismatches = 0;
+    BOOLEAN Ret = FALSE;
+
+    RtlFillMemory(&IoStatus, sizeof(IoStatus), 0x55);
+    _SEH2_TRY
+    {
+        CcPrepareMdlWrite(FileObject, Offset, Length, &MdlChain, &IoStatus);
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    ok_eq_hex(IoStatus.Status, STATUS_SUCCESS);
+    ok_eq_ulongptr(IoStatus.Information, Length);
+    ok(MdlChain != NULL, "No MDL chain\n");
+    if (MdlChain == NULL)
+        return;
+
+    if (Abort)
+    {
+        CheckMdlChain(MdlChain, Offset->QuadPart, Length, FALSE, FALSE);
+        CcMdlWriteAbort(FileObject, MdlChain);
+        return;
+    }
+
+    CheckMdlChain(MdlChain, Offset->QuadPart, Length, FALSE, TRUE);
+    CcMdlWriteComplete(FileObject, Offset, MdlChain);
+
+    /* The data written through the chain is visible through the cache */
+    Buffer = ExAllocatePoolWithTag(NonPagedPool, Length, 'MldT');
+    ok(Buffer != NULL, "Null pointer!\n");
+    if (Buffer == NULL)
+        return;
+
+    _SEH2_TRY
+    {
+        Ret = CcCopyRead(FileObject, Offset, Length, TRUE, Buffer, &IoStatus);
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    ok_bool_true(Ret, "CcCopyRead");
+    if (Ret)
+    {
+        for (i = 0; i < Length; i++)
+        {
+            if (Buffer[i] != WRITE_PATTERN)
+                Mismatches++;
+        }
+        ok_eq_ulong(Mismatches, 0LU);
+    }
+
+    ExFreePoolWithTag(Buffer, 'MldT');
+}
+
+static
+NTSTATUS
+TestMessageHandler(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ ULONG ControlCode,
+    _In_opt_ PVOID Buffer,
+    _In_ SIZE_T InLength,
+    _Inout_ PSIZE_T OutLength)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PTEST_MDL_RANGE Range = Buffer;
+    LARGE_INTEGER Offset;
+
+    PAGED_CODE();
+
+    ok(TestFileObject != NULL, "No test file open\n");
+    if (TestFileObject == NULL)
+        return STATUS_INVALID_DEVICE_STATE;
+
+    ok(Buffer != NULL && InLength == sizeof(*Range), "Bad input\n");
+    if (Buffer == NULL || InLength != sizeof(*Range))
+        return STATUS_INVALID_PARAMETER;
+
+    ok(Range->Length != 0 && Range->Offset + Range->Length <= TEST_FILE_SIZE, "Bad range\n");
+    if (Range->Length == 0 || Range->Offset + Range->Length > TEST_FILE_SIZE)
+        return STATUS_INVALID_PARAMETER;
+
+    Offset.QuadPart = Range->Offset;
+    switch (ControlCode)
+    {
+        case IOCTL_MDL_READ:
+            TestMdlRead(TestFileObject, &Offset, Range->Length);
+            break;
+        case IOCTL_MDL_WRITE:
+        case IOCTL_MDL_WRITE_ABORT:
+            TestMdlWrite(TestFileObject, &Offset, Range->Length, ControlCode == IOCTL_MDL_WRITE_ABORT);
+            break;
+        default:
+            ok(0, "Got an unknown message! DeviceObject=%p, ControlCode=%lu, Buffer=%p, In=%lu, Out=%lu bytes\n",
+                    DeviceObject, ControlCode, Buffer, InLength, *OutLength);
+            Status = STATUS_NOT_IMPLEMENTED;
+            break;
+    }
+
+    *OutLength = 0;
+    return Status;
+}
+
+static
+NTSTATUS
+TestIrpHandler(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION IoStack)
+{
+    NTSTATUS Status;
+    PTEST_FCB Fcb;
+    CACHE_UNINITIALIZE_EVENT CacheUninitEvent;
+
+    PAGED_CODE();
+
+    DPRINT("IRP %x/%x\n", IoStack->MajorFunction, IoStack->MinorFunction);
+    ASSERT(IoStack->MajorFunction == IRP_MJ_CLEANUP ||
+           IoStack->MajorFunction == IRP_MJ_CREATE ||
+           IoStack->MajorFunction == IRP_MJ_READ ||
+           IoStack->MajorFunction == IRP_MJ_WRITE);
+
+    Status = STATUS_NOT_SUPPORTED;
+    Irp->IoStatus.Information = 0;
+
+    if (IoStack->MajorFunction == IRP_MJ_CREATE)
+    {
+        /* Only the test file is cached, not the handle of the test framework */
+        if (IoStack->FileObject->FileName.Length >= 2 * sizeof(WCHAR))
+        {
+            Fcb = ExAllocatePoolWithTag(NonPagedPool, sizeof(*Fcb), 'FldM');
+            if (Fcb == NULL)
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto Complete;
+            }
+            RtlZeroMemory(Fcb, sizeof(*Fcb));
+            ExInitializeFastMutex(&Fcb->HeaderMutex);
+            FsRtlSetupAdvancedHeader(&Fcb->Header, &Fcb->HeaderMutex);
+            Fcb->Header.AllocationSize.QuadPart = TEST_FILE_SIZE;
+            Fcb->Header.FileSize.QuadPart = TEST_FILE_SIZE;
+            Fcb->Header.ValidDataLength.QuadPart = TEST_FILE_SIZE;
+            Fcb->Header.IsFastIoPossible = FastIoIsNotPossible;
+            IoStack->FileObject->FsContext = Fcb;
+            IoStack->FileObject->SectionObjectPointer = &Fcb->SectionObjectPointers;
+
+            CcInitializeCacheMap(IoStack->FileObject,
+                                 (PCC_FILE_SIZES)&Fcb->Header.AllocationSize,
+                                 FALSE, &Callbacks, NULL);
+
+            TestFileObject = IoStack->FileObject;
+        }
+
+        Irp->IoStatus.Information = FILE_OPENED;
+        Status = STATUS_SUCCESS;
+    }
+    else if (IoStack->MajorFunction == IRP_MJ_READ ||
+             IoStack->MajorFunction == IRP_MJ_WRITE)
+    {
+        LARGE_INTEGER Offset;
+        ULONG Length;
+        PUCHAR Buffer;
+        ULONG i;
+
+        ok_eq_pointer(IoStack->FileObject, TestFileObject);
+
+        if (IoStack->MajorFunction == IRP_MJ_READ)
+        {
+            Offset = IoStack->Parameters.Read.ByteOffset;
+            Length = IoStack->Parameters.Read.Length;
+        }
+        else
+        {
+            Offset = IoStack->Parameters.Write.ByteOffset;
+            Length = IoStack->Parameters.Write.Length;
+        }
+
+        /* Only the cache manager reads and writes the test file */
+        ok(FlagOn(Irp->Flags, IRP_NOCACHE), "Cached IO\n");
+        ok((Irp->Flags & IRP_PAGING_IO) != 0, "Non paging IO\n");
+        ok(Offset.QuadPart % PAGE_SIZE == 0, "Offset is not aligned: %I64i\n", Offset.QuadPart);
+        if (IoStack->MajorFunction == IRP_MJ_READ)
+        {
+            Buffer = MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority);
+            ok(Buffer != NULL, "Null pointer!\n");
+            if (Buffer != NULL)
+            {
+                for (i = 0; i < Length; i++)
+                {
+                    Buffer[i] = PatternAt(Offset.QuadPart + i);
+                }
+            }
+        }
+        Irp->IoStatus.Information = Length;
+        Status = STATUS_SUCCESS;
+    }
+    else if (IoStack->MajorFunction == IRP_MJ_CLEANUP)
+    {
+        Fcb = IoStack->FileObject->FsContext;
+        if (Fcb != NULL)
+        {
+            KeInitializeEvent(&CacheUninitEvent.Event, NotificationEvent, FALSE);
+            CcUninitializeCacheMap(IoStack->FileObject, NULL, &CacheUninitEvent);
+            KeWaitForSingleObject(&CacheUninitEvent.Event, Executive, KernelMode, FALSE, NULL);
+            ExFreePoolWithTag(Fcb, 'FldM');
+            IoStack->FileObject->FsContext = NULL;
+            TestFileObject = NULL;
+        }
+        Status = STATUS_SUCCESS;
+    }
+
+Complete:
+    Irp->IoStatus.Status = Status;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return Status;
+}
@@ -0,0 +1,64 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite CcMdlRead/CcPrepareMdlWrite test user-mode part
+ */
+
+#include <kmt_test.h>
+
+#include "CcMdl.h"
+
+#define VIEW_SIZE 0x40000
+
+static
+DWORD
+SendRange(
+    _In_ DWORD ControlCode,
+    _In_ ULONG Offset,
+    _In_ ULONG Length)
+{
+    TEST_MDL_RANGE Range;
+    DWORD OutLength = 0;
+
+    Range.Offset = Offset;
+    Range.Length = Length;
+    return KmtSendBufferToDriver(ControlCode, &Range, sizeof(Range), &OutLength);
+}
+
+START_TEST(CcMdl)
+{
+    HANDLE Handle;
+    NTSTATUS Status;
+    IO_STATUS_BLOCK IoStatusBlock;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING MdlTest = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcMdl\\MdlTest");
+
+    KmtLoadDriver(L"CcMdl", FALSE);
+    KmtOpenDriver();
+
+    InitializeObjectAttributes(&ObjectAttributes, &MdlTest, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtOpenFile(&Handle, FILE_ALL_ACCESS, &ObjectAttributes, &IoStatusBlock, 0, FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (!skip(NT_SUCCESS(Status), "No test file\n"))
+    {
+        /* Within a view, unaligned, and across two views */
+        ok_eq_ulong(SendRange(IOCTL_MDL_READ, 0, PAGE_SIZE), (ULONG)ERROR_SUCCESS);
+        ok_eq_ulong(SendRange(IOCTL_MDL_READ, 3, 2 * PAGE_SIZE), (ULONG)ERROR_SUCCESS);
+        ok_eq_ulong(SendRange(IOCTL_MDL_READ, VIEW_SIZE - PAGE_SIZE - 5, 2 * PAGE_SIZE), (ULONG)ERROR_SUCCESS);
+        ok_eq_ulong(SendRange(IOCTL_MDL_READ, VIEW_SIZE - 0x100, 2 * VIEW_SIZE), (ULONG)ERROR_SUCCESS);
+
+        ok_eq_ulong(SendRange(IOCTL_MDL_WRITE, 4 * VIEW_SIZE + 7, PAGE_SIZE), (ULONG)ERROR_SUCCESS);
+        ok_eq_ulong(SendRange(IOCTL_MDL_WRITE, 6 * VIEW_SIZE - PAGE_SIZE, 2 * PAGE_SIZE), (ULONG)ERROR_SUCCESS);
+
+        ok_eq_ulong(SendRange(IOCTL_MDL_WRITE_ABORT, 8 * VIEW_SIZE + 11, PAGE_SIZE), (ULONG)ERROR_SUCCESS);
+        ok_eq_ulong(SendRange(IOCTL_MDL_WRITE_ABORT, 10 * VIEW_SIZE - PAGE_SIZE, 2 * PAGE_SIZE), (ULONG)ERROR_SUCCESS);
+
+        /* The views are still usable after the chains were released */
+        ok_eq_ulong(SendRange(IOCTL_MDL_READ, VIEW_SIZE - PAGE_SIZE - 5, 2 * PAGE_SIZE), (ULONG)ERROR_SUCCESS);
+
+        NtClose(Handle);
+    }
+
+    KmtCloseDriver();
+    KmtUnloadDriver();
+}
@@ -0,0 +1,104 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite lookaside list depth adjustment test
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#define TAG_TEST 'LxeT'
+#define TEST_ENTRY_SIZE 64
+#define TEST_BATCH_SIZE 200
+
+/* The balance set manager adjusts lookaside depths once a second */
+#define TEST_GROW_SECONDS 5
+#define TEST_SHRINK_SECONDS 40
+
+/* Same as ExMinimumLookasideDepth */
+#define MINIMUM_DEPTH 4
+
+static
+VOID
+Sleep100ms(VOID)
+{
+    LARGE_INTEGER Timeout;
+
+    Timeout.QuadPart = -100 * 10 * 1000;
+    KeDelayExecutionThread(KernelMode, FALSE, &Timeout);
+}
+
+/* Allocates a batch from an empty list, so most allocations miss */
+static
+VOID
+MissBatch(
+    _In_ PNPAGED_LOOKASIDE_LIST Lookaside,
+    _In_ PVOID *Entries)
+{
+    ULONG i;
+
+    for (i = 0; i < TEST_BATCH_SIZE; i++)
+    {
+        Entries[i] = ExAllocateFromNPagedLookasideList(Lookaside);
+        ok(Entries[i] != NULL, "Allocation %lu failed\n", i);
+    }
+
+    for (i = 0; i < TEST_BATCH_SIZE; i++)
+    {
+        if (Entries[i] != NULL)
+            ExFreeToNPagedLookasideList(Lookaside, Entries[i]);
+    }
+}
+
+START_TEST(ExLookaside)
+{
+    NPAGED_LOOKASIDE_LIST Lookaside;
+    PVOID *Entries;
+    USHORT Depth, LastDepth, MaxDepth;
+    ULONG i;
+
+    Entries = ExAllocatePoolWithTag(NonPagedPool, TEST_BATCH_SIZE * sizeof(PVOID), TAG_TEST);
+    if (skip(Entries != NULL, "Out of memory\n"))
+        return;
+
+    ExInitializeNPagedLookasideList(&Lookaside, NULL, NULL, 0, TEST_ENTRY_SIZE, TAG_TEST, 0);
+    ok_eq_uint(Lookaside.L.Depth, MINIMUM_DEPTH);
+    ok(Lookaside.L.MaximumDepth >= MINIMUM_DEPTH, "MaximumDepth = %u\n", Lookaside.L.MaximumDepth);
+
+    /* A list that keeps missing gets deeper */
+    MaxDepth = Lookaside.L.Depth;
+    for (i = 0; i < TEST_GROW_SECONDS * 10 && MaxDepth == MINIMUM_DEPTH; i++)
+    {
+        MissBatch(&Lookaside, Entries);
+        Sleep100ms();
+
+        Depth = Lookaside.L.Depth;
+        ok(Depth >= MINIMUM_DEPTH && Depth <= Lookaside.L.MaximumDepth,
+           "Depth %u out of [%u, %u]\n", Depth, MINIMUM_DEPTH, Lookaside.L.MaximumDepth);
+        if (Depth > MaxDepth) MaxDepth = Depth;
+    }
+    ok(MaxDepth > MINIMUM_DEPTH, "Depth did not grow: %u\n", MaxDepth);
+
+    /* Once idle, it shrinks back to the minimum and gives back its surplus */
+    LastDepth = Lookaside.L.Depth;
+    for (i = 0; i < TEST_SHRINK_SECONDS * 10 && LastDepth > MINIMUM_DEPTH; i++)
+    {
+        Sleep100ms();
+
+        Depth = Lookaside.L.Depth;
+        ok(Depth <= LastDepth, "Idle list grew from %u to %u\n", LastDepth, Depth);
+        ok(Depth >= MINIMUM_DEPTH, "Depth %u below %u\n", Depth, MINIMUM_DEPTH);
+        LastDepth = Depth;
+    }
+    ok_eq_uint(Lookaside.L.Depth, MINIMUM_DEPTH);
+
+    /* The trim runs right after the depth update, give it a moment */
+    Sleep100ms();
+    ok(ExQueryDepthSList(&Lookaside.L.ListHead) <= Lookaside.L.Depth,
+       "%u entries cached beyond depth %u\n", ExQueryDepthSList(&Lookaside.L.ListHead), Lookaside.L.Depth);
+
+    ExDeleteNPagedLookasideList(&Lookaside);
+    ExFreePoolWithTag(Entries, TAG_TEST);
+}
@@ -264,10 +264,62 @@ TestPoolQuota(VOID)
     KmtEndSeh(STATUS_SUCCESS);
 }
 
+static
+VOID
+TestPoolDescriptors(VOID)
+{
+    SYSTEM_PERFORMANCE_INFORMATION Before, After;
+    PUCHAR Blocks[64];
+    ULONG Processor, i, Size, Count = 0;
+    NTSTATUS Status;
+
+    Status = ZwQuerySystemInformation(SystemPerformanceInformation, &Before, sizeof(Before), NULL);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+
+    for (Processor = 0; Processor < (ULONG)KeNumberProcessors; Processor++)
+    {
+        /* Small blocks come from the descriptor of the current processor */
+        KeSetSystemAffinityThread((KAFFINITY)1 << Processor);
+        for (i = 0; i < RTL_NUMBER_OF(Blocks); i++)
+        {
+            Size = 8 + i * 24;
+            Blocks[i] = ExAllocatePoolWithTag(NonPagedPool, Size, TAG_POOLTEST);
+            ok(Blocks[i] != NULL, "Allocation of %lu bytes failed on processor %lu\n", Size, Processor);
+            if (Blocks[i] == NULL)
+                continue;
+            ok_eq_tag(KmtGetPoolTag(Blocks[i]), TAG_POOLTEST);
+            RtlFillMemory(Blocks[i], Size, (UCHAR)i);
+            Count++;
+        }
+
+        /* Free them from another processor, they must go back where they came from */
+        KeSetSystemAffinityThread((KAFFINITY)1 << ((Processor + 1) % KeNumberProcessors));
+        for (i = 0; i < RTL_NUMBER_OF(Blocks); i++)
+        {
+            if (Blocks[i] == NULL)
+                continue;
+            Size = 8 + i * 24;
+            ok(Blocks[i][0] == (UCHAR)i && Blocks[i][Size - 1] == (UCHAR)i,
+               "Block %lu of processor %lu was overwritten\n", i, Processor);
+            ExFreePoolWithTag(Blocks[i], TAG_POOLTEST);
+        }
+    }
+    KeRevertToUserAffinityThread();
+
+    /* The counters of all descriptors are reported */
+    Status = ZwQuerySystemInformation(SystemPerformanceInformation, &After, sizeof(After), NULL);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    ok(After.NonPagedPoolAllocs - Before.NonPagedPoolAllocs >= Count,
+       "%lu allocations, expected at least %lu\n", After.NonPagedPoolAllocs - Before.NonPagedPoolAllocs, Count);
+    ok(After.NonPagedPoolFrees - Before.NonPagedPoolFrees >= Count,
+       "%lu frees, expected at least %lu\n", After.NonPagedPoolFrees - Before.NonPagedPoolFrees, Count);
+}
+
 START_TEST(ExPools)
 {
     PoolsTest();
     PoolsCorruption();
     TestPoolTags();
     TestPoolQuota();
+    TestPoolDescriptors();
 }
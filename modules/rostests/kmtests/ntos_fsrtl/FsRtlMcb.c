@@ -687,9 +687,86 @@ static VOID FsRtlLargeMcbTestsExt2()
     FsRtlUninitializeLargeMcb(&FirstMcb);
 }
 
+#define FRAGMENTED_RUNS 20000
+
+static ULONGLONG ElapsedUs(LARGE_INTEGER Start, LARGE_INTEGER End, LARGE_INTEGER Frequency)
+{
+    return (End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart;
+}
+
+static VOID FsRtlLargeMcbBenchmark()
+{
+    LARGE_MCB LargeMcb;
+    LARGE_INTEGER Frequency, Start, Added, LookedUp, Enumerated, Split, Truncated;
+    LONGLONG Vbn, Lbn, SectorCount;
+    ULONG i, NbRuns, Index;
+    BOOLEAN AllAdded = TRUE, Found = TRUE, InOrder = TRUE;
+
+    FsRtlInitializeLargeMcb(&LargeMcb, PagedPool);
+
+    /* Every 8 sectors of the file live somewhere else on the disk, and one extent out of four is sparse */
+    Start = KeQueryPerformanceCounter(&Frequency);
+    for (i = 0; i < FRAGMENTED_RUNS; i++)
+    {
+        if (i % 4 == 1)
+            continue;
+        if (!FsRtlAddLargeMcbEntry(&LargeMcb, i * 8, (i * 7919 % FRAGMENTED_RUNS) * 16, 8))
+            AllAdded = FALSE;
+    }
+    Added = KeQueryPerformanceCounter(NULL);
+    ok(AllAdded == TRUE, "Failed to add the runs\n");
+    NbRuns = FsRtlNumberOfRunsInLargeMcb(&LargeMcb);
+    ok(NbRuns == FRAGMENTED_RUNS, "Expected %u runs, got: %lu\n", FRAGMENTED_RUNS, NbRuns);
+
+    for (i = 0; i < FRAGMENTED_RUNS; i++)
+    {
+        if (!FsRtlLookupLargeMcbEntry(&LargeMcb, i * 8 + i % 8, &Lbn, &SectorCount, NULL, NULL, &Index) ||
+            Lbn != ((i % 4 == 1) ? -1LL : (LONGLONG)(i * 7919 % FRAGMENTED_RUNS) * 16 + i % 8) ||
+            SectorCount != 8 - i % 8 || Index != i)
+        {
+            Found = FALSE;
+        }
+    }
+    LookedUp = KeQueryPerformanceCounter(NULL);
+    ok(Found == TRUE, "Lookups returned wrong runs\n");
+
+    for (i = 0; FsRtlGetNextLargeMcbEntry(&LargeMcb, i, &Vbn, &Lbn, &SectorCount); i++)
+    {
+        if (Vbn != i * 8 || SectorCount != 8)
+            InOrder = FALSE;
+    }
+    Enumerated = KeQueryPerformanceCounter(NULL);
+    ok(InOrder == TRUE, "Runs were not enumerated in order\n");
+    ok(i == FRAGMENTED_RUNS, "Enumerated %lu runs\n", i);
+
+    /* Shift the second half of the file */
+    ok(FsRtlSplitLargeMcb(&LargeMcb, FRAGMENTED_RUNS * 4, 8) == TRUE, "expected TRUE, got FALSE\n");
+    Split = KeQueryPerformanceCounter(NULL);
+    ok(FsRtlLookupLastLargeMcbEntryAndIndex(&LargeMcb, &Vbn, &Lbn, &Index) == TRUE, "expected TRUE, got FALSE\n");
+    ok(Vbn == FRAGMENTED_RUNS * 8 + 7, "Expected Vbn %u, got: %I64d\n", FRAGMENTED_RUNS * 8 + 7, Vbn);
+    ok(Index == FRAGMENTED_RUNS, "Expected Index %u, got: %lu\n", FRAGMENTED_RUNS, Index);
+
+    /* And cut it off again */
+    FsRtlTruncateLargeMcb(&LargeMcb, FRAGMENTED_RUNS * 4);
+    Truncated = KeQueryPerformanceCounter(NULL);
+    NbRuns = FsRtlNumberOfRunsInLargeMcb(&LargeMcb);
+    ok(NbRuns == FRAGMENTED_RUNS / 2, "Expected %u runs, got: %lu\n", FRAGMENTED_RUNS / 2, NbRuns);
+
+    trace("%u runs: add %I64u us, lookup %I64u us, enumerate %I64u us, split %I64u us, truncate %I64u us\n",
+          FRAGMENTED_RUNS,
+          ElapsedUs(Start, Added, Frequency),
+          ElapsedUs(Added, LookedUp, Frequency),
+          ElapsedUs(LookedUp, Enumerated, Frequency),
+          ElapsedUs(Enumerated, Split, Frequency),
+          ElapsedUs(Split, Truncated, Frequency));
+
+    FsRtlUninitializeLargeMcb(&LargeMcb);
+}
+
 START_TEST(FsRtlMcb)
 {
     FsRtlMcbTest();
     FsRtlLargeMcbTest();
     FsRtlLargeMcbTestsExt2();
+    FsRtlLargeMcbBenchmark();
 }
@@ -60,6 +60,70 @@ DpcHandler(
     ok_eq_pointer(Prcb->DpcData[DPC_NORMAL].DpcListHead.Blink, Dpc->DpcListEntry.Blink);
 }
 
+static KDEFERRED_ROUTINE ThreadedDpcHandler;
+
+static
+VOID
+NTAPI
+ThreadedDpcHandler(
+    IN PRKDPC Dpc,
+    IN PVOID DeferredContext,
+    IN PVOID SystemArgument1,
+    IN PVOID SystemArgument2)
+{
+    PKPRCB Prcb = KeGetCurrentPrcb();
+
+    /* with threaded DPCs enabled we run in the DPC thread at PASSIVE_LEVEL */
+    if (Prcb->ThreadDpcEnable)
+    {
+        ok_irql(PASSIVE_LEVEL);
+        ok_eq_uint(Prcb->DpcThreadActive, 1);
+        ok_eq_pointer(KeGetCurrentThread(), Prcb->DpcThread);
+    }
+    else
+    {
+        ok_irql(DISPATCH_LEVEL);
+    }
+    ok_eq_uint(Dpc->Type, ThreadedDpcObject);
+    ok_eq_pointer(Dpc->DpcData, NULL);
+    ok_eq_pointer(SystemArgument1, (PVOID)0xabc123);
+    ok_eq_pointer(SystemArgument2, (PVOID)0x5678);
+    InterlockedIncrement(&DpcCount);
+    KeSetEvent(DeferredContext, IO_NO_INCREMENT, FALSE);
+}
+
+static
+VOID
+TestThreadedDpc(VOID)
+{
+    KDPC Dpc;
+    KEVENT Event;
+    LARGE_INTEGER Timeout;
+    NTSTATUS Status;
+    BOOLEAN Ret;
+    int i;
+
+    KeInitializeEvent(&Event, SynchronizationEvent, FALSE);
+    KeInitializeThreadedDpc(&Dpc, ThreadedDpcHandler, &Event);
+    ok_eq_uint(Dpc.Type, ThreadedDpcObject);
+    ok_eq_pointer(Dpc.DpcData, NULL);
+
+    DpcCount = 0;
+    Timeout.QuadPart = -10 * 1000 * 1000;
+    for (i = 0; i < 5; ++i)
+    {
+        Ret = KeInsertQueueDpc(&Dpc, (PVOID)0xabc123, (PVOID)0x5678);
+        ok_bool_true(Ret, "KeInsertQueueDpc returned");
+        Status = KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, &Timeout);
+        ok_eq_hex(Status, STATUS_SUCCESS);
+    }
+    ok_eq_long(DpcCount, 5L);
+
+    /* nothing is left queued after a flush */
+    KeFlushQueuedDpcs();
+    ok_eq_pointer(Dpc.DpcData, NULL);
+}
+
 START_TEST(KeDpc)
 {
     NTSTATUS Status = STATUS_SUCCESS;
@@ -178,4 +242,6 @@ START_TEST(KeDpc)
     ok_dpccount();
     ok_irql(PASSIVE_LEVEL);
     trace("Final Dpc count: %ld, expected %ld\n", DpcCount, ExpectedDpcCount);
+
+    TestThreadedDpc();
 }
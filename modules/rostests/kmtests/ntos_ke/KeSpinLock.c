@@ -51,8 +51,6 @@ BOOLEAN
 *pKeTestSpinLock)(
   _In_ PKSPIN_LOCK SpinLock);
 
-/* TODO: multiprocessor testing */
-
 struct _CHECK_DATA;
 typedef struct _CHECK_DATA CHECK_DATA, *PCHECK_DATA;
 
@@ -321,6 +319,130 @@ TestSpinLock(
     KmtSetIrql(CheckData->OriginalIrql);
 }
 
+#define CONTENTION_ITERATIONS 100000
+
+typedef struct _CONTENTION_DATA
+{
+    KSPIN_LOCK SpinLock;
+    BOOLEAN Queued;
+    KEVENT StartEvent;
+    volatile LONG Ready;
+    ULONG Counter;
+    ULONG Owners;
+    BOOLEAN Overlapped;
+} CONTENTION_DATA, *PCONTENTION_DATA;
+
+typedef struct _CONTENTION_THREAD
+{
+    PCONTENTION_DATA Data;
+    CCHAR Processor;
+    HANDLE Handle;
+    PKTHREAD Thread;
+} CONTENTION_THREAD, *PCONTENTION_THREAD;
+
+static
+VOID
+NTAPI
+ContentionThread(
+    IN PVOID Context)
+{
+    PCONTENTION_THREAD ThreadData = Context;
+    PCONTENTION_DATA Data = ThreadData->Data;
+    KLOCK_QUEUE_HANDLE LockHandle;
+    KIRQL OldIrql;
+    ULONG i;
+
+    KeSetSystemAffinityThread((KAFFINITY)1 << ThreadData->Processor);
+    InterlockedIncrement(&Data->Ready);
+    KeWaitForSingleObject(&Data->StartEvent, Executive, KernelMode, FALSE, NULL);
+
+    for (i = 0; i < CONTENTION_ITERATIONS; ++i)
+    {
+        if (Data->Queued)
+            KeAcquireInStackQueuedSpinLock(&Data->SpinLock, &LockHandle);
+        else
+            KeAcquireSpinLock(&Data->SpinLock, &OldIrql);
+
+        /* a second owner inside the lock would be a broken lock */
+        if (Data->Owners++ != 0)
+            Data->Overlapped = TRUE;
+        Data->Counter++;
+        Data->Owners--;
+
+        if (Data->Queued)
+            KeReleaseInStackQueuedSpinLock(&LockHandle);
+        else
+            KeReleaseSpinLock(&Data->SpinLock, OldIrql);
+    }
+
+    KeRevertToUserAffinityThread();
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+static
+VOID
+TestContention(
+    IN BOOLEAN Queued)
+{
+    CONTENTION_THREAD Threads[MAXIMUM_PROCESSORS];
+    CONTENTION_DATA Data;
+    OBJECT_ATTRIBUTES Attributes;
+    LARGE_INTEGER Frequency, Start, End, Timeout;
+    NTSTATUS Status;
+    CCHAR Count = KeNumberProcessors, i;
+
+    RtlZeroMemory(&Data, sizeof(Data));
+    KeInitializeSpinLock(&Data.SpinLock);
+    KeInitializeEvent(&Data.StartEvent, NotificationEvent, FALSE);
+    Data.Queued = Queued;
+
+    InitializeObjectAttributes(&Attributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+    for (i = 0; i < Count; ++i)
+    {
+        Threads[i].Data = &Data;
+        Threads[i].Processor = i;
+        Threads[i].Thread = NULL;
+        Status = PsCreateSystemThread(&Threads[i].Handle, GENERIC_ALL, &Attributes, NULL, NULL, ContentionThread, &Threads[i]);
+        ok_eq_hex(Status, STATUS_SUCCESS);
+        if (!NT_SUCCESS(Status))
+        {
+            Count = i;
+            break;
+        }
+        Status = ObReferenceObjectByHandle(Threads[i].Handle, SYNCHRONIZE, *PsThreadType, KernelMode, (PVOID *)&Threads[i].Thread, NULL);
+        ok_eq_hex(Status, STATUS_SUCCESS);
+    }
+
+    /* let every thread reach its processor before starting the clock */
+    Timeout.QuadPart = -10 * 1000;
+    while (Data.Ready < Count)
+        KeDelayExecutionThread(KernelMode, FALSE, &Timeout);
+
+    Start = KeQueryPerformanceCounter(&Frequency);
+    KeSetEvent(&Data.StartEvent, IO_NO_INCREMENT, FALSE);
+    for (i = 0; i < Count; ++i)
+    {
+        if (Threads[i].Thread)
+        {
+            Status = KeWaitForSingleObject(Threads[i].Thread, Executive, KernelMode, FALSE, NULL);
+            ok_eq_hex(Status, STATUS_SUCCESS);
+            ObDereferenceObject(Threads[i].Thread);
+        }
+        ZwClose(Threads[i].Handle);
+    }
+    End = KeQueryPerformanceCounter(NULL);
+
+    ok_eq_ulong(Data.Counter, (ULONG)Count * CONTENTION_ITERATIONS);
+    ok_bool_false(Data.Overlapped, "Lock owners overlapped:");
+    ok_eq_ulongptr(Data.SpinLock, 0);
+
+    trace("%s spin lock, %d processors x %u acquisitions: %I64u us\n",
+          Queued ? "Queued" : "Normal",
+          Count,
+          CONTENTION_ITERATIONS,
+          (End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart);
+}
+
 START_TEST(KeSpinLock)
 {
     KSPIN_LOCK SpinLock = (KSPIN_LOCK)0x5555555555555555LL;
@@ -403,4 +525,11 @@ START_TEST(KeSpinLock)
     }
 
     KmtSetIrql(PASSIVE_LEVEL);
+
+    /* multiprocessor contention: correctness of both flavors, and their cost */
+    if (!skip(KeNumberProcessors > 1, "Contention test needs more than one processor\n"))
+    {
+        TestContention(FALSE);
+        TestContention(TRUE);
+    }
 }
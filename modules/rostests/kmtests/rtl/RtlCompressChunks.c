@@ -0,0 +1,149 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite chunk-level compression test
+ */
+
+#include <kmt_test.h>
+
+#define TAG_TEST 'CltR'
+#define UNIT_SIZE (16 * 4096)
+#define UNIT_CHUNKS (UNIT_SIZE / 4096)
+
+typedef struct _TEST_DATA_INFO
+{
+    COMPRESSED_DATA_INFO Info;
+    ULONG MoreChunkSizes[UNIT_CHUNKS - 1];
+} TEST_DATA_INFO;
+
+static
+VOID
+FillUnit(
+    PUCHAR Buffer)
+{
+    ULONG Seed = 1, i;
+
+    for (i = 0; i < UNIT_SIZE; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        /* one chunk of zeros, one chunk of random data, the rest compresses */
+        if (i / 4096 == 3)
+            Buffer[i] = 0;
+        else if (i / 4096 == 5)
+            Buffer[i] = (UCHAR)(Seed >> 16);
+        else
+            Buffer[i] = (UCHAR)((Seed >> 16) % 5);
+    }
+}
+
+static
+VOID
+TestDescribeReserve(
+    PUCHAR Source,
+    PUCHAR Scratch,
+    PUCHAR Buffer,
+    ULONG BufferSize,
+    PVOID WorkSpace)
+{
+    PUCHAR Current = Buffer, End = Buffer + BufferSize, ChunkBuffer;
+    ULONG ChunkSize, CompressedSize;
+    NTSTATUS Status;
+
+    Status = RtlReserveChunk(COMPRESSION_FORMAT_LZNT1, &Current, End, &ChunkBuffer, 0);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    ok_eq_pointer(ChunkBuffer, Buffer);
+
+    Status = RtlReserveChunk(COMPRESSION_FORMAT_LZNT1, &Current, End, &ChunkBuffer, 4096);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    RtlCopyMemory(ChunkBuffer, Source, 4096);
+
+    Status = RtlCompressBuffer(COMPRESSION_FORMAT_LZNT1, Source, 4096, Scratch,
+                               4096, 4096, &CompressedSize, WorkSpace);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    Status = RtlReserveChunk(COMPRESSION_FORMAT_LZNT1, &Current, End, &ChunkBuffer, CompressedSize);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    RtlCopyMemory(ChunkBuffer, Scratch, CompressedSize);
+    End = Current;
+
+    Current = Buffer;
+    Status = RtlDescribeChunk(COMPRESSION_FORMAT_LZNT1, &Current, End, &ChunkBuffer, &ChunkSize);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    ok_eq_ulong(ChunkSize, 0UL);
+    Status = RtlDescribeChunk(COMPRESSION_FORMAT_LZNT1, &Current, End, &ChunkBuffer, &ChunkSize);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    ok_eq_ulong(ChunkSize, 4096UL);
+    ok(RtlCompareMemory(ChunkBuffer, Source, 4096) == 4096, "Uncompressed chunk mismatch\n");
+    Status = RtlDescribeChunk(COMPRESSION_FORMAT_LZNT1, &Current, End, &ChunkBuffer, &ChunkSize);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    ok_eq_ulong(ChunkSize, CompressedSize);
+    Status = RtlDescribeChunk(COMPRESSION_FORMAT_LZNT1, &Current, End, &ChunkBuffer, &ChunkSize);
+    ok_eq_hex(Status, STATUS_NO_MORE_ENTRIES);
+    ok_eq_ulong(ChunkSize, 0UL);
+}
+
+START_TEST(RtlCompressChunks)
+{
+    ULONG CompressWorkSpace, FragmentWorkSpace, Total, Split, i;
+    PUCHAR Source, Compressed, Decompressed;
+    TEST_DATA_INFO DataInfo;
+    PVOID WorkSpace;
+    NTSTATUS Status;
+
+    Status = RtlGetCompressionWorkSpaceSize(COMPRESSION_FORMAT_LZNT1, &CompressWorkSpace, &FragmentWorkSpace);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+
+    WorkSpace = ExAllocatePoolWithTag(NonPagedPool, CompressWorkSpace, TAG_TEST);
+    Source = ExAllocatePoolWithTag(NonPagedPool, UNIT_SIZE, TAG_TEST);
+    Compressed = ExAllocatePoolWithTag(NonPagedPool, UNIT_SIZE, TAG_TEST);
+    Decompressed = ExAllocatePoolWithTag(NonPagedPool, UNIT_SIZE, TAG_TEST);
+    if (!skip(WorkSpace && Source && Compressed && Decompressed, "Out of memory\n"))
+    {
+        FillUnit(Source);
+
+        RtlZeroMemory(&DataInfo, sizeof(DataInfo));
+        DataInfo.Info.CompressionFormatAndEngine = COMPRESSION_FORMAT_LZNT1;
+        DataInfo.Info.CompressionUnitShift = 16;
+        DataInfo.Info.ChunkShift = 12;
+        DataInfo.Info.ClusterShift = 9;
+        Status = RtlCompressChunks(Source, UNIT_SIZE, Compressed, UNIT_SIZE,
+                                   &DataInfo.Info, sizeof(DataInfo), WorkSpace);
+        ok_eq_hex(Status, STATUS_SUCCESS);
+        ok_eq_uint(DataInfo.Info.NumberOfChunks, UNIT_CHUNKS);
+        ok_eq_ulong(DataInfo.Info.CompressedChunkSizes[3], 0UL);
+        ok_eq_ulong(DataInfo.Info.CompressedChunkSizes[5], 4096UL);
+
+        Total = 0;
+        for (i = 0; i < UNIT_CHUNKS; i++)
+        {
+            ok(DataInfo.Info.CompressedChunkSizes[i] <= 4096, "Chunk %lu has size %lu\n", i, DataInfo.Info.CompressedChunkSizes[i]);
+            Total += DataInfo.Info.CompressedChunkSizes[i];
+        }
+
+        /* any split between buffer and tail has to give back the same data */
+        for (Split = 0; Split <= Total; Split += 1000)
+        {
+            RtlFillMemory(Decompressed, UNIT_SIZE, 0x55);
+            Status = RtlDecompressChunks(Decompressed, UNIT_SIZE, Compressed, Split,
+                                         Compressed + Split, Total - Split, &DataInfo.Info);
+            ok_eq_hex(Status, STATUS_SUCCESS);
+            ok(RtlCompareMemory(Decompressed, Source, UNIT_SIZE) == UNIT_SIZE, "Data mismatch for split %lu\n", Split);
+        }
+
+        /* a single chunk can be decompressed on its own */
+        Split = 0;
+        for (i = 0; i < 7; i++)
+            Split += DataInfo.Info.CompressedChunkSizes[i];
+        Status = RtlDecompressBuffer(COMPRESSION_FORMAT_LZNT1, Decompressed, 4096, Compressed + Split,
+                                     DataInfo.Info.CompressedChunkSizes[7], &Total);
+        ok_eq_hex(Status, STATUS_SUCCESS);
+        ok_eq_ulong(Total, 4096UL);
+        ok(RtlCompareMemory(Decompressed, Source + 7 * 4096, 4096) == 4096, "Chunk 7 mismatch\n");
+
+        TestDescribeReserve(Source, Decompressed, Compressed, UNIT_SIZE, WorkSpace);
+    }
+
+    if (Decompressed) ExFreePoolWithTag(Decompressed, TAG_TEST);
+    if (Compressed) ExFreePoolWithTag(Compressed, TAG_TEST);
+    if (Source) ExFreePoolWithTag(Source, TAG_TEST);
+    if (WorkSpace) ExFreePoolWithTag(WorkSpace, TAG_TEST);
+}
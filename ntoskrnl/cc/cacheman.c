@@ -16,6 +16,19 @@
 BOOLEAN CcPfEnablePrefetcher;
 PFSN_PREFETCHER_GLOBALS CcPfGlobals;
 
+extern KGUARDED_MUTEX ViewLock;
+
+/* Upper bound for the data read ahead of a single request */
+#define CC_MAX_READ_AHEAD (16 * VACB_MAPPING_GRANULARITY)
+
+typedef struct _CC_READ_AHEAD_CONTEXT
+{
+    WORK_QUEUE_ITEM WorkItem;
+    PFILE_OBJECT FileObject;
+    LONGLONG FileOffset;
+    LONGLONG Length;
+} CC_READ_AHEAD_CONTEXT, *PCC_READ_AHEAD_CONTEXT;
+
 /* FUNCTIONS *****************************************************************/
 
 VOID
@@ -45,6 +58,91 @@ CcInitializeCacheManager(VOID)
     return TRUE;
 }
 
+static
+VOID
+NTAPI
+CcRosReadAheadWorker(
+    IN PVOID Parameter)
+{
+    PCC_READ_AHEAD_CONTEXT Context = Parameter;
+    PFILE_OBJECT FileObject = Context->FileObject;
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    PROS_PRIVATE_CACHE_MAP PrivateCacheMap;
+    LONGLONG CurrentOffset, EndOffset;
+    PVOID BaseAddress;
+    PROS_VACB Vacb;
+    BOOLEAN Valid;
+    NTSTATUS Status;
+    KIRQL OldIrql;
+
+    /* Keep the shared cache map around while we're reading, the file
+     * may have been closed since the read ahead was scheduled */
+    KeAcquireGuardedMutex(&ViewLock);
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    if (SharedCacheMap != NULL && FileObject->PrivateCacheMap != NULL)
+    {
+        SharedCacheMap->OpenCount++;
+    }
+    else
+    {
+        SharedCacheMap = NULL;
+    }
+    KeReleaseGuardedMutex(&ViewLock);
+
+    /* Don't wait for the file system, it may be tearing the cache map down
+     * and waiting for us. Read ahead is only an optimization anyway. */
+    if (SharedCacheMap != NULL &&
+        SharedCacheMap->Callbacks->AcquireForReadAhead(SharedCacheMap->LazyWriteContext, FALSE))
+    {
+        CurrentOffset = ROUND_DOWN(Context->FileOffset, VACB_MAPPING_GRANULARITY);
+        EndOffset = Context->FileOffset + Context->Length;
+        while (CurrentOffset < EndOffset)
+        {
+            Status = CcRosRequestVacb(SharedCacheMap,
+                                      CurrentOffset,
+                                      &BaseAddress,
+                                      &Valid,
+                                      &Vacb);
+            if (!NT_SUCCESS(Status))
+                break;
+
+            /* Only fault in views the reader didn't get to already */
+            if (!Valid)
+            {
+                Status = CcReadVirtualAddress(Vacb);
+                Valid = NT_SUCCESS(Status);
+            }
+            CcRosReleaseVacb(SharedCacheMap, Vacb, Valid, FALSE, FALSE);
+            if (!Valid)
+                break;
+
+            CurrentOffset += VACB_MAPPING_GRANULARITY;
+        }
+
+        SharedCacheMap->Callbacks->ReleaseFromReadAhead(SharedCacheMap->LazyWriteContext);
+    }
+
+    /* Let the file object schedule the next read ahead */
+    KeAcquireGuardedMutex(&ViewLock);
+    PrivateCacheMap = FileObject->PrivateCacheMap;
+    if (PrivateCacheMap != NULL)
+    {
+        KeAcquireSpinLock(&PrivateCacheMap->ReadAheadSpinLock, &OldIrql);
+        PrivateCacheMap->ReadAheadActive = FALSE;
+        KeSetEvent(&PrivateCacheMap->ReadAheadDone, IO_NO_INCREMENT, FALSE);
+        KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+    }
+    KeReleaseGuardedMutex(&ViewLock);
+
+    if (SharedCacheMap != NULL)
+    {
+        CcRosDereferenceCache(FileObject);
+    }
+
+    ObDereferenceObject(FileObject);
+    ExFreePoolWithTag(Context, TAG_CC);
+}
+
 /*
  * @unimplemented
  */
@@ -78,17 +176,108 @@ CcRemapBcb (
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
 CcScheduleReadAhead (
-	IN	PFILE_OBJECT		FileObject,
-	IN	PLARGE_INTEGER		FileOffset,
-	IN	ULONG			Length
-	)
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER FileOffset,
+    IN ULONG Length)
 {
-	UNIMPLEMENTED;
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    PROS_PRIVATE_CACHE_MAP PrivateCacheMap;
+    PCC_READ_AHEAD_CONTEXT Context;
+    LONGLONG ReadEnd, ReadAheadStart, ReadAheadEnd, Window;
+    BOOLEAN Sequential;
+    KIRQL OldIrql;
+
+    CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d Length=%lu\n",
+        FileObject, FileOffset->QuadPart, Length);
+
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    PrivateCacheMap = FileObject->PrivateCacheMap;
+    if (SharedCacheMap == NULL || PrivateCacheMap == NULL || Length == 0)
+    {
+        return;
+    }
+
+    ReadEnd = FileOffset->QuadPart + Length;
+
+    /* Read twice the request, rounded to the file's granularity, but
+     * always keep at least the next view ahead of the reader */
+    Window = ((LONGLONG)Length + PrivateCacheMap->ReadAheadMask) & ~(LONGLONG)PrivateCacheMap->ReadAheadMask;
+    Window = min(max(2 * Window, VACB_MAPPING_GRANULARITY), CC_MAX_READ_AHEAD);
+
+    KeAcquireSpinLock(&PrivateCacheMap->ReadAheadSpinLock, &OldIrql);
+
+    /* File systems may schedule read ahead for a read CcCopyRead already handled */
+    if (FileOffset->QuadPart == PrivateCacheMap->FileOffset.QuadPart &&
+        ReadEnd == PrivateCacheMap->BeyondLastByte.QuadPart)
+    {
+        KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+        return;
+    }
+
+    /* A read is sequential if it starts in the granule where the previous
+     * one ended. The very first read of the file counts too. */
+    Sequential = ((FileOffset->QuadPart & ~(LONGLONG)PrivateCacheMap->ReadAheadMask) ==
+                  (PrivateCacheMap->BeyondLastByte.QuadPart & ~(LONGLONG)PrivateCacheMap->ReadAheadMask)) ||
+                 (FileOffset->QuadPart == PrivateCacheMap->BeyondLastByte.QuadPart);
+
+    PrivateCacheMap->FileOffset.QuadPart = FileOffset->QuadPart;
+    PrivateCacheMap->BeyondLastByte.QuadPart = ReadEnd;
+
+    /* Forget about the previous read ahead when the reader seeks */
+    if (!Sequential)
+    {
+        PrivateCacheMap->ReadAheadOffset.QuadPart = 0;
+        PrivateCacheMap->ReadAheadLength = 0;
+    }
+
+    if (!Sequential ||
+        !PrivateCacheMap->ReadAheadEnabled ||
+        PrivateCacheMap->ReadAheadActive)
+    {
+        KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+        return;
+    }
+
+    /* The reader already faulted in the views up to the end of its request,
+     * and the previous read ahead may have gone further */
+    ReadAheadStart = max(ROUND_UP(ReadEnd, VACB_MAPPING_GRANULARITY),
+                         PrivateCacheMap->ReadAheadOffset.QuadPart + PrivateCacheMap->ReadAheadLength);
+    ReadAheadEnd = min(ReadEnd + Window, SharedCacheMap->FileSize.QuadPart);
+    if (ReadAheadStart >= ReadAheadEnd)
+    {
+        KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+        return;
+    }
+
+    PrivateCacheMap->ReadAheadOffset.QuadPart = ReadAheadStart;
+    PrivateCacheMap->ReadAheadLength = (ULONG)(ReadAheadEnd - ReadAheadStart);
+    PrivateCacheMap->ReadAheadActive = TRUE;
+    KeClearEvent(&PrivateCacheMap->ReadAheadDone);
+
+    KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+
+    Context = ExAllocatePoolWithTag(NonPagedPool, sizeof(*Context), TAG_CC);
+    if (Context == NULL)
+    {
+        KeAcquireSpinLock(&PrivateCacheMap->ReadAheadSpinLock, &OldIrql);
+        PrivateCacheMap->ReadAheadLength = 0;
+        PrivateCacheMap->ReadAheadActive = FALSE;
+        KeSetEvent(&PrivateCacheMap->ReadAheadDone, IO_NO_INCREMENT, FALSE);
+        KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+        return;
+    }
+
+    ObReferenceObject(FileObject);
+    Context->FileObject = FileObject;
+    Context->FileOffset = ReadAheadStart;
+    Context->Length = ReadAheadEnd - ReadAheadStart;
+    ExInitializeWorkItem(&Context->WorkItem, CcRosReadAheadWorker, Context);
+    ExQueueWorkItem(&Context->WorkItem, DelayedWorkQueue);
 }
 
 /*
@@ -133,7 +322,7 @@ CcSetBcbOwnerPointer (
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -142,26 +331,53 @@ CcSetDirtyPageThreshold (
 	IN	ULONG		DirtyPageThreshold
 	)
 {
+    PFSRTL_COMMON_FCB_HEADER Fcb;
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+
     CCTRACE(CC_API_DEBUG, "FileObject=%p DirtyPageThreshold=%lu\n",
         FileObject, DirtyPageThreshold);
 
-	UNIMPLEMENTED;
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    if (SharedCacheMap != NULL)
+    {
+        SharedCacheMap->DirtyPageThreshold = DirtyPageThreshold;
+    }
+
+    /* Tell FsRtl that writes to this file may get throttled by CcCanIWrite */
+    Fcb = FileObject->FsContext;
+    if (!BooleanFlagOn(Fcb->Flags, FSRTL_FLAG_LIMIT_MODIFIED_PAGES))
+    {
+        SetFlag(Fcb->Flags, FSRTL_FLAG_LIMIT_MODIFIED_PAGES);
+    }
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
 CcSetReadAheadGranularity (
-	IN	PFILE_OBJECT	FileObject,
-	IN	ULONG		Granularity
-	)
+    IN PFILE_OBJECT FileObject,
+    IN ULONG Granularity)
 {
-    static ULONG Warn;
+    PROS_PRIVATE_CACHE_MAP PrivateCacheMap;
 
     CCTRACE(CC_API_DEBUG, "FileObject=%p Granularity=%lu\n",
         FileObject, Granularity);
 
-    if (!Warn++) UNIMPLEMENTED;
+    PrivateCacheMap = FileObject->PrivateCacheMap;
+    if (PrivateCacheMap == NULL)
+    {
+        DPRINT1("Setting read ahead granularity on uncached file object %p\n", FileObject);
+        return;
+    }
+
+    /* The granularity is used as a mask */
+    if (Granularity < PAGE_SIZE || (Granularity & (Granularity - 1)) != 0)
+    {
+        DPRINT1("Invalid read ahead granularity %lu\n", Granularity);
+        return;
+    }
+
+    PrivateCacheMap->ReadAheadMask = Granularity - 1;
 }
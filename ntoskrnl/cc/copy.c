@@ -34,6 +34,24 @@ ULONG CcFastReadWait;
 ULONG CcFastReadNoWait;
 ULONG CcFastReadResourceMiss;
 
+extern ULONG DirtyPageCount;
+
+/* Writers waiting for the lazy writer, in arrival order */
+typedef struct _CC_DEFERRED_WRITE
+{
+    LIST_ENTRY DeferredWriteLinks;
+    PFILE_OBJECT FileObject;
+    ULONG BytesToWrite;
+    /* Either a CcCanIWrite caller waiting on Event, or a CcDeferWrite post */
+    PKEVENT Event;
+    PCC_POST_DEFERRED_WRITE PostRoutine;
+    PVOID Context1;
+    PVOID Context2;
+} CC_DEFERRED_WRITE, *PCC_DEFERRED_WRITE;
+
+LIST_ENTRY CcDeferredWrites;
+KSPIN_LOCK CcDeferredWriteSpinLock;
+
 /* FUNCTIONS *****************************************************************/
 
 VOID
@@ -244,7 +262,7 @@ CcCopyData (
     ULONG BytesCopied;
     KIRQL OldIrql;
     PROS_SHARED_CACHE_MAP SharedCacheMap;
-    PLIST_ENTRY ListEntry;
+    LONGLONG ViewOffset;
     PROS_VACB Vacb;
     ULONG PartialLength;
     PVOID BaseAddress;
@@ -258,26 +276,18 @@ CcCopyData (
     {
         /* test if the requested data is available */
         KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &OldIrql);
-        /* FIXME: this loop doesn't take into account areas that don't have
-         * a VACB in the list yet */
-        ListEntry = SharedCacheMap->CacheMapVacbListHead.Flink;
-        while (ListEntry != &SharedCacheMap->CacheMapVacbListHead)
+        for (ViewOffset = ROUND_DOWN(CurrentOffset, VACB_MAPPING_GRANULARITY);
+             ViewOffset < CurrentOffset + Length;
+             ViewOffset += VACB_MAPPING_GRANULARITY)
         {
-            Vacb = CONTAINING_RECORD(ListEntry,
-                                     ROS_VACB,
-                                     CacheMapVacbListEntry);
-            ListEntry = ListEntry->Flink;
-            if (!Vacb->Valid &&
-                DoRangesIntersect(Vacb->FileOffset.QuadPart,
-                                  VACB_MAPPING_GRANULARITY,
-                                  CurrentOffset, Length))
+            /* Views that don't exist yet would have to be read too */
+            Vacb = CcRosIndexLookupVacb(SharedCacheMap, ViewOffset);
+            if (Vacb == NULL || !Vacb->Valid)
             {
                 KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
                 /* data not available */
                 return FALSE;
             }
-            if (Vacb->FileOffset.QuadPart >= CurrentOffset + Length)
-                break;
         }
         KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
     }
@@ -363,7 +373,102 @@ CcCopyData (
 }
 
 /*
- * @unimplemented
+ * Checks whether BytesToWrite more bytes of dirty data for the file still fit
+ * in the global and per-file limits. PendingPages are pages promised to other
+ * writers that haven't been dirtied yet.
+ */
+static
+BOOLEAN
+CcRosCanWriteNow (
+    IN PFILE_OBJECT FileObject,
+    IN ULONG BytesToWrite,
+    IN ULONG PendingPages)
+{
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    ULONG Pages = BYTES_TO_PAGES(BytesToWrite);
+    ULONG Dirty;
+
+    /* With nothing dirty there's nothing to wait for, however big the write */
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    if (SharedCacheMap != NULL && SharedCacheMap->DirtyPageThreshold != 0)
+    {
+        Dirty = SharedCacheMap->DirtyPages;
+        if (Dirty != 0 && Dirty + Pages > SharedCacheMap->DirtyPageThreshold)
+        {
+            return FALSE;
+        }
+    }
+
+    Dirty = DirtyPageCount + PendingPages;
+    if (Dirty != 0 && Dirty + Pages > CcDirtyPageThreshold)
+    {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Releases the deferred writers that fit in the dirty page limits again,
+ * called by the lazy writer after each scan.
+ */
+VOID
+NTAPI
+CcPostDeferredWrites (
+    VOID)
+{
+    PCC_DEFERRED_WRITE DeferredWrite;
+    PLIST_ENTRY ListEntry;
+    ULONG PendingPages = 0;
+    KIRQL OldIrql;
+
+    for (;;)
+    {
+        DeferredWrite = NULL;
+
+        KeAcquireSpinLock(&CcDeferredWriteSpinLock, &OldIrql);
+        for (ListEntry = CcDeferredWrites.Flink;
+             ListEntry != &CcDeferredWrites;
+             ListEntry = ListEntry->Flink)
+        {
+            DeferredWrite = CONTAINING_RECORD(ListEntry, CC_DEFERRED_WRITE, DeferredWriteLinks);
+
+            /* Writers blocked by their own file's limit don't hold up the others */
+            if (CcRosCanWriteNow(DeferredWrite->FileObject,
+                                 DeferredWrite->BytesToWrite,
+                                 PendingPages))
+            {
+                RemoveEntryList(&DeferredWrite->DeferredWriteLinks);
+                DeferredWrite->DeferredWriteLinks.Flink = NULL;
+                break;
+            }
+            DeferredWrite = NULL;
+        }
+        KeReleaseSpinLock(&CcDeferredWriteSpinLock, OldIrql);
+
+        if (DeferredWrite == NULL)
+        {
+            break;
+        }
+
+        /* The pages only get dirty once the writer ran, count them meanwhile */
+        PendingPages += BYTES_TO_PAGES(DeferredWrite->BytesToWrite);
+
+        if (DeferredWrite->Event != NULL)
+        {
+            KeSetEvent(DeferredWrite->Event, IO_NO_INCREMENT, FALSE);
+        }
+        else
+        {
+            DeferredWrite->PostRoutine(DeferredWrite->Context1, DeferredWrite->Context2);
+            ObDereferenceObject(DeferredWrite->FileObject);
+            ExFreePoolWithTag(DeferredWrite, TAG_CC);
+        }
+    }
+}
+
+/*
+ * @implemented
  */
 BOOLEAN
 NTAPI
@@ -373,9 +478,83 @@ CcCanIWrite (
     IN BOOLEAN Wait,
     IN BOOLEAN Retrying)
 {
+    CC_DEFERRED_WRITE DeferredWrite;
+    LARGE_INTEGER Timeout;
+    ULONG DirtyBefore;
+    KEVENT Event;
+    KIRQL OldIrql;
+    NTSTATUS Status;
+
     CCTRACE(CC_API_DEBUG, "FileObject=%p BytesToWrite=%lu Wait=%d Retrying=%d\n",
         FileObject, BytesToWrite, Wait, Retrying);
 
+    /* Write through doesn't leave anything dirty behind */
+    if (BooleanFlagOn(FileObject->Flags, FO_WRITE_THROUGH))
+    {
+        return TRUE;
+    }
+
+    /* Don't let newcomers overtake the writers that already wait */
+    if ((Retrying || IsListEmpty(&CcDeferredWrites)) &&
+        CcRosCanWriteNow(FileObject, BytesToWrite, 0))
+    {
+        return TRUE;
+    }
+
+    if (!Wait)
+    {
+        CcRosScheduleLazyWrite(TRUE);
+        return FALSE;
+    }
+
+    KeInitializeEvent(&Event, NotificationEvent, FALSE);
+    DeferredWrite.FileObject = FileObject;
+    DeferredWrite.BytesToWrite = BytesToWrite;
+    DeferredWrite.Event = &Event;
+    DeferredWrite.PostRoutine = NULL;
+
+    KeAcquireSpinLock(&CcDeferredWriteSpinLock, &OldIrql);
+    if (Retrying)
+    {
+        InsertHeadList(&CcDeferredWrites, &DeferredWrite.DeferredWriteLinks);
+    }
+    else
+    {
+        InsertTailList(&CcDeferredWrites, &DeferredWrite.DeferredWriteLinks);
+    }
+    KeReleaseSpinLock(&CcDeferredWriteSpinLock, OldIrql);
+
+    Timeout.QuadPart = -1000 * 1000 * 10LL;
+    for (;;)
+    {
+        DirtyBefore = DirtyPageCount;
+        CcRosScheduleLazyWrite(TRUE);
+
+        Status = KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, &Timeout);
+        if (Status == STATUS_SUCCESS)
+        {
+            break;
+        }
+
+        /* If the lazy writer can't get anything out, it's likely waiting
+         * for locks our caller holds. Give up on throttling then */
+        if (DirtyPageCount >= DirtyBefore)
+        {
+            KeAcquireSpinLock(&CcDeferredWriteSpinLock, &OldIrql);
+            if (DeferredWrite.DeferredWriteLinks.Flink != NULL)
+            {
+                RemoveEntryList(&DeferredWrite.DeferredWriteLinks);
+                KeReleaseSpinLock(&CcDeferredWriteSpinLock, OldIrql);
+                break;
+            }
+            KeReleaseSpinLock(&CcDeferredWriteSpinLock, OldIrql);
+
+            /* We were released in the meantime, the event is on its way */
+            KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
+            break;
+        }
+    }
+
     return TRUE;
 }
 
@@ -400,13 +579,20 @@ CcCopyRead (
            FileObject, FileOffset->QuadPart, Length, Wait,
            Buffer, IoStatus);
 
-    return CcCopyData(FileObject,
-                      FileOffset->QuadPart,
-                      Buffer,
-                      Length,
-                      CcOperationRead,
-                      Wait,
-                      IoStatus);
+    if (!CcCopyData(FileObject,
+                    FileOffset->QuadPart,
+                    Buffer,
+                    Length,
+                    CcOperationRead,
+                    Wait,
+                    IoStatus))
+    {
+        return FALSE;
+    }
+
+    /* Get the next views in while the caller consumes this data */
+    CcScheduleReadAhead(FileObject, FileOffset, Length);
+    return TRUE;
 }
 
 /*
@@ -440,7 +626,7 @@ CcCopyWrite (
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -452,10 +638,41 @@ CcDeferWrite (
     IN ULONG BytesToWrite,
     IN BOOLEAN Retrying)
 {
+    PCC_DEFERRED_WRITE DeferredWrite;
+    KIRQL OldIrql;
+
     CCTRACE(CC_API_DEBUG, "FileObject=%p PostRoutine=%p Context1=%p Context2=%p BytesToWrite=%lu Retrying=%d\n",
         FileObject, PostRoutine, Context1, Context2, BytesToWrite, Retrying);
 
-    PostRoutine(Context1, Context2);
+    DeferredWrite = ExAllocatePoolWithTag(NonPagedPool, sizeof(CC_DEFERRED_WRITE), TAG_CC);
+    if (DeferredWrite == NULL)
+    {
+        /* Better write now than never */
+        PostRoutine(Context1, Context2);
+        return;
+    }
+
+    /* The lazy writer posts it later on, keep the file object around until then */
+    ObReferenceObject(FileObject);
+    DeferredWrite->FileObject = FileObject;
+    DeferredWrite->BytesToWrite = BytesToWrite;
+    DeferredWrite->Event = NULL;
+    DeferredWrite->PostRoutine = PostRoutine;
+    DeferredWrite->Context1 = Context1;
+    DeferredWrite->Context2 = Context2;
+
+    KeAcquireSpinLock(&CcDeferredWriteSpinLock, &OldIrql);
+    if (Retrying)
+    {
+        InsertHeadList(&CcDeferredWrites, &DeferredWrite->DeferredWriteLinks);
+    }
+    else
+    {
+        InsertTailList(&CcDeferredWrites, &DeferredWrite->DeferredWriteLinks);
+    }
+    KeReleaseSpinLock(&CcDeferredWriteSpinLock, OldIrql);
+
+    CcRosScheduleLazyWrite(TRUE);
 }
 
 /*
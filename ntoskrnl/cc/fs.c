@@ -21,13 +21,14 @@
 
 extern KGUARDED_MUTEX ViewLock;
 extern ULONG DirtyPageCount;
+extern LIST_ENTRY DirtyVacbListHead;
 
 NTSTATUS CcRosInternalFreeVacb(PROS_VACB Vacb);
 
 /* FUNCTIONS *****************************************************************/
 
 /*
- * @unimplemented
+ * @implemented
  */
 LARGE_INTEGER
 NTAPI
@@ -37,14 +38,44 @@ CcGetDirtyPages (
     IN PVOID Context1,
     IN PVOID Context2)
 {
-    LARGE_INTEGER i;
+    PLIST_ENTRY ListEntry;
+    PROS_VACB Vacb;
+    LARGE_INTEGER FileOffset;
+    LARGE_INTEGER Lsn;
+    ULONG Length;
 
     CCTRACE(CC_API_DEBUG, "LogHandle=%p DirtyPageRoutine=%p Context1=%p Context2=%p\n",
         LogHandle, DirtyPageRoutine, Context1, Context2);
 
-    UNIMPLEMENTED;
-    i.QuadPart = 0;
-    return i;
+    /* We don't track LSNs, every view is reported with a null one */
+    Lsn.QuadPart = 0;
+
+    /* The routine is called with the ViewLock held, it must not call back into Cc */
+    KeAcquireGuardedMutex(&ViewLock);
+    for (ListEntry = DirtyVacbListHead.Flink;
+         ListEntry != &DirtyVacbListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Vacb = CONTAINING_RECORD(ListEntry, ROS_VACB, DirtyVacbListEntry);
+        if (Vacb->SharedCacheMap->LogHandle != LogHandle)
+        {
+            continue;
+        }
+
+        FileOffset = Vacb->FileOffset;
+        Length = (ULONG)min(VACB_MAPPING_GRANULARITY,
+                            Vacb->SharedCacheMap->SectionSize.QuadPart - FileOffset.QuadPart);
+        DirtyPageRoutine(Vacb->SharedCacheMap->FileObject,
+                         &FileOffset,
+                         Length,
+                         &Lsn,
+                         &Lsn,
+                         Context1,
+                         Context2);
+    }
+    KeReleaseGuardedMutex(&ViewLock);
+
+    return Lsn;
 }
 
 /*
@@ -111,17 +142,34 @@ CcInitializeCacheMap (
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 BOOLEAN
 NTAPI
 CcIsThereDirtyData (
     IN PVPB Vpb)
 {
+    PLIST_ENTRY ListEntry;
+    PROS_VACB Vacb;
+    BOOLEAN Dirty = FALSE;
+
     CCTRACE(CC_API_DEBUG, "Vpb=%p\n", Vpb);
 
-    UNIMPLEMENTED;
-    return FALSE;
+    KeAcquireGuardedMutex(&ViewLock);
+    for (ListEntry = DirtyVacbListHead.Flink;
+         ListEntry != &DirtyVacbListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Vacb = CONTAINING_RECORD(ListEntry, ROS_VACB, DirtyVacbListEntry);
+        if (Vacb->SharedCacheMap->FileObject->Vpb == Vpb)
+        {
+            Dirty = TRUE;
+            break;
+        }
+    }
+    KeReleaseGuardedMutex(&ViewLock);
+
+    return Dirty;
 }
 
 /*
@@ -206,7 +254,9 @@ CcPurgeCacheSection (
         {
             RemoveEntryList(&Vacb->DirtyVacbListEntry);
             DirtyPageCount -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+            SharedCacheMap->DirtyPages -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
         }
+        CcRosIndexRemoveVacb(Vacb);
         RemoveEntryList(&Vacb->CacheMapVacbListEntry);
         InsertHeadList(&FreeList, &Vacb->CacheMapVacbListEntry);
     }
@@ -270,7 +320,7 @@ CcSetFileSizes (
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -279,10 +329,18 @@ CcSetLogHandleForFile (
     IN PVOID LogHandle,
     IN PFLUSH_TO_LSN FlushToLsnRoutine)
 {
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+
     CCTRACE(CC_API_DEBUG, "FileObject=%p LogHandle=%p FlushToLsnRoutine=%p\n",
         FileObject, LogHandle, FlushToLsnRoutine);
 
-    UNIMPLEMENTED;
+    /* Only remembered for CcGetDirtyPages, we don't track LSNs */
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    if (SharedCacheMap == NULL)
+        return;
+
+    SharedCacheMap->LogHandle = LogHandle;
+    SharedCacheMap->FlushToLsnRoutine = FlushToLsnRoutine;
 }
 
 /*
@@ -297,11 +355,24 @@ CcUninitializeCacheMap (
 {
     NTSTATUS Status;
     PROS_SHARED_CACHE_MAP SharedCacheMap;
+    PROS_PRIVATE_CACHE_MAP PrivateCacheMap;
     KIRQL OldIrql;
 
     CCTRACE(CC_API_DEBUG, "FileObject=%p TruncateSize=%p UninitializeCompleteEvent=%p\n",
         FileObject, TruncateSize, UninitializeCompleteEvent);
 
+    /* A read ahead in flight still uses the views and issues
+     * paging I/O on this file object */
+    PrivateCacheMap = FileObject->PrivateCacheMap;
+    if (PrivateCacheMap != NULL)
+    {
+        KeWaitForSingleObject(&PrivateCacheMap->ReadAheadDone,
+                              Executive,
+                              KernelMode,
+                              FALSE,
+                              NULL);
+    }
+
     if (TruncateSize != NULL &&
         FileObject->SectionObjectPointer != NULL &&
         FileObject->SectionObjectPointer->SharedCacheMap != NULL)
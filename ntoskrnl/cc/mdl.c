@@ -15,6 +15,146 @@
 
 /* FUNCTIONS *****************************************************************/
 
+/*
+ * Locks the cache views backing [FileOffset, FileOffset + Length) and
+ * describes them with one MDL per view. Each view stays mapped until
+ * the chain is handed back through CcMdlReleaseChain.
+ */
+static
+VOID
+CcMdlLockRange (
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER FileOffset,
+    IN ULONG Length,
+    IN LOCK_OPERATION Operation,
+    OUT PMDL * MdlChain,
+    OUT PIO_STATUS_BLOCK IoStatus)
+{
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    PROS_VACB Vacb;
+    PVOID BaseAddress;
+    BOOLEAN Valid;
+    LONGLONG CurrentOffset;
+    ULONG Remaining, ViewOffset, PartialLength;
+    PMDL Mdl, *Tail;
+    NTSTATUS Status;
+
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    ASSERT(SharedCacheMap);
+
+    Tail = MdlChain;
+    *Tail = NULL;
+
+    CurrentOffset = FileOffset->QuadPart;
+    Remaining = Length;
+    IoStatus->Information = 0;
+
+    while (Remaining > 0)
+    {
+        ViewOffset = CurrentOffset % VACB_MAPPING_GRANULARITY;
+        PartialLength = min(VACB_MAPPING_GRANULARITY - ViewOffset, Remaining);
+
+        Status = CcRosRequestVacb(SharedCacheMap,
+                                  CurrentOffset - ViewOffset,
+                                  &BaseAddress,
+                                  &Valid,
+                                  &Vacb);
+        if (!NT_SUCCESS(Status))
+        {
+            ExRaiseStatus(Status);
+        }
+        if (!Valid)
+        {
+            Status = CcReadVirtualAddress(Vacb);
+            if (!NT_SUCCESS(Status))
+            {
+                CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE, FALSE);
+                ExRaiseStatus(Status);
+            }
+        }
+
+        /* The chain may be freed by whoever owns it in the end, like the
+         * I/O manager when an IRP completes with it, so use plain MDLs */
+        Mdl = IoAllocateMdl((PUCHAR)BaseAddress + ViewOffset, PartialLength, FALSE, FALSE, NULL);
+        if (Mdl == NULL)
+        {
+            CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
+            ExRaiseStatus(STATUS_INSUFFICIENT_RESOURCES);
+        }
+
+        Status = STATUS_SUCCESS;
+        _SEH2_TRY
+        {
+            MmProbeAndLockPages(Mdl, KernelMode, Operation);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+
+        if (!NT_SUCCESS(Status))
+        {
+            IoFreeMdl(Mdl);
+            CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
+            ExRaiseStatus(Status);
+        }
+
+        /* Keep the view mapped for as long as the MDL describes it */
+        CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, TRUE);
+
+        *Tail = Mdl;
+        Tail = &Mdl->Next;
+
+        IoStatus->Information += PartialLength;
+        CurrentOffset += PartialLength;
+        Remaining -= PartialLength;
+    }
+
+    IoStatus->Status = STATUS_SUCCESS;
+}
+
+/*
+ * Unlocks and frees an MDL chain built by CcMdlLockRange and drops
+ * the mappings it held on the cache views.
+ */
+static
+VOID
+CcMdlReleaseChain (
+    IN PFILE_OBJECT FileObject,
+    IN PMDL MdlChain,
+    IN BOOLEAN Dirty)
+{
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    LONGLONG FileOffset;
+    PMDL Mdl;
+
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+
+    while ((Mdl = MdlChain))
+    {
+        MdlChain = Mdl->Next;
+        MmUnlockPages(Mdl);
+
+        /* The view is found back from the address the MDL describes */
+        if (SharedCacheMap != NULL)
+        {
+            if (CcRosLookupVacbAddress(SharedCacheMap,
+                                       MmGetMdlVirtualAddress(Mdl),
+                                       &FileOffset))
+            {
+                CcRosUnmapVacb(SharedCacheMap, FileOffset, Dirty);
+            }
+            else
+            {
+                DPRINT1("MDL %p doesn't describe a view of %p\n", Mdl, FileObject);
+            }
+        }
+
+        IoFreeMdl(Mdl);
+    }
+}
+
 /*
  * @implemented
  */
@@ -28,10 +168,29 @@ CcMdlRead (
     OUT PIO_STATUS_BLOCK IoStatus
     )
 {
+    PMDL Chain = NULL;
+
     CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d Length=%lu\n",
         FileObject, FileOffset->QuadPart, Length);
 
-    UNIMPLEMENTED;
+    _SEH2_TRY
+    {
+        CcMdlLockRange(FileObject, FileOffset, Length, IoReadAccess, &Chain, IoStatus);
+    }
+    _SEH2_FINALLY
+    {
+        /* Don't leak the views we already locked if one of them failed */
+        if (_SEH2_AbnormalTermination())
+        {
+            CcMdlReleaseChain(FileObject, Chain, FALSE);
+            Chain = NULL;
+        }
+    }
+    _SEH2_END;
+
+    *MdlChain = Chain;
+
+    CcScheduleReadAhead(FileObject, FileOffset, Length);
 }
 
 /*
@@ -58,15 +217,7 @@ CcMdlReadComplete2 (
     IN PMDL MemoryDescriptorList
 )
 {
-    PMDL Mdl;
-
-    /* Free MDLs */
-    while ((Mdl = MemoryDescriptorList))
-    {
-        MemoryDescriptorList = Mdl->Next;
-        MmUnlockPages(Mdl);
-        IoFreeMdl(Mdl);
-    }
+    CcMdlReleaseChain(FileObject, MemoryDescriptorList, FALSE);
 }
 
 /*
@@ -102,9 +253,12 @@ CcMdlReadComplete (
     if (FastDispatch && FastDispatch->MdlReadComplete)
     {
          /* Use the fast path */
-        FastDispatch->MdlReadComplete(FileObject,
-                                      MdlChain,
-                                      DeviceObject);
+        if (FastDispatch->MdlReadComplete(FileObject,
+                                          MdlChain,
+                                          DeviceObject))
+        {
+            return;
+        }
     }
 
     /* Use slow path */
@@ -132,10 +286,13 @@ CcMdlWriteComplete (
     if (FastDispatch && FastDispatch->MdlWriteComplete)
     {
          /* Use the fast path */
-        FastDispatch->MdlWriteComplete(FileObject,
-                                       FileOffset,
-                                       MdlChain,
-                                       DeviceObject);
+        if (FastDispatch->MdlWriteComplete(FileObject,
+                                           FileOffset,
+                                           MdlChain,
+                                           DeviceObject))
+        {
+            return;
+        }
     }
 
     /* Use slow path */
@@ -149,11 +306,33 @@ CcMdlWriteComplete2 (
     IN PLARGE_INTEGER FileOffset,
     IN PMDL MdlChain)
 {
-    UNIMPLEMENTED;
+    IO_STATUS_BLOCK IoStatus;
+    ULONG Length = 0;
+    PMDL Mdl;
+
+    CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d MdlChain=%p\n",
+        FileObject, FileOffset->QuadPart, MdlChain);
+
+    for (Mdl = MdlChain; Mdl != NULL; Mdl = Mdl->Next)
+    {
+        Length += MmGetMdlByteCount(Mdl);
+    }
+
+    /* The views now hold the caller's data, let the lazy writer have them */
+    CcMdlReleaseChain(FileObject, MdlChain, TRUE);
+
+    if (FileObject->Flags & FO_WRITE_THROUGH)
+    {
+        CcFlushCache(FileObject->SectionObjectPointer, FileOffset, Length, &IoStatus);
+        if (!NT_SUCCESS(IoStatus.Status))
+        {
+            ExRaiseStatus(IoStatus.Status);
+        }
+    }
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -161,11 +340,13 @@ CcMdlWriteAbort (
     IN PFILE_OBJECT FileObject,
     IN PMDL MdlChain)
 {
-    UNIMPLEMENTED;
+    CCTRACE(CC_API_DEBUG, "FileObject=%p MdlChain=%p\n", FileObject, MdlChain);
+
+    CcMdlReleaseChain(FileObject, MdlChain, FALSE);
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -176,8 +357,26 @@ CcPrepareMdlWrite (
     OUT PMDL * MdlChain,
     OUT PIO_STATUS_BLOCK IoStatus)
 {
+    PMDL Chain = NULL;
+
     CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d Length=%lu\n",
         FileObject, FileOffset->QuadPart, Length);
 
-    UNIMPLEMENTED;
+    /* The views are read in first, so that a partial write of a page
+     * doesn't lose the data around it */
+    _SEH2_TRY
+    {
+        CcMdlLockRange(FileObject, FileOffset, Length, IoWriteAccess, &Chain, IoStatus);
+    }
+    _SEH2_FINALLY
+    {
+        if (_SEH2_AbnormalTermination())
+        {
+            CcMdlReleaseChain(FileObject, Chain, FALSE);
+            Chain = NULL;
+        }
+    }
+    _SEH2_END;
+
+    *MdlChain = Chain;
 }
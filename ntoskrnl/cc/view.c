@@ -41,10 +41,30 @@
 
 /* GLOBALS *******************************************************************/
 
-static LIST_ENTRY DirtyVacbListHead;
+LIST_ENTRY DirtyVacbListHead;
 static LIST_ENTRY VacbLruListHead;
 ULONG DirtyPageCount = 0;
 
+/* Writers get throttled by CcCanIWrite past this many dirty pages */
+ULONG CcDirtyPageThreshold = 0;
+
+/* Interval between two lazy writer scans, and the shorter one used
+ * while writers are waiting for it */
+#define CC_LAZY_WRITE_INTERVAL (-1000 * 1000 * 10LL)
+#define CC_LAZY_WRITE_FAST_INTERVAL (-100 * 1000 * 10LL)
+
+static KTIMER LazyWriteTimer;
+static KDPC LazyWriteDpc;
+static WORK_QUEUE_ITEM LazyWriteWorkItem;
+/* Is a scan pending or running */
+static LONG LazyWriteScanActive;
+
+ULONG CcLazyWriteIos = 0;
+ULONG CcLazyWritePages = 0;
+
+extern LIST_ENTRY CcDeferredWrites;
+extern KSPIN_LOCK CcDeferredWriteSpinLock;
+
 KGUARDED_MUTEX ViewLock;
 
 NPAGED_LOOKASIDE_LIST iBcbLookasideList;
@@ -54,27 +74,32 @@ static NPAGED_LOOKASIDE_LIST VacbLookasideList;
 #if DBG
 static void CcRosVacbIncRefCount_(PROS_VACB vacb, const char* file, int line)
 {
-    ++vacb->ReferenceCount;
+    ULONG Refs;
+
+    Refs = InterlockedIncrement((PLONG)&vacb->ReferenceCount);
     if (vacb->SharedCacheMap->Trace)
     {
         DbgPrint("(%s:%i) VACB %p ++RefCount=%lu, Dirty %u, PageOut %lu\n",
-                 file, line, vacb, vacb->ReferenceCount, vacb->Dirty, vacb->PageOut);
+                 file, line, vacb, Refs, vacb->Dirty, vacb->PageOut);
     }
 }
 static void CcRosVacbDecRefCount_(PROS_VACB vacb, const char* file, int line)
 {
-    --vacb->ReferenceCount;
+    ULONG Refs;
+
+    Refs = InterlockedDecrement((PLONG)&vacb->ReferenceCount);
     if (vacb->SharedCacheMap->Trace)
     {
         DbgPrint("(%s:%i) VACB %p --RefCount=%lu, Dirty %u, PageOut %lu\n",
-                 file, line, vacb, vacb->ReferenceCount, vacb->Dirty, vacb->PageOut);
+                 file, line, vacb, Refs, vacb->Dirty, vacb->PageOut);
     }
 }
 #define CcRosVacbIncRefCount(vacb) CcRosVacbIncRefCount_(vacb,__FILE__,__LINE__)
 #define CcRosVacbDecRefCount(vacb) CcRosVacbDecRefCount_(vacb,__FILE__,__LINE__)
 #else
-#define CcRosVacbIncRefCount(vacb) (++((vacb)->ReferenceCount))
-#define CcRosVacbDecRefCount(vacb) (--((vacb)->ReferenceCount))
+/* Lookups only hold the cache map lock, the lazy writer only the ViewLock */
+#define CcRosVacbIncRefCount(vacb) InterlockedIncrement((PLONG)&(vacb)->ReferenceCount)
+#define CcRosVacbDecRefCount(vacb) InterlockedDecrement((PLONG)&(vacb)->ReferenceCount)
 #endif
 
 NTSTATUS
@@ -146,6 +171,7 @@ CcRosFlushVacb (
         Vacb->Dirty = FALSE;
         RemoveEntryList(&Vacb->DirtyVacbListEntry);
         DirtyPageCount -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+        Vacb->SharedCacheMap->DirtyPages -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
         CcRosVacbDecRefCount(Vacb);
 
         KeReleaseSpinLock(&Vacb->SharedCacheMap->CacheMapLock, oldIrql);
@@ -240,7 +266,7 @@ CcRosFlushDirtyPages (
         else
         {
             (*Count) += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
-            Target -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+            Target -= min(Target, VACB_MAPPING_GRANULARITY / PAGE_SIZE);
         }
 
         current_entry = DirtyVacbListHead.Flink;
@@ -253,6 +279,89 @@ CcRosFlushDirtyPages (
     return STATUS_SUCCESS;
 }
 
+static
+VOID
+NTAPI
+CcRosLazyWriteScan (
+    PVOID Context)
+{
+    ULONG Target, Count;
+    BOOLEAN Throttled;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    /* Write an eighth of the backlog per scan, so that the flush rate
+     * follows the amount of dirty data. When writers are waiting, or
+     * about to be, write out everything we can instead */
+    Throttled = !IsListEmpty(&CcDeferredWrites) ||
+                DirtyPageCount >= CcDirtyPageThreshold / 4 * 3;
+    if (Throttled)
+    {
+        Target = DirtyPageCount;
+    }
+    else
+    {
+        Target = max(DirtyPageCount / 8, VACB_MAPPING_GRANULARITY / PAGE_SIZE);
+    }
+
+    CcRosFlushDirtyPages(Target, &Count, FALSE);
+    if (Count != 0)
+    {
+        CcLazyWriteIos += Count / (VACB_MAPPING_GRANULARITY / PAGE_SIZE);
+        CcLazyWritePages += Count;
+    }
+
+    /* Let the writers that fit in again go */
+    CcPostDeferredWrites();
+
+    InterlockedExchange(&LazyWriteScanActive, FALSE);
+    if (DirtyPageCount != 0 || !IsListEmpty(&CcDeferredWrites))
+    {
+        CcRosScheduleLazyWrite(!IsListEmpty(&CcDeferredWrites));
+    }
+}
+
+static
+VOID
+NTAPI
+CcRosLazyWriteDpc (
+    PKDPC Dpc,
+    PVOID DeferredContext,
+    PVOID SystemArgument1,
+    PVOID SystemArgument2)
+{
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(DeferredContext);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    /* Not on the critical queue, file systems park throttled writes there */
+    ExQueueWorkItem(&LazyWriteWorkItem, DelayedWorkQueue);
+}
+
+VOID
+NTAPI
+CcRosScheduleLazyWrite (
+    BOOLEAN FastScan)
+{
+    LARGE_INTEGER DueTime;
+
+    DueTime.QuadPart = FastScan ? CC_LAZY_WRITE_FAST_INTERVAL : CC_LAZY_WRITE_INTERVAL;
+
+    if (InterlockedExchange(&LazyWriteScanActive, TRUE))
+    {
+        /* Already scheduled. Pull a pending scan in if we're in a hurry,
+         * a running one will reschedule itself */
+        if (FastScan && KeCancelTimer(&LazyWriteTimer))
+        {
+            KeSetTimer(&LazyWriteTimer, DueTime, &LazyWriteDpc);
+        }
+        return;
+    }
+
+    KeSetTimer(&LazyWriteTimer, DueTime, &LazyWriteDpc);
+}
+
 NTSTATUS
 CcRosTrimCache (
     ULONG Target,
@@ -295,6 +404,14 @@ retry:
 
         KeAcquireSpinLock(&current->SharedCacheMap->CacheMapLock, &oldIrql);
 
+        /* Give the views looked up since the last pass a second chance */
+        if (current->Accessed)
+        {
+            current->Accessed = FALSE;
+            KeReleaseSpinLock(&current->SharedCacheMap->CacheMapLock, oldIrql);
+            continue;
+        }
+
         /* Reference the VACB */
         CcRosVacbIncRefCount(current);
 
@@ -327,6 +444,7 @@ retry:
             ASSERT(!current->Dirty);
             ASSERT(!current->MappedCount);
 
+            CcRosIndexRemoveVacb(current);
             RemoveEntryList(&current->CacheMapVacbListEntry);
             RemoveEntryList(&current->VacbLruListEntry);
             InsertHeadList(&FreeList, &current->CacheMapVacbListEntry);
@@ -385,6 +503,7 @@ CcRosReleaseVacb (
     BOOLEAN Mapped)
 {
     BOOLEAN WasDirty;
+    BOOLEAN NeedViewLock;
     KIRQL oldIrql;
 
     ASSERT(SharedCacheMap);
@@ -392,7 +511,13 @@ CcRosReleaseVacb (
     DPRINT("CcRosReleaseVacb(SharedCacheMap 0x%p, Vacb 0x%p, Valid %u)\n",
            SharedCacheMap, Vacb, Valid);
 
-    KeAcquireGuardedMutex(&ViewLock);
+    /* We hold the VACB lock, so nobody else can change its dirty state.
+     * Only queuing it on the dirty list requires the ViewLock. */
+    NeedViewLock = Dirty && !Vacb->Dirty;
+    if (NeedViewLock)
+    {
+        KeAcquireGuardedMutex(&ViewLock);
+    }
     KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
 
     Vacb->Valid = Valid;
@@ -404,6 +529,8 @@ CcRosReleaseVacb (
     {
         InsertTailList(&DirtyVacbListHead, &Vacb->DirtyVacbListEntry);
         DirtyPageCount += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+        SharedCacheMap->DirtyPages += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+        CcRosScheduleLazyWrite(FALSE);
     }
 
     if (Mapped)
@@ -421,7 +548,10 @@ CcRosReleaseVacb (
     }
 
     KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
-    KeReleaseGuardedMutex(&ViewLock);
+    if (NeedViewLock)
+    {
+        KeReleaseGuardedMutex(&ViewLock);
+    }
     CcRosReleaseVacbLock(Vacb);
 
     return STATUS_SUCCESS;
@@ -434,7 +564,6 @@ CcRosLookupVacb (
     PROS_SHARED_CACHE_MAP SharedCacheMap,
     LONGLONG FileOffset)
 {
-    PLIST_ENTRY current_entry;
     PROS_VACB current;
     KIRQL oldIrql;
 
@@ -443,34 +572,65 @@ CcRosLookupVacb (
     DPRINT("CcRosLookupVacb(SharedCacheMap 0x%p, FileOffset %I64u)\n",
            SharedCacheMap, FileOffset);
 
-    KeAcquireGuardedMutex(&ViewLock);
+    /* The index is only guarded by the cache map lock, lookups on
+     * different files don't contend with each other */
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
+
+    current = CcRosIndexLookupVacb(SharedCacheMap, FileOffset);
+    if (current != NULL)
+    {
+        CcRosVacbIncRefCount(current);
+    }
+
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
+
+    if (current != NULL)
+    {
+        CcRosAcquireVacbLock(current, NULL);
+    }
+
+    return current;
+}
+
+BOOLEAN
+NTAPI
+CcRosLookupVacbAddress (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    PVOID Address,
+    PLONGLONG FileOffset)
+{
+    PLIST_ENTRY current_entry;
+    PROS_VACB current;
+    KIRQL oldIrql;
+    BOOLEAN Found = FALSE;
+
+    ASSERT(SharedCacheMap);
+
+    DPRINT("CcRosLookupVacbAddress(SharedCacheMap 0x%p, Address 0x%p)\n",
+           SharedCacheMap, Address);
+
+    /* Only used to find the views behind an MDL chain, which are
+     * pinned by their mapping and can't go away under us */
     KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
 
     current_entry = SharedCacheMap->CacheMapVacbListHead.Flink;
     while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
     {
-        current = CONTAINING_RECORD(current_entry,
-                                    ROS_VACB,
-                                    CacheMapVacbListEntry);
-        if (IsPointInRange(current->FileOffset.QuadPart,
-                           VACB_MAPPING_GRANULARITY,
-                           FileOffset))
+        current = CONTAINING_RECORD(current_entry, ROS_VACB, CacheMapVacbListEntry);
+        if ((ULONG_PTR)Address >= (ULONG_PTR)current->BaseAddress &&
+            (ULONG_PTR)Address < (ULONG_PTR)current->BaseAddress + VACB_MAPPING_GRANULARITY)
         {
-            CcRosVacbIncRefCount(current);
-            KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
-            KeReleaseGuardedMutex(&ViewLock);
-            CcRosAcquireVacbLock(current, NULL);
-            return current;
-        }
-        if (current->FileOffset.QuadPart > FileOffset)
+            *FileOffset = current->FileOffset.QuadPart +
+                          ((ULONG_PTR)Address - (ULONG_PTR)current->BaseAddress);
+            Found = TRUE;
             break;
+        }
         current_entry = current_entry->Flink;
     }
 
     KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
-    KeReleaseGuardedMutex(&ViewLock);
 
-    return NULL;
+    return Found;
 }
 
 NTSTATUS
@@ -500,6 +660,8 @@ CcRosMarkDirtyVacb (
     {
         InsertTailList(&DirtyVacbListHead, &Vacb->DirtyVacbListEntry);
         DirtyPageCount += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+        SharedCacheMap->DirtyPages += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+        CcRosScheduleLazyWrite(FALSE);
     }
     else
     {
@@ -553,6 +715,8 @@ CcRosUnmapVacb (
     {
         InsertTailList(&DirtyVacbListHead, &Vacb->DirtyVacbListEntry);
         DirtyPageCount += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+        SharedCacheMap->DirtyPages += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+        CcRosScheduleLazyWrite(FALSE);
     }
 
     CcRosVacbDecRefCount(Vacb);
@@ -630,6 +794,86 @@ CcRosMapVacb(
     return STATUS_SUCCESS;
 }
 
+static
+NTSTATUS
+CcRosGrowVacbIndex (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    LONGLONG FileOffset)
+{
+    PROS_VACB_INDEX_LEAF *NewLeaves, *OldLeaves;
+    ULONG NewCount;
+    KIRQL oldIrql;
+
+    /* Only the directory covers the highest view, leaves are allocated
+     * with their first view. Double it so that extending files doesn't
+     * reallocate it for every new leaf. */
+    NewCount = (ULONG)((FileOffset / VACB_MAPPING_GRANULARITY) >> CC_VACB_LEAF_SHIFT) + 1;
+    NewCount = max(NewCount, SharedCacheMap->VacbLeavesCount * 2);
+
+    NewLeaves = ExAllocatePoolWithTag(NonPagedPool, NewCount * sizeof(PROS_VACB_INDEX_LEAF), TAG_VACB);
+    if (NewLeaves == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlZeroMemory(NewLeaves, NewCount * sizeof(PROS_VACB_INDEX_LEAF));
+
+    OldLeaves = NULL;
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
+    /* Someone may have grown it while we were allocating */
+    if (SharedCacheMap->VacbLeavesCount < NewCount)
+    {
+        RtlCopyMemory(NewLeaves,
+                      SharedCacheMap->VacbLeaves,
+                      SharedCacheMap->VacbLeavesCount * sizeof(PROS_VACB_INDEX_LEAF));
+        OldLeaves = SharedCacheMap->VacbLeaves;
+        SharedCacheMap->VacbLeaves = NewLeaves;
+        SharedCacheMap->VacbLeavesCount = NewCount;
+        NewLeaves = NULL;
+    }
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
+
+    if (OldLeaves != NULL)
+    {
+        ExFreePoolWithTag(OldLeaves, TAG_VACB);
+    }
+    if (NewLeaves != NULL)
+    {
+        ExFreePoolWithTag(NewLeaves, TAG_VACB);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static
+PROS_VACB
+CcRosIndexFindPreviousVacb (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    LONGLONG FileOffset)
+{
+    PROS_VACB_INDEX_LEAF Leaf;
+    LONGLONG Index;
+
+    /* The caller must hold the CacheMapLock. Absent leaves are
+     * skipped whole, so this doesn't walk every empty slot. */
+    Index = FileOffset / VACB_MAPPING_GRANULARITY;
+    while (Index > 0)
+    {
+        Index--;
+        Leaf = SharedCacheMap->VacbLeaves[Index >> CC_VACB_LEAF_SHIFT];
+        if (Leaf == NULL)
+        {
+            Index &= ~(LONGLONG)(CC_VACB_LEAF_ENTRIES - 1);
+            continue;
+        }
+        if (Leaf->Vacbs[Index & (CC_VACB_LEAF_ENTRIES - 1)] != NULL)
+        {
+            return Leaf->Vacbs[Index & (CC_VACB_LEAF_ENTRIES - 1)];
+        }
+    }
+
+    return NULL;
+}
+
 static
 NTSTATUS
 CcRosCreateVacb (
@@ -639,7 +883,8 @@ CcRosCreateVacb (
 {
     PROS_VACB current;
     PROS_VACB previous;
-    PLIST_ENTRY current_entry;
+    PROS_VACB_INDEX_LEAF *Leaf;
+    LONGLONG Index;
     NTSTATUS Status;
     KIRQL oldIrql;
 
@@ -653,11 +898,24 @@ CcRosCreateVacb (
         return STATUS_INVALID_PARAMETER;
     }
 
+    /* The directory never shrinks, so an unlocked check is enough here */
+    Index = FileOffset / VACB_MAPPING_GRANULARITY;
+    if ((Index >> CC_VACB_LEAF_SHIFT) >= SharedCacheMap->VacbLeavesCount)
+    {
+        Status = CcRosGrowVacbIndex(SharedCacheMap, FileOffset);
+        if (!NT_SUCCESS(Status))
+        {
+            *Vacb = NULL;
+            return Status;
+        }
+    }
+
     current = ExAllocateFromNPagedLookasideList(&VacbLookasideList);
     current->BaseAddress = NULL;
     current->Valid = FALSE;
     current->Dirty = FALSE;
     current->PageOut = FALSE;
+    current->Accessed = FALSE;
     current->FileOffset.QuadPart = ROUND_DOWN(FileOffset, VACB_MAPPING_GRANULARITY);
     current->SharedCacheMap = SharedCacheMap;
 #if DBG
@@ -682,47 +940,48 @@ CcRosCreateVacb (
      * our newly created VACB and return the existing one.
      */
     KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
-    current_entry = SharedCacheMap->CacheMapVacbListHead.Flink;
-    previous = NULL;
-    while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
+    current = CcRosIndexLookupVacb(SharedCacheMap, FileOffset);
+    if (current != NULL)
     {
-        current = CONTAINING_RECORD(current_entry,
-                                    ROS_VACB,
-                                    CacheMapVacbListEntry);
-        if (IsPointInRange(current->FileOffset.QuadPart,
-                           VACB_MAPPING_GRANULARITY,
-                           FileOffset))
-        {
-            CcRosVacbIncRefCount(current);
-            KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
+        CcRosVacbIncRefCount(current);
+        KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
 #if DBG
-            if (SharedCacheMap->Trace)
-            {
-                DPRINT1("CacheMap 0x%p: deleting newly created VACB 0x%p ( found existing one 0x%p )\n",
-                        SharedCacheMap,
-                        (*Vacb),
-                        current);
-            }
-#endif
-            CcRosReleaseVacbLock(*Vacb);
-            KeReleaseGuardedMutex(&ViewLock);
-            ExFreeToNPagedLookasideList(&VacbLookasideList, *Vacb);
-            *Vacb = current;
-            CcRosAcquireVacbLock(current, NULL);
-            return STATUS_SUCCESS;
-        }
-        if (current->FileOffset.QuadPart < FileOffset)
+        if (SharedCacheMap->Trace)
         {
-            ASSERT(previous == NULL ||
-                   previous->FileOffset.QuadPart < current->FileOffset.QuadPart);
-            previous = current;
+            DPRINT1("CacheMap 0x%p: deleting newly created VACB 0x%p ( found existing one 0x%p )\n",
+                    SharedCacheMap,
+                    (*Vacb),
+                    current);
         }
-        if (current->FileOffset.QuadPart > FileOffset)
-            break;
-        current_entry = current_entry->Flink;
+#endif
+        CcRosReleaseVacbLock(*Vacb);
+        KeReleaseGuardedMutex(&ViewLock);
+        ExFreeToNPagedLookasideList(&VacbLookasideList, *Vacb);
+        *Vacb = current;
+        CcRosAcquireVacbLock(current, NULL);
+        return STATUS_SUCCESS;
     }
-    /* There was no existing VACB. */
+    /* There was no existing VACB, make sure its leaf exists. Nonpaged
+     * pool can be allocated at DISPATCH_LEVEL. */
     current = *Vacb;
+    Leaf = &SharedCacheMap->VacbLeaves[Index >> CC_VACB_LEAF_SHIFT];
+    if (*Leaf == NULL)
+    {
+        *Leaf = ExAllocatePoolWithTag(NonPagedPool, sizeof(ROS_VACB_INDEX_LEAF), TAG_VACB);
+        if (*Leaf == NULL)
+        {
+            KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
+            CcRosReleaseVacbLock(current);
+            KeReleaseGuardedMutex(&ViewLock);
+            ExFreeToNPagedLookasideList(&VacbLookasideList, current);
+            *Vacb = NULL;
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        RtlZeroMemory(*Leaf, sizeof(ROS_VACB_INDEX_LEAF));
+    }
+
+    /* Keep the list sorted by linking it after the closest view below it */
+    previous = CcRosIndexFindPreviousVacb(SharedCacheMap, FileOffset);
     if (previous)
     {
         InsertHeadList(&previous->CacheMapVacbListEntry, &current->CacheMapVacbListEntry);
@@ -731,6 +990,8 @@ CcRosCreateVacb (
     {
         InsertHeadList(&SharedCacheMap->CacheMapVacbListHead, &current->CacheMapVacbListEntry);
     }
+    (*Leaf)->Vacbs[Index & (CC_VACB_LEAF_ENTRIES - 1)] = current;
+    (*Leaf)->Count++;
     KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
     InsertTailList(&VacbLruListHead, &current->VacbLruListEntry);
     KeReleaseGuardedMutex(&ViewLock);
@@ -757,8 +1018,13 @@ CcRosCreateVacb (
     Status = CcRosMapVacb(current);
     if (!NT_SUCCESS(Status))
     {
+        KeAcquireGuardedMutex(&ViewLock);
+        KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
+        CcRosIndexRemoveVacb(current);
         RemoveEntryList(&current->CacheMapVacbListEntry);
         RemoveEntryList(&current->VacbLruListEntry);
+        KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
+        KeReleaseGuardedMutex(&ViewLock);
         CcRosReleaseVacbLock(current);
         ExFreeToNPagedLookasideList(&VacbLookasideList, current);
     }
@@ -799,13 +1065,9 @@ CcRosGetVacb (
         }
     }
 
-    KeAcquireGuardedMutex(&ViewLock);
-
-    /* Move to the tail of the LRU list */
-    RemoveEntryList(&current->VacbLruListEntry);
-    InsertTailList(&VacbLruListHead, &current->VacbLruListEntry);
-
-    KeReleaseGuardedMutex(&ViewLock);
+    /* Rather than moving it to the tail of the LRU list, which needs
+     * the ViewLock, let CcRosTrimCache skip it once */
+    current->Accessed = TRUE;
 
     /*
      * Return information about the VACB to the caller.
@@ -985,6 +1247,8 @@ CcRosDeleteFileCache (
 {
     PLIST_ENTRY current_entry;
     PROS_VACB current;
+    PROS_VACB_INDEX_LEAF *Leaves;
+    ULONG LeavesCount, Index;
     LIST_ENTRY FreeList;
     KIRQL oldIrql;
 
@@ -1019,6 +1283,10 @@ CcRosDeleteFileCache (
             }
             InsertHeadList(&FreeList, &current->CacheMapVacbListEntry);
         }
+        Leaves = SharedCacheMap->VacbLeaves;
+        LeavesCount = SharedCacheMap->VacbLeavesCount;
+        SharedCacheMap->VacbLeaves = NULL;
+        SharedCacheMap->VacbLeavesCount = 0;
 #if DBG
         SharedCacheMap->Trace = FALSE;
 #endif
@@ -1033,6 +1301,17 @@ CcRosDeleteFileCache (
             current = CONTAINING_RECORD(current_entry, ROS_VACB, CacheMapVacbListEntry);
             CcRosInternalFreeVacb(current);
         }
+        for (Index = 0; Index < LeavesCount; Index++)
+        {
+            if (Leaves[Index] != NULL)
+            {
+                ExFreePoolWithTag(Leaves[Index], TAG_VACB);
+            }
+        }
+        if (Leaves != NULL)
+        {
+            ExFreePoolWithTag(Leaves, TAG_VACB);
+        }
         ExFreeToNPagedLookasideList(&SharedCacheMapLookasideList, SharedCacheMap);
         KeAcquireGuardedMutex(&ViewLock);
     }
@@ -1091,6 +1370,31 @@ CcRosDereferenceCache (
     KeReleaseGuardedMutex(&ViewLock);
 }
 
+static
+PROS_PRIVATE_CACHE_MAP
+CcRosCreatePrivateCacheMap (
+    PFILE_OBJECT FileObject)
+{
+    PROS_PRIVATE_CACHE_MAP PrivateCacheMap;
+
+    PrivateCacheMap = ExAllocatePoolWithTag(NonPagedPool,
+                                            sizeof(*PrivateCacheMap),
+                                            TAG_PRIVATE_CACHE_MAP);
+    if (PrivateCacheMap == NULL)
+    {
+        return NULL;
+    }
+
+    RtlZeroMemory(PrivateCacheMap, sizeof(*PrivateCacheMap));
+    PrivateCacheMap->FileObject = FileObject;
+    PrivateCacheMap->ReadAheadMask = PAGE_SIZE - 1;
+    PrivateCacheMap->ReadAheadEnabled = TRUE;
+    KeInitializeEvent(&PrivateCacheMap->ReadAheadDone, NotificationEvent, TRUE);
+    KeInitializeSpinLock(&PrivateCacheMap->ReadAheadSpinLock);
+
+    return PrivateCacheMap;
+}
+
 NTSTATUS
 NTAPI
 CcRosReleaseFileCache (
@@ -1109,6 +1413,7 @@ CcRosReleaseFileCache (
         SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
         if (FileObject->PrivateCacheMap != NULL)
         {
+            ExFreePoolWithTag(FileObject->PrivateCacheMap, TAG_PRIVATE_CACHE_MAP);
             FileObject->PrivateCacheMap = NULL;
             if (SharedCacheMap->OpenCount > 0)
             {
@@ -1143,12 +1448,19 @@ CcTryToInitializeFileCache (
     }
     else
     {
+        Status = STATUS_SUCCESS;
         if (FileObject->PrivateCacheMap == NULL)
         {
-            FileObject->PrivateCacheMap = SharedCacheMap;
-            SharedCacheMap->OpenCount++;
+            FileObject->PrivateCacheMap = CcRosCreatePrivateCacheMap(FileObject);
+            if (FileObject->PrivateCacheMap == NULL)
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+            }
+            else
+            {
+                SharedCacheMap->OpenCount++;
+            }
         }
-        Status = STATUS_SUCCESS;
     }
     KeReleaseGuardedMutex(&ViewLock);
 
@@ -1169,18 +1481,32 @@ CcRosInitializeFileCache (
  */
 {
     PROS_SHARED_CACHE_MAP SharedCacheMap;
+    PROS_PRIVATE_CACHE_MAP PrivateCacheMap = NULL;
 
     SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
     DPRINT("CcRosInitializeFileCache(FileObject 0x%p, SharedCacheMap 0x%p)\n",
            FileObject, SharedCacheMap);
 
     KeAcquireGuardedMutex(&ViewLock);
+    if (FileObject->PrivateCacheMap == NULL)
+    {
+        PrivateCacheMap = CcRosCreatePrivateCacheMap(FileObject);
+        if (PrivateCacheMap == NULL)
+        {
+            KeReleaseGuardedMutex(&ViewLock);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
     if (SharedCacheMap == NULL)
     {
         SharedCacheMap = ExAllocateFromNPagedLookasideList(&SharedCacheMapLookasideList);
         if (SharedCacheMap == NULL)
         {
             KeReleaseGuardedMutex(&ViewLock);
+            if (PrivateCacheMap != NULL)
+            {
+                ExFreePoolWithTag(PrivateCacheMap, TAG_PRIVATE_CACHE_MAP);
+            }
             return STATUS_INSUFFICIENT_RESOURCES;
         }
         RtlZeroMemory(SharedCacheMap, sizeof(*SharedCacheMap));
@@ -1198,9 +1524,9 @@ CcRosInitializeFileCache (
         InitializeListHead(&SharedCacheMap->CacheMapVacbListHead);
         FileObject->SectionObjectPointer->SharedCacheMap = SharedCacheMap;
     }
-    if (FileObject->PrivateCacheMap == NULL)
+    if (PrivateCacheMap != NULL)
     {
-        FileObject->PrivateCacheMap = SharedCacheMap;
+        FileObject->PrivateCacheMap = PrivateCacheMap;
         SharedCacheMap->OpenCount++;
     }
     KeReleaseGuardedMutex(&ViewLock);
@@ -1239,7 +1565,18 @@ CcInitView (
 
     InitializeListHead(&DirtyVacbListHead);
     InitializeListHead(&VacbLruListHead);
+    InitializeListHead(&CcDeferredWrites);
+    KeInitializeSpinLock(&CcDeferredWriteSpinLock);
     KeInitializeGuardedMutex(&ViewLock);
+
+    /* Let dirty data take up to an eighth of the memory before writers
+     * have to wait for the lazy writer, but no less than a few views */
+    CcDirtyPageThreshold = max(MmNumberOfPhysicalPages / 8,
+                               16 * (VACB_MAPPING_GRANULARITY / PAGE_SIZE));
+
+    KeInitializeTimer(&LazyWriteTimer);
+    KeInitializeDpc(&LazyWriteDpc, CcRosLazyWriteDpc, NULL);
+    ExInitializeWorkItem(&LazyWriteWorkItem, CcRosLazyWriteScan, NULL);
     ExInitializeNPagedLookasideList(&iBcbLookasideList,
                                     NULL,
                                     NULL,
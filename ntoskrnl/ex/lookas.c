@@ -27,6 +27,11 @@ LIST_ENTRY ExPoolLookasideListHead;
 GENERAL_LOOKASIDE ExpSmallNPagedPoolLookasideLists[MAXIMUM_PROCESSORS];
 GENERAL_LOOKASIDE ExpSmallPagedPoolLookasideLists[MAXIMUM_PROCESSORS];
 
+/* Depth tuning parameters, applied once per balance set manager scan */
+#define EXP_MINIMUM_LOOKASIDE_DEPTH     4
+#define EXP_MINIMUM_ALLOCATION_RATE     25
+#define EXP_IDLE_DEPTH_DECREMENT        10
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
 VOID
@@ -123,6 +128,185 @@ ExpInitLookasideLists(VOID)
     }
 }
 
+static
+USHORT
+ExpComputeLookasideDepth(IN ULONG Allocates,
+                         IN ULONG Misses,
+                         IN USHORT MaximumDepth,
+                         IN USHORT Depth)
+{
+    ULONG Ratio, Target;
+
+    /* Counters wrap independently, so never trust more misses than allocations */
+    if (Misses > Allocates) Misses = Allocates;
+
+    /* Miss rate over the last scan, in tenths of a percent */
+    Ratio = Allocates ? (Misses * 1000) / Allocates : 0;
+    Target = Depth;
+
+    if (Allocates < EXP_MINIMUM_ALLOCATION_RATE)
+    {
+        /* The list is (almost) idle, shrink it quickly */
+        if (Target > EXP_MINIMUM_LOOKASIDE_DEPTH + EXP_IDLE_DEPTH_DECREMENT)
+        {
+            Target -= EXP_IDLE_DEPTH_DECREMENT;
+        }
+        else
+        {
+            Target = EXP_MINIMUM_LOOKASIDE_DEPTH;
+        }
+    }
+    else if (Ratio < 5)
+    {
+        /* Almost every allocation hits, see if we can do with less */
+        if (Target > EXP_MINIMUM_LOOKASIDE_DEPTH) Target--;
+    }
+    else
+    {
+        /* Grow proportionally to the miss rate, up to the maximum */
+        Target += ((Ratio * MaximumDepth) / 2000) + 5;
+    }
+
+    /* Stay within bounds */
+    if (Target > MaximumDepth) Target = MaximumDepth;
+    if (Target < EXP_MINIMUM_LOOKASIDE_DEPTH) Target = EXP_MINIMUM_LOOKASIDE_DEPTH;
+    return (USHORT)Target;
+}
+
+static
+BOOLEAN
+ExpScanLookasideList(IN PGENERAL_LOOKASIDE List,
+                     IN BOOLEAN ListUsesMisses)
+{
+    ULONG Allocates, Misses;
+    USHORT Depth;
+
+    /* Compute the activity since the last scan */
+    Allocates = List->TotalAllocates - List->LastTotalAllocates;
+    List->LastTotalAllocates = List->TotalAllocates;
+    if (ListUsesMisses)
+    {
+        Misses = List->AllocateMisses - List->LastAllocateMisses;
+        List->LastAllocateMisses = List->AllocateMisses;
+    }
+    else
+    {
+        Misses = Allocates - (List->AllocateHits - List->LastAllocateHits);
+        List->LastAllocateHits = List->AllocateHits;
+    }
+
+    /* Set the new depth and tell the caller if the list shrunk */
+    Depth = ExpComputeLookasideDepth(Allocates,
+                                     Misses,
+                                     List->MaximumDepth,
+                                     List->Depth);
+    if (Depth >= List->Depth)
+    {
+        List->Depth = Depth;
+        return FALSE;
+    }
+
+    List->Depth = Depth;
+    return TRUE;
+}
+
+static
+VOID
+ExpTrimLookasideList(IN PGENERAL_LOOKASIDE List,
+                     IN PSINGLE_LIST_ENTRY FreeList OPTIONAL)
+{
+    PVOID Entry;
+
+    /*
+     * Entries the caller frees later are only collected here. Entries with
+     * their own free routine cannot outlive the lock, since the list (and
+     * the driver owning it) may go away, so free them now if that is legal.
+     */
+    if (FreeList && (List->Free != ExFreePool) && ((List->Type & 1) == PagedPool))
+    {
+        return;
+    }
+
+    /* Give back whatever the list caches beyond its new depth */
+    while (ExQueryDepthSList(&List->ListHead) > List->Depth)
+    {
+        Entry = InterlockedPopEntrySList(&List->ListHead);
+        if (!Entry) break;
+
+        if (FreeList && (List->Free == ExFreePool))
+        {
+            PushEntryList(FreeList, (PSINGLE_LIST_ENTRY)Entry);
+        }
+        else
+        {
+            (*List->Free)(Entry);
+        }
+    }
+}
+
+static
+VOID
+ExpScanLookasideListHead(IN PLIST_ENTRY ListHead,
+                         IN BOOLEAN ListUsesMisses,
+                         IN PSINGLE_LIST_ENTRY FreeList OPTIONAL)
+{
+    PLIST_ENTRY ListEntry;
+    PGENERAL_LOOKASIDE List;
+
+    for (ListEntry = ListHead->Flink;
+         ListEntry != ListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        List = CONTAINING_RECORD(ListEntry, GENERAL_LOOKASIDE, ListEntry);
+        if (ExpScanLookasideList(List, ListUsesMisses))
+        {
+            ExpTrimLookasideList(List, FreeList);
+        }
+    }
+}
+
+/*
+ * Called once a second by the balance set manager. Lists that missed a lot
+ * since the last scan are made deeper, idle ones are made shallower and the
+ * entries they no longer need are returned to the pool.
+ */
+VOID
+NTAPI
+ExAdjustLookasideDepth(VOID)
+{
+    KIRQL OldIrql;
+    SINGLE_LIST_ENTRY FreeList;
+    PSINGLE_LIST_ENTRY Entry;
+
+    PAGED_CODE();
+
+    /*
+     * Pool and system lists are never deleted, so no lock is needed. Blocks
+     * cached by the pool lists were already untracked by ExFreePoolWithTag
+     * and cannot go through it again, so they go straight back to their
+     * descriptor.
+     */
+    FreeList.Next = NULL;
+    ExpScanLookasideListHead(&ExPoolLookasideListHead, FALSE, &FreeList);
+    while ((Entry = PopEntryList(&FreeList))) ExpFreeCachedPoolBlock(Entry);
+    ExpScanLookasideListHead(&ExSystemLookasideListHead, TRUE, NULL);
+
+    /*
+     * Driver lists can be deleted under us, so hold their lock while scanning.
+     * The surplus is collected under the lock and freed once it is dropped,
+     * which also keeps paged entries from being freed at DISPATCH_LEVEL.
+     */
+    KeAcquireSpinLock(&ExpNonPagedLookasideListLock, &OldIrql);
+    ExpScanLookasideListHead(&ExpNonPagedLookasideListHead, TRUE, &FreeList);
+    KeReleaseSpinLock(&ExpNonPagedLookasideListLock, OldIrql);
+    while ((Entry = PopEntryList(&FreeList))) ExFreePool(Entry);
+
+    KeAcquireSpinLock(&ExpPagedLookasideListLock, &OldIrql);
+    ExpScanLookasideListHead(&ExpPagedLookasideListHead, TRUE, &FreeList);
+    KeReleaseSpinLock(&ExpPagedLookasideListLock, OldIrql);
+    while ((Entry = PopEntryList(&FreeList))) ExFreePool(Entry);
+}
+
 /* PUBLIC FUNCTIONS **********************************************************/
 
 /*
@@ -22,17 +22,45 @@
 PAGED_LOOKASIDE_LIST FsRtlFirstMappingLookasideList;
 NPAGED_LOOKASIDE_LIST FsRtlFastMutexLookasideList;
 
-/* We use only real 'mapping' runs; we do not store 'holes' to our GTree. */
-typedef struct _LARGE_MCB_MAPPING_ENTRY // run
+/*
+ * The mapping is a B+tree of runs kept in Vbn order. Holes are stored as
+ * runs mapping to Lbn -1, so the runs cover the file from Vbn 0 without
+ * gaps and the index of a run is its position in the tree. Leaves only
+ * record the length of each run; interior nodes keep the sector and run
+ * totals of every child. Lookups descend by Vbn or by index without
+ * touching the tree, and shifting all the runs after a Vbn only means
+ * fixing up the totals on a single path.
+ */
+#define MCB_LEAF_RUNS       32
+#define MCB_INDEX_CHILDREN  32
+
+typedef struct _LARGE_MCB_RUN
 {
-    LARGE_INTEGER RunStartVbn;
-    LARGE_INTEGER RunEndVbn;   /* RunStartVbn+SectorCount; that means +1 after the last sector */
-    LARGE_INTEGER StartingLbn; /* Lbn of 'RunStartVbn' */
-} LARGE_MCB_MAPPING_ENTRY, *PLARGE_MCB_MAPPING_ENTRY;
+    LONGLONG SectorCount;
+    LONGLONG Lbn;   /* -1 for holes */
+} LARGE_MCB_RUN, *PLARGE_MCB_RUN;
+
+typedef struct _LARGE_MCB_NODE
+{
+    USHORT Level;   /* 0 for leaves */
+    USHORT Count;   /* Runs of a leaf, children of an interior node */
+    union
+    {
+        LARGE_MCB_RUN Runs[MCB_LEAF_RUNS];
+        struct
+        {
+            LONGLONG ChildSectors[MCB_INDEX_CHILDREN];
+            ULONG ChildRuns[MCB_INDEX_CHILDREN];
+            struct _LARGE_MCB_NODE *Children[MCB_INDEX_CHILDREN];
+        };
+    };
+} LARGE_MCB_NODE, *PLARGE_MCB_NODE;
 
 typedef struct _LARGE_MCB_MAPPING // mcb_priv
 {
-    RTL_GENERIC_TABLE Table;
+    PLARGE_MCB_NODE Root;   /* NULL while the MCB is empty */
+    LONGLONG Sectors;       /* Vbn following the last run */
+    ULONG Runs;             /* Holes included; the last run is never a hole */
 } LARGE_MCB_MAPPING, *PLARGE_MCB_MAPPING;
 
 typedef struct _BASE_MCB_INTERNAL {
@@ -43,74 +71,620 @@ typedef struct _BASE_MCB_INTERNAL {
     PLARGE_MCB_MAPPING Mapping;
 } BASE_MCB_INTERNAL, *PBASE_MCB_INTERNAL;
 
-/*
-static LARGE_MCB_MAPPING_ENTRY StaticRunBelow0 = {
-    {{-1}}, // ignored
-    {{0}},
-    {{-1}}, // ignored
-};
-*/
-
-static PVOID NTAPI McbMappingAllocate(PRTL_GENERIC_TABLE Table, CLONG Bytes)
+#define McbIsHole(Run) ((Run)->Lbn == -1)
+
+static
+PLARGE_MCB_NODE
+McbAllocateNode(IN PBASE_MCB_INTERNAL Mcb,
+                IN USHORT Level)
 {
-    PVOID Result;
-    PBASE_MCB Mcb = (PBASE_MCB)Table->TableContext;
-    Result = ExAllocatePoolWithTag(Mcb->PoolType, Bytes, 'LMCB');
-    DPRINT("McbMappingAllocate(%lu) => %p\n", Bytes, Result);
-    return Result;
+    PLARGE_MCB_NODE Node;
+
+    Node = ExAllocatePoolWithTag(Mcb->PoolType | POOL_RAISE_IF_ALLOCATION_FAILURE,
+                                 sizeof(LARGE_MCB_NODE),
+                                 'LMCB');
+    Node->Level = Level;
+    Node->Count = 0;
+    DPRINT("McbAllocateNode(%p, %u) => %p\n", Mcb, Level, Node);
+    return Node;
 }
 
-static VOID NTAPI McbMappingFree(PRTL_GENERIC_TABLE Table, PVOID Buffer)
+static
+VOID
+McbFreeNode(IN PLARGE_MCB_NODE Node)
 {
-    DPRINT("McbMappingFree(%p)\n", Buffer);
-    ExFreePoolWithTag(Buffer, 'LMCB');
+    USHORT i;
+
+    if (Node->Level > 0)
+    {
+        for (i = 0; i < Node->Count; i++)
+            McbFreeNode(Node->Children[i]);
+    }
+
+    DPRINT("McbFreeNode(%p)\n", Node);
+    ExFreePoolWithTag(Node, 'LMCB');
 }
 
 static
-RTL_GENERIC_COMPARE_RESULTS
-NTAPI
-McbMappingCompare(PRTL_GENERIC_TABLE Table,
-                  PVOID PtrA,
-                  PVOID PtrB)
+LONGLONG
+McbNodeSectors(IN PLARGE_MCB_NODE Node)
+{
+    LONGLONG Sectors = 0;
+    USHORT i;
+
+    for (i = 0; i < Node->Count; i++)
+        Sectors += Node->Level ? Node->ChildSectors[i] : Node->Runs[i].SectorCount;
+
+    return Sectors;
+}
+
+static
+ULONG
+McbNodeRuns(IN PLARGE_MCB_NODE Node)
+{
+    ULONG Runs = 0;
+    USHORT i;
+
+    if (Node->Level == 0)
+        return Node->Count;
+
+    for (i = 0; i < Node->Count; i++)
+        Runs += Node->ChildRuns[i];
+
+    return Runs;
+}
+
+static
+VOID
+McbInsertChild(IN PLARGE_MCB_NODE Node,
+               IN USHORT Slot,
+               IN PLARGE_MCB_NODE Child)
+{
+    USHORT Moved = Node->Count - Slot;
+
+    ASSERT(Node->Count < MCB_INDEX_CHILDREN);
+
+    RtlMoveMemory(&Node->ChildSectors[Slot + 1], &Node->ChildSectors[Slot], Moved * sizeof(LONGLONG));
+    RtlMoveMemory(&Node->ChildRuns[Slot + 1], &Node->ChildRuns[Slot], Moved * sizeof(ULONG));
+    RtlMoveMemory(&Node->Children[Slot + 1], &Node->Children[Slot], Moved * sizeof(PLARGE_MCB_NODE));
+    Node->ChildSectors[Slot] = McbNodeSectors(Child);
+    Node->ChildRuns[Slot] = McbNodeRuns(Child);
+    Node->Children[Slot] = Child;
+    Node->Count++;
+}
+
+static
+VOID
+McbRemoveChild(IN PLARGE_MCB_NODE Node,
+               IN USHORT Slot)
+{
+    USHORT Moved = Node->Count - Slot - 1;
+
+    RtlMoveMemory(&Node->ChildSectors[Slot], &Node->ChildSectors[Slot + 1], Moved * sizeof(LONGLONG));
+    RtlMoveMemory(&Node->ChildRuns[Slot], &Node->ChildRuns[Slot + 1], Moved * sizeof(ULONG));
+    RtlMoveMemory(&Node->Children[Slot], &Node->Children[Slot + 1], Moved * sizeof(PLARGE_MCB_NODE));
+    Node->Count--;
+}
+
+/* Moves everything past the first Keep entries of a child into a new sibling */
+static
+VOID
+McbSplitChild(IN PBASE_MCB_INTERNAL Mcb,
+              IN PLARGE_MCB_NODE Node,
+              IN USHORT Slot,
+              IN USHORT Keep)
 {
-    PLARGE_MCB_MAPPING_ENTRY A = PtrA, B = PtrB;
-    RTL_GENERIC_COMPARE_RESULTS Res;
-
-    ASSERT(A);
-    ASSERT(B);
-
-    if (A->RunStartVbn.QuadPart == B->RunStartVbn.QuadPart && A->RunEndVbn.QuadPart == B->RunEndVbn.QuadPart)
-        Res = GenericEqual;
-    else if (A->RunEndVbn.QuadPart <= B->RunStartVbn.QuadPart)
-        Res = GenericLessThan;
-    else if (A->RunEndVbn.QuadPart >= B->RunStartVbn.QuadPart)
-        Res = GenericGreaterThan;
+    PLARGE_MCB_NODE Child = Node->Children[Slot], Sibling;
+    USHORT Moved = Child->Count - Keep;
+
+    /* Allocate first, so that failing leaves the tree untouched */
+    Sibling = McbAllocateNode(Mcb, Child->Level);
+
+    if (Child->Level == 0)
+    {
+        RtlCopyMemory(Sibling->Runs, &Child->Runs[Keep], Moved * sizeof(LARGE_MCB_RUN));
+    }
     else
     {
-        ASSERT(FALSE);
-        Res = GenericEqual;
+        RtlCopyMemory(Sibling->ChildSectors, &Child->ChildSectors[Keep], Moved * sizeof(LONGLONG));
+        RtlCopyMemory(Sibling->ChildRuns, &Child->ChildRuns[Keep], Moved * sizeof(ULONG));
+        RtlCopyMemory(Sibling->Children, &Child->Children[Keep], Moved * sizeof(PLARGE_MCB_NODE));
     }
+    Sibling->Count = Moved;
+    Child->Count = Keep;
 
-    return Res;
+    McbInsertChild(Node, Slot + 1, Sibling);
+    Node->ChildSectors[Slot] -= Node->ChildSectors[Slot + 1];
+    Node->ChildRuns[Slot] -= Node->ChildRuns[Slot + 1];
 }
 
-static RTL_GENERIC_COMPARE_RESULTS NTAPI McbMappingIntersectCompare(PRTL_GENERIC_TABLE Table, PVOID PtrA, PVOID PtrB)
+/* Appends the child following Slot to it and frees the emptied node */
+static
+VOID
+McbMergeChildren(IN PLARGE_MCB_NODE Node,
+                 IN USHORT Slot)
 {
-    PLARGE_MCB_MAPPING_ENTRY A = PtrA, B = PtrB;
-    RTL_GENERIC_COMPARE_RESULTS Res;
-
-    if (A->RunStartVbn.QuadPart <= B->RunStartVbn.QuadPart && A->RunEndVbn.QuadPart > B->RunStartVbn.QuadPart)
-        Res = GenericEqual;
-    else if (A->RunStartVbn.QuadPart >= B->RunStartVbn.QuadPart && B->RunEndVbn.QuadPart > A->RunStartVbn.QuadPart)
-        Res = GenericEqual;
-    else if (A->RunStartVbn.QuadPart < B->RunStartVbn.QuadPart)
-        Res = GenericLessThan;
-    else if (A->RunStartVbn.QuadPart > B->RunStartVbn.QuadPart)
-        Res = GenericGreaterThan;
+    PLARGE_MCB_NODE Left = Node->Children[Slot], Right = Node->Children[Slot + 1];
+
+    if (Left->Level == 0)
+    {
+        RtlCopyMemory(&Left->Runs[Left->Count], Right->Runs, Right->Count * sizeof(LARGE_MCB_RUN));
+    }
     else
-        Res = GenericEqual;
+    {
+        RtlCopyMemory(&Left->ChildSectors[Left->Count], Right->ChildSectors, Right->Count * sizeof(LONGLONG));
+        RtlCopyMemory(&Left->ChildRuns[Left->Count], Right->ChildRuns, Right->Count * sizeof(ULONG));
+        RtlCopyMemory(&Left->Children[Left->Count], Right->Children, Right->Count * sizeof(PLARGE_MCB_NODE));
+    }
+    Left->Count += Right->Count;
+
+    Node->ChildSectors[Slot] += Node->ChildSectors[Slot + 1];
+    Node->ChildRuns[Slot] += Node->ChildRuns[Slot + 1];
+    Right->Count = 0;
+    McbFreeNode(Right);
+    McbRemoveChild(Node, Slot + 1);
+}
+
+/* Frees a child left empty, or folds a sparse one into a neighbour with room for it */
+static
+VOID
+McbRebalanceChild(IN PLARGE_MCB_NODE Node,
+                  IN USHORT Slot)
+{
+    PLARGE_MCB_NODE Child = Node->Children[Slot];
+    USHORT Capacity = Child->Level ? MCB_INDEX_CHILDREN : MCB_LEAF_RUNS;
+
+    if (Child->Count == 0)
+    {
+        McbFreeNode(Child);
+        McbRemoveChild(Node, Slot);
+        return;
+    }
+
+    if (Child->Count >= Capacity / 4)
+        return;
+
+    if (Slot > 0 && Node->Children[Slot - 1]->Count + Child->Count <= Capacity)
+        McbMergeChildren(Node, Slot - 1);
+    else if (Slot + 1 < Node->Count && Node->Children[Slot + 1]->Count + Child->Count <= Capacity)
+        McbMergeChildren(Node, Slot);
+}
+
+/* Drops root levels left with a single child, and the root itself once it is empty */
+static
+VOID
+McbShrinkRoot(IN PLARGE_MCB_MAPPING Mapping)
+{
+    PLARGE_MCB_NODE Root;
+
+    while ((Root = Mapping->Root)->Level > 0 && Root->Count == 1)
+    {
+        Mapping->Root = Root->Children[0];
+        Root->Count = 0;
+        McbFreeNode(Root);
+    }
+
+    if (Root->Count == 0)
+    {
+        McbFreeNode(Root);
+        Mapping->Root = NULL;
+    }
+}
+
+static
+BOOLEAN
+McbFindRunByVbn(IN PLARGE_MCB_MAPPING Mapping,
+                IN LONGLONG Vbn,
+                OUT PLARGE_MCB_RUN Run,
+                OUT PLONGLONG RunVbn,
+                OUT PULONG Index)
+{
+    PLARGE_MCB_NODE Node = Mapping->Root;
+    LONGLONG Base = 0;
+    ULONG RunIndex = 0;
+    USHORT i;
+
+    if (Vbn < 0 || Vbn >= Mapping->Sectors)
+        return FALSE;
+
+    while (Node->Level > 0)
+    {
+        for (i = 0; i < Node->Count - 1 && Vbn >= Base + Node->ChildSectors[i]; i++)
+        {
+            Base += Node->ChildSectors[i];
+            RunIndex += Node->ChildRuns[i];
+        }
+        Node = Node->Children[i];
+    }
 
-    return Res;
+    for (i = 0; i < Node->Count - 1 && Vbn >= Base + Node->Runs[i].SectorCount; i++)
+        Base += Node->Runs[i].SectorCount;
+
+    *Run = Node->Runs[i];
+    *RunVbn = Base;
+    *Index = RunIndex + i;
+    return TRUE;
+}
+
+static
+BOOLEAN
+McbFindRunByIndex(IN PLARGE_MCB_MAPPING Mapping,
+                  IN ULONG Index,
+                  OUT PLARGE_MCB_RUN Run,
+                  OUT PLONGLONG RunVbn)
+{
+    PLARGE_MCB_NODE Node = Mapping->Root;
+    LONGLONG Base = 0;
+    USHORT i;
+
+    if (Index >= Mapping->Runs)
+        return FALSE;
+
+    while (Node->Level > 0)
+    {
+        for (i = 0; i < Node->Count - 1 && Index >= Node->ChildRuns[i]; i++)
+        {
+            Index -= Node->ChildRuns[i];
+            Base += Node->ChildSectors[i];
+        }
+        Node = Node->Children[i];
+    }
+
+    for (i = 0; i < Index; i++)
+        Base += Node->Runs[i].SectorCount;
+
+    *Run = Node->Runs[Index];
+    *RunVbn = Base;
+    return TRUE;
+}
+
+/* Replaces the run at Index and returns by how much its length changed */
+static
+LONGLONG
+McbSetRunNode(IN PLARGE_MCB_NODE Node,
+              IN ULONG Index,
+              IN PLARGE_MCB_RUN Run)
+{
+    LONGLONG Delta;
+    USHORT i;
+
+    if (Node->Level == 0)
+    {
+        Delta = Run->SectorCount - Node->Runs[Index].SectorCount;
+        Node->Runs[Index] = *Run;
+        return Delta;
+    }
+
+    for (i = 0; i < Node->Count - 1 && Index >= Node->ChildRuns[i]; i++)
+        Index -= Node->ChildRuns[i];
+
+    Delta = McbSetRunNode(Node->Children[i], Index, Run);
+    Node->ChildSectors[i] += Delta;
+    return Delta;
+}
+
+static
+VOID
+McbSetRun(IN PLARGE_MCB_MAPPING Mapping,
+          IN ULONG Index,
+          IN PLARGE_MCB_RUN Run)
+{
+    Mapping->Sectors += McbSetRunNode(Mapping->Root, Index, Run);
+}
+
+static
+BOOLEAN
+McbIsNodeFull(IN PLARGE_MCB_NODE Node)
+{
+    /* A leaf must have room for the two runs an insertion may add */
+    if (Node->Level == 0)
+        return Node->Count + 2 > MCB_LEAF_RUNS;
+
+    return Node->Count == MCB_INDEX_CHILDREN;
+}
+
+/*
+ * Inserts Count runs (at most two) in front of the run at Index. Full
+ * nodes are split on the way down, before anything else is modified, so
+ * an allocation failure leaves the mapping as it was.
+ */
+static
+VOID
+McbInsertRunsNode(IN PBASE_MCB_INTERNAL Mcb,
+                  IN PLARGE_MCB_NODE Node,
+                  IN ULONG Index,
+                  IN PLARGE_MCB_RUN Runs,
+                  IN USHORT Count,
+                  IN LONGLONG Sectors)
+{
+    PLARGE_MCB_NODE Child;
+    USHORT i;
+
+    if (Node->Level == 0)
+    {
+        RtlMoveMemory(&Node->Runs[Index + Count], &Node->Runs[Index], (Node->Count - Index) * sizeof(LARGE_MCB_RUN));
+        RtlCopyMemory(&Node->Runs[Index], Runs, Count * sizeof(LARGE_MCB_RUN));
+        Node->Count += Count;
+        return;
+    }
+
+    for (i = 0; i < Node->Count - 1 && Index > Node->ChildRuns[i]; i++)
+        Index -= Node->ChildRuns[i];
+
+    Child = Node->Children[i];
+    if (McbIsNodeFull(Child))
+    {
+        /* Files mostly grow at the end: keep the child full when appending to it */
+        McbSplitChild(Mcb, Node, i, (Index == Node->ChildRuns[i]) ? Child->Count - 1 : Child->Count / 2);
+        if (Index > Node->ChildRuns[i])
+        {
+            Index -= Node->ChildRuns[i];
+            i++;
+        }
+        Child = Node->Children[i];
+    }
+
+    McbInsertRunsNode(Mcb, Child, Index, Runs, Count, Sectors);
+    Node->ChildSectors[i] += Sectors;
+    Node->ChildRuns[i] += Count;
+}
+
+static
+VOID
+McbInsertRuns(IN PBASE_MCB_INTERNAL Mcb,
+              IN ULONG Index,
+              IN PLARGE_MCB_RUN Runs,
+              IN USHORT Count)
+{
+    PLARGE_MCB_MAPPING Mapping = Mcb->Mapping;
+    PLARGE_MCB_NODE Root;
+    LONGLONG Sectors = 0;
+    USHORT i;
+
+    for (i = 0; i < Count; i++)
+        Sectors += Runs[i].SectorCount;
+
+    if (!Mapping->Root)
+    {
+        Mapping->Root = McbAllocateNode(Mcb, 0);
+    }
+    else if (McbIsNodeFull(Mapping->Root))
+    {
+        /* Grow a new root above the full one, the descent splits it */
+        Root = McbAllocateNode(Mcb, Mapping->Root->Level + 1);
+        Root->Count = 1;
+        Root->ChildSectors[0] = Mapping->Sectors;
+        Root->ChildRuns[0] = Mapping->Runs;
+        Root->Children[0] = Mapping->Root;
+        Mapping->Root = Root;
+    }
+
+    McbInsertRunsNode(Mcb, Mapping->Root, Index, Runs, Count, Sectors);
+    Mapping->Sectors += Sectors;
+    Mapping->Runs += Count;
+}
+
+/* Removes the run at Index and returns its length */
+static
+LONGLONG
+McbDeleteRunNode(IN PLARGE_MCB_NODE Node,
+                 IN ULONG Index)
+{
+    LONGLONG Sectors;
+    USHORT i;
+
+    if (Node->Level == 0)
+    {
+        Sectors = Node->Runs[Index].SectorCount;
+        RtlMoveMemory(&Node->Runs[Index], &Node->Runs[Index + 1], (Node->Count - Index - 1) * sizeof(LARGE_MCB_RUN));
+        Node->Count--;
+        return Sectors;
+    }
+
+    for (i = 0; i < Node->Count - 1 && Index >= Node->ChildRuns[i]; i++)
+        Index -= Node->ChildRuns[i];
+
+    Sectors = McbDeleteRunNode(Node->Children[i], Index);
+    Node->ChildSectors[i] -= Sectors;
+    Node->ChildRuns[i]--;
+    McbRebalanceChild(Node, i);
+    return Sectors;
+}
+
+static
+VOID
+McbDeleteRun(IN PLARGE_MCB_MAPPING Mapping,
+             IN ULONG Index)
+{
+    Mapping->Sectors -= McbDeleteRunNode(Mapping->Root, Index);
+    Mapping->Runs--;
+    McbShrinkRoot(Mapping);
+}
+
+/* Keeps the first Index runs, which must not be 0, and returns the sectors they cover */
+static
+LONGLONG
+McbTruncateNode(IN PLARGE_MCB_NODE Node,
+                IN ULONG Index)
+{
+    LONGLONG Sectors = 0;
+    USHORT i, j;
+
+    if (Node->Level == 0)
+    {
+        Node->Count = (USHORT)Index;
+        return McbNodeSectors(Node);
+    }
+
+    for (i = 0; i < Node->Count - 1 && Index > Node->ChildRuns[i]; i++)
+    {
+        Index -= Node->ChildRuns[i];
+        Sectors += Node->ChildSectors[i];
+    }
+
+    /* Whole subtrees past the cut go away without being walked run by run */
+    for (j = i + 1; j < Node->Count; j++)
+        McbFreeNode(Node->Children[j]);
+    Node->Count = i + 1;
+
+    Node->ChildSectors[i] = McbTruncateNode(Node->Children[i], Index);
+    Node->ChildRuns[i] = Index;
+    Sectors += Node->ChildSectors[i];
+    McbRebalanceChild(Node, i);
+    return Sectors;
+}
+
+static
+VOID
+McbTruncateRuns(IN PLARGE_MCB_MAPPING Mapping,
+                IN ULONG Index)
+{
+    if (Index >= Mapping->Runs)
+        return;
+
+    if (Index == 0)
+    {
+        McbFreeNode(Mapping->Root);
+        Mapping->Root = NULL;
+        Mapping->Sectors = 0;
+        Mapping->Runs = 0;
+        return;
+    }
+
+    Mapping->Sectors = McbTruncateNode(Mapping->Root, Index);
+    Mapping->Runs = Index;
+    McbShrinkRoot(Mapping);
+}
+
+/* Makes a run start at Vbn, which must be mapped, and returns its index */
+static
+ULONG
+McbSplitRunAt(IN PBASE_MCB_INTERNAL Mcb,
+              IN LONGLONG Vbn)
+{
+    LARGE_MCB_RUN Run, Upper;
+    LONGLONG RunVbn;
+    ULONG Index;
+
+    McbFindRunByVbn(Mcb->Mapping, Vbn, &Run, &RunVbn, &Index);
+    if (RunVbn == Vbn)
+        return Index;
+
+    Upper.SectorCount = RunVbn + Run.SectorCount - Vbn;
+    Upper.Lbn = McbIsHole(&Run) ? -1 : Run.Lbn + (Vbn - RunVbn);
+    McbInsertRuns(Mcb, Index + 1, &Upper, 1);
+
+    Run.SectorCount = Vbn - RunVbn;
+    McbSetRun(Mcb->Mapping, Index, &Run);
+    return Index + 1;
+}
+
+static
+BOOLEAN
+McbCanMergeRuns(IN PLARGE_MCB_RUN Lower,
+                IN PLARGE_MCB_RUN Higher)
+{
+    /* Holes merge together, mappings only when their Lbns are contiguous too */
+    if (McbIsHole(Lower) || McbIsHole(Higher))
+        return McbIsHole(Lower) && McbIsHole(Higher);
+
+    return Lower->Lbn + Lower->SectorCount == Higher->Lbn;
+}
+
+static
+VOID
+McbCoalesceRun(IN PLARGE_MCB_MAPPING Mapping,
+               IN ULONG Index)
+{
+    LARGE_MCB_RUN Run, Other;
+    LONGLONG RunVbn;
+
+    McbFindRunByIndex(Mapping, Index, &Run, &RunVbn);
+
+    if (McbFindRunByIndex(Mapping, Index + 1, &Other, &RunVbn) &&
+        McbCanMergeRuns(&Run, &Other))
+    {
+        Run.SectorCount += Other.SectorCount;
+        McbSetRun(Mapping, Index, &Run);
+        McbDeleteRun(Mapping, Index + 1);
+    }
+
+    if (Index > 0 &&
+        McbFindRunByIndex(Mapping, Index - 1, &Other, &RunVbn) &&
+        McbCanMergeRuns(&Other, &Run))
+    {
+        Other.SectorCount += Run.SectorCount;
+        McbSetRun(Mapping, Index - 1, &Other);
+        McbDeleteRun(Mapping, Index);
+    }
+}
+
+/* Maps Vbn ... Vbn+SectorCount-1 from Lbn onwards, or punches a hole there if Lbn is -1 */
+static
+VOID
+McbSetRange(IN PBASE_MCB_INTERNAL Mcb,
+            IN LONGLONG Vbn,
+            IN LONGLONG SectorCount,
+            IN LONGLONG Lbn)
+{
+    PLARGE_MCB_MAPPING Mapping = Mcb->Mapping;
+    LARGE_MCB_RUN Runs[2];
+    LONGLONG RunVbn;
+    ULONG First, Last;
+    USHORT Count = 0;
+
+    if (Vbn >= Mapping->Sectors)
+    {
+        if (Lbn == -1)
+            return;
+
+        /* Append the run, behind a hole if it does not follow the last one */
+        if (Vbn > Mapping->Sectors)
+        {
+            Runs[Count].SectorCount = Vbn - Mapping->Sectors;
+            Runs[Count++].Lbn = -1;
+        }
+        Runs[Count].SectorCount = SectorCount;
+        Runs[Count++].Lbn = Lbn;
+        McbInsertRuns(Mcb, Mapping->Runs, Runs, Count);
+        McbCoalesceRun(Mapping, Mapping->Runs - 1);
+        return;
+    }
+
+    /* Cut the runs at both ends of the range */
+    First = McbSplitRunAt(Mcb, Vbn);
+    if (Vbn + SectorCount < Mapping->Sectors)
+    {
+        Last = McbSplitRunAt(Mcb, Vbn + SectorCount);
+    }
+    else if (Lbn == -1)
+    {
+        /* Unmapping the tail shortens the mapping, which never ends with a hole */
+        McbTruncateRuns(Mapping, First);
+        if (McbFindRunByIndex(Mapping, First - 1, &Runs[0], &RunVbn) && McbIsHole(&Runs[0]))
+            McbTruncateRuns(Mapping, First - 1);
+        return;
+    }
+    else
+    {
+        Last = Mapping->Runs;
+    }
+
+    /* Reuse the first run of the range and drop the others */
+    Runs[0].SectorCount = SectorCount;
+    Runs[0].Lbn = Lbn;
+    McbSetRun(Mapping, First, &Runs[0]);
+    if (Last == Mapping->Runs)
+    {
+        McbTruncateRuns(Mapping, First + 1);
+    }
+    else
+    {
+        while (--Last > First)
+            McbDeleteRun(Mapping, First + 1);
+    }
+
+    McbCoalesceRun(Mapping, First);
 }
 
 
@@ -138,12 +712,10 @@ FsRtlAddBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
                      IN LONGLONG SectorCount)
 {
     BOOLEAN Result = TRUE;
-    BOOLEAN IntResult;
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    LARGE_MCB_MAPPING_ENTRY Node, NeedleRun;
-    PLARGE_MCB_MAPPING_ENTRY LowerRun, HigherRun;
-    BOOLEAN NewElement;
-    LONGLONG IntLbn;
+    LARGE_MCB_RUN Run;
+    LONGLONG RunVbn;
+    ULONG Index;
 
     DPRINT("FsRtlAddBaseMcbEntry(%p, %I64d, %I64d, %I64d)\n", OpaqueMcb, Vbn, Lbn, SectorCount);
 
@@ -153,121 +725,29 @@ FsRtlAddBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
         goto quit;
     }
 
-    if (SectorCount <= 0)
+    if (SectorCount <= 0 || Vbn + SectorCount <= Vbn)
     {
         Result = FALSE;
         goto quit;
     }
 
-    IntResult = FsRtlLookupBaseMcbEntry(OpaqueMcb, Vbn, &IntLbn, NULL, NULL, NULL, NULL);
-    if (IntResult)
+    /* Overwriting an existing mapping is not possible, but the new run may extend one */
+    if (McbFindRunByVbn(Mcb->Mapping, Vbn, &Run, &RunVbn, &Index))
     {
-        if (IntLbn != -1 && IntLbn != Lbn)
+        do
         {
-            Result = FALSE;
-            goto quit;
-        }
-    }
-
-    /* clean any possible previous entries in our range */
-    FsRtlRemoveBaseMcbEntry(OpaqueMcb, Vbn, SectorCount);
-
-    // We need to map [Vbn, Vbn+SectorCount) to [Lbn, Lbn+SectorCount),
-    // taking in account the fact that we need to merge these runs if
-    // they are adjacent or overlap, but fail if new run fully fits into another run
-
-    /* initially we think we will be inserted as a separate run */
-    Node.RunStartVbn.QuadPart = Vbn;
-    Node.RunEndVbn.QuadPart = Vbn + SectorCount;
-    Node.StartingLbn.QuadPart = Lbn;
-
-    /* optionally merge with lower run */
-    NeedleRun.RunStartVbn.QuadPart = Node.RunStartVbn.QuadPart - 1;
-    NeedleRun.RunEndVbn.QuadPart = NeedleRun.RunStartVbn.QuadPart + 1;
-    NeedleRun.StartingLbn.QuadPart = ~0ULL;
-    Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-    if ((LowerRun = RtlLookupElementGenericTable(&Mcb->Mapping->Table, &NeedleRun)) &&
-        (LowerRun->StartingLbn.QuadPart + (LowerRun->RunEndVbn.QuadPart - LowerRun->RunStartVbn.QuadPart) == Node.StartingLbn.QuadPart))
-    {
-        ASSERT(LowerRun->RunEndVbn.QuadPart == Node.RunStartVbn.QuadPart);
-        Node.RunStartVbn.QuadPart = LowerRun->RunStartVbn.QuadPart;
-        Node.StartingLbn.QuadPart = LowerRun->StartingLbn.QuadPart;
-        Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
-        RtlDeleteElementGenericTable(&Mcb->Mapping->Table, LowerRun);
-        --Mcb->PairCount;
-        DPRINT("Intersecting lower run found (%I64d,%I64d) Lbn: %I64d\n", LowerRun->RunStartVbn.QuadPart, LowerRun->RunEndVbn.QuadPart, LowerRun->StartingLbn.QuadPart);
+            if (!McbIsHole(&Run) && Run.Lbn - RunVbn != Lbn - Vbn)
+            {
+                Result = FALSE;
+                goto quit;
+            }
+        } while (RunVbn + Run.SectorCount < Vbn + SectorCount &&
+                 McbFindRunByIndex(Mcb->Mapping, ++Index, &Run, &RunVbn));
     }
 
-    /* optionally merge with higher run */
-    NeedleRun.RunStartVbn.QuadPart = Node.RunEndVbn.QuadPart;
-    NeedleRun.RunEndVbn.QuadPart = NeedleRun.RunStartVbn.QuadPart + 1;
-    Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-    if ((HigherRun = RtlLookupElementGenericTable(&Mcb->Mapping->Table, &NeedleRun)) &&
-        (Node.StartingLbn.QuadPart <= HigherRun->StartingLbn.QuadPart))
-    {
-        ASSERT(HigherRun->RunStartVbn.QuadPart == Node.RunEndVbn.QuadPart);
-        Node.RunEndVbn.QuadPart = HigherRun->RunEndVbn.QuadPart;
-        Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
-        RtlDeleteElementGenericTable(&Mcb->Mapping->Table, HigherRun);
-        --Mcb->PairCount;
-        DPRINT("Intersecting higher run found (%I64d,%I64d) Lbn: %I64d\n", HigherRun->RunStartVbn.QuadPart, HigherRun->RunEndVbn.QuadPart, HigherRun->StartingLbn.QuadPart);
-    }
-    Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
-
-    /* finally insert the resulting run */
-    RtlInsertElementGenericTable(&Mcb->Mapping->Table, &Node, sizeof(Node), &NewElement);
-    ++Mcb->PairCount;
-    ASSERT(NewElement);
-
-    // NB: Two consecutive runs can only be merged, if actual LBNs also match!
-
-    /* 1.
-            Existing->RunStartVbn
-            |
-            |///////|
-                |/////////////|
-                |
-                Node->RunStartVbn
-
-        2.
-            Existing->RunStartVbn
-            |
-            |///////|
-        |//////|
-        |
-        Node->RunStartVbn
-
-        3.
-            Existing->RunStartVbn
-            |
-            |///////|
-                |///|
-                |
-                Node->RunStartVbn
-
-        4.
-            Existing->RunStartVbn
-            |
-            |///////|
-        |///////////////|
-        |
-        Node->RunStartVbn
-
-
-    Situation with holes:
-    1. Holes at both ends
-    2. Hole at the right, new run merged with the previous run
-    3. Hole at the right, new run is not merged with the previous run
-    4. Hole at the left, new run merged with the next run
-    5. Hole at the left, new run is not merged with the next run
-    6. No holes, exact fit to merge with both previous and next runs
-    7. No holes, merges only with the next run
-    8. No holes, merges only with the previous run
-    9. No holes, does not merge with next or prev runs
-
-
-    Overwriting existing mapping is not possible and results in FALSE being returned
-    */
+    /* Replace what was there; the run merges with its neighbours if their Lbns are contiguous */
+    McbSetRange(Mcb, Vbn, SectorCount, Lbn);
+    Mcb->PairCount = Mcb->Mapping->Runs;
 
 quit:
     DPRINT("FsRtlAddBaseMcbEntry(%p, %I64d, %I64d, %I64d) = %d\n", Mcb, Vbn, Lbn, SectorCount, Result);
@@ -284,16 +764,24 @@ FsRtlAddLargeMcbEntry(IN PLARGE_MCB Mcb,
                       IN LONGLONG Lbn,
                       IN LONGLONG SectorCount)
 {
-    BOOLEAN Result;
+    BOOLEAN Result = FALSE;
 
     DPRINT("FsRtlAddLargeMcbEntry(%p, %I64d, %I64d, %I64d)\n", Mcb, Vbn, Lbn, SectorCount);
 
+    /* Adding a run may raise when a node can't be allocated, don't keep the mutex then */
     KeAcquireGuardedMutex(Mcb->GuardedMutex);
-    Result = FsRtlAddBaseMcbEntry(&(Mcb->BaseMcb),
-                                  Vbn,
-                                  Lbn,
-                                  SectorCount);
-    KeReleaseGuardedMutex(Mcb->GuardedMutex);
+    _SEH2_TRY
+    {
+        Result = FsRtlAddBaseMcbEntry(&(Mcb->BaseMcb),
+                                      Vbn,
+                                      Lbn,
+                                      SectorCount);
+    }
+    _SEH2_FINALLY
+    {
+        KeReleaseGuardedMutex(Mcb->GuardedMutex);
+    }
+    _SEH2_END;
 
     DPRINT("FsRtlAddLargeMcbEntry(%p, %I64d, %I64d, %I64d) = %d\n", Mcb, Vbn, Lbn, SectorCount, Result);
 
@@ -316,7 +804,7 @@ FsRtlAddLargeMcbEntry(IN PLARGE_MCB Mcb,
  * Retrieves the parameters of the specified run with index @RunIndex.
  * 
  * Mapping %0 always starts at virtual block %0, either as 'hole' or as 'real' mapping.
- * libcaptive does not store 'hole' information to its #GTree.
+ * 'hole' runs are stored in the tree like any other run.
  * Last run is always a 'real' run. 'hole' runs appear as mapping to constant @Lbn value %-1.
  *
  * Returns: %TRUE if successful.
@@ -331,46 +819,17 @@ FsRtlGetNextBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
 {
     BOOLEAN Result = FALSE;
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    PLARGE_MCB_MAPPING_ENTRY Run = NULL;
-    ULONG CurrentIndex = 0;
-    ULONGLONG LastVbn = 0;
-    ULONGLONG LastSectorCount = 0;
-
-    // Traverse the tree 
-    for (Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, TRUE);
-    Run;
-        Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, FALSE))
-    {
-        // is the current index a hole?
-        if (Run->RunStartVbn.QuadPart > (LastVbn + LastSectorCount))
-        {
-            // Is this the index we're looking for?
-            if (RunIndex == CurrentIndex)
-            {
-                *Vbn = LastVbn + LastSectorCount;
-                *Lbn = -1;
-                *SectorCount = Run->RunStartVbn.QuadPart - *Vbn;
-
-                Result = TRUE;
-                goto quit;
-            }
-
-            CurrentIndex++;
-        }
+    LARGE_MCB_RUN Run;
+    LONGLONG RunVbn;
 
-        if (RunIndex == CurrentIndex)
-        {
-            *Vbn = Run->RunStartVbn.QuadPart;
-            *Lbn = Run->StartingLbn.QuadPart;
-            *SectorCount = Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart;
-
-            Result = TRUE;
-            goto quit;
-        }
+    if (McbFindRunByIndex(Mcb->Mapping, RunIndex, &Run, &RunVbn))
+    {
+        *Vbn = RunVbn;
+        *Lbn = Run.Lbn;
+        *SectorCount = Run.SectorCount;
 
-        CurrentIndex++;
-        LastVbn = Run->RunStartVbn.QuadPart;
-        LastSectorCount = Run->RunEndVbn.QuadPart - Run->RunStartVbn.QuadPart;
+        Result = TRUE;
+        goto quit;
     }
 
     // these values are meaningless when returning false (but setting them can be helpful for debugging purposes)
@@ -435,11 +894,9 @@ FsRtlInitializeBaseMcb(IN PBASE_MCB OpaqueMcb,
     Mcb->PoolType = PoolType;
     Mcb->PairCount = 0;
     Mcb->MaximumPairCount = MAXIMUM_PAIR_COUNT;
-    RtlInitializeGenericTable(&Mcb->Mapping->Table,
-                              McbMappingCompare,
-                              McbMappingAllocate,
-                              McbMappingFree,
-                              Mcb);
+    Mcb->Mapping->Root = NULL;
+    Mcb->Mapping->Sectors = 0;
+    Mcb->Mapping->Runs = 0;
 }
 
 /*
@@ -510,36 +967,34 @@ FsRtlLookupBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
     OUT PULONG Index OPTIONAL)
 {
     BOOLEAN Result = FALSE;
-    ULONG i;
-    LONGLONG LastVbn = 0, LastLbn = 0, Count = 0;   // the last values we've found during traversal
+    PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
+    LARGE_MCB_RUN Run;
+    LONGLONG RunVbn;
+    ULONG RunIndex;
 
     DPRINT("FsRtlLookupBaseMcbEntry(%p, %I64d, %p, %p, %p, %p, %p)\n", OpaqueMcb, Vbn, Lbn, SectorCountFromLbn, StartingLbn, SectorCountFromStartingLbn, Index);
 
-    for (i = 0; FsRtlGetNextBaseMcbEntry(OpaqueMcb, i, &LastVbn, &LastLbn, &Count); i++)
+    if (McbFindRunByVbn(Mcb->Mapping, Vbn, &Run, &RunVbn, &RunIndex))
     {
-        // have we reached the target mapping?
-        if (Vbn < LastVbn + Count)
+        if (Lbn)
         {
-            if (Lbn)
-            {
-                if (LastLbn == -1)
-                    *Lbn = -1;
-                else
-                    *Lbn = LastLbn + (Vbn - LastVbn);
-            }
-
-            if (SectorCountFromLbn)
-                *SectorCountFromLbn = LastVbn + Count - Vbn;
-            if (StartingLbn)
-                *StartingLbn = LastLbn;
-            if (SectorCountFromStartingLbn)
-                *SectorCountFromStartingLbn = LastVbn + Count - LastVbn;
-            if (Index)
-                *Index = i;
-
-            Result = TRUE;
-            goto quit;
+            if (McbIsHole(&Run))
+                *Lbn = -1;
+            else
+                *Lbn = Run.Lbn + (Vbn - RunVbn);
         }
+
+        if (SectorCountFromLbn)
+            *SectorCountFromLbn = RunVbn + Run.SectorCount - Vbn;
+        if (StartingLbn)
+            *StartingLbn = Run.Lbn;
+        if (SectorCountFromStartingLbn)
+            *SectorCountFromStartingLbn = Run.SectorCount;
+        if (Index)
+            *Index = RunIndex;
+
+        Result = TRUE;
+        goto quit;
     }
 
     if (Lbn)
@@ -598,47 +1053,26 @@ FsRtlLookupLastLargeMcbEntryAndIndex_internal(IN PBASE_MCB_INTERNAL Mcb,
                                               OUT PLONGLONG Lbn,
                                               OUT PULONG Index OPTIONAL)
 {
-    ULONG RunIndex = 0;
-    PLARGE_MCB_MAPPING_ENTRY Run, RunFound = NULL;
-    LONGLONG LastVbn = 0;
+    LARGE_MCB_RUN Run;
+    LONGLONG RunVbn;
 
-    for (Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, TRUE);
-        Run;
-        Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, FALSE))
-    {
-        /* Take care when we must emulate missing 'hole' runs. */
-        if (Run->RunStartVbn.QuadPart > LastVbn)
-        {
-            RunIndex++;
-        }
-        LastVbn = Run->RunEndVbn.QuadPart;
-        RunIndex++;
-        RunFound = Run;
-    }
-
-    if (!RunFound)
+    /* The last run is never a hole */
+    if (!McbFindRunByIndex(Mcb->Mapping, Mcb->Mapping->Runs - 1, &Run, &RunVbn))
     {
         return FALSE;
     }
 
     if (Vbn)
     {
-        *Vbn = RunFound->RunEndVbn.QuadPart - 1;
+        *Vbn = RunVbn + Run.SectorCount - 1;
     }
     if (Lbn)
     {
-        if (1)
-        {
-            *Lbn = RunFound->StartingLbn.QuadPart + (RunFound->RunEndVbn.QuadPart - RunFound->RunStartVbn.QuadPart) - 1;
-        }
-        else
-        {
-            *Lbn = ~0ULL;
-        }
+        *Lbn = Run.Lbn + Run.SectorCount - 1;
     }
     if (Index)
     {
-        *Index = RunIndex - 1;
+        *Index = Mcb->Mapping->Runs - 1;
     }
 
     return TRUE;
@@ -694,7 +1128,7 @@ FsRtlLookupLastLargeMcbEntryAndIndex(IN PLARGE_MCB OpaqueMcb,
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 BOOLEAN
 NTAPI
@@ -745,17 +1179,13 @@ ULONG
 NTAPI
 FsRtlNumberOfRunsInBaseMcb(IN PBASE_MCB OpaqueMcb)
 {
-    ULONG NumberOfRuns = 0;
-    LONGLONG Vbn, Lbn, Count;
-    int i;
+    PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
+    ULONG NumberOfRuns;
 
     DPRINT("FsRtlNumberOfRunsInBaseMcb(%p)\n", OpaqueMcb);
 
-    // Count how many Mcb entries there are
-    for (i = 0; FsRtlGetNextBaseMcbEntry(OpaqueMcb, i, &Vbn, &Lbn, &Count); i++)
-    {
-        NumberOfRuns++;
-    }
+    /* Holes are stored as runs, so the count is always up to date */
+    NumberOfRuns = Mcb->Mapping->Runs;
 
     DPRINT("FsRtlNumberOfRunsInBaseMcb(%p) = %d\n", OpaqueMcb, NumberOfRuns);
     return NumberOfRuns;
@@ -801,8 +1231,6 @@ FsRtlRemoveBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
                         IN LONGLONG SectorCount)
 {
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    LARGE_MCB_MAPPING_ENTRY NeedleRun;
-    PLARGE_MCB_MAPPING_ENTRY HaystackRun;
     BOOLEAN Result = TRUE;
 
     DPRINT("FsRtlRemoveBaseMcbEntry(%p, %I64d, %I64d)\n", OpaqueMcb, Vbn, SectorCount);
@@ -819,35 +1247,9 @@ FsRtlRemoveBaseMcbEntry(IN PBASE_MCB OpaqueMcb,
         goto quit;
     }
 
-    NeedleRun.RunStartVbn.QuadPart = Vbn;
-    NeedleRun.RunEndVbn.QuadPart = Vbn + SectorCount;
-    NeedleRun.StartingLbn.QuadPart = ~0ULL;
-
-    /* adjust/destroy all intersecting ranges */
-    Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-    while ((HaystackRun = RtlLookupElementGenericTable(&Mcb->Mapping->Table, &NeedleRun)))
-    {
-        if (HaystackRun->RunStartVbn.QuadPart < NeedleRun.RunStartVbn.QuadPart)
-        {
-            ASSERT(HaystackRun->RunEndVbn.QuadPart > NeedleRun.RunStartVbn.QuadPart);
-            HaystackRun->RunEndVbn.QuadPart = NeedleRun.RunStartVbn.QuadPart;
-        }
-        else if (HaystackRun->RunEndVbn.QuadPart > NeedleRun.RunEndVbn.QuadPart)
-        {
-            ASSERT(HaystackRun->RunStartVbn.QuadPart < NeedleRun.RunEndVbn.QuadPart);
-            HaystackRun->RunStartVbn.QuadPart = NeedleRun.RunEndVbn.QuadPart;
-        }
-        else
-        {
-            //ASSERT(NeedleRun.RunStartVbn.QuadPart >= HaystackRun->RunStartVbn.QuadPart);
-            //ASSERT(NeedleRun.RunEndVbn.QuadPart <= HaystackRun->RunEndVbn.QuadPart);
-            Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
-            RtlDeleteElementGenericTable(&Mcb->Mapping->Table, HaystackRun);
-            --Mcb->PairCount;
-            Mcb->Mapping->Table.CompareRoutine = McbMappingIntersectCompare;
-        }
-    }
-    Mcb->Mapping->Table.CompareRoutine = McbMappingCompare;
+    /* punch a hole over the range; it merges with the holes around it */
+    McbSetRange(Mcb, Vbn, SectorCount, -1);
+    Mcb->PairCount = Mcb->Mapping->Runs;
 
 quit:
     DPRINT("FsRtlRemoveBaseMcbEntry(%p, %I64d, %I64d) = %d\n", OpaqueMcb, Vbn, SectorCount, Result);
@@ -866,8 +1268,15 @@ FsRtlRemoveLargeMcbEntry(IN PLARGE_MCB Mcb,
     DPRINT("FsRtlRemoveLargeMcbEntry(%p, %I64d, %I64d)\n", Mcb, Vbn, SectorCount);
 
     KeAcquireGuardedMutex(Mcb->GuardedMutex);
-    FsRtlRemoveBaseMcbEntry(&(Mcb->BaseMcb), Vbn, SectorCount);
-    KeReleaseGuardedMutex(Mcb->GuardedMutex);
+    _SEH2_TRY
+    {
+        FsRtlRemoveBaseMcbEntry(&(Mcb->BaseMcb), Vbn, SectorCount);
+    }
+    _SEH2_FINALLY
+    {
+        KeReleaseGuardedMutex(Mcb->GuardedMutex);
+    }
+    _SEH2_END;
 }
 
 /*
@@ -878,15 +1287,10 @@ NTAPI
 FsRtlResetBaseMcb(IN PBASE_MCB OpaqueMcb)
 {
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    PLARGE_MCB_MAPPING_ENTRY Element;
 
     DPRINT("FsRtlResetBaseMcb(%p)\n", OpaqueMcb);
 
-    while (RtlNumberGenericTableElements(&Mcb->Mapping->Table) &&
-           (Element = (PLARGE_MCB_MAPPING_ENTRY)RtlGetElementGenericTable(&Mcb->Mapping->Table, 0)))
-    {
-        RtlDeleteElementGenericTable(&Mcb->Mapping->Table, Element);
-    }
+    McbTruncateRuns(Mcb->Mapping, 0);
 
     Mcb->PairCount = 0;
     Mcb->MaximumPairCount = 0;
@@ -912,7 +1316,7 @@ FsRtlResetLargeMcb(IN PLARGE_MCB Mcb,
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 BOOLEAN
 NTAPI
@@ -921,54 +1325,50 @@ FsRtlSplitBaseMcb(IN PBASE_MCB OpaqueMcb,
                   IN LONGLONG Amount)
 {
     PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
-    PLARGE_MCB_MAPPING_ENTRY Run, InsertLowerRun = NULL, ExistingRun = NULL;
-    BOOLEAN NewElement;
+    LARGE_MCB_RUN Run, Hole;
+    LONGLONG RunVbn;
+    ULONG Index;
+    BOOLEAN Result = TRUE;
 
     DPRINT("FsRtlSplitBaseMcb(%p, %I64d, %I64d)\n", OpaqueMcb, Vbn, Amount);
 
-    /* Traverse the tree */
-    for (Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, TRUE);
-        Run;
-        Run = (PLARGE_MCB_MAPPING_ENTRY)RtlEnumerateGenericTable(&Mcb->Mapping->Table, FALSE))
+    /* The runs following Vbn must not be shifted past the largest Vbn */
+    if (Amount < 0 || Amount > MAXLONGLONG - Mcb->Mapping->Sectors)
     {
-        /* unaffected run? */
-        /* FIXME: performance: effective skip of all 'lower' runs without traversing them */
-        if (Vbn >= Run->RunEndVbn.QuadPart) { DPRINT("Skipping it\n"); continue; }
-
-        /* crossing run to be split?
-        * 'lower_run' is created on the original place; just shortened.
-        * current 'run' is shifted up later
-        */
-        if (Vbn < Run->RunEndVbn.QuadPart)
-        {
-            /* FIXME: shift 'run->Lbn_start' ? */
-            Run->RunStartVbn.QuadPart = Vbn;
-
-            InsertLowerRun = NULL;
-        }
-
-        /* Shift the current 'run'.
-        * Ordering is not changed in Generic Tree so I hope I do not need to reinsert it.
-        */
-        Run->RunStartVbn.QuadPart += Amount;
-        ASSERT(Run->RunEndVbn.QuadPart + Amount > Run->RunEndVbn.QuadPart); /* overflow? */
-        Run->RunEndVbn.QuadPart += Amount;
-        /* FIXME: shift 'run->Lbn_start' ? */
-
-        /* continue the traversal */
+        Result = FALSE;
+        goto quit;
     }
 
-    if (InsertLowerRun)
+    /* Nothing to shift? */
+    if (Amount == 0 || !McbFindRunByVbn(Mcb->Mapping, Vbn, &Run, &RunVbn, &Index))
     {
-        ExistingRun = RtlInsertElementGenericTable(&Mcb->Mapping->Table, InsertLowerRun, sizeof(*InsertLowerRun), &NewElement);
-        ++Mcb->PairCount;
+        goto quit;
     }
 
-    ASSERT(ExistingRun == NULL);
-
-    DPRINT("FsRtlSplitBaseMcb(%p, %I64d, %I64d) = %d\n", OpaqueMcb, Vbn, Amount, TRUE);
+    /* Shifting the runs only takes a hole of Amount sectors at Vbn */
+    if (McbIsHole(&Run))
+    {
+        Run.SectorCount += Amount;
+        McbSetRun(Mcb->Mapping, Index, &Run);
+    }
+    else if (RunVbn == Vbn && Index > 0 &&
+             McbFindRunByIndex(Mcb->Mapping, Index - 1, &Run, &RunVbn) && McbIsHole(&Run))
+    {
+        Run.SectorCount += Amount;
+        McbSetRun(Mcb->Mapping, Index - 1, &Run);
+    }
+    else
+    {
+        /* A run crossing Vbn is cut in two around the new hole */
+        Hole.SectorCount = Amount;
+        Hole.Lbn = -1;
+        McbInsertRuns(Mcb, McbSplitRunAt(Mcb, Vbn), &Hole, 1);
+        Mcb->PairCount = Mcb->Mapping->Runs;
+    }
 
-    return TRUE;
+quit:
+    DPRINT("FsRtlSplitBaseMcb(%p, %I64d, %I64d) = %d\n", OpaqueMcb, Vbn, Amount, Result);
+    return Result;
 }
 
 /*
@@ -980,15 +1380,22 @@ FsRtlSplitLargeMcb(IN PLARGE_MCB Mcb,
                    IN LONGLONG Vbn,
                    IN LONGLONG Amount)
 {
-    BOOLEAN Result;
+    BOOLEAN Result = FALSE;
 
     DPRINT("FsRtlSplitLargeMcb(%p, %I64d, %I64d)\n", Mcb, Vbn, Amount);
 
     KeAcquireGuardedMutex(Mcb->GuardedMutex);
-    Result = FsRtlSplitBaseMcb(&(Mcb->BaseMcb),
-                               Vbn,
-                               Amount);
-    KeReleaseGuardedMutex(Mcb->GuardedMutex);
+    _SEH2_TRY
+    {
+        Result = FsRtlSplitBaseMcb(&(Mcb->BaseMcb),
+                                   Vbn,
+                                   Amount);
+    }
+    _SEH2_FINALLY
+    {
+        KeReleaseGuardedMutex(Mcb->GuardedMutex);
+    }
+    _SEH2_END;
 
     DPRINT("FsRtlSplitLargeMcb(%p, %I64d, %I64d) = %d\n", Mcb, Vbn, Amount, Result);
 
@@ -996,16 +1403,22 @@ FsRtlSplitLargeMcb(IN PLARGE_MCB Mcb,
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
 FsRtlTruncateBaseMcb(IN PBASE_MCB OpaqueMcb,
                      IN LONGLONG Vbn)
 {
+    PBASE_MCB_INTERNAL Mcb = (PBASE_MCB_INTERNAL)OpaqueMcb;
+
     DPRINT("FsRtlTruncateBaseMcb(%p, %I64d)\n", OpaqueMcb, Vbn);
 
-    FsRtlRemoveBaseMcbEntry(OpaqueMcb, Vbn, MAXLONG - Vbn + 1);
+    if (Vbn >= 0 && Vbn < Mcb->Mapping->Sectors)
+    {
+        McbSetRange(Mcb, Vbn, Mcb->Mapping->Sectors - Vbn, -1);
+        Mcb->PairCount = Mcb->Mapping->Runs;
+    }
 }
 
 /*
@@ -1019,8 +1432,15 @@ FsRtlTruncateLargeMcb(IN PLARGE_MCB Mcb,
     DPRINT("FsRtlTruncateLargeMcb(%p, %I64d)\n", Mcb, Vbn);
 
     KeAcquireGuardedMutex(Mcb->GuardedMutex);
-    FsRtlTruncateBaseMcb(&(Mcb->BaseMcb), Vbn);
-    KeReleaseGuardedMutex(Mcb->GuardedMutex);
+    _SEH2_TRY
+    {
+        FsRtlTruncateBaseMcb(&(Mcb->BaseMcb), Vbn);
+    }
+    _SEH2_FINALLY
+    {
+        KeReleaseGuardedMutex(Mcb->GuardedMutex);
+    }
+    _SEH2_END;
 }
 
 /*
@@ -40,6 +40,9 @@
 // Global Cc Data
 //
 extern ULONG CcRosTraceLevel;
+extern ULONG CcDirtyPageThreshold;
+extern ULONG CcLazyWriteIos;
+extern ULONG CcLazyWritePages;
 
 typedef struct _PF_SCENARIO_ID
 {
@@ -142,6 +145,19 @@ typedef struct _PFSN_PREFETCHER_GLOBALS
     LONG ActivePrefetches;
 } PFSN_PREFETCHER_GLOBALS, *PPFSN_PREFETCHER_GLOBALS;
 
+typedef struct _ROS_VACB *PROS_VACB;
+
+/* The VACB index is a directory of leaves, each one covering
+ * CC_VACB_LEAF_ENTRIES views and allocated with its first view */
+#define CC_VACB_LEAF_SHIFT 7
+#define CC_VACB_LEAF_ENTRIES (1 << CC_VACB_LEAF_SHIFT)
+
+typedef struct _ROS_VACB_INDEX_LEAF
+{
+    ULONG Count;
+    PROS_VACB Vacbs[CC_VACB_LEAF_ENTRIES];
+} ROS_VACB_INDEX_LEAF, *PROS_VACB_INDEX_LEAF;
+
 typedef struct _ROS_SHARED_CACHE_MAP
 {
     LIST_ENTRY CacheMapVacbListHead;
@@ -154,11 +170,39 @@ typedef struct _ROS_SHARED_CACHE_MAP
     PVOID LazyWriteContext;
     KSPIN_LOCK CacheMapLock;
     ULONG OpenCount;
+    /* VACBs indexed by FileOffset / VACB_MAPPING_GRANULARITY, guarded by CacheMapLock */
+    PROS_VACB_INDEX_LEAF *VacbLeaves;
+    ULONG VacbLeavesCount;
+    /* Dirty pages of this file and the limit set through CcSetDirtyPageThreshold,
+     * zero meaning no limit. DirtyPages is guarded by the ViewLock */
+    ULONG DirtyPages;
+    ULONG DirtyPageThreshold;
+    PVOID LogHandle;
+    PFLUSH_TO_LSN FlushToLsnRoutine;
 #if DBG
     BOOLEAN Trace; /* enable extra trace output for this cache map and it's VACBs */
 #endif
 } ROS_SHARED_CACHE_MAP, *PROS_SHARED_CACHE_MAP;
 
+typedef struct _ROS_PRIVATE_CACHE_MAP
+{
+    PFILE_OBJECT FileObject;
+    /* Read ahead granularity, minus one */
+    ULONG ReadAheadMask;
+    BOOLEAN ReadAheadEnabled;
+    /* Is a read ahead work item queued or running */
+    BOOLEAN ReadAheadActive;
+    /* Signaled when no read ahead is in flight for this file object */
+    KEVENT ReadAheadDone;
+    /* Range of the last read through this file object */
+    LARGE_INTEGER FileOffset;
+    LARGE_INTEGER BeyondLastByte;
+    /* Range of the last read ahead */
+    LARGE_INTEGER ReadAheadOffset;
+    ULONG ReadAheadLength;
+    KSPIN_LOCK ReadAheadSpinLock;
+} ROS_PRIVATE_CACHE_MAP, *PROS_PRIVATE_CACHE_MAP;
+
 typedef struct _ROS_VACB
 {
     /* Base address of the region where the view's data is mapped. */
@@ -171,6 +215,8 @@ typedef struct _ROS_VACB
     BOOLEAN Dirty;
     /* Page out in progress */
     BOOLEAN PageOut;
+    /* Was the view looked up since the last trim pass */
+    BOOLEAN Accessed;
     ULONG MappedCount;
     /* Entry in the list of VACBs for this shared cache map. */
     LIST_ENTRY CacheMapVacbListEntry;
@@ -190,7 +236,7 @@ typedef struct _ROS_VACB
     /* Pointer to the shared cache map for the file which this view maps data for. */
     PROS_SHARED_CACHE_MAP SharedCacheMap;
     /* Pointer to the next VACB in a chain. */
-} ROS_VACB, *PROS_VACB;
+} ROS_VACB;
 
 typedef struct _INTERNAL_BCB
 {
@@ -270,6 +316,14 @@ CcRosLookupVacb(
     LONGLONG FileOffset
 );
 
+BOOLEAN
+NTAPI
+CcRosLookupVacbAddress(
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    PVOID Address,
+    PLONGLONG FileOffset
+);
+
 VOID
 NTAPI
 CcInitCacheZeroPage(VOID);
@@ -289,6 +343,16 @@ CcRosFlushDirtyPages(
     BOOLEAN Wait
 );
 
+VOID
+NTAPI
+CcRosScheduleLazyWrite(
+    BOOLEAN FastScan
+);
+
+VOID
+NTAPI
+CcPostDeferredWrites(VOID);
+
 VOID
 NTAPI
 CcRosDereferenceCache(PFILE_OBJECT FileObject);
@@ -388,3 +452,45 @@ IsPointInRange(
 {
     return DoRangesIntersect(Offset1, Length1, Point, 1);
 }
+
+FORCEINLINE
+PROS_VACB
+CcRosIndexLookupVacb(
+    _In_ PROS_SHARED_CACHE_MAP SharedCacheMap,
+    _In_ LONGLONG FileOffset)
+{
+    LONGLONG Index = FileOffset / VACB_MAPPING_GRANULARITY;
+    PROS_VACB_INDEX_LEAF Leaf;
+
+    /* The caller must hold the CacheMapLock */
+    if (FileOffset < 0 || (Index >> CC_VACB_LEAF_SHIFT) >= SharedCacheMap->VacbLeavesCount)
+        return NULL;
+    Leaf = SharedCacheMap->VacbLeaves[Index >> CC_VACB_LEAF_SHIFT];
+    if (Leaf == NULL)
+        return NULL;
+    return Leaf->Vacbs[Index & (CC_VACB_LEAF_ENTRIES - 1)];
+}
+
+FORCEINLINE
+VOID
+CcRosIndexRemoveVacb(
+    _In_ PROS_VACB Vacb)
+{
+    PROS_SHARED_CACHE_MAP SharedCacheMap = Vacb->SharedCacheMap;
+    LONGLONG Index = Vacb->FileOffset.QuadPart / VACB_MAPPING_GRANULARITY;
+    PROS_VACB_INDEX_LEAF Leaf;
+
+    /* The caller must hold the CacheMapLock */
+    ASSERT((Index >> CC_VACB_LEAF_SHIFT) < SharedCacheMap->VacbLeavesCount);
+    Leaf = SharedCacheMap->VacbLeaves[Index >> CC_VACB_LEAF_SHIFT];
+    ASSERT(Leaf != NULL);
+    ASSERT(Leaf->Vacbs[Index & (CC_VACB_LEAF_ENTRIES - 1)] == Vacb);
+    Leaf->Vacbs[Index & (CC_VACB_LEAF_ENTRIES - 1)] = NULL;
+
+    /* Nonpaged pool can be freed at DISPATCH_LEVEL */
+    if (--Leaf->Count == 0)
+    {
+        SharedCacheMap->VacbLeaves[Index >> CC_VACB_LEAF_SHIFT] = NULL;
+        ExFreePoolWithTag(Leaf, TAG_VACB);
+    }
+}
@@ -195,6 +195,10 @@ VOID
 NTAPI
 ExpInitLookasideLists(VOID);
 
+VOID
+NTAPI
+ExAdjustLookasideDepth(VOID);
+
 VOID
 NTAPI
 ExInitializeSystemLookasideList(
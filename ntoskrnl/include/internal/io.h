@@ -81,6 +81,14 @@
 //
 #define RD_SYMLINK_CREATE_FAILED 5
 
+//
+// The completion notification class is handled by the I/O Manager itself,
+// which isn't built with the Vista headers that define it
+//
+#if (NTDDI_VERSION < NTDDI_VISTA)
+#define FileIoCompletionNotificationInformation ((FILE_INFORMATION_CLASS)41)
+#endif
+
 //
 // Max traversal of reparse points for a single open in IoParseDevice
 //
@@ -118,6 +126,21 @@ typedef struct _FILE_OBJECT_EXTENSION
         FALSE :                                         \
         FileObject->Flags & FO_SYNCHRONOUS_IO))         \
 
+//
+// Determines if a request that completed without pending can skip the
+// completion port of its File Object
+//
+#define IopSkipCompletionPort(FileObject, Status)       \
+    (((FileObject)->Flags & FO_SKIP_COMPLETION_PORT) && \
+     NT_SUCCESS(Status))
+
+//
+// Determines if a successful fast I/O can skip signaling the caller's event
+//
+#define IopSkipFastIoEvent(FileObject, Status)          \
+    (((FileObject)->Flags & FO_SKIP_SET_FAST_IO) &&     \
+     NT_SUCCESS(Status))
+
 //
 // Returns the internal Device Object Extension
 //
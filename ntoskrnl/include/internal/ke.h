@@ -705,6 +705,29 @@ VOID
 FASTCALL
 KiActivateWaiterQueue(IN PKQUEUE Queue);
 
+ULONG
+NTAPI
+KeRemoveQueueEx(
+    IN PKQUEUE Queue,
+    IN KPROCESSOR_MODE WaitMode,
+    IN BOOLEAN Alertable,
+    IN PLARGE_INTEGER Timeout OPTIONAL,
+    OUT PLIST_ENTRY *EntryArray,
+    IN ULONG Count
+);
+
+KAFFINITY
+NTAPI
+KeSetSystemAffinityThreadEx(
+    IN KAFFINITY Affinity
+);
+
+VOID
+NTAPI
+KeRevertToUserAffinityThreadEx(
+    IN KAFFINITY Affinity
+);
+
 ULONG
 NTAPI
 KeQueryRuntimeProcess(IN PKPROCESS Process,
@@ -997,6 +1020,12 @@ KiRetireDpcList(
     IN PKPRCB Prcb
 );
 
+VOID
+NTAPI
+KiStartDpcThread(
+    IN PKPRCB Prcb
+);
+
 VOID
 NTAPI
 KiQuantumEnd(
@@ -1389,6 +1389,11 @@ NTAPI
 ExReturnPoolQuota(
     IN PVOID P);
 
+VOID
+NTAPI
+ExpFreeCachedPoolBlock(
+    IN PVOID P);
+
 
 /* mmsup.c *****************************************************************/
 
@@ -144,6 +144,36 @@ typedef union
     ULARGE_INTEGER Alignment;
 } ALIGNEDNAME;
 
+//
+// Directory Object with a growable hash table. The NDK structure comes first
+// and keeps its 37 embedded buckets, which are used until the directory fills
+// up and a larger power-of-two table is allocated in HashTable. Entries are
+// also kept in insertion order, so that enumeration can resume from the
+// sequence number of an entry no matter how the table was resized.
+//
+#define OBP_DIRECTORY_MIN_HASH_SHIFT    7
+#define OBP_DIRECTORY_MAX_HASH_SHIFT    16
+#define OBP_DIRECTORY_LOAD_FACTOR       2
+#define OBP_DIRECTORY_HASH_SEED         2166136261UL
+#define OBP_DIRECTORY_HASH_PRIME        16777619UL
+#define ObpDirectoryHashIndex(Hash, Shift)              \
+    ((ULONG)((ULONG)(Hash) * 0x9E3779B1UL) >> (32 - (Shift)))
+typedef struct _OBP_DIRECTORY_ENTRY
+{
+    OBJECT_DIRECTORY_ENTRY Entry;
+    LIST_ENTRY OrderLink;
+    ULONG Sequence;
+} OBP_DIRECTORY_ENTRY, *POBP_DIRECTORY_ENTRY;
+typedef struct _OBP_DIRECTORY
+{
+    OBJECT_DIRECTORY Directory;
+    POBJECT_DIRECTORY_ENTRY *HashTable;
+    ULONG HashShift;
+    ULONG EntryCount;
+    LIST_ENTRY EntryList;
+    ULONG LastSequence;
+} OBP_DIRECTORY, *POBP_DIRECTORY;
+
 //
 // Private Temporary Buffer for Lookup Routines
 //
@@ -198,6 +228,12 @@ ObpLookupEntryDirectory(
     IN POBP_LOOKUP_CONTEXT Context
 );
 
+VOID
+NTAPI
+ObpDeleteDirectory(
+    IN PVOID ObjectBody
+);
+
 //
 // Symbolic Link Functions
 //
@@ -42,6 +42,52 @@ KxReleaseSpinLock(IN PKSPIN_LOCK SpinLock)
     KeMemoryBarrierWithoutFence();
 }
 
+//
+// Queued Spinlock Acquire at IRQL >= DISPATCH_LEVEL
+//
+FORCEINLINE
+VOID
+KxAcquireQueuedSpinLock(IN PKSPIN_LOCK_QUEUE LockQueue)
+{
+    /* On UP builds, spinlocks don't exist at IRQL >= DISPATCH */
+    UNREFERENCED_PARAMETER(LockQueue);
+
+    /* Add an explicit memory barrier to prevent the compiler from reordering
+       memory accesses across the borders of spinlocks */
+    KeMemoryBarrierWithoutFence();
+}
+
+//
+// Queued Spinlock Try-Acquire at IRQL >= DISPATCH_LEVEL
+//
+FORCEINLINE
+BOOLEAN
+KxTryToAcquireQueuedSpinLock(IN PKSPIN_LOCK_QUEUE LockQueue)
+{
+    /* On UP builds, spinlocks don't exist at IRQL >= DISPATCH */
+    UNREFERENCED_PARAMETER(LockQueue);
+
+    /* Add an explicit memory barrier to prevent the compiler from reordering
+       memory accesses across the borders of spinlocks */
+    KeMemoryBarrierWithoutFence();
+    return TRUE;
+}
+
+//
+// Queued Spinlock Release at IRQL >= DISPATCH_LEVEL
+//
+FORCEINLINE
+VOID
+KxReleaseQueuedSpinLock(IN PKSPIN_LOCK_QUEUE LockQueue)
+{
+    /* On UP builds, spinlocks don't exist at IRQL >= DISPATCH */
+    UNREFERENCED_PARAMETER(LockQueue);
+
+    /* Add an explicit memory barrier to prevent the compiler from reordering
+       memory accesses across the borders of spinlocks */
+    KeMemoryBarrierWithoutFence();
+}
+
 #else
 
 //
@@ -100,4 +146,125 @@ KxReleaseSpinLock(IN PKSPIN_LOCK SpinLock)
     InterlockedAnd((PLONG)SpinLock, 0);
 }
 
+//
+// The spinlock of a queued lock holds the tail of the queue of waiting
+// processors, and each waiter spins on the low bits of its own queue entry's
+// Lock pointer until its predecessor hands the lock over (MCS lock).
+//
+#define KxQueuedSpinLockAddress(LockQueue) \
+    ((PKSPIN_LOCK)((ULONG_PTR)(LockQueue)->Lock & \
+                   ~(ULONG_PTR)(LOCK_QUEUE_WAIT | LOCK_QUEUE_OWNER)))
+
+//
+// Queued Spinlock Acquire at IRQL >= DISPATCH_LEVEL
+//
+FORCEINLINE
+VOID
+KxAcquireQueuedSpinLock(IN PKSPIN_LOCK_QUEUE LockQueue)
+{
+    PKSPIN_LOCK_QUEUE Predecessor;
+
+#if DBG
+    /* Make sure that we don't own the lock already */
+    if ((ULONG_PTR)LockQueue->Lock & LOCK_QUEUE_OWNER)
+    {
+        /* We do, bugcheck! */
+        KeBugCheckEx(SPIN_LOCK_ALREADY_OWNED, (ULONG_PTR)LockQueue->Lock, 0, 0, 0);
+    }
+#endif
+
+    /* Append ourselves to the queue */
+    LockQueue->Next = NULL;
+    Predecessor = InterlockedExchangePointer((PVOID*)KxQueuedSpinLockAddress(LockQueue),
+                                             LockQueue);
+    if (Predecessor)
+    {
+        /* Mark ourselves as waiting before the predecessor can see us */
+        LockQueue->Lock = (PKSPIN_LOCK)((ULONG_PTR)LockQueue->Lock | LOCK_QUEUE_WAIT);
+        KeMemoryBarrier();
+        Predecessor->Next = LockQueue;
+
+        /* Spin on our own queue entry until the lock is handed to us */
+        while ((ULONG_PTR)LockQueue->Lock & LOCK_QUEUE_WAIT)
+        {
+            /* Yield and keep looping */
+            YieldProcessor();
+        }
+    }
+    else
+    {
+        /* The queue was empty, we own the lock */
+        LockQueue->Lock = (PKSPIN_LOCK)((ULONG_PTR)LockQueue->Lock | LOCK_QUEUE_OWNER);
+    }
+}
+
+//
+// Queued Spinlock Try-Acquire at IRQL >= DISPATCH_LEVEL
+//
+FORCEINLINE
+BOOLEAN
+KxTryToAcquireQueuedSpinLock(IN PKSPIN_LOCK_QUEUE LockQueue)
+{
+    PKSPIN_LOCK SpinLock = KxQueuedSpinLockAddress(LockQueue);
+
+    /* Only take the lock if nobody holds it or waits for it */
+    LockQueue->Next = NULL;
+    if ((*(volatile KSPIN_LOCK *)SpinLock) ||
+        (InterlockedCompareExchangePointer((PVOID*)SpinLock, LockQueue, NULL)))
+    {
+        return FALSE;
+    }
+
+    /* We own the lock */
+    LockQueue->Lock = (PKSPIN_LOCK)((ULONG_PTR)LockQueue->Lock | LOCK_QUEUE_OWNER);
+    return TRUE;
+}
+
+//
+// Queued Spinlock Release at IRQL >= DISPATCH_LEVEL
+//
+FORCEINLINE
+VOID
+KxReleaseQueuedSpinLock(IN PKSPIN_LOCK_QUEUE LockQueue)
+{
+    PKSPIN_LOCK SpinLock = KxQueuedSpinLockAddress(LockQueue);
+    PKSPIN_LOCK_QUEUE Successor;
+
+#if DBG
+    /* Make sure that we own the lock */
+    if (!((ULONG_PTR)LockQueue->Lock & LOCK_QUEUE_OWNER))
+    {
+        /* We don't, bugcheck */
+        KeBugCheckEx(SPIN_LOCK_NOT_OWNED, (ULONG_PTR)LockQueue->Lock, 0, 0, 0);
+    }
+#endif
+
+    /* Drop ownership */
+    LockQueue->Lock = SpinLock;
+    Successor = LockQueue->Next;
+    if (!Successor)
+    {
+        /* Nobody is linked behind us, try to empty the queue */
+        if (InterlockedCompareExchangePointer((PVOID*)SpinLock,
+                                              NULL,
+                                              LockQueue) == LockQueue)
+        {
+            return;
+        }
+
+        /* A new waiter swapped itself in, wait until it links itself to us */
+        while (!(Successor = LockQueue->Next))
+        {
+            /* Yield and keep looping */
+            YieldProcessor();
+        }
+    }
+
+    /* Hand the lock over: clear the successor's wait bit, set its owner bit */
+    LockQueue->Next = NULL;
+    KeMemoryBarrier();
+    Successor->Lock = (PKSPIN_LOCK)((ULONG_PTR)Successor->Lock ^
+                                    (LOCK_QUEUE_WAIT | LOCK_QUEUE_OWNER));
+}
+
 #endif
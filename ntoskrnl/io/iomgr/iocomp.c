@@ -17,6 +17,9 @@ POBJECT_TYPE IoCompletionType;
 
 GENERAL_LOOKASIDE IoCompletionPacketLookaside;
 
+/* Maximum number of packets NtRemoveIoCompletionEx removes in one call */
+#define IOP_MAXIMUM_REMOVE_COUNT 64
+
 GENERIC_MAPPING IopCompletionMapping =
 {
     STANDARD_RIGHTS_READ | IO_COMPLETION_QUERY_STATE,
@@ -95,6 +98,50 @@ IopFreeMiniPacket(PIOP_MINI_COMPLETION_PACKET Packet)
     InterlockedPushEntrySList(&List->L.ListHead, (PSLIST_ENTRY)Packet);
 }
 
+static
+VOID
+NTAPI
+IopRetrieveCompletionPacket(IN PLIST_ENTRY ListEntry,
+                            OUT PFILE_IO_COMPLETION_INFORMATION Information)
+{
+    PIOP_MINI_COMPLETION_PACKET Packet;
+    PIRP Irp;
+
+    /* Get the Packet Data */
+    Packet = CONTAINING_RECORD(ListEntry,
+                               IOP_MINI_COMPLETION_PACKET,
+                               ListEntry);
+
+    /* Check if this is piggybacked on an IRP */
+    if (Packet->PacketType == IopCompletionPacketIrp)
+    {
+        /* Get the IRP */
+        Irp = CONTAINING_RECORD(ListEntry,
+                                IRP,
+                                Tail.Overlay.ListEntry);
+
+        /* Save values */
+        Information->KeyContext = Irp->Tail.CompletionKey;
+        Information->ApcContext = Irp->Overlay.AsynchronousParameters.UserApcContext;
+        Information->IoStatusBlock = Irp->IoStatus;
+
+        /* Free the IRP */
+        IoFreeIrp(Irp);
+    }
+    else
+    {
+        /* Save values, the status doesn't cover the whole pointer union */
+        Information->KeyContext = Packet->KeyContext;
+        Information->ApcContext = Packet->ApcContext;
+        RtlZeroMemory(&Information->IoStatusBlock, sizeof(IO_STATUS_BLOCK));
+        Information->IoStatusBlock.Status = Packet->IoStatus;
+        Information->IoStatusBlock.Information = Packet->IoStatusInformation;
+
+        /* Free the packet */
+        IopFreeMiniPacket(Packet);
+    }
+}
+
 VOID
 NTAPI
 IopDeleteIoCompletion(PVOID ObjectBody)
@@ -449,13 +496,10 @@ NtRemoveIoCompletion(IN HANDLE IoCompletionHandle,
 {
     LARGE_INTEGER SafeTimeout;
     PKQUEUE Queue;
-    PIOP_MINI_COMPLETION_PACKET Packet;
     PLIST_ENTRY ListEntry;
     KPROCESSOR_MODE PreviousMode = ExGetPreviousMode();
     NTSTATUS Status;
-    PIRP Irp;
-    PVOID Apc, Key;
-    IO_STATUS_BLOCK IoStatus;
+    FILE_IO_COMPLETION_INFORMATION Information;
     PAGED_CODE();
 
     /* Check if the call was from user mode */
@@ -506,46 +550,124 @@ NtRemoveIoCompletion(IN HANDLE IoCompletionHandle,
         }
         else
         {
-            /* Get the Packet Data */
-            Packet = CONTAINING_RECORD(ListEntry,
-                                       IOP_MINI_COMPLETION_PACKET,
-                                       ListEntry);
+            /* Get the values and free the packet */
+            IopRetrieveCompletionPacket(ListEntry, &Information);
 
-            /* Check if this is piggybacked on an IRP */
-            if (Packet->PacketType == IopCompletionPacketIrp)
+            /* Enter SEH to write back the values */
+            _SEH2_TRY
             {
-                /* Get the IRP */
-                Irp = CONTAINING_RECORD(ListEntry,
-                                        IRP,
-                                        Tail.Overlay.ListEntry);
-
-                /* Save values */
-                Key = Irp->Tail.CompletionKey;
-                Apc = Irp->Overlay.AsynchronousParameters.UserApcContext;
-                IoStatus = Irp->IoStatus;
-
-                /* Free the IRP */
-                IoFreeIrp(Irp);
+                /* Write the values to caller */
+                *ApcContext = Information.ApcContext;
+                *KeyContext = Information.KeyContext;
+                *IoStatusBlock = Information.IoStatusBlock;
             }
-            else
+            _SEH2_EXCEPT(ExSystemExceptionFilter())
             {
-                /* Save values */
-                Key = Packet->KeyContext;
-                Apc = Packet->ApcContext;
-                IoStatus.Status = Packet->IoStatus;
-                IoStatus.Information = Packet->IoStatusInformation;
+                /* Get the exception code */
+                Status = _SEH2_GetExceptionCode();
+            }
+            _SEH2_END;
+        }
 
-                /* Free the packet */
-                IopFreeMiniPacket(Packet);
+        /* Dereference the Object */
+        ObDereferenceObject(Queue);
+    }
+
+    /* Return status */
+    return Status;
+}
+
+NTSTATUS
+NTAPI
+NtRemoveIoCompletionEx(IN HANDLE IoCompletionHandle,
+                       OUT PFILE_IO_COMPLETION_INFORMATION IoCompletionInformation,
+                       IN ULONG Count,
+                       OUT PULONG NumEntriesRemoved,
+                       IN PLARGE_INTEGER Timeout OPTIONAL,
+                       IN BOOLEAN Alertable)
+{
+    LARGE_INTEGER SafeTimeout;
+    PKQUEUE Queue;
+    PLIST_ENTRY ListEntries[IOP_MAXIMUM_REMOVE_COUNT];
+    KPROCESSOR_MODE PreviousMode = ExGetPreviousMode();
+    NTSTATUS Status;
+    FILE_IO_COMPLETION_INFORMATION Information;
+    ULONG Removed, i;
+    PAGED_CODE();
+
+    /* We need room for at least one packet */
+    if (!Count) return STATUS_INVALID_PARAMETER;
+
+    /* Don't remove more than we can hold, the caller will come back for more */
+    if (Count > IOP_MAXIMUM_REMOVE_COUNT) Count = IOP_MAXIMUM_REMOVE_COUNT;
+
+    /* Check if the call was from user mode */
+    if (PreviousMode != KernelMode)
+    {
+        /* Protect probes in SEH */
+        _SEH2_TRY
+        {
+            /* Probe the output array and count */
+            ProbeForWrite(IoCompletionInformation,
+                          Count * sizeof(FILE_IO_COMPLETION_INFORMATION),
+                          sizeof(PVOID));
+            ProbeForWriteUlong(NumEntriesRemoved);
+            if (Timeout)
+            {
+                /* Probe and capture the timeout */
+                SafeTimeout = ProbeForReadLargeInteger(Timeout);
+                Timeout = &SafeTimeout;
             }
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            /* Return the exception code */
+            _SEH2_YIELD(return _SEH2_GetExceptionCode());
+        }
+        _SEH2_END;
+    }
+
+    /* Open the Object */
+    Status = ObReferenceObjectByHandle(IoCompletionHandle,
+                                       IO_COMPLETION_MODIFY_STATE,
+                                       IoCompletionType,
+                                       PreviousMode,
+                                       (PVOID*)&Queue,
+                                       NULL);
+    if (!NT_SUCCESS(Status)) return Status;
+
+    /* Remove as many entries as are available, waiting only for the first */
+    Removed = KeRemoveQueueEx(Queue,
+                              PreviousMode,
+                              Alertable,
+                              Timeout,
+                              ListEntries,
+                              Count);
+
+    /* If we got a timeout, an alert or user_apc back, return the status */
+    Status = (NTSTATUS)(ULONG_PTR)ListEntries[0];
+    if ((Status == STATUS_TIMEOUT) ||
+        (Status == STATUS_USER_APC) ||
+        (Status == STATUS_ALERTED))
+    {
+        /* Nothing was removed */
+        Removed = 0;
+    }
+    else
+    {
+        /* Write back every packet, but keep freeing them if the caller faults */
+        Status = STATUS_SUCCESS;
+        for (i = 0; i < Removed; i++)
+        {
+            /* Get the values and free the packet */
+            IopRetrieveCompletionPacket(ListEntries[i], &Information);
+            if (!NT_SUCCESS(Status)) continue;
 
             /* Enter SEH to write back the values */
             _SEH2_TRY
             {
                 /* Write the values to caller */
-                *ApcContext = Apc;
-                *KeyContext = Key;
-                *IoStatusBlock = IoStatus;
+                IoCompletionInformation[i] = Information;
             }
             _SEH2_EXCEPT(ExSystemExceptionFilter())
             {
@@ -554,10 +676,22 @@ NtRemoveIoCompletion(IN HANDLE IoCompletionHandle,
             }
             _SEH2_END;
         }
+    }
 
-        /* Dereference the Object */
-        ObDereferenceObject(Queue);
+    /* Dereference the Object */
+    ObDereferenceObject(Queue);
+
+    /* Return the number of entries removed */
+    _SEH2_TRY
+    {
+        *NumEntriesRemoved = Removed;
+    }
+    _SEH2_EXCEPT(ExSystemExceptionFilter())
+    {
+        /* Get the exception code */
+        Status = _SEH2_GetExceptionCode();
     }
+    _SEH2_END;
 
     /* Return status */
     return Status;
@@ -425,7 +425,10 @@ IopDeviceFsIoControl(IN HANDLE DeviceHandle,
                 /* If we had an event, signal it */
                 if (Event)
                 {
-                    KeSetEvent(EventObject, IO_NO_INCREMENT, FALSE);
+                    if (!IopSkipFastIoEvent(FileObject, KernelIosb.Status))
+                    {
+                        KeSetEvent(EventObject, IO_NO_INCREMENT, FALSE);
+                    }
                     ObDereferenceObject(EventObject);
                 }
 
@@ -436,7 +439,8 @@ IopDeviceFsIoControl(IN HANDLE DeviceHandle,
                 }
 
                 /* Set completion if required */
-                if (CompletionInfo.Port != NULL && UserApcContext != NULL)
+                if (CompletionInfo.Port != NULL && UserApcContext != NULL &&
+                    !IopSkipCompletionPort(FileObject, KernelIosb.Status))
                 {
                     if (!NT_SUCCESS(IoSetIoCompletion(CompletionInfo.Port,
                                                       CompletionInfo.Key,
@@ -1020,6 +1024,85 @@ IopGetFileMode(IN PFILE_OBJECT FileObject)
     return Mode;
 }
 
+static
+NTSTATUS
+IopSetIoCompletionNotification(IN HANDLE FileHandle,
+                               OUT PIO_STATUS_BLOCK IoStatusBlock,
+                               IN PVOID FileInformation,
+                               IN ULONG Length,
+                               IN KPROCESSOR_MODE PreviousMode)
+{
+    PFILE_OBJECT FileObject;
+    ULONG Modes, Flags = 0;
+    NTSTATUS Status;
+
+    /* Validate the length */
+    if (Length < sizeof(FILE_IO_COMPLETION_NOTIFICATION_INFORMATION))
+    {
+        /* Invalid length */
+        return STATUS_INFO_LENGTH_MISMATCH;
+    }
+
+    /* Enter SEH for probing and capturing */
+    _SEH2_TRY
+    {
+        /* Check if we're called from user mode */
+        if (PreviousMode != KernelMode)
+        {
+            /* Probe the I/O Status block and the information */
+            ProbeForWriteIoStatusBlock(IoStatusBlock);
+            ProbeForRead(FileInformation, Length, sizeof(ULONG));
+        }
+
+        /* Capture the requested modes */
+        Modes = ((PFILE_IO_COMPLETION_NOTIFICATION_INFORMATION)FileInformation)->Flags;
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        /* Return the exception code */
+        _SEH2_YIELD(return _SEH2_GetExceptionCode());
+    }
+    _SEH2_END;
+
+    /* Validate and convert them to File Object flags */
+    if (Modes & ~(FILE_SKIP_COMPLETION_PORT_ON_SUCCESS |
+                  FILE_SKIP_SET_EVENT_ON_HANDLE |
+                  FILE_SKIP_SET_USER_EVENT_ON_FAST_IO))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (Modes & FILE_SKIP_COMPLETION_PORT_ON_SUCCESS) Flags |= FO_SKIP_COMPLETION_PORT;
+    if (Modes & FILE_SKIP_SET_EVENT_ON_HANDLE) Flags |= FO_SKIP_SET_EVENT;
+    if (Modes & FILE_SKIP_SET_USER_EVENT_ON_FAST_IO) Flags |= FO_SKIP_SET_FAST_IO;
+
+    /* Reference the Handle, the modes don't need any access */
+    Status = ObReferenceObjectByHandle(FileHandle,
+                                       0,
+                                       IoFileObjectType,
+                                       PreviousMode,
+                                       (PVOID *)&FileObject,
+                                       NULL);
+    if (!NT_SUCCESS(Status)) return Status;
+
+    /* Modes can be set, but never cleared again */
+    InterlockedOr((PLONG)&FileObject->Flags, Flags);
+    ObDereferenceObject(FileObject);
+
+    /* Enter SEH to write back the I/O Status Block */
+    _SEH2_TRY
+    {
+        IoStatusBlock->Status = STATUS_SUCCESS;
+        IoStatusBlock->Information = 0;
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        /* Ignore any error, the modes are already set */
+    }
+    _SEH2_END;
+
+    return STATUS_SUCCESS;
+}
+
 /* PUBLIC FUNCTIONS **********************************************************/
 
 /*
@@ -1715,12 +1798,16 @@ NtLockFile(IN HANDLE FileHandle,
             /* If we had an event, signal it */
             if (EventHandle)
             {
-                KeSetEvent(Event, IO_NO_INCREMENT, FALSE);
+                if (!IopSkipFastIoEvent(FileObject, KernelIosb.Status))
+                {
+                    KeSetEvent(Event, IO_NO_INCREMENT, FALSE);
+                }
                 ObDereferenceObject(Event);
             }
 
             /* Set completion if required */
-            if (FileObject->CompletionContext != NULL && ApcContext != NULL)
+            if (FileObject->CompletionContext != NULL && ApcContext != NULL &&
+                !IopSkipCompletionPort(FileObject, KernelIosb.Status))
             {
                 if (!NT_SUCCESS(IoSetIoCompletion(FileObject->CompletionContext->Port,
                                                   FileObject->CompletionContext->Key,
@@ -2843,6 +2930,16 @@ NtSetInformationFile(IN HANDLE FileHandle,
     PAGED_CODE();
     IOTRACE(IO_API_DEBUG, "FileHandle: %p\n", FileHandle);
 
+    /* Completion notification modes only live in the File Object */
+    if (FileInformationClass == FileIoCompletionNotificationInformation)
+    {
+        return IopSetIoCompletionNotification(FileHandle,
+                                              IoStatusBlock,
+                                              FileInformation,
+                                              Length,
+                                              PreviousMode);
+    }
+
     /* Check if we're called from user mode */
     if (PreviousMode != KernelMode)
     {
@@ -330,8 +330,14 @@ IopCompleteRequest(IN PKAPC Apc,
         (Irp->PendingReturned &&
          !IsIrpSynchronous(Irp, FileObject)))
     {
-        /* Get any information we need from the FO before we kill it */
-        if ((FileObject) && (FileObject->CompletionContext))
+        /*
+         * Get any information we need from the FO before we kill it, unless
+         * the caller already got the result of a synchronous success and
+         * asked us not to queue it to the port.
+         */
+        if ((FileObject) && (FileObject->CompletionContext) &&
+            ((Irp->PendingReturned) ||
+             !IopSkipCompletionPort(FileObject, Irp->IoStatus.Status)))
         {
             /* Save Completion Data */
             Port = FileObject->CompletionContext->Port;
@@ -397,8 +403,12 @@ IopCompleteRequest(IN PKAPC Apc,
         }
         else if (FileObject)
         {
-            /* Signal the file object and set the status */
-            KeSetEvent(&FileObject->Event, 0, FALSE);
+            /* Signal the file object unless nobody waits on an async handle */
+            if (!(FileObject->Flags & FO_SKIP_SET_EVENT) ||
+                (FileObject->Flags & FO_SYNCHRONOUS_IO))
+            {
+                KeSetEvent(&FileObject->Event, 0, FALSE);
+            }
             FileObject->FinalStatus = Irp->IoStatus.Status;
 
             /*
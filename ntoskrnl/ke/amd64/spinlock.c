@@ -75,7 +75,7 @@ KeAcquireQueuedSpinLock(IN KSPIN_LOCK_QUEUE_NUMBER LockNumber)
     KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
 
     /* Acquire the lock */
-    KxAcquireSpinLock(KeGetCurrentPrcb()->LockQueue[LockNumber].Lock); // HACK
+    KxAcquireQueuedSpinLock(&KeGetCurrentPrcb()->LockQueue[LockNumber]);
     return OldIrql;
 }
 
@@ -91,7 +91,7 @@ KeAcquireQueuedSpinLockRaiseToSynch(IN KSPIN_LOCK_QUEUE_NUMBER LockNumber)
     KeRaiseIrql(SYNCH_LEVEL, &OldIrql);
 
     /* Acquire the lock */
-    KxAcquireSpinLock(KeGetCurrentPrcb()->LockQueue[LockNumber].Lock); // HACK
+    KxAcquireQueuedSpinLock(&KeGetCurrentPrcb()->LockQueue[LockNumber]);
     return OldIrql;
 }
 
@@ -110,7 +110,7 @@ KeAcquireInStackQueuedSpinLock(IN PKSPIN_LOCK SpinLock,
     KeRaiseIrql(DISPATCH_LEVEL, &LockHandle->OldIrql);
 
     /* Acquire the lock */
-    KxAcquireSpinLock(LockHandle->LockQueue.Lock); // HACK
+    KxAcquireQueuedSpinLock(&LockHandle->LockQueue);
 }
 
 
@@ -129,7 +129,7 @@ KeAcquireInStackQueuedSpinLockRaiseToSynch(IN PKSPIN_LOCK SpinLock,
     KeRaiseIrql(SYNCH_LEVEL, &LockHandle->OldIrql);
 
     /* Acquire the lock */
-    KxAcquireSpinLock(LockHandle->LockQueue.Lock); // HACK
+    KxAcquireQueuedSpinLock(&LockHandle->LockQueue);
 }
 
 
@@ -141,7 +141,7 @@ KeReleaseQueuedSpinLock(IN KSPIN_LOCK_QUEUE_NUMBER LockNumber,
                         IN KIRQL OldIrql)
 {
     /* Release the lock */
-    KxReleaseSpinLock(KeGetCurrentPrcb()->LockQueue[LockNumber].Lock); // HACK
+    KxReleaseQueuedSpinLock(&KeGetCurrentPrcb()->LockQueue[LockNumber]);
 
     /* Lower IRQL back */
     KeLowerIrql(OldIrql);
@@ -154,8 +154,8 @@ KeReleaseQueuedSpinLock(IN KSPIN_LOCK_QUEUE_NUMBER LockNumber,
 VOID
 KeReleaseInStackQueuedSpinLock(IN PKLOCK_QUEUE_HANDLE LockHandle)
 {
-    /* Simply lower IRQL back */
-    KxReleaseSpinLock(LockHandle->LockQueue.Lock); // HACK
+    /* Release the lock and lower IRQL back */
+    KxReleaseQueuedSpinLock(&LockHandle->LockQueue);
     KeLowerIrql(LockHandle->OldIrql);
 }
 
@@ -167,20 +167,18 @@ BOOLEAN
 KeTryToAcquireQueuedSpinLockRaiseToSynch(IN KSPIN_LOCK_QUEUE_NUMBER LockNumber,
                                          IN PKIRQL OldIrql)
 {
-#ifndef CONFIG_SMP
-    /* Simply raise to dispatch */
-    KeRaiseIrql(DISPATCH_LEVEL, OldIrql);
+    /* Raise to synch */
+    KeRaiseIrql(SYNCH_LEVEL, OldIrql);
 
-    /* Add an explicit memory barrier to prevent the compiler from reordering
-       memory accesses across the borders of spinlocks */
-    KeMemoryBarrierWithoutFence();
+    /* Try to acquire the lock, and lower IRQL back if somebody holds it */
+    if (!KxTryToAcquireQueuedSpinLock(&KeGetCurrentPrcb()->LockQueue[LockNumber]))
+    {
+        KeLowerIrql(*OldIrql);
+        return FALSE;
+    }
 
-    /* Always return true on UP Machines */
+    /* We own the lock */
     return TRUE;
-#else
-    UNIMPLEMENTED;
-    ASSERT(FALSE);
-#endif
 }
 
 /*
@@ -190,20 +188,18 @@ LOGICAL
 KeTryToAcquireQueuedSpinLock(IN KSPIN_LOCK_QUEUE_NUMBER LockNumber,
                              OUT PKIRQL OldIrql)
 {
-#ifndef CONFIG_SMP
-    /* Simply raise to dispatch */
+    /* Raise to dispatch */
     KeRaiseIrql(DISPATCH_LEVEL, OldIrql);
 
-    /* Add an explicit memory barrier to prevent the compiler from reordering
-       memory accesses across the borders of spinlocks */
-    KeMemoryBarrierWithoutFence();
+    /* Try to acquire the lock, and lower IRQL back if somebody holds it */
+    if (!KxTryToAcquireQueuedSpinLock(&KeGetCurrentPrcb()->LockQueue[LockNumber]))
+    {
+        KeLowerIrql(*OldIrql);
+        return FALSE;
+    }
 
-    /* Always return true on UP Machines */
+    /* We own the lock */
     return TRUE;
-#else
-    UNIMPLEMENTED;
-    ASSERT(FALSE);
-#endif
 }
 
 /* EOF */
@@ -34,7 +34,8 @@ KiDpcInterruptHandler(VOID)
     /* Check for pending timers, pending DPCs, or pending ready threads */
     if ((Prcb->DpcData[0].DpcQueueDepth) ||
         (Prcb->TimerRequest) ||
-        (Prcb->DeferredReadyListHead.Next))
+        (Prcb->DeferredReadyListHead.Next) ||
+        (Prcb->DpcSetEventRequest))
     {
         /* Retire DPCs while under the DPC stack */
         KiRetireDpcListInDpcStack(Prcb, Prcb->DpcStack);
@@ -127,7 +128,8 @@ KiIdleLoop(VOID)
         /* Check for pending timers, pending DPCs, or pending ready threads */
         if ((Prcb->DpcData[0].DpcQueueDepth) ||
             (Prcb->TimerRequest) ||
-            (Prcb->DeferredReadyListHead.Next))
+            (Prcb->DeferredReadyListHead.Next) ||
+            (Prcb->DpcSetEventRequest))
         {
             /* Quiesce the DPC software interrupt */
             HalClearSoftwareInterrupt(DISPATCH_LEVEL);
@@ -41,7 +41,8 @@ KiIdleLoop(VOID)
         //
         if ((Prcb->DpcData[0].DpcQueueDepth) ||
             (Prcb->TimerRequest) ||
-            (Prcb->DeferredReadyListHead.Next))
+            (Prcb->DeferredReadyListHead.Next) ||
+            (Prcb->DpcSetEventRequest))
         {
             //
             // Clear the pending interrupt
@@ -288,7 +289,8 @@ KiDispatchInterrupt(VOID)
     //
     if ((Prcb->DpcData[0].DpcQueueDepth) ||
         (Prcb->TimerRequest) ||
-        (Prcb->DeferredReadyListHead.Next))
+        (Prcb->DeferredReadyListHead.Next) ||
+        (Prcb->DpcSetEventRequest))
     {
         //
         // Retire DPCs
@@ -20,7 +20,7 @@ ULONG KiMaximumDpcQueueDepth = 4;
 ULONG KiMinimumDpcRate = 3;
 ULONG KiAdjustDpcThreshold = 20;
 ULONG KiIdealDpcRate = 20;
-BOOLEAN KeThreadDpcEnable;
+BOOLEAN KeThreadDpcEnable = TRUE;
 FAST_MUTEX KiGenericCallDpcMutex;
 KDPC KiTimerExpireDpc;
 ULONG KiTimeLimitIsrMicroseconds;
@@ -185,7 +185,6 @@ KiTimerExpiration(IN PKDPC Dpc,
                 /* Check if we have a DPC */
                 if (TimerDpc)
                 {
-#ifdef CONFIG_SMP
                     /* 
                      * If the DPC is targeted to another processor,
                      * then insert it into that processor's DPC queue
@@ -195,8 +194,11 @@ KiTimerExpiration(IN PKDPC Dpc,
                      * then also insert it into the DPC queue for threaded delivery,
                      * instead of doing it here.
                      */
-                    if (((TimerDpc->Number >= MAXIMUM_PROCESSORS) &&
+                    if (
+#ifdef CONFIG_SMP
+                        ((TimerDpc->Number >= MAXIMUM_PROCESSORS) &&
                         ((TimerDpc->Number - MAXIMUM_PROCESSORS) != Prcb->Number)) ||
+#endif
                         ((TimerDpc->Type == ThreadedDpcObject) && (Prcb->ThreadDpcEnable)))
                     {
                         /* Queue it */
@@ -205,7 +207,6 @@ KiTimerExpiration(IN PKDPC Dpc,
                                          UlongToPtr(SystemTime.HighPart));
                     }
                     else
-#endif
                     {
                         /* Setup the DPC Entry */
                         DpcEntry[DpcCalls].Dpc = TimerDpc;
@@ -397,7 +398,6 @@ KiTimerListExpire(IN PLIST_ENTRY ExpiredListHead,
         /* Check if we have a DPC */
         if (TimerDpc)
         {
-#ifdef CONFIG_SMP
             /* 
              * If the DPC is targeted to another processor,
              * then insert it into that processor's DPC queue
@@ -407,8 +407,11 @@ KiTimerListExpire(IN PLIST_ENTRY ExpiredListHead,
              * then also insert it into the DPC queue for threaded delivery,
              * instead of doing it here.
              */
-            if (((TimerDpc->Number >= MAXIMUM_PROCESSORS) &&
+            if (
+#ifdef CONFIG_SMP
+                ((TimerDpc->Number >= MAXIMUM_PROCESSORS) &&
                 ((TimerDpc->Number - MAXIMUM_PROCESSORS) != Prcb->Number)) ||
+#endif
                 ((TimerDpc->Type == ThreadedDpcObject) && (Prcb->ThreadDpcEnable)))
             {
                 /* Queue it */
@@ -417,7 +420,6 @@ KiTimerListExpire(IN PLIST_ENTRY ExpiredListHead,
                                  UlongToPtr(SystemTime.HighPart));
             }
             else
-#endif
             {
                 /* Setup the DPC Entry */
                 DpcEntry[DpcCalls].Dpc = TimerDpc;
@@ -652,6 +654,18 @@ KiRetireDpcList(IN PKPRCB Prcb)
         Prcb->DpcRoutineActive = FALSE;
         Prcb->DpcInterruptRequested = FALSE;
 
+        /* Check if the DPC thread has to be woken up */
+        if (Prcb->DpcSetEventRequest)
+        {
+            /* Signal it with interrupts enabled */
+            _enable();
+            if (InterlockedExchange(&Prcb->DpcSetEventRequest, 0))
+            {
+                KeSetEvent(&Prcb->DpcEvent, 0, FALSE);
+            }
+            _disable();
+        }
+
 #ifdef CONFIG_SMP
         /* Check if we have deferred threads */
         if (Prcb->DeferredReadyListHead.Next)
@@ -672,6 +686,132 @@ KiRetireDpcList(IN PKPRCB Prcb)
     } while (DpcData->DpcQueueDepth != 0);
 }
 
+static
+VOID
+NTAPI
+KiExecuteDpc(IN PVOID Context)
+{
+    PKPRCB Prcb = Context;
+    PKDPC_DATA DpcData = &Prcb->DpcData[DPC_THREADED];
+    PLIST_ENTRY ListHead = &DpcData->DpcListHead, DpcEntry;
+    PKDPC Dpc;
+    PKDEFERRED_ROUTINE DeferredRoutine;
+    PVOID DeferredContext, SystemArgument1, SystemArgument2;
+    BOOLEAN Enable;
+
+    /* Stay on our processor, ahead of every other thread */
+    KeSetSystemAffinityThread(AFFINITY_MASK(Prcb->Number));
+    KeSetPriorityThread(KeGetCurrentThread(), HIGH_PRIORITY);
+    Prcb->DpcThread = KeGetCurrentThread();
+
+    /* Threaded DPCs can now be queued to this processor */
+    Prcb->ThreadDpcEnable = TRUE;
+
+    /* Main outer loop */
+    for (;;)
+    {
+        /* Wait for KeInsertQueueDpc to request us */
+        KeWaitForSingleObject(&Prcb->DpcEvent,
+                              Executive,
+                              KernelMode,
+                              FALSE,
+                              NULL);
+
+        /* Set us as active */
+        Prcb->DpcThreadActive = TRUE;
+        Prcb->DpcThreadRequested = FALSE;
+
+        for (;;)
+        {
+            /* Loop while we have entries in the queue */
+            while (DpcData->DpcQueueDepth != 0)
+            {
+                /* The DPC lock is taken at HIGH_LEVEL, keep interrupts off */
+                Enable = KeDisableInterrupts();
+                KiAcquireSpinLock(&DpcData->DpcLock);
+                DpcEntry = ListHead->Flink;
+
+                /* Make sure we have an entry */
+                if (DpcEntry != ListHead)
+                {
+                    /* Remove the DPC from the list */
+                    RemoveEntryList(DpcEntry);
+                    Dpc = CONTAINING_RECORD(DpcEntry, KDPC, DpcListEntry);
+
+                    /* Clear its DPC data and save its parameters */
+                    Dpc->DpcData = NULL;
+                    DeferredRoutine = Dpc->DeferredRoutine;
+                    DeferredContext = Dpc->DeferredContext;
+                    SystemArgument1 = Dpc->SystemArgument1;
+                    SystemArgument2 = Dpc->SystemArgument2;
+
+                    /* Decrease the queue depth */
+                    DpcData->DpcQueueDepth--;
+
+                    /* Release the lock and re-enable interrupts */
+                    KiReleaseSpinLock(&DpcData->DpcLock);
+                    if (Enable) _enable();
+
+                    /* Call the DPC at PASSIVE_LEVEL */
+                    DeferredRoutine(Dpc,
+                                    DeferredContext,
+                                    SystemArgument1,
+                                    SystemArgument2);
+                    ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+                }
+                else
+                {
+                    /* The queue should be flushed now */
+                    ASSERT(DpcData->DpcQueueDepth == 0);
+
+                    /* Release DPC Lock */
+                    KiReleaseSpinLock(&DpcData->DpcLock);
+                    if (Enable) _enable();
+                }
+            }
+
+            /*
+             * Go inactive, then look again: a DPC queued while we were still
+             * active did not request us.
+             */
+            Prcb->DpcThreadActive = FALSE;
+            KeMemoryBarrier();
+            if (DpcData->DpcQueueDepth == 0) break;
+            Prcb->DpcThreadActive = TRUE;
+        }
+    }
+}
+
+VOID
+NTAPI
+INIT_FUNCTION
+KiStartDpcThread(IN PKPRCB Prcb)
+{
+    HANDLE ThreadHandle;
+    NTSTATUS Status;
+
+    /* Initialize the event the DPC thread waits on */
+    KeInitializeEvent(&Prcb->DpcEvent, SynchronizationEvent, FALSE);
+
+    /* Create the thread; it enables threaded DPCs once it is running */
+    Status = PsCreateSystemThread(&ThreadHandle,
+                                  THREAD_ALL_ACCESS,
+                                  NULL,
+                                  NULL,
+                                  NULL,
+                                  KiExecuteDpc,
+                                  Prcb);
+    if (!NT_SUCCESS(Status))
+    {
+        /* Threaded DPCs will simply run as normal DPCs on this processor */
+        DPRINT1("Failed to create the DPC thread for CPU %u: 0x%lx\n",
+                Prcb->Number, Status);
+        return;
+    }
+
+    ObCloseHandle(ThreadHandle, KernelMode);
+}
+
 VOID
 NTAPI
 KiInitializeDpc(IN PKDPC Dpc,
@@ -796,8 +936,16 @@ KeInsertQueueDpc(IN PKDPC Dpc,
             /* Make sure a threaded DPC isn't already active */
             if (!(Prcb->DpcThreadActive) && !(Prcb->DpcThreadRequested))
             {
-                /* FIXME: Setup Threaded DPC */
-                UNIMPLEMENTED_FATAL("Threaded DPC not supported\n");
+                /*
+                 * Have the next dispatch interrupt of the target CPU signal
+                 * its DPC thread, through the quantum end processing
+                 */
+                InterlockedExchange(&Prcb->DpcSetEventRequest, TRUE);
+                Prcb->DpcThreadRequested = TRUE;
+                Prcb->QuantumEnd = TRUE;
+
+                /* Set DPC inserted */
+                DpcInserted = TRUE;
             }
         }
         else
@@ -917,25 +1065,52 @@ VOID
 NTAPI
 KeFlushQueuedDpcs(VOID)
 {
-    PKPRCB CurrentPrcb = KeGetCurrentPrcb();
+    PKPRCB Prcb;
+    KAFFINITY Affinity, OldAffinity = 0, PreviousAffinity;
+    BOOLEAN AffinitySet = FALSE;
+    LARGE_INTEGER Interval;
+    ULONG i;
     PAGED_CODE();
 
-    /* Check if this is an UP machine */
-    if (KeActiveProcessors == 1)
+    /* Visit every processor in turn */
+    Interval.QuadPart = -10 * 1000;
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
     {
+        Affinity = AFFINITY_MASK(i);
+        if (!(Affinity & KeActiveProcessors)) continue;
+
+        /* Run on it, so that lowering IRQL there drains its DPC queue */
+        if (KeNumberProcessors > 1)
+        {
+            /* Remember the affinity the caller had before the first switch */
+            PreviousAffinity = KeSetSystemAffinityThreadEx(Affinity);
+            if (!AffinitySet)
+            {
+                OldAffinity = PreviousAffinity;
+                AffinitySet = TRUE;
+            }
+        }
+        Prcb = KeGetCurrentPrcb();
+
         /* Check if there are DPCs on either queues */
-        if ((CurrentPrcb->DpcData[DPC_NORMAL].DpcQueueDepth > 0) ||
-            (CurrentPrcb->DpcData[DPC_THREADED].DpcQueueDepth > 0))
+        if ((Prcb->DpcData[DPC_NORMAL].DpcQueueDepth > 0) ||
+            (Prcb->DpcData[DPC_THREADED].DpcQueueDepth > 0))
         {
             /* Request an interrupt */
             HalRequestSoftwareInterrupt(DISPATCH_LEVEL);
         }
+
+        /* The DPC thread outranks us, but its DPCs may block */
+        if (KeGetCurrentThread() == Prcb->DpcThread) continue;
+        while ((Prcb->DpcData[DPC_THREADED].DpcQueueDepth > 0) ||
+               (Prcb->DpcThreadActive))
+        {
+            KeDelayExecutionThread(KernelMode, FALSE, &Interval);
+        }
     }
-    else
-    {
-        /* FIXME: SMP support required */
-        ASSERT(FALSE);
-    }
+
+    /* Return to the caller's affinity, which may be a system one */
+    if (AffinitySet) KeRevertToUserAffinityThreadEx(OldAffinity);
 }
 
 /*
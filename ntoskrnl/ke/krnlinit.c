@@ -204,6 +204,10 @@ KiInitSpinLocks(IN PKPRCB Prcb,
     KeInitializeSpinLock(&Prcb->DpcData[DPC_NORMAL].DpcLock);
     Prcb->DpcData[DPC_NORMAL].DpcQueueDepth = 0;
     Prcb->DpcData[DPC_NORMAL].DpcCount = 0;
+    InitializeListHead(&Prcb->DpcData[DPC_THREADED].DpcListHead);
+    KeInitializeSpinLock(&Prcb->DpcData[DPC_THREADED].DpcLock);
+    Prcb->DpcData[DPC_THREADED].DpcQueueDepth = 0;
+    Prcb->DpcData[DPC_THREADED].DpcCount = 0;
     Prcb->DpcRoutineActive = FALSE;
     Prcb->MaximumDpcQueueDepth = KiMaximumDpcQueueDepth;
     Prcb->MinimumDpcRate = KiMinimumDpcRate;
@@ -292,11 +296,16 @@ NTAPI
 INIT_FUNCTION
 KeInitSystem(VOID)
 {
+    ULONG i;
+
     /* Check if Threaded DPCs are enabled */
     if (KeThreadDpcEnable)
     {
-        /* FIXME: TODO */
-        DPRINT1("Threaded DPCs not yet supported\n");
+        /* Start a DPC thread for every processor */
+        for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+        {
+            KiStartDpcThread(KiProcessorBlock[i]);
+        }
     }
 
     /* Initialize non-portable parts of the kernel */
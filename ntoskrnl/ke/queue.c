@@ -240,6 +240,28 @@ KeRemoveQueue(IN PKQUEUE Queue,
               IN PLARGE_INTEGER Timeout OPTIONAL)
 {
     PLIST_ENTRY QueueEntry;
+
+    /* Remove a single entry, the status is returned in its place */
+    KeRemoveQueueEx(Queue, WaitMode, FALSE, Timeout, &QueueEntry, 1);
+    return QueueEntry;
+}
+
+/*
+ * @implemented
+ *
+ * Returns the number of entries written to the array. A timeout, alert or
+ * user APC is returned as a single entry holding the status code.
+ */
+ULONG
+NTAPI
+KeRemoveQueueEx(IN PKQUEUE Queue,
+                IN KPROCESSOR_MODE WaitMode,
+                IN BOOLEAN Alertable,
+                IN PLARGE_INTEGER Timeout OPTIONAL,
+                OUT PLIST_ENTRY *EntryArray,
+                IN ULONG Count)
+{
+    PLIST_ENTRY QueueEntry;
     LONG_PTR Status;
     PKTHREAD Thread = KeGetCurrentThread();
     PKQUEUE PreviousQueue;
@@ -249,9 +271,11 @@ KeRemoveQueue(IN PKQUEUE Queue,
     BOOLEAN Swappable;
     PLARGE_INTEGER OriginalDueTime = Timeout;
     LARGE_INTEGER DueTime = {{0}}, NewDueTime, InterruptTime;
-    ULONG Hand = 0;
+    ULONG Hand = 0, Removed = 0;
+    KIRQL OldIrql;
     ASSERT_QUEUE(Queue);
     ASSERT_IRQL_LESS_OR_EQUAL(DISPATCH_LEVEL);
+    ASSERT(Count != 0);
 
     /* Check if the Lock is already held */
     if (Thread->WaitNext)
@@ -306,27 +330,36 @@ KeRemoveQueue(IN PKQUEUE Queue,
         if ((Queue->CurrentCount < Queue->MaximumCount) &&
             (QueueEntry != &Queue->EntryListHead))
         {
-            /* Decrease the number of entries */
-            Queue->Header.SignalState--;
-
             /* Increase numbef of running threads */
             Queue->CurrentCount++;
 
-            /* Check if the entry is valid. If not, bugcheck */
-            if (!(QueueEntry->Flink) || !(QueueEntry->Blink))
+            /* Remove as many entries as the caller asked for */
+            do
             {
-                /* Invalid item */
-                KeBugCheckEx(INVALID_WORK_QUEUE_ITEM,
-                             (ULONG_PTR)QueueEntry,
-                             (ULONG_PTR)Queue,
-                             (ULONG_PTR)NULL,
-                             (ULONG_PTR)((PWORK_QUEUE_ITEM)QueueEntry)->
-                                         WorkerRoutine);
-            }
+                /* Decrease the number of entries */
+                Queue->Header.SignalState--;
 
-            /* Remove the Entry */
-            RemoveEntryList(QueueEntry);
-            QueueEntry->Flink = NULL;
+                /* Check if the entry is valid. If not, bugcheck */
+                if (!(QueueEntry->Flink) || !(QueueEntry->Blink))
+                {
+                    /* Invalid item */
+                    KeBugCheckEx(INVALID_WORK_QUEUE_ITEM,
+                                 (ULONG_PTR)QueueEntry,
+                                 (ULONG_PTR)Queue,
+                                 (ULONG_PTR)NULL,
+                                 (ULONG_PTR)((PWORK_QUEUE_ITEM)QueueEntry)->
+                                             WorkerRoutine);
+                }
+
+                /* Remove the Entry */
+                RemoveEntryList(QueueEntry);
+                QueueEntry->Flink = NULL;
+                EntryArray[Removed++] = QueueEntry;
+
+                /* Move to the next one */
+                QueueEntry = Queue->EntryListHead.Flink;
+            } while ((Removed < Count) &&
+                     (QueueEntry != &Queue->EntryListHead));
 
             /* Nothing to wait on */
             break;
@@ -344,12 +377,12 @@ KeRemoveQueue(IN PKQUEUE Queue,
             }
             else
             {
-                /* Fail if there's a User APC Pending */
-                if ((WaitMode != KernelMode) &&
-                    (Thread->ApcState.UserApcPending))
+                /* Fail if we were alerted or there's a User APC Pending */
+                Status = KiCheckAlertability(Thread, Alertable, WaitMode);
+                if (Status != STATUS_WAIT_0)
                 {
                     /* Return the status and increase the pending threads */
-                    QueueEntry = (PLIST_ENTRY)STATUS_USER_APC;
+                    EntryArray[Removed++] = (PLIST_ENTRY)Status;
                     Queue->CurrentCount++;
                     break;
                 }
@@ -362,7 +395,7 @@ KeRemoveQueue(IN PKQUEUE Queue,
                     if ((ULONG64)InterruptTime.QuadPart >= Timer->DueTime.QuadPart)
                     {
                         /* It did, so we don't need to wait */
-                        QueueEntry = (PLIST_ENTRY)STATUS_TIMEOUT;
+                        EntryArray[Removed++] = (PLIST_ENTRY)STATUS_TIMEOUT;
                         Queue->CurrentCount++;
                         break;
                     }
@@ -404,7 +437,39 @@ KeRemoveQueue(IN PKQUEUE Queue,
                 Thread->WaitReason = 0;
 
                 /* Check if we were executing an APC */
-                if (Status != STATUS_KERNEL_APC) return (PLIST_ENTRY)Status;
+                if (Status != STATUS_KERNEL_APC)
+                {
+                    /* Return the entry or status we were woken up with */
+                    EntryArray[Removed++] = (PLIST_ENTRY)Status;
+                    if ((Status == STATUS_TIMEOUT) ||
+                        (Status == STATUS_USER_APC) ||
+                        (Status == STATUS_ALERTED) ||
+                        (Removed == Count))
+                    {
+                        return Removed;
+                    }
+
+                    /*
+                     * The waker already counted us as running, so just pick up
+                     * whatever else was queued behind the entry we were given
+                     */
+                    OldIrql = KiAcquireDispatcherLock();
+                    QueueEntry = Queue->EntryListHead.Flink;
+                    while ((Removed < Count) &&
+                           (QueueEntry != &Queue->EntryListHead))
+                    {
+                        /* Remove the Entry */
+                        Queue->Header.SignalState--;
+                        RemoveEntryList(QueueEntry);
+                        QueueEntry->Flink = NULL;
+                        EntryArray[Removed++] = QueueEntry;
+
+                        /* Move to the next one */
+                        QueueEntry = Queue->EntryListHead.Flink;
+                    }
+                    KiReleaseDispatcherLock(OldIrql);
+                    return Removed;
+                }
 
                 /* Check if we had a timeout */
                 if (Timeout)
@@ -427,7 +492,7 @@ KeRemoveQueue(IN PKQUEUE Queue,
     /* Unlock Database and return */
     KiReleaseDispatcherLockFromDpcLevel();
     KiExitDispatcher(Thread->WaitIrql);
-    return QueueEntry;
+    return Removed;
 }
 
 /*
@@ -12,93 +12,13 @@
 #define NDEBUG
 #include <debug.h>
 
-#define LQ_WAIT     1
-#define LQ_OWN      2
-
 /* PRIVATE FUNCTIONS *********************************************************/
 
-#if 0
-//
-// FIXME: The queued spinlock routines are broken.
-//
-
-VOID
-FASTCALL
-KeAcquireQueuedSpinLockAtDpcLevel(IN PKSPIN_LOCK_QUEUE LockHandle)
-{
-#ifdef CONFIG_SMP
-    PKSPIN_LOCK_QUEUE Prev;
-
-    /* Set the new lock */
-    Prev = (PKSPIN_LOCK_QUEUE)
-           InterlockedExchange((PLONG)LockHandle->Next,
-                               (LONG)LockHandle);
-    if (!Prev)
-    {
-        /* There was nothing there before. We now own it */
-         *LockHandle->Lock |= LQ_OWN;
-        return;
-    }
-
-    /* Set the wait flag */
-     *LockHandle->Lock |= LQ_WAIT;
-
-    /* Link us */
-    Prev->Next = (PKSPIN_LOCK_QUEUE)LockHandle;
-
-    /* Loop and wait */
-    while (*LockHandle->Lock & LQ_WAIT)
-        YieldProcessor();
-#endif
-}
-
-VOID
-FASTCALL
-KeReleaseQueuedSpinLockFromDpcLevel(IN PKSPIN_LOCK_QUEUE LockHandle)
-{
-#ifdef CONFIG_SMP
-    KSPIN_LOCK LockVal;
-    PKSPIN_LOCK_QUEUE Waiter;
-
-    /* Remove own and wait flags */
-    *LockHandle->Lock &= ~(LQ_OWN | LQ_WAIT);
-    LockVal = *LockHandle->Lock;
-
-    /* Check if we already own it */
-    if (LockVal == (KSPIN_LOCK)LockHandle)
-    {
-        /* Disown it */
-        LockVal = (KSPIN_LOCK)
-                  InterlockedCompareExchangePointer(LockHandle->Lock,
-                                                    NULL,
-                                                    LockHandle);
-    }
-    if (LockVal == (KSPIN_LOCK)LockHandle) return;
-
-    /* Need to wait for it */
-    Waiter = LockHandle->Next;
-    while (!Waiter)
-    {
-        YieldProcessor();
-        Waiter = LockHandle->Next;
-    }
-
-    /* It's gone */
-    *(ULONG_PTR*)&Waiter->Lock ^= (LQ_OWN | LQ_WAIT);
-    LockHandle->Next = NULL;
-#endif
-}
-
-#else
-//
-// HACK: Hacked to work like normal spinlocks
-//
-
 VOID
 FASTCALL
 KeAcquireQueuedSpinLockAtDpcLevel(IN PKSPIN_LOCK_QUEUE LockHandle)
 {
-#ifdef CONFIG_SMP
+#if DBG
     /* Make sure we are at DPC or above! */
     if (KeGetCurrentIrql() < DISPATCH_LEVEL)
     {
@@ -109,17 +29,17 @@ KeAcquireQueuedSpinLockAtDpcLevel(IN PKSPIN_LOCK_QUEUE LockHandle)
                      0,
                      0);
     }
+#endif
 
     /* Do the inlined function */
-    KxAcquireSpinLock(LockHandle->Lock);
-#endif
+    KxAcquireQueuedSpinLock(LockHandle);
 }
 
 VOID
 FASTCALL
 KeReleaseQueuedSpinLockFromDpcLevel(IN PKSPIN_LOCK_QUEUE LockHandle)
 {
-#ifdef CONFIG_SMP
+#if DBG
     /* Make sure we are at DPC or above! */
     if (KeGetCurrentIrql() < DISPATCH_LEVEL)
     {
@@ -130,14 +50,12 @@ KeReleaseQueuedSpinLockFromDpcLevel(IN PKSPIN_LOCK_QUEUE LockHandle)
                      0,
                      0);
     }
+#endif
 
     /* Do the inlined function */
-    KxReleaseSpinLock(LockHandle->Lock);
-#endif
+    KxReleaseQueuedSpinLock(LockHandle);
 }
 
-#endif
-
 /* PUBLIC FUNCTIONS **********************************************************/
 
 /*
@@ -337,28 +255,12 @@ FASTCALL
 KeAcquireInStackQueuedSpinLockAtDpcLevel(IN PKSPIN_LOCK SpinLock,
                                          IN PKLOCK_QUEUE_HANDLE LockHandle)
 {
-#ifdef CONFIG_SMP
     /* Set it up properly */
     LockHandle->LockQueue.Next = NULL;
     LockHandle->LockQueue.Lock = SpinLock;
-#if 0
-    KeAcquireQueuedSpinLockAtDpcLevel(LockHandle->LockQueue.Next);
-#else
-    /* Make sure we are at DPC or above! */
-    if (KeGetCurrentIrql() < DISPATCH_LEVEL)
-    {
-        /* We aren't -- bugcheck */
-        KeBugCheckEx(IRQL_NOT_GREATER_OR_EQUAL,
-                     (ULONG_PTR)LockHandle->LockQueue.Lock,
-                     KeGetCurrentIrql(),
-                     0,
-                     0);
-    }
 
     /* Acquire the lock */
-    KxAcquireSpinLock(LockHandle->LockQueue.Lock); // HACK
-#endif
-#endif
+    KeAcquireQueuedSpinLockAtDpcLevel(&LockHandle->LockQueue);
 }
 
 /*
@@ -368,70 +270,87 @@ VOID
 FASTCALL
 KeReleaseInStackQueuedSpinLockFromDpcLevel(IN PKLOCK_QUEUE_HANDLE LockHandle)
 {
-#ifdef CONFIG_SMP
-#if 0
     /* Call the internal function */
-    KeReleaseQueuedSpinLockFromDpcLevel(LockHandle->LockQueue.Next);
-#else
-    /* Make sure we are at DPC or above! */
-    if (KeGetCurrentIrql() < DISPATCH_LEVEL)
-    {
-        /* We aren't -- bugcheck */
-        KeBugCheckEx(IRQL_NOT_GREATER_OR_EQUAL,
-                     (ULONG_PTR)LockHandle->LockQueue.Lock,
-                     KeGetCurrentIrql(),
-                     0,
-                     0);
-    }
-
-    /* Release the lock */
-    KxReleaseSpinLock(LockHandle->LockQueue.Lock); // HACK
-#endif
-#endif
+    KeReleaseQueuedSpinLockFromDpcLevel(&LockHandle->LockQueue);
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 KIRQL
 FASTCALL
 KeAcquireSpinLockForDpc(IN PKSPIN_LOCK SpinLock)
 {
-    UNIMPLEMENTED;
-    return 0;
+    KIRQL OldIrql;
+
+    /* A threaded DPC runs at PASSIVE_LEVEL and has to raise on its own */
+    if (KeGetCurrentPrcb()->DpcThreadActive)
+    {
+        KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    }
+    else
+    {
+        OldIrql = KeGetCurrentIrql();
+    }
+
+    /* Acquire the lock */
+    KxAcquireSpinLock(SpinLock);
+    return OldIrql;
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 FASTCALL
 KeReleaseSpinLockForDpc(IN PKSPIN_LOCK SpinLock,
                         IN KIRQL OldIrql)
 {
-    UNIMPLEMENTED;
+    /* Release the lock */
+    KxReleaseSpinLock(SpinLock);
+
+    /* Only a threaded DPC raised, so only it lowers back */
+    if (KeGetCurrentPrcb()->DpcThreadActive) KeLowerIrql(OldIrql);
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
-KIRQL
+VOID
 FASTCALL
 KeAcquireInStackQueuedSpinLockForDpc(IN PKSPIN_LOCK SpinLock,
                                      IN PKLOCK_QUEUE_HANDLE LockHandle)
 {
-    UNIMPLEMENTED;
-    return 0;
+    /* Set up the lock */
+    LockHandle->LockQueue.Next = NULL;
+    LockHandle->LockQueue.Lock = SpinLock;
+
+    /* A threaded DPC runs at PASSIVE_LEVEL and has to raise on its own */
+    if (KeGetCurrentPrcb()->DpcThreadActive)
+    {
+        KeRaiseIrql(DISPATCH_LEVEL, &LockHandle->OldIrql);
+    }
+    else
+    {
+        LockHandle->OldIrql = KeGetCurrentIrql();
+    }
+
+    /* Acquire the lock */
+    KxAcquireQueuedSpinLock(&LockHandle->LockQueue);
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 FASTCALL
 KeReleaseInStackQueuedSpinLockForDpc(IN PKLOCK_QUEUE_HANDLE LockHandle)
 {
-    UNIMPLEMENTED;
+    /* Release the lock */
+    KxReleaseQueuedSpinLock(&LockHandle->LockQueue);
+
+    /* Only a threaded DPC raised, so only it lowers back */
+    if (KeGetCurrentPrcb()->DpcThreadActive) KeLowerIrql(LockHandle->OldIrql);
 }
 
 /*
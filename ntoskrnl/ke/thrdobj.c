@@ -1176,6 +1176,42 @@ KeSetSystemAffinityThread(IN KAFFINITY Affinity)
     KiReleaseDispatcherLock(OldIrql);
 }
 
+/*
+ * @implemented
+ */
+KAFFINITY
+NTAPI
+KeSetSystemAffinityThreadEx(IN KAFFINITY Affinity)
+{
+    PKTHREAD CurrentThread = KeGetCurrentThread();
+    KAFFINITY OldAffinity;
+
+    /* Only this thread changes its system affinity, so no lock is needed */
+    OldAffinity = CurrentThread->SystemAffinityActive ? CurrentThread->Affinity : 0;
+
+    /* Set the new system affinity and return the previous one, if any */
+    KeSetSystemAffinityThread(Affinity);
+    return OldAffinity;
+}
+
+/*
+ * @implemented
+ */
+VOID
+NTAPI
+KeRevertToUserAffinityThreadEx(IN KAFFINITY Affinity)
+{
+    /* Restore the system affinity the caller had, or the user one */
+    if (Affinity)
+    {
+        KeSetSystemAffinityThread(Affinity);
+    }
+    else
+    {
+        KeRevertToUserAffinityThread();
+    }
+}
+
 /*
  * @implemented
  */
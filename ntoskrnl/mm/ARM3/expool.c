@@ -31,7 +31,9 @@ typedef struct _POOL_DPC_CONTEXT
 } POOL_DPC_CONTEXT, *PPOOL_DPC_CONTEXT;
 
 ULONG ExpNumberOfPagedPools;
+ULONG ExpNumberOfNonPagedPools;
 POOL_DESCRIPTOR NonPagedPoolDescriptor;
+PPOOL_DESCRIPTOR ExpNonPagedPoolDescriptor[EXP_MAX_NONPAGED_POOLS + 1];
 PPOOL_DESCRIPTOR ExpPagedPoolDescriptor[16 + 1];
 PPOOL_DESCRIPTOR PoolVector[2];
 PKGUARDED_MUTEX ExpPagedPoolMutex;
@@ -869,7 +871,6 @@ ExpInsertPoolTracker(IN ULONG Key,
 
 VOID
 NTAPI
-INIT_SECTION
 ExInitializePoolDescriptor(IN PPOOL_DESCRIPTOR PoolDescriptor,
                            IN POOL_TYPE PoolType,
                            IN ULONG PoolIndex,
@@ -1101,18 +1102,14 @@ InitializePool(IN POOL_TYPE PoolType,
                                             sizeof(POOL_TRACKER_BIG_PAGES)),
                              NonPagedPool);
 
-        //
-        // No support for NUMA systems at this time
-        //
-        ASSERT(KeNumberNodes == 1);
-
         //
         // Initialize the tag spinlock
         //
         KeInitializeSpinLock(&ExpTaggedPoolLock);
 
         //
-        // Initialize the nonpaged pool descriptor
+        // Initialize the nonpaged pool descriptor. It serves the boot processor
+        // and is the one big page allocations are accounted to
         //
         PoolVector[NonPagedPool] = &NonPagedPoolDescriptor;
         ExInitializePoolDescriptor(PoolVector[NonPagedPool],
@@ -1120,14 +1117,25 @@ InitializePool(IN POOL_TYPE PoolType,
                                    0,
                                    Threshold,
                                    NULL);
+        ExpNonPagedPoolDescriptor[0] = &NonPagedPoolDescriptor;
+
+        //
+        // Small allocations are spread over one descriptor per node on NUMA
+        // systems, or else over one per processor, so that they don't all
+        // serialize on a single lock. The other processors aren't started yet,
+        // so their descriptors get created on first use
+        //
+        if (KeNumberNodes > 1)
+        {
+            ExpNumberOfNonPagedPools = min(KeNumberNodes, EXP_MAX_NONPAGED_POOLS);
+        }
+        else
+        {
+            ExpNumberOfNonPagedPools = EXP_MAX_NONPAGED_POOLS;
+        }
     }
     else
     {
-        //
-        // No support for NUMA systems at this time
-        //
-        ASSERT(KeNumberNodes == 1);
-
         //
         // Allocate the pool descriptor
         //
@@ -1169,19 +1177,105 @@ InitializePool(IN POOL_TYPE PoolType,
     }
 }
 
+static
+PPOOL_DESCRIPTOR
+NTAPI
+ExpCreateNonPagedPoolDescriptor(IN ULONG PoolIndex)
+{
+    PPOOL_DESCRIPTOR Descriptor, Existing;
+    PKSPIN_LOCK PoolLock;
+    SIZE_T Size;
+
+    //
+    // Go straight to the page allocator, so that we don't recurse into
+    // ourselves looking for this very descriptor
+    //
+    Size = sizeof(POOL_DESCRIPTOR) + sizeof(KSPIN_LOCK);
+    Descriptor = MiAllocatePoolPages(NonPagedPool, Size);
+    if (!Descriptor)
+    {
+        //
+        // Fall back to the shared descriptor, we'll try again next time
+        //
+        return &NonPagedPoolDescriptor;
+    }
+
+    //
+    // Each descriptor has its own lock, allocated right behind it
+    //
+    PoolLock = (PKSPIN_LOCK)(Descriptor + 1);
+    KeInitializeSpinLock(PoolLock);
+    ExInitializePoolDescriptor(Descriptor,
+                               NonPagedPool,
+                               PoolIndex,
+                               NonPagedPoolDescriptor.Threshold,
+                               PoolLock);
+
+    //
+    // Another processor sharing this slot may have beaten us to it
+    //
+    Existing = InterlockedCompareExchangePointer((PVOID*)&ExpNonPagedPoolDescriptor[PoolIndex],
+                                                 Descriptor,
+                                                 NULL);
+    if (Existing)
+    {
+        MiFreePoolPages(Descriptor);
+        return Existing;
+    }
+
+    ExpInsertPoolTracker('looP', ROUND_TO_PAGES(Size), NonPagedPool);
+    return Descriptor;
+}
+
+FORCEINLINE
+PPOOL_DESCRIPTOR
+ExpGetNonPagedPoolDescriptor(IN PKPRCB Prcb)
+{
+    PPOOL_DESCRIPTOR Descriptor;
+    ULONG PoolIndex;
+
+    //
+    // Pick the descriptor of our node, or of our processor if there's only
+    // one node
+    //
+    if (KeNumberNodes > 1)
+    {
+        PoolIndex = Prcb->ParentNode->NodeNumber;
+    }
+    else
+    {
+        PoolIndex = Prcb->Number;
+    }
+    PoolIndex %= ExpNumberOfNonPagedPools;
+
+    Descriptor = ExpNonPagedPoolDescriptor[PoolIndex];
+    if (Descriptor) return Descriptor;
+
+    return ExpCreateNonPagedPoolDescriptor(PoolIndex);
+}
+
 FORCEINLINE
 KIRQL
 ExLockPool(IN PPOOL_DESCRIPTOR Descriptor)
 {
+    KIRQL OldIrql;
+
     //
     // Check if this is nonpaged pool
     //
     if ((Descriptor->PoolType & BASE_POOL_TYPE_MASK) == NonPagedPool)
     {
         //
-        // Use the queued spin lock
+        // The first descriptor uses the queued spin lock, the other ones
+        // have their own
         //
-        return KeAcquireQueuedSpinLock(LockQueueNonPagedPoolLock);
+        if (!Descriptor->LockAddress)
+        {
+            return KeAcquireQueuedSpinLock(LockQueueNonPagedPoolLock);
+        }
+
+        KeAcquireSpinLock(Descriptor->LockAddress, &OldIrql);
+        return OldIrql;
     }
     else
     {
@@ -1204,9 +1298,16 @@ ExUnlockPool(IN PPOOL_DESCRIPTOR Descriptor,
     if ((Descriptor->PoolType & BASE_POOL_TYPE_MASK) == NonPagedPool)
     {
         //
-        // Use the queued spin lock
+        // Release whichever spin lock ExLockPool took
         //
-        KeReleaseQueuedSpinLock(LockQueueNonPagedPoolLock, OldIrql);
+        if (!Descriptor->LockAddress)
+        {
+            KeReleaseQueuedSpinLock(LockQueueNonPagedPoolLock, OldIrql);
+        }
+        else
+        {
+            KeReleaseSpinLock(Descriptor->LockAddress, OldIrql);
+        }
     }
     else
     {
@@ -1562,20 +1663,16 @@ ExQueryPoolUsage(OUT PULONG PagedPoolPages,
 
     //
     // If the system has more than one non-paged pool, copy the other descriptor
-    // totals as well
+    // totals as well. Those that weren't needed yet don't exist
     //
-#if 0
-    if (ExpNumberOfNonPagedPools > 1)
+    for (i = 1; i < ExpNumberOfNonPagedPools; i++)
     {
-        for (i = 0; i < ExpNumberOfNonPagedPools; i++)
-        {
-            PoolDesc = ExpNonPagedPoolDescriptor[i];
-            *NonPagedPoolPages += PoolDesc->TotalPages + PoolDesc->TotalBigPages;
-            *NonPagedPoolAllocs += PoolDesc->RunningAllocs;
-            *NonPagedPoolFrees += PoolDesc->RunningDeAllocs;
-        }
+        PoolDesc = ExpNonPagedPoolDescriptor[i];
+        if (!PoolDesc) continue;
+        *NonPagedPoolPages += PoolDesc->TotalPages + PoolDesc->TotalBigPages;
+        *NonPagedPoolAllocs += PoolDesc->RunningAllocs;
+        *NonPagedPoolFrees += PoolDesc->RunningDeAllocs;
     }
-#endif
 
     //
     // FIXME: Not yet supported
@@ -1791,6 +1888,14 @@ ExAllocatePoolWithTag(IN POOL_TYPE PoolType,
         return Entry;
     }
 
+    //
+    // Small nonpaged allocations come from the current processor's descriptor
+    //
+    if (PoolType == NonPagedPool)
+    {
+        PoolDesc = ExpGetNonPagedPoolDescriptor(Prcb);
+    }
+
     //
     // Should never request 0 bytes from the pool, but since so many drivers do
     // it, we'll just assume they want 1 byte, based on NT's similar behavior
@@ -1986,9 +2091,12 @@ ExAllocatePoolWithTag(IN POOL_TYPE PoolType,
                 }
 
                 //
-                // Now our (allocation) entry is the right size
+                // Now our (allocation) entry is the right size. Both halves
+                // still belong to this descriptor
                 //
                 Entry->BlockSize = i;
+                Entry->PoolIndex = PoolDesc->PoolIndex;
+                FragmentEntry->PoolIndex = PoolDesc->PoolIndex;
 
                 //
                 // And the next entry is now the free fragment which contains
@@ -2112,6 +2220,7 @@ ExAllocatePoolWithTag(IN POOL_TYPE PoolType,
     //
     Entry->Ulong1 = 0;
     Entry->BlockSize = i;
+    Entry->PoolIndex = PoolDesc->PoolIndex;
     Entry->PoolType = OriginalType + 1;
 
     //
@@ -2125,6 +2234,7 @@ ExAllocatePoolWithTag(IN POOL_TYPE PoolType,
     FragmentEntry->Ulong1 = 0;
     FragmentEntry->BlockSize = BlockSize;
     FragmentEntry->PreviousSize = i;
+    FragmentEntry->PoolIndex = PoolDesc->PoolIndex;
 
     //
     // Increment required counters
@@ -2211,6 +2321,190 @@ ExAllocatePool(POOL_TYPE PoolType,
     return ExAllocatePoolWithTag(PoolType, NumberOfBytes, Tag);
 }
 
+static
+VOID
+NTAPI
+ExpReleasePoolBlock(IN PPOOL_DESCRIPTOR PoolDesc,
+                    IN PPOOL_HEADER Entry)
+{
+    PPOOL_HEADER NextEntry;
+    USHORT BlockSize = Entry->BlockSize;
+    BOOLEAN Combined = FALSE;
+    KIRQL OldIrql;
+
+    //
+    // Get the pointer to the next entry
+    //
+    NextEntry = POOL_BLOCK(Entry, BlockSize);
+
+    //
+    // Update performance counters
+    //
+    InterlockedIncrement((PLONG)&PoolDesc->RunningDeAllocs);
+    InterlockedExchangeAddSizeT(&PoolDesc->TotalBytes, -BlockSize * POOL_BLOCK_SIZE);
+
+    //
+    // Acquire the pool lock
+    //
+    OldIrql = ExLockPool(PoolDesc);
+
+    //
+    // Check if the next allocation is at the end of the page
+    //
+    ExpCheckPoolBlocks(Entry);
+    if (PAGE_ALIGN(NextEntry) != NextEntry)
+    {
+        //
+        // We may be able to combine the block if it's free
+        //
+        if (NextEntry->PoolType == 0)
+        {
+            //
+            // The next block is free, so we'll do a combine
+            //
+            Combined = TRUE;
+
+            //
+            // Make sure there's actual data in the block -- anything smaller
+            // than this means we only have the header, so there's no linked list
+            // for us to remove
+            //
+            if ((NextEntry->BlockSize != 1))
+            {
+                //
+                // The block is at least big enough to have a linked list, so go
+                // ahead and remove it
+                //
+                ExpCheckPoolLinks(POOL_FREE_BLOCK(NextEntry));
+                ExpRemovePoolEntryList(POOL_FREE_BLOCK(NextEntry));
+                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Flink));
+                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Blink));
+            }
+
+            //
+            // Our entry is now combined with the next entry
+            //
+            Entry->BlockSize = Entry->BlockSize + NextEntry->BlockSize;
+        }
+    }
+
+    //
+    // Now check if there was a previous entry on the same page as us
+    //
+    if (Entry->PreviousSize)
+    {
+        //
+        // Great, grab that entry and check if it's free
+        //
+        NextEntry = POOL_PREV_BLOCK(Entry);
+        if (NextEntry->PoolType == 0)
+        {
+            //
+            // It is, so we can do a combine
+            //
+            Combined = TRUE;
+
+            //
+            // Make sure there's actual data in the block -- anything smaller
+            // than this means we only have the header so there's no linked list
+            // for us to remove
+            //
+            if ((NextEntry->BlockSize != 1))
+            {
+                //
+                // The block is at least big enough to have a linked list, so go
+                // ahead and remove it
+                //
+                ExpCheckPoolLinks(POOL_FREE_BLOCK(NextEntry));
+                ExpRemovePoolEntryList(POOL_FREE_BLOCK(NextEntry));
+                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Flink));
+                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Blink));
+            }
+
+            //
+            // Combine our original block (which might've already been combined
+            // with the next block), into the previous block
+            //
+            NextEntry->BlockSize = NextEntry->BlockSize + Entry->BlockSize;
+
+            //
+            // And now we'll work with the previous block instead
+            //
+            Entry = NextEntry;
+        }
+    }
+
+    //
+    // By now, it may have been possible for our combined blocks to actually
+    // have made up a full page (if there were only 2-3 allocations on the
+    // page, they could've all been combined).
+    //
+    if ((PAGE_ALIGN(Entry) == Entry) &&
+        (PAGE_ALIGN(POOL_NEXT_BLOCK(Entry)) == POOL_NEXT_BLOCK(Entry)))
+    {
+        //
+        // In this case, release the pool lock, update the performance counter,
+        // and free the page
+        //
+        ExUnlockPool(PoolDesc, OldIrql);
+        InterlockedExchangeAdd((PLONG)&PoolDesc->TotalPages, -1);
+        MiFreePoolPages(Entry);
+        return;
+    }
+
+    //
+    // Otherwise, we now have a free block (or a combination of 2 or 3)
+    //
+    Entry->PoolType = 0;
+    BlockSize = Entry->BlockSize;
+    ASSERT(BlockSize != 1);
+
+    //
+    // Check if we actually did combine it with anyone
+    //
+    if (Combined)
+    {
+        //
+        // Get the first combined block (either our original to begin with, or
+        // the one after the original, depending if we combined with the previous)
+        //
+        NextEntry = POOL_NEXT_BLOCK(Entry);
+
+        //
+        // As long as the next block isn't on a page boundary, have it point
+        // back to us
+        //
+        if (PAGE_ALIGN(NextEntry) != NextEntry) NextEntry->PreviousSize = BlockSize;
+    }
+
+    //
+    // Insert this new free block, and release the pool lock
+    //
+    ExpInsertPoolHeadList(&PoolDesc->ListHeads[BlockSize - 1], POOL_FREE_BLOCK(Entry));
+    ExpCheckPoolLinks(POOL_FREE_BLOCK(Entry));
+    ExUnlockPool(PoolDesc, OldIrql);
+}
+
+/*
+ * Gives a block cached by a pool lookaside list back to its descriptor.
+ * It was already untracked and its quota returned when it was cached.
+ */
+VOID
+NTAPI
+ExpFreeCachedPoolBlock(IN PVOID P)
+{
+    PPOOL_HEADER Entry = P;
+    POOL_TYPE PoolType;
+
+    Entry--;
+    PoolType = (Entry->PoolType - 1) & BASE_POOL_TYPE_MASK;
+    ExpCheckPoolIrqlLevel(PoolType, 0, P);
+    ExpReleasePoolBlock((PoolType == NonPagedPool) ?
+                        ExpNonPagedPoolDescriptor[Entry->PoolIndex] :
+                        PoolVector[PoolType],
+                        Entry);
+}
+
 /*
  * @implemented
  */
@@ -2219,13 +2513,11 @@ NTAPI
 ExFreePoolWithTag(IN PVOID P,
                   IN ULONG TagToFree)
 {
-    PPOOL_HEADER Entry, NextEntry;
+    PPOOL_HEADER Entry;
     USHORT BlockSize;
-    KIRQL OldIrql;
     POOL_TYPE PoolType;
     PPOOL_DESCRIPTOR PoolDesc;
     ULONG Tag;
-    BOOLEAN Combined = FALSE;
     PFN_NUMBER PageCount, RealPageCount;
     PKPRCB Prcb = KeGetCurrentPrcb();
     PGENERAL_LOOKASIDE LookasideList;
@@ -2392,7 +2684,18 @@ ExFreePoolWithTag(IN PVOID P,
     //
     BlockSize = Entry->BlockSize;
     PoolType = (Entry->PoolType - 1) & BASE_POOL_TYPE_MASK;
-    PoolDesc = PoolVector[PoolType];
+    if (PoolType == NonPagedPool)
+    {
+        //
+        // The block goes back to the descriptor its page came from
+        //
+        PoolDesc = ExpNonPagedPoolDescriptor[Entry->PoolIndex];
+    }
+    else
+    {
+        PoolDesc = PoolVector[PoolType];
+    }
+    ASSERT(PoolDesc != NULL);
 
     //
     // Make sure that the IRQL makes sense
@@ -2478,157 +2781,7 @@ ExFreePoolWithTag(IN PVOID P,
         }
     }
 
-    //
-    // Get the pointer to the next entry
-    //
-    NextEntry = POOL_BLOCK(Entry, BlockSize);
-
-    //
-    // Update performance counters
-    //
-    InterlockedIncrement((PLONG)&PoolDesc->RunningDeAllocs);
-    InterlockedExchangeAddSizeT(&PoolDesc->TotalBytes, -BlockSize * POOL_BLOCK_SIZE);
-
-    //
-    // Acquire the pool lock
-    //
-    OldIrql = ExLockPool(PoolDesc);
-
-    //
-    // Check if the next allocation is at the end of the page
-    //
-    ExpCheckPoolBlocks(Entry);
-    if (PAGE_ALIGN(NextEntry) != NextEntry)
-    {
-        //
-        // We may be able to combine the block if it's free
-        //
-        if (NextEntry->PoolType == 0)
-        {
-            //
-            // The next block is free, so we'll do a combine
-            //
-            Combined = TRUE;
-
-            //
-            // Make sure there's actual data in the block -- anything smaller
-            // than this means we only have the header, so there's no linked list
-            // for us to remove
-            //
-            if ((NextEntry->BlockSize != 1))
-            {
-                //
-                // The block is at least big enough to have a linked list, so go
-                // ahead and remove it
-                //
-                ExpCheckPoolLinks(POOL_FREE_BLOCK(NextEntry));
-                ExpRemovePoolEntryList(POOL_FREE_BLOCK(NextEntry));
-                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Flink));
-                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Blink));
-            }
-
-            //
-            // Our entry is now combined with the next entry
-            //
-            Entry->BlockSize = Entry->BlockSize + NextEntry->BlockSize;
-        }
-    }
-
-    //
-    // Now check if there was a previous entry on the same page as us
-    //
-    if (Entry->PreviousSize)
-    {
-        //
-        // Great, grab that entry and check if it's free
-        //
-        NextEntry = POOL_PREV_BLOCK(Entry);
-        if (NextEntry->PoolType == 0)
-        {
-            //
-            // It is, so we can do a combine
-            //
-            Combined = TRUE;
-
-            //
-            // Make sure there's actual data in the block -- anything smaller
-            // than this means we only have the header so there's no linked list
-            // for us to remove
-            //
-            if ((NextEntry->BlockSize != 1))
-            {
-                //
-                // The block is at least big enough to have a linked list, so go
-                // ahead and remove it
-                //
-                ExpCheckPoolLinks(POOL_FREE_BLOCK(NextEntry));
-                ExpRemovePoolEntryList(POOL_FREE_BLOCK(NextEntry));
-                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Flink));
-                ExpCheckPoolLinks(ExpDecodePoolLink((POOL_FREE_BLOCK(NextEntry))->Blink));
-            }
-
-            //
-            // Combine our original block (which might've already been combined
-            // with the next block), into the previous block
-            //
-            NextEntry->BlockSize = NextEntry->BlockSize + Entry->BlockSize;
-
-            //
-            // And now we'll work with the previous block instead
-            //
-            Entry = NextEntry;
-        }
-    }
-
-    //
-    // By now, it may have been possible for our combined blocks to actually
-    // have made up a full page (if there were only 2-3 allocations on the
-    // page, they could've all been combined).
-    //
-    if ((PAGE_ALIGN(Entry) == Entry) &&
-        (PAGE_ALIGN(POOL_NEXT_BLOCK(Entry)) == POOL_NEXT_BLOCK(Entry)))
-    {
-        //
-        // In this case, release the pool lock, update the performance counter,
-        // and free the page
-        //
-        ExUnlockPool(PoolDesc, OldIrql);
-        InterlockedExchangeAdd((PLONG)&PoolDesc->TotalPages, -1);
-        MiFreePoolPages(Entry);
-        return;
-    }
-
-    //
-    // Otherwise, we now have a free block (or a combination of 2 or 3)
-    //
-    Entry->PoolType = 0;
-    BlockSize = Entry->BlockSize;
-    ASSERT(BlockSize != 1);
-
-    //
-    // Check if we actually did combine it with anyone
-    //
-    if (Combined)
-    {
-        //
-        // Get the first combined block (either our original to begin with, or
-        // the one after the original, depending if we combined with the previous)
-        //
-        NextEntry = POOL_NEXT_BLOCK(Entry);
-
-        //
-        // As long as the next block isn't on a page boundary, have it point
-        // back to us
-        //
-        if (PAGE_ALIGN(NextEntry) != NextEntry) NextEntry->PreviousSize = BlockSize;
-    }
-
-    //
-    // Insert this new free block, and release the pool lock
-    //
-    ExpInsertPoolHeadList(&PoolDesc->ListHeads[BlockSize - 1], POOL_FREE_BLOCK(Entry));
-    ExpCheckPoolLinks(POOL_FREE_BLOCK(Entry));
-    ExUnlockPool(PoolDesc, OldIrql);
+    ExpReleasePoolBlock(PoolDesc, Entry);
 }
 
 /*
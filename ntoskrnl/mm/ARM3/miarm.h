@@ -360,8 +360,16 @@ typedef struct _POOL_TRACKER_BIG_PAGES
     PVOID QuotaObject;
 } POOL_TRACKER_BIG_PAGES, *PPOOL_TRACKER_BIG_PAGES;
 
+//
+// Nonpaged pool descriptors, one per node or processor. The pool header's
+// PoolIndex field limits how many there can be
+//
+#define EXP_MAX_NONPAGED_POOLS 16
+
 extern ULONG ExpNumberOfPagedPools;
+extern ULONG ExpNumberOfNonPagedPools;
 extern POOL_DESCRIPTOR NonPagedPoolDescriptor;
+extern PPOOL_DESCRIPTOR ExpNonPagedPoolDescriptor[EXP_MAX_NONPAGED_POOLS + 1];
 extern PPOOL_DESCRIPTOR ExpPagedPoolDescriptor[16 + 1];
 extern PPOOL_TRACKER_TABLE PoolTrackTable;
 
@@ -1804,7 +1812,6 @@ InitializePool(           //
 // FIXFIX: THIS ONE TOO
 VOID
 NTAPI
-INIT_FUNCTION
 ExInitializePoolDescriptor(
     IN PPOOL_DESCRIPTOR PoolDescriptor,
     IN POOL_TYPE PoolType,
@@ -674,11 +674,13 @@
 @ stdcall KeRemoveEntryDeviceQueue(ptr ptr)
 @ stdcall KeRemoveQueue(ptr long ptr)
 @ stdcall KeRemoveQueueDpc(ptr)
+@ stdcall KeRemoveQueueEx(ptr long long ptr ptr long)
 @ stdcall KeRemoveSystemServiceTable(long)
 @ stdcall KeResetEvent(ptr)
 @ stdcall -arch=i386 KeRestoreFloatingPointState(ptr)
 @ stdcall -arch=x86_64 KeRestoreFloatingPointState(ptr) KxRestoreFloatingPointState
 @ stdcall KeRevertToUserAffinityThread()
+@ stdcall KeRevertToUserAffinityThreadEx(long)
 @ stdcall KeRundownQueue(ptr)
 @ stdcall -arch=i386 KeSaveFloatingPointState(ptr)
 @ stdcall -arch=x86_64 KeSaveFloatingPointState(ptr) KxSaveFloatingPointState
@@ -695,6 +697,7 @@
 @ stdcall KeSetPriorityThread(ptr long)
 @ stdcall KeSetProfileIrql(long)
 @ stdcall KeSetSystemAffinityThread(long)
+@ stdcall KeSetSystemAffinityThreadEx(long)
 @ stdcall KeSetTargetProcessorDpc(ptr long)
 @ stdcall KeSetTimeIncrement(long long)
 @ stdcall KeSetTimer(ptr long long ptr)
@@ -1069,6 +1072,7 @@
 @ stdcall RtlClearAllBits(ptr)
 @ stdcall RtlClearBit(ptr long)
 @ stdcall RtlClearBits(ptr long long)
+@ stdcall RtlClearBitsSummary(ptr long long)
 @ stdcall RtlCompareMemory(ptr ptr long)
 @ stdcall RtlCompareMemoryUlong(ptr long long)
 @ stdcall RtlCompareString(ptr ptr long)
@@ -1129,6 +1133,8 @@
 @ stdcall -arch=i386,arm RtlFillMemoryUlong(ptr long long)
 @ stdcall RtlFindClearBits(ptr long long)
 @ stdcall RtlFindClearBitsAndSet(ptr long long)
+@ stdcall RtlFindClearBitsAndSetSummary(ptr long long)
+@ stdcall RtlFindClearBitsSummary(ptr long long)
 @ stdcall RtlFindClearRuns(ptr ptr long long)
 @ stdcall RtlFindFirstRunClear(ptr ptr)
 @ stdcall RtlFindLastBackwardRunClear(ptr long ptr)
@@ -1174,6 +1180,7 @@
 @ stdcall RtlInitUnicodeString(ptr wstr)
 @ stdcall RtlInitUnicodeStringEx(ptr wstr)
 @ stdcall RtlInitializeBitMap(ptr ptr long)
+@ stdcall RtlInitializeBitMapSummary(ptr ptr ptr long)
 @ stdcall RtlInitializeGenericTable(ptr ptr ptr ptr ptr)
 @ stdcall RtlInitializeGenericTableAvl(ptr ptr ptr ptr ptr)
 @ stdcall RtlInitializeRangeList(ptr)
@@ -1239,6 +1246,7 @@
 @ stdcall RtlNumberGenericTableElements(ptr)
 @ stdcall RtlNumberGenericTableElementsAvl(ptr)
 @ stdcall RtlNumberOfClearBits(ptr)
+@ stdcall RtlNumberOfClearBitsSummary(ptr)
 @ stdcall RtlNumberOfSetBits(ptr)
 @ stdcall RtlOemStringToCountedUnicodeString(ptr ptr long)
 @ stdcall RtlOemStringToUnicodeSize(ptr) RtlxOemStringToUnicodeSize
@@ -1267,6 +1275,7 @@
 @ stdcall RtlSetAllBits(ptr)
 @ stdcall RtlSetBit(ptr long)
 @ stdcall RtlSetBits(ptr long long)
+@ stdcall RtlSetBitsSummary(ptr long long)
 @ stdcall RtlSetDaclSecurityDescriptor(ptr long ptr long)
 @ stdcall RtlSetGroupSecurityDescriptor(ptr ptr long)
 @ stdcall RtlSetOwnerSecurityDescriptor(ptr ptr long)
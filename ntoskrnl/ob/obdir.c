@@ -22,6 +22,151 @@ POBJECT_TYPE ObDirectoryType = NULL;
 
 /* PRIVATE FUNCTIONS ******************************************************/
 
+FORCEINLINE
+POBJECT_DIRECTORY_ENTRY *
+ObpGetDirectoryBuckets(IN POBP_DIRECTORY Directory,
+                       OUT PULONG BucketCount)
+{
+    /* Use the embedded buckets until the directory has grown */
+    if (!Directory->HashTable)
+    {
+        *BucketCount = NUMBER_HASH_BUCKETS;
+        return Directory->Directory.HashBuckets;
+    }
+
+    /* Otherwise use the power-of-two table */
+    *BucketCount = 1 << Directory->HashShift;
+    return Directory->HashTable;
+}
+
+FORCEINLINE
+ULONG
+ObpGetDirectoryHashIndex(IN POBP_DIRECTORY Directory,
+                         IN ULONG HashValue)
+{
+    /* The embedded buckets are indexed by modulo, the grown table by mixing */
+    if (!Directory->HashTable) return HashValue % NUMBER_HASH_BUCKETS;
+    return ObpDirectoryHashIndex(HashValue, Directory->HashShift);
+}
+
+/*++
+* @name ObpGrowDirectory
+*
+*     The ObpGrowDirectory routine rehashes the entries of a directory into
+*     a larger bucket table.
+*
+* @param Directory
+*        Directory whose hash table has reached its load factor.
+*
+* @return None.
+*
+* @remarks The directory must be locked exclusively. If the new table can't
+*          be allocated, the directory keeps its current one.
+*
+*--*/
+static
+VOID
+ObpGrowDirectory(IN POBP_DIRECTORY Directory)
+{
+    POBJECT_DIRECTORY_ENTRY *OldTable, *NewTable;
+    POBJECT_DIRECTORY_ENTRY Entry, NextEntry;
+    ULONG OldCount, NewShift, Index, i;
+
+    /* Start at the minimum size and grow four times larger afterwards */
+    NewShift = Directory->HashTable ? Directory->HashShift + 2 :
+                                      OBP_DIRECTORY_MIN_HASH_SHIFT;
+    if (NewShift > OBP_DIRECTORY_MAX_HASH_SHIFT)
+    {
+        NewShift = OBP_DIRECTORY_MAX_HASH_SHIFT;
+    }
+    if (NewShift <= Directory->HashShift) return;
+
+    /* Allocate the new table */
+    NewTable = ExAllocatePoolWithTag(PagedPool,
+                                     sizeof(POBJECT_DIRECTORY_ENTRY) << NewShift,
+                                     OB_DIR_TAG);
+    if (!NewTable) return;
+    RtlZeroMemory(NewTable, sizeof(POBJECT_DIRECTORY_ENTRY) << NewShift);
+
+    /* Move every entry over, the stored hash saves hashing the names again */
+    OldTable = ObpGetDirectoryBuckets(Directory, &OldCount);
+    for (i = 0; i < OldCount; i++)
+    {
+        for (Entry = OldTable[i]; Entry; Entry = NextEntry)
+        {
+            NextEntry = Entry->ChainLink;
+            Index = ObpDirectoryHashIndex(Entry->HashValue, NewShift);
+            Entry->ChainLink = NewTable[Index];
+            NewTable[Index] = Entry;
+        }
+        OldTable[i] = NULL;
+    }
+
+    /* Free the previous table if it wasn't the embedded one */
+    if (Directory->HashTable) ExFreePoolWithTag(Directory->HashTable, OB_DIR_TAG);
+    Directory->HashTable = NewTable;
+    Directory->HashShift = NewShift;
+}
+
+/*++
+* @name ObpRenumberDirectory
+*
+*     The ObpRenumberDirectory routine assigns new sequence numbers to the
+*     entries of a directory before its sequence counter wraps.
+*
+* @param Directory
+*        Directory whose sequence counter is about to wrap.
+*
+* @return None.
+*
+* @remarks The directory must be locked exclusively. Enumerations that are
+*          in progress may return some entries twice afterwards.
+*
+*--*/
+static
+VOID
+ObpRenumberDirectory(IN POBP_DIRECTORY Directory)
+{
+    PLIST_ENTRY ListEntry;
+
+    /* Number the entries again, in the order they were inserted */
+    Directory->LastSequence = 0;
+    for (ListEntry = Directory->EntryList.Flink;
+         ListEntry != &Directory->EntryList;
+         ListEntry = ListEntry->Flink)
+    {
+        CONTAINING_RECORD(ListEntry,
+                          OBP_DIRECTORY_ENTRY,
+                          OrderLink)->Sequence = ++Directory->LastSequence;
+    }
+}
+
+/*++
+* @name ObpDeleteDirectory
+*
+*     The ObpDeleteDirectory routine is the delete procedure of directory
+*     objects.
+*
+* @param ObjectBody
+*        Directory being deleted.
+*
+* @return None.
+*
+* @remarks Named objects reference their directory, so it is empty by now.
+*
+*--*/
+VOID
+NTAPI
+ObpDeleteDirectory(IN PVOID ObjectBody)
+{
+    POBP_DIRECTORY Directory = ObjectBody;
+
+    /* Free the grown hash table */
+    ASSERT(Directory->EntryCount == 0);
+    ASSERT(IsListEmpty(&Directory->EntryList));
+    if (Directory->HashTable) ExFreePoolWithTag(Directory->HashTable, OB_DIR_TAG);
+}
+
 /*++
 * @name ObpInsertEntryDirectory
 *
@@ -47,9 +192,12 @@ ObpInsertEntryDirectory(IN POBJECT_DIRECTORY Parent,
                         IN POBP_LOOKUP_CONTEXT Context,
                         IN POBJECT_HEADER ObjectHeader)
 {
+    POBP_DIRECTORY Directory = (POBP_DIRECTORY)Parent;
     POBJECT_DIRECTORY_ENTRY *AllocatedEntry;
     POBJECT_DIRECTORY_ENTRY NewEntry;
+    POBP_DIRECTORY_ENTRY OrderedEntry;
     POBJECT_HEADER_NAME_INFO HeaderNameInfo;
+    ULONG BucketCount;
 
     /* Make sure we have a name */
     ASSERT(ObjectHeader->NameInfoOffset != 0);
@@ -67,10 +215,11 @@ ObpInsertEntryDirectory(IN POBJECT_DIRECTORY Parent,
     }
 
     /* Allocate a new Directory Entry */
-    NewEntry = ExAllocatePoolWithTag(PagedPool,
-                                     sizeof(OBJECT_DIRECTORY_ENTRY),
-                                     OB_DIR_TAG);
-    if (!NewEntry) return FALSE;
+    OrderedEntry = ExAllocatePoolWithTag(PagedPool,
+                                         sizeof(OBP_DIRECTORY_ENTRY),
+                                         OB_DIR_TAG);
+    if (!OrderedEntry) return FALSE;
+    NewEntry = &OrderedEntry->Entry;
 
     /* Save the hash */
     NewEntry->HashValue = Context->HashValue;
@@ -78,8 +227,11 @@ ObpInsertEntryDirectory(IN POBJECT_DIRECTORY Parent,
     /* Get the Object Name Information */
     HeaderNameInfo = OBJECT_HEADER_TO_NAME_INFO(ObjectHeader);
 
-    /* Get the Allocated entry */
-    AllocatedEntry = &Parent->HashBuckets[Context->HashIndex];
+    /* Get the Allocated entry, the table may have grown since the lookup */
+    Context->HashIndex = (USHORT)ObpGetDirectoryHashIndex(Directory,
+                                                          Context->HashValue);
+    AllocatedEntry = &ObpGetDirectoryBuckets(Directory,
+                                             &BucketCount)[Context->HashIndex];
 
     /* Set it */
     NewEntry->ChainLink = *AllocatedEntry;
@@ -90,6 +242,19 @@ ObpInsertEntryDirectory(IN POBJECT_DIRECTORY Parent,
 
     /* Associate the Directory */
     HeaderNameInfo->Directory = Parent;
+
+    /* Append it to the enumeration order, renumber before the sequence wraps */
+    if (Directory->LastSequence >= MAXULONG - 1) ObpRenumberDirectory(Directory);
+    OrderedEntry->Sequence = ++Directory->LastSequence;
+    InsertTailList(&Directory->EntryList, &OrderedEntry->OrderLink);
+
+    /* Grow the hash table once the chains get too long */
+    Directory->EntryCount++;
+    if ((Directory->EntryCount > BucketCount * OBP_DIRECTORY_LOAD_FACTOR) &&
+        (Directory->HashShift < OBP_DIRECTORY_MAX_HASH_SHIFT))
+    {
+        ObpGrowDirectory(Directory);
+    }
     return TRUE;
 }
 
@@ -138,6 +303,7 @@ ObpLookupEntryDirectory(IN POBJECT_DIRECTORY Directory,
     POBJECT_DIRECTORY_ENTRY CurrentEntry;
     PVOID FoundObject = NULL;
     PWSTR Buffer;
+    ULONG BucketCount;
     PAGED_CODE();
 
     /* Check if we should search the shadow directory */
@@ -156,31 +322,20 @@ ObpLookupEntryDirectory(IN POBJECT_DIRECTORY Directory,
     /* Fail if the name is empty */
     if (!(Buffer) || !(TotalChars)) goto Quickie;
 
-    /* Create the Hash */
-    for (HashValue = 0; TotalChars; TotalChars--)
+    /* Create the Hash (FNV-1a of the upcased name) */
+    for (HashValue = OBP_DIRECTORY_HASH_SEED; TotalChars; TotalChars--)
     {
-        /* Go to the next Character */
+        /* Go to the next Character and upcase it */
         CurrentChar = *Buffer++;
+        if (CurrentChar > 'z') CurrentChar = RtlUpcaseUnicodeChar(CurrentChar);
+        else if (CurrentChar >= 'a') CurrentChar -= ('a'-'A');
 
-        /* Prepare the Hash */
-        HashValue += (HashValue << 1) + (HashValue >> 1);
-
-        /* Create the rest based on the name */
-        if (CurrentChar < 'a') HashValue += CurrentChar;
-        else if (CurrentChar > 'z') HashValue += RtlUpcaseUnicodeChar(CurrentChar);
-        else HashValue += (CurrentChar - ('a'-'A'));
+        /* Mix it into the Hash */
+        HashValue = (HashValue ^ CurrentChar) * OBP_DIRECTORY_HASH_PRIME;
     }
 
-    /* Merge it with our number of hash buckets */
-    HashIndex = HashValue % 37;
-
     /* Save the result */
     Context->HashValue = HashValue;
-    Context->HashIndex = (USHORT)HashIndex;
-
-    /* Get the root entry and set it as our lookup bucket */
-    AllocatedEntry = &Directory->HashBuckets[HashIndex];
-    LookupBucket = AllocatedEntry;
 
     /* Check if the directory is already locked */
     if (!Context->DirectoryLocked)
@@ -189,6 +344,15 @@ ObpLookupEntryDirectory(IN POBJECT_DIRECTORY Directory,
         ObpAcquireDirectoryLockShared(Directory, Context);
     }
 
+    /* Merge it with the current number of hash buckets, now that it's stable */
+    HashIndex = ObpGetDirectoryHashIndex((POBP_DIRECTORY)Directory, HashValue);
+    Context->HashIndex = (USHORT)HashIndex;
+
+    /* Get the root entry and set it as our lookup bucket */
+    AllocatedEntry = &ObpGetDirectoryBuckets((POBP_DIRECTORY)Directory,
+                                             &BucketCount)[HashIndex];
+    LookupBucket = AllocatedEntry;
+
     /* Start looping */
     while ((CurrentEntry = *AllocatedEntry))
     {
@@ -217,12 +381,15 @@ ObpLookupEntryDirectory(IN POBJECT_DIRECTORY Directory,
     /* Check if we still have an entry */
     if (CurrentEntry)
     {
-        /* Set this entry as the first, to speed up incoming insertion */
+        /*
+         * Set this entry as the first, to speed up incoming insertion. Only
+         * do it when we already own the lock, so that shared lookups never
+         * have to convert it and block each other.
+         */
         if (AllocatedEntry != LookupBucket)
         {
-            /* Check if the directory was locked or convert the lock */
-            if ((Context->DirectoryLocked) ||
-                (ExConvertPushLockSharedToExclusive(&Directory->Lock)))
+            /* Check if the directory was locked */
+            if (Context->DirectoryLocked)
             {
                 /* Set the Current Entry */
                 *AllocatedEntry = CurrentEntry->ChainLink;
@@ -309,24 +476,36 @@ BOOLEAN
 NTAPI
 ObpDeleteEntryDirectory(POBP_LOOKUP_CONTEXT Context)
 {
-    POBJECT_DIRECTORY Directory;
+    POBP_DIRECTORY Directory;
     POBJECT_DIRECTORY_ENTRY *AllocatedEntry;
     POBJECT_DIRECTORY_ENTRY CurrentEntry;
+    POBP_DIRECTORY_ENTRY OrderedEntry;
+    ULONG BucketCount;
 
     /* Get the Directory */
-    Directory = Context->Directory;
+    Directory = (POBP_DIRECTORY)Context->Directory;
     if (!Directory) return FALSE;
 
-    /* Get the Entry */
-    AllocatedEntry = &Directory->HashBuckets[Context->HashIndex];
-    CurrentEntry = *AllocatedEntry;
+    /* Find the Entry of the object that was looked up in its bucket */
+    AllocatedEntry = &ObpGetDirectoryBuckets(Directory, &BucketCount)
+                     [ObpGetDirectoryHashIndex(Directory, Context->HashValue)];
+    while ((CurrentEntry = *AllocatedEntry))
+    {
+        if (CurrentEntry->Object == Context->Object) break;
+        AllocatedEntry = &CurrentEntry->ChainLink;
+    }
+    ASSERT(CurrentEntry != NULL);
+    if (!CurrentEntry) return FALSE;
 
     /* Unlink the Entry */
     *AllocatedEntry = CurrentEntry->ChainLink;
     CurrentEntry->ChainLink = NULL;
+    Directory->EntryCount--;
+    OrderedEntry = CONTAINING_RECORD(CurrentEntry, OBP_DIRECTORY_ENTRY, Entry);
+    RemoveEntryList(&OrderedEntry->OrderLink);
 
     /* Free it */
-    ExFreePoolWithTag(CurrentEntry, OB_DIR_TAG);
+    ExFreePoolWithTag(OrderedEntry, OB_DIR_TAG);
 
     /* Return */
     return TRUE;
@@ -430,11 +609,11 @@ NtOpenDirectoryObject(OUT PHANDLE DirectoryHandle,
 *        otherwise as many as will fit in the buffer.
 *
 * @param RestartScan
-*        If TRUE start reading at index 0.
-*        If FALSE start reading at the index specified by *ObjectIndex.
+*        If TRUE start reading at the first entry.
+*        If FALSE start reading at the key specified by *Context.
 *
 * @param Context
-*        Zero based index into the directory, interpretation
+*        Opaque key of the next entry to read, interpretation
 *        depends on RestartScan.
 *
 * @param ReturnLength
@@ -469,8 +648,8 @@ NtQueryDirectoryObject(IN HANDLE DirectoryHandle,
     POBJECT_DIRECTORY_INFORMATION DirectoryInfo;
     ULONG Length, TotalLength;
     ULONG Count, CurrentEntry;
-    ULONG Hash;
-    POBJECT_DIRECTORY_ENTRY Entry;
+    PLIST_ENTRY ListEntry;
+    POBP_DIRECTORY_ENTRY Entry;
     POBJECT_HEADER ObjectHeader;
     POBJECT_HEADER_NAME_INFO ObjectNameInfo;
     UNICODE_STRING Name;
@@ -538,94 +717,92 @@ NtQueryDirectoryObject(IN HANDLE DirectoryHandle,
     DirectoryInfo = (POBJECT_DIRECTORY_INFORMATION)LocalBuffer;
     TotalLength = sizeof(OBJECT_DIRECTORY_INFORMATION);
 
-    /* Start with 0 entries */
+    /* Start with 0 entries, resuming after the last entry returned */
     Count = 0;
-    CurrentEntry = 0;
+    CurrentEntry = SkipEntries;
 
-    /* Set default status and start looping */
+    /*
+     * Walk the entries in insertion order. The key is the sequence number of
+     * the next entry to return, so it stays valid when the hash table grows
+     * or when entries before it are removed.
+     */
     Status = STATUS_NO_MORE_ENTRIES;
-    for (Hash = 0; Hash < 37; Hash++)
+    for (ListEntry = ((POBP_DIRECTORY)Directory)->EntryList.Flink;
+         ListEntry != &((POBP_DIRECTORY)Directory)->EntryList;
+         ListEntry = ListEntry->Flink)
     {
-        /* Get this entry and loop all of them */
-        Entry = Directory->HashBuckets[Hash];
-        while (Entry)
+        /* Skip the entries that were already returned */
+        Entry = CONTAINING_RECORD(ListEntry, OBP_DIRECTORY_ENTRY, OrderLink);
+        if (Entry->Sequence < SkipEntries) continue;
+
+        /* Get the header data */
+        ObjectHeader = OBJECT_TO_OBJECT_HEADER(Entry->Entry.Object);
+        ObjectNameInfo = OBJECT_HEADER_TO_NAME_INFO(ObjectHeader);
+
+        /* Get the object name */
+        if (ObjectNameInfo)
         {
-            /* Check if we should process this entry */
-            if (SkipEntries == CurrentEntry++)
-            {
-                /* Get the header data */
-                ObjectHeader = OBJECT_TO_OBJECT_HEADER(Entry->Object);
-                ObjectNameInfo = OBJECT_HEADER_TO_NAME_INFO(ObjectHeader);
-
-                /* Get the object name */
-                if (ObjectNameInfo)
-                {
-                    /* Use the one we have */
-                    Name = ObjectNameInfo->Name;
-                }
-                else
-                {
-                    /* Otherwise, use an empty one */
-                    RtlInitEmptyUnicodeString(&Name, NULL, 0);
-                }
-
-                /* Calculate the length for this entry */
-                Length = sizeof(OBJECT_DIRECTORY_INFORMATION) +
-                         Name.Length + sizeof(UNICODE_NULL) +
-                         ObjectHeader->Type->Name.Length + sizeof(UNICODE_NULL);
-
-                /* Make sure this entry won't overflow */
-                if ((TotalLength + Length) > BufferLength)
-                {
-                    /* Check if the caller wanted only an entry */
-                    if (ReturnSingleEntry)
-                    {
-                        /* Then we'll fail and ask for more buffer */
-                        TotalLength += Length;
-                        Status = STATUS_BUFFER_TOO_SMALL;
-                    }
-                    else
-                    {
-                        /* Otherwise, we'll say we're done for now */
-                        Status = STATUS_MORE_ENTRIES;
-                    }
-
-                    /* Decrease the entry since we didn't process */
-                    CurrentEntry--;
-                    goto Quickie;
-                }
-
-                /* Now fill in the buffer */
-                DirectoryInfo->Name.Length = Name.Length;
-                DirectoryInfo->Name.MaximumLength = Name.Length +
-                                                    sizeof(UNICODE_NULL);
-                DirectoryInfo->Name.Buffer = Name.Buffer;
-                DirectoryInfo->TypeName.Length = ObjectHeader->
-                                                 Type->Name.Length;
-                DirectoryInfo->TypeName.MaximumLength = ObjectHeader->
-                                                        Type->Name.Length +
-                                                        sizeof(UNICODE_NULL);
-                DirectoryInfo->TypeName.Buffer = ObjectHeader->
-                                                 Type->Name.Buffer;
-
-                /* Set success */
-                Status = STATUS_SUCCESS;
-
-                /* Increase statistics */
-                TotalLength += Length;
-                DirectoryInfo++;
-                Count++;
+            /* Use the one we have */
+            Name = ObjectNameInfo->Name;
+        }
+        else
+        {
+            /* Otherwise, use an empty one */
+            RtlInitEmptyUnicodeString(&Name, NULL, 0);
+        }
 
-                /* If the caller only wanted an entry, bail out */
-                if (ReturnSingleEntry) goto Quickie;
+        /* Calculate the length for this entry */
+        Length = sizeof(OBJECT_DIRECTORY_INFORMATION) +
+                 Name.Length + sizeof(UNICODE_NULL) +
+                 ObjectHeader->Type->Name.Length + sizeof(UNICODE_NULL);
 
-                /* Increase the key by one */
-                SkipEntries++;
+        /* Make sure this entry won't overflow */
+        if ((TotalLength + Length) > BufferLength)
+        {
+            /* Check if the caller wanted only an entry */
+            if (ReturnSingleEntry)
+            {
+                /* Then we'll fail and ask for more buffer */
+                TotalLength += Length;
+                Status = STATUS_BUFFER_TOO_SMALL;
+            }
+            else
+            {
+                /* Otherwise, we'll say we're done for now */
+                Status = STATUS_MORE_ENTRIES;
             }
 
-            /* Move to the next directory */
-            Entry = Entry->ChainLink;
+            /* Resume at this entry since we didn't process it */
+            CurrentEntry = Entry->Sequence;
+            goto Quickie;
         }
+
+        /* Now fill in the buffer */
+        DirectoryInfo->Name.Length = Name.Length;
+        DirectoryInfo->Name.MaximumLength = Name.Length +
+                                            sizeof(UNICODE_NULL);
+        DirectoryInfo->Name.Buffer = Name.Buffer;
+        DirectoryInfo->TypeName.Length = ObjectHeader->
+                                         Type->Name.Length;
+        DirectoryInfo->TypeName.MaximumLength = ObjectHeader->
+                                                Type->Name.Length +
+                                                sizeof(UNICODE_NULL);
+        DirectoryInfo->TypeName.Buffer = ObjectHeader->
+                                         Type->Name.Buffer;
+
+        /* Set success */
+        Status = STATUS_SUCCESS;
+
+        /* Increase statistics */
+        TotalLength += Length;
+        DirectoryInfo++;
+        Count++;
+
+        /* The key now points past this entry */
+        CurrentEntry = Entry->Sequence + 1;
+
+        /* If the caller only wanted an entry, bail out */
+        if (ReturnSingleEntry) goto Quickie;
     }
 
 Quickie:
@@ -760,16 +937,17 @@ NtCreateDirectoryObject(OUT PHANDLE DirectoryHandle,
                             ObjectAttributes,
                             PreviousMode,
                             NULL,
-                            sizeof(OBJECT_DIRECTORY),
+                            sizeof(OBP_DIRECTORY),
                             0,
                             0,
                             (PVOID*)&Directory);
     if (!NT_SUCCESS(Status)) return Status;
 
     /* Setup the object */
-    RtlZeroMemory(Directory, sizeof(OBJECT_DIRECTORY));
+    RtlZeroMemory(Directory, sizeof(OBP_DIRECTORY));
     ExInitializePushLock(&Directory->Lock);
     Directory->SessionId = -1;
+    InitializeListHead(&((POBP_DIRECTORY)Directory)->EntryList);
 
     /* Insert it into the handle table */
     Status = ObInsertObject((PVOID)Directory,
@@ -280,8 +280,8 @@ ObInitSystem(VOID)
     ObjectTypeInitializer.CaseInsensitive = TRUE;
     ObjectTypeInitializer.MaintainTypeList = FALSE;
     ObjectTypeInitializer.GenericMapping = ObpDirectoryMapping;
-    ObjectTypeInitializer.DeleteProcedure = NULL;
-    ObjectTypeInitializer.DefaultNonPagedPoolCharge = sizeof(OBJECT_DIRECTORY);
+    ObjectTypeInitializer.DeleteProcedure = ObpDeleteDirectory;
+    ObjectTypeInitializer.DefaultNonPagedPoolCharge = sizeof(OBP_DIRECTORY);
     ObCreateObjectType(&Name, &ObjectTypeInitializer, NULL, &ObDirectoryType);
     ObDirectoryType->TypeInfo.ValidAccessMask &= ~SYNCHRONIZE;
 
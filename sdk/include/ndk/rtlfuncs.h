@@ -893,7 +893,7 @@ RtlDestroyHeap(
 );
 
 NTSYSAPI
-ULONG
+NTSTATUS
 NTAPI
 RtlExtendHeap(
     _In_ HANDLE Heap,
@@ -994,7 +994,7 @@ RtlLockHeap(
 
 _Must_inspect_result_
 NTSYSAPI
-NTSTATUS
+ULONG
 NTAPI
 RtlMultipleAllocateHeap (
     _In_ HANDLE HeapHandle,
@@ -1005,7 +1005,7 @@ RtlMultipleAllocateHeap (
     );
 
 NTSYSAPI
-NTSTATUS
+ULONG
 NTAPI
 RtlMultipleFreeHeap (
     _In_ HANDLE HeapHandle,
@@ -3439,6 +3439,59 @@ RtlCheckBit(
 
 #endif // NTOS_MODE_USER
 
+NTSYSAPI
+VOID
+NTAPI
+RtlInitializeBitMapSummary(
+    _Out_ PRTL_BITMAP_SUMMARY Summary,
+    _In_ PRTL_BITMAP BitMapHeader,
+    _Out_writes_(RTL_BITMAP_SUMMARY_BLOCKS(BitMapHeader->SizeOfBitMap, BlockShift)) PULONG ClearCountBuffer,
+    _In_range_(5, 31) ULONG BlockShift
+);
+
+NTSYSAPI
+VOID
+NTAPI
+RtlClearBitsSummary(
+    _In_ PRTL_BITMAP_SUMMARY Summary,
+    _In_ ULONG StartingIndex,
+    _In_ ULONG NumberToClear
+);
+
+NTSYSAPI
+VOID
+NTAPI
+RtlSetBitsSummary(
+    _In_ PRTL_BITMAP_SUMMARY Summary,
+    _In_ ULONG StartingIndex,
+    _In_ ULONG NumberToSet
+);
+
+NTSYSAPI
+ULONG
+NTAPI
+RtlFindClearBitsSummary(
+    _In_ PRTL_BITMAP_SUMMARY Summary,
+    _In_ ULONG NumberToFind,
+    _In_ ULONG HintIndex
+);
+
+NTSYSAPI
+ULONG
+NTAPI
+RtlFindClearBitsAndSetSummary(
+    _In_ PRTL_BITMAP_SUMMARY Summary,
+    _In_ ULONG NumberToFind,
+    _In_ ULONG HintIndex
+);
+
+NTSYSAPI
+ULONG
+NTAPI
+RtlNumberOfClearBitsSummary(
+    _In_ PRTL_BITMAP_SUMMARY Summary
+);
+
 
 //
 // Timer Functions
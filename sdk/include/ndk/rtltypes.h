@@ -943,6 +943,23 @@ typedef struct _ACTIVATION_CONTEXT_STACK_FRAMELIST
 
 #endif /* NTOS_MODE_USER */
 
+//
+// Summary index for large RTL bitmaps (ReactOS extension)
+//
+typedef struct _RTL_BITMAP_SUMMARY
+{
+    PRTL_BITMAP BitMap;
+    PULONG ClearCount;
+    ULONG BlockShift;
+    ULONG NumberOfBlocks;
+} RTL_BITMAP_SUMMARY, *PRTL_BITMAP_SUMMARY;
+
+//
+// Number of ClearCount entries needed for a bitmap
+//
+#define RTL_BITMAP_SUMMARY_BLOCKS(SizeOfBitMap, BlockShift) \
+    (((SizeOfBitMap) >> (BlockShift)) + (((SizeOfBitMap) & ((1UL << (BlockShift)) - 1)) != 0))
+
 #if (NTDDI_VERSION >= NTDDI_WS03SP1)
 typedef struct _ACTIVATION_CONTEXT_STACK
 {
@@ -1032,6 +1049,19 @@ typedef struct _RTL_HEAP_USAGE
     ULONG_PTR Reserved[8];
 } RTL_HEAP_USAGE, *PRTL_HEAP_USAGE;
 
+//
+// RtlWalkHeap Entry Flags
+//
+#define RTL_HEAP_BUSY                                       0x0001
+#define RTL_HEAP_SEGMENT                                    0x0002
+#define RTL_HEAP_SETTABLE_VALUE                             0x0010
+#define RTL_HEAP_SETTABLE_FLAG1                             0x0020
+#define RTL_HEAP_SETTABLE_FLAG2                             0x0040
+#define RTL_HEAP_SETTABLE_FLAG3                             0x0080
+#define RTL_HEAP_SETTABLE_FLAGS                             0x00E0
+#define RTL_HEAP_UNCOMMITTED_RANGE                          0x0100
+#define RTL_HEAP_PROTECTED_ENTRY                            0x0200
+
 typedef struct _RTL_HEAP_WALK_ENTRY
 {
     PVOID DataAddress;
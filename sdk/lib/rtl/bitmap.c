@@ -58,6 +58,14 @@ typedef ULONG64 BITMAP_BUFFER, *PBITMAP_BUFFER;
 #define RtlFindClearRuns RtlFindClearRuns64
 #define RtlFindLongestRunClear RtlFindLongestRunClear64
 #define RtlFindLongestRunSet RtlFindLongestRunSet64
+#define RTL_BITMAP_SUMMARY RTL_BITMAP_SUMMARY64
+#define PRTL_BITMAP_SUMMARY PRTL_BITMAP_SUMMARY64
+#define RtlInitializeBitMapSummary RtlInitializeBitMapSummary64
+#define RtlClearBitsSummary RtlClearBitsSummary64
+#define RtlSetBitsSummary RtlSetBitsSummary64
+#define RtlFindClearBitsSummary RtlFindClearBitsSummary64
+#define RtlFindClearBitsAndSetSummary RtlFindClearBitsAndSetSummary64
+#define RtlNumberOfClearBitsSummary RtlNumberOfClearBitsSummary64
 #else
 #define _BITCOUNT 32
 #define MAXINDEX 0xFFFFFFFF
@@ -65,35 +73,76 @@ typedef ULONG BITMAP_INDEX, *PBITMAP_INDEX;
 typedef ULONG BITMAP_BUFFER, *PBITMAP_BUFFER;
 #endif
 
-/* DATA *********************************************************************/
-
-/* Number of set bits per byte value */
-static const
-UCHAR
-BitCountTable[256] =
-{
-    /* x0 x1 x2 x3 x4 x5 x6 x7 x8 x9 xA xB xC xD xE xF */
-       0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, /* 0x */
-       1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, /* 1x */
-       1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, /* 2x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* 3x */
-       1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, /* 4x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* 5x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* 6c */
-       3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, /* 7x */
-       1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, /* 8x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* 9x */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* Ax */
-       3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, /* Bx */
-       2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, /* Cx */
-       3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, /* Dx */
-       3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, /* Ex */
-       4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8  /* Fx */
-};
-
+/* Number of buffer words tested at once when skipping uniform stretches */
+#define BLOCK_WORDS 4
 
 /* PRIVATE FUNCTIONS ********************************************************/
 
+static __inline
+BITMAP_INDEX
+RtlpPopulationCount(
+    _In_ BITMAP_BUFFER Value)
+{
+    /* Count bits in parallel, no lookups and no branches. The POPCNT
+       instruction is not available on every CPU we run on. */
+    Value = Value - ((Value >> 1) & (BITMAP_BUFFER)0x5555555555555555ULL);
+    Value = (Value & (BITMAP_BUFFER)0x3333333333333333ULL) +
+            ((Value >> 2) & (BITMAP_BUFFER)0x3333333333333333ULL);
+    Value = (Value + (Value >> 4)) & (BITMAP_BUFFER)0x0F0F0F0F0F0F0F0FULL;
+    return (BITMAP_INDEX)((BITMAP_BUFFER)(Value * (BITMAP_BUFFER)0x0101010101010101ULL) >> (_BITCOUNT - 8));
+}
+
+static
+BITMAP_INDEX
+RtlpNumberOfSetBitsInRange(
+    _In_ PRTL_BITMAP BitMapHeader,
+    _In_ BITMAP_INDEX StartingIndex,
+    _In_ BITMAP_INDEX Length)
+{
+    PBITMAP_BUFFER Buffer;
+    BITMAP_INDEX BitCount, BitPos;
+
+    if (Length == 0)
+        return 0;
+
+    /* Calculate positions */
+    Buffer = BitMapHeader->Buffer + StartingIndex / _BITCOUNT;
+    BitPos = StartingIndex & (_BITCOUNT - 1);
+
+    /* Does the range end in the first ULONG? */
+    if (BitPos + Length <= _BITCOUNT)
+    {
+        return RtlpPopulationCount((*Buffer >> BitPos) & (MAXINDEX >> (_BITCOUNT - Length)));
+    }
+
+    /* Count the bits of the first ULONG that belong to the range */
+    BitCount = RtlpPopulationCount(*Buffer++ >> BitPos);
+    Length -= _BITCOUNT - BitPos;
+
+    /* Count full ULONGs, a block at a time */
+    while (Length >= BLOCK_WORDS * _BITCOUNT)
+    {
+        BitCount += RtlpPopulationCount(Buffer[0]) + RtlpPopulationCount(Buffer[1]) +
+                    RtlpPopulationCount(Buffer[2]) + RtlpPopulationCount(Buffer[3]);
+        Buffer += BLOCK_WORDS;
+        Length -= BLOCK_WORDS * _BITCOUNT;
+    }
+
+    while (Length >= _BITCOUNT)
+    {
+        BitCount += RtlpPopulationCount(*Buffer++);
+        Length -= _BITCOUNT;
+    }
+
+    /* Count the bits that are left in the last ULONG */
+    if (Length)
+    {
+        BitCount += RtlpPopulationCount(*Buffer & ~(MAXINDEX << Length));
+    }
+
+    return BitCount;
+}
+
 static __inline
 BITMAP_INDEX
 RtlpGetLengthOfRunClear(
@@ -120,6 +169,13 @@ RtlpGetLengthOfRunClear(
     /* Clear the bits that don't belong to this run */
     Value = *Buffer++ >> BitPos << BitPos;
 
+    /* Skip whole blocks of clear ULONGs */
+    while (Value == 0 && Buffer + BLOCK_WORDS <= MaxBuffer)
+    {
+        if ((Buffer[0] | Buffer[1] | Buffer[2] | Buffer[3]) != 0) break;
+        Buffer += BLOCK_WORDS;
+    }
+
     /* Skip all clear ULONGs */
     while (Value == 0 && Buffer < MaxBuffer)
     {
@@ -174,6 +230,13 @@ RtlpGetLengthOfRunSet(
     /* Get the inversed value, clear bits that don't belong to the run */
     InvValue = ~(*Buffer++) >> BitPos << BitPos;
 
+    /* Skip whole blocks of set ULONGs */
+    while (InvValue == 0 && Buffer + BLOCK_WORDS <= MaxBuffer)
+    {
+        if ((Buffer[0] & Buffer[1] & Buffer[2] & Buffer[3]) != MAXINDEX) break;
+        Buffer += BLOCK_WORDS;
+    }
+
     /* Skip all set ULONGs */
     while (InvValue == 0 && Buffer < MaxBuffer)
     {
@@ -474,25 +537,7 @@ NTAPI
 RtlNumberOfSetBits(
     _In_ PRTL_BITMAP BitMapHeader)
 {
-    PUCHAR Byte, MaxByte;
-    BITMAP_INDEX BitCount = 0;
-    ULONG Shift;
-
-    Byte = (PUCHAR)BitMapHeader->Buffer;
-    MaxByte = Byte + BitMapHeader->SizeOfBitMap / 8;
-
-    while (Byte < MaxByte)
-    {
-        BitCount += BitCountTable[*Byte++];
-    }
-
-    if (BitMapHeader->SizeOfBitMap & 7)
-    {
-        Shift = 8 - (BitMapHeader->SizeOfBitMap & 7);
-        BitCount += BitCountTable[((*Byte) << Shift) & 0xFF];
-    }
-
-    return BitCount;
+    return RtlpNumberOfSetBitsInRange(BitMapHeader, 0, BitMapHeader->SizeOfBitMap);
 }
 
 BITMAP_INDEX
@@ -537,12 +582,13 @@ retry:
     CurrentBit = HintIndex;
 
     /* Loop until something is found or the end is reached */
-    while (CurrentBit + NumberToFind < Margin)
+    while (CurrentBit + NumberToFind <= Margin)
     {
-        /* Search for the next clear run, by skipping a set run */
+        /* Search for the next clear run, by skipping a set run. A run that
+           starts past the margin cannot fit, so don't look any further. */
         CurrentBit += RtlpGetLengthOfRunSet(BitMapHeader,
                                             CurrentBit,
-                                            MAXINDEX);
+                                            Margin - CurrentBit);
 
         /* Get length of the clear bit run */
         CurrentLength = RtlpGetLengthOfRunClear(BitMapHeader,
@@ -607,10 +653,11 @@ retry:
     /* Loop until something is found or the end is reached */
     while (CurrentBit + NumberToFind <= Margin)
     {
-        /* Search for the next set run, by skipping a clear run */
+        /* Search for the next set run, by skipping a clear run. A run that
+           starts past the margin cannot fit, so don't look any further. */
         CurrentBit += RtlpGetLengthOfRunClear(BitMapHeader,
                                               CurrentBit,
-                                              MAXINDEX);
+                                              Margin - CurrentBit);
 
         /* Get length of the set bit run */
         CurrentLength = RtlpGetLengthOfRunSet(BitMapHeader,
@@ -872,8 +919,8 @@ RtlFindClearRuns(
             /* Loop all runs */
             for (Run = 0; Run < SizeOfRunArray; Run++)
             {
-                /*Is this the new smallest run? */
-                if (NumberOfBits < RunArray[SmallestRun].NumberOfBits)
+                /* Is this the new smallest run? */
+                if (RunArray[Run].NumberOfBits < RunArray[SmallestRun].NumberOfBits)
                 {
                     /* Set it as new smallest run */
                     SmallestRun = Run;
@@ -881,11 +928,11 @@ RtlFindClearRuns(
             }
         }
 
-        /* Advance bits */
-        FromIndex += NumberOfBits;
+        /* Continue behind the run, the bits in front of it are done */
+        FromIndex = StartingIndex + NumberOfBits;
     }
 
-    return Run;
+    return SizeOfRunArray;
 }
 
 BITMAP_INDEX
@@ -914,8 +961,11 @@ RtlFindLongestRunClear(
             *StartingIndex = Index;
         }
 
-        /* Advance bits */
-        FromIndex += NumberOfBits;
+        /* Continue behind the run, the bits in front of it are done */
+        FromIndex = Index + NumberOfBits;
+
+        /* Stop when what's left can't hold a longer run */
+        if (BitMapHeader->SizeOfBitMap - FromIndex <= MaxNumberOfBits) break;
     }
 
     return MaxNumberOfBits;
@@ -947,10 +997,258 @@ RtlFindLongestRunSet(
             *StartingIndex = Index;
         }
 
-        /* Advance bits */
-        FromIndex += NumberOfBits;
+        /* Continue behind the run, the bits in front of it are done */
+        FromIndex = Index + NumberOfBits;
+
+        /* Stop when what's left can't hold a longer run */
+        if (BitMapHeader->SizeOfBitMap - FromIndex <= MaxNumberOfBits) break;
     }
 
     return MaxNumberOfBits;
 }
 
+/* SUMMARY INDEX ************************************************************/
+
+/*
+ * A summary keeps the number of clear bits for every block of
+ * 2^BlockShift bits of a bitmap, so that searches can step over fully
+ * allocated blocks without reading them. All changes to the bitmap must
+ * go through the summary routines, or the summary has to be initialized
+ * again before it's used.
+ */
+
+static __inline
+BITMAP_INDEX
+RtlpGetSummaryBlockSize(
+    _In_ PRTL_BITMAP_SUMMARY Summary,
+    _In_ BITMAP_INDEX Block)
+{
+    BITMAP_INDEX BlockStart = Block << Summary->BlockShift;
+
+    /* The last block may be cut short by the end of the bitmap */
+    return min((BITMAP_INDEX)1 << Summary->BlockShift,
+               Summary->BitMap->SizeOfBitMap - BlockStart);
+}
+
+VOID
+NTAPI
+RtlInitializeBitMapSummary(
+    _Out_ PRTL_BITMAP_SUMMARY Summary,
+    _In_ PRTL_BITMAP BitMapHeader,
+    _Out_ PULONG ClearCountBuffer,
+    _In_ ULONG BlockShift)
+{
+    BITMAP_INDEX Block, BlockSize;
+
+    ASSERT(BlockShift >= 5 && BlockShift < 32);
+
+    /* Setup the summary header */
+    Summary->BitMap = BitMapHeader;
+    Summary->ClearCount = ClearCountBuffer;
+    Summary->BlockShift = BlockShift;
+    Summary->NumberOfBlocks = RTL_BITMAP_SUMMARY_BLOCKS(BitMapHeader->SizeOfBitMap, (BITMAP_INDEX)BlockShift);
+
+    /* Count what's clear in every block */
+    for (Block = 0; Block < Summary->NumberOfBlocks; Block++)
+    {
+        BlockSize = RtlpGetSummaryBlockSize(Summary, Block);
+        ClearCountBuffer[Block] = (ULONG)(BlockSize -
+            RtlpNumberOfSetBitsInRange(BitMapHeader, Block << BlockShift, BlockSize));
+    }
+}
+
+static
+VOID
+RtlpUpdateSummary(
+    _In_ PRTL_BITMAP_SUMMARY Summary,
+    _In_ BITMAP_INDEX StartingIndex,
+    _In_ BITMAP_INDEX Length,
+    _In_ BOOLEAN Set)
+{
+    BITMAP_INDEX Block, LastBlock, BlockStart, BlockSize, Start, End, SetBits;
+
+    if (Length == 0)
+        return;
+
+    Block = StartingIndex >> Summary->BlockShift;
+    LastBlock = (StartingIndex + Length - 1) >> Summary->BlockShift;
+
+    for (; Block <= LastBlock; Block++)
+    {
+        BlockStart = Block << Summary->BlockShift;
+        BlockSize = RtlpGetSummaryBlockSize(Summary, Block);
+
+        /* Get the part of the range that's in this block */
+        Start = max(StartingIndex, BlockStart);
+        End = min(StartingIndex + Length, BlockStart + BlockSize);
+
+        /* A fully covered block doesn't need to be counted */
+        if (End - Start == BlockSize)
+        {
+            Summary->ClearCount[Block] = Set ? 0 : (ULONG)BlockSize;
+            continue;
+        }
+
+        /* Only the bits that actually change are accounted */
+        SetBits = RtlpNumberOfSetBitsInRange(Summary->BitMap, Start, End - Start);
+        if (Set)
+            Summary->ClearCount[Block] -= (ULONG)(End - Start - SetBits);
+        else
+            Summary->ClearCount[Block] += (ULONG)SetBits;
+    }
+}
+
+VOID
+NTAPI
+RtlClearBitsSummary(
+    _In_ PRTL_BITMAP_SUMMARY Summary,
+    _In_ BITMAP_INDEX StartingIndex,
+    _In_ BITMAP_INDEX NumberToClear)
+{
+    ASSERT(StartingIndex + NumberToClear <= Summary->BitMap->SizeOfBitMap);
+
+    /* Account the bits before they change */
+    RtlpUpdateSummary(Summary, StartingIndex, NumberToClear, FALSE);
+    RtlClearBits(Summary->BitMap, StartingIndex, NumberToClear);
+}
+
+VOID
+NTAPI
+RtlSetBitsSummary(
+    _In_ PRTL_BITMAP_SUMMARY Summary,
+    _In_ BITMAP_INDEX StartingIndex,
+    _In_ BITMAP_INDEX NumberToSet)
+{
+    ASSERT(StartingIndex + NumberToSet <= Summary->BitMap->SizeOfBitMap);
+
+    /* Account the bits before they change */
+    RtlpUpdateSummary(Summary, StartingIndex, NumberToSet, TRUE);
+    RtlSetBits(Summary->BitMap, StartingIndex, NumberToSet);
+}
+
+BITMAP_INDEX
+NTAPI
+RtlFindClearBitsSummary(
+    _In_ PRTL_BITMAP_SUMMARY Summary,
+    _In_ BITMAP_INDEX NumberToFind,
+    _In_ BITMAP_INDEX HintIndex)
+{
+    PRTL_BITMAP BitMapHeader = Summary->BitMap;
+    BITMAP_INDEX CurrentBit, Margin, CurrentLength, Block, BlockEnd;
+
+    /* Check for valid parameters */
+    if (NumberToFind > BitMapHeader->SizeOfBitMap)
+    {
+        return MAXINDEX;
+    }
+
+    /* Check if the hint is outside the bitmap */
+    if (HintIndex >= BitMapHeader->SizeOfBitMap) HintIndex = 0;
+
+    /* Check for trivial case */
+    if (NumberToFind == 0)
+    {
+        /* Return hint rounded down to byte margin */
+        return HintIndex & ~7;
+    }
+
+    /* First margin is end of bitmap */
+    Margin = BitMapHeader->SizeOfBitMap;
+
+retry:
+    /* Start with hint index */
+    CurrentBit = HintIndex;
+
+    /* Loop until something is found or the end is reached */
+    while (CurrentBit + NumberToFind <= Margin)
+    {
+        /* Step over fully allocated blocks without touching the bitmap */
+        Block = CurrentBit >> Summary->BlockShift;
+        if (Summary->ClearCount[Block] == 0)
+        {
+            do
+            {
+                Block++;
+            } while (Block < Summary->NumberOfBlocks && Summary->ClearCount[Block] == 0);
+
+            /* The end of the last block may not fit in an index */
+            if (Block >= Summary->NumberOfBlocks)
+                break;
+
+            CurrentBit = Block << Summary->BlockShift;
+            continue;
+        }
+
+        /* Skip the set run, but not past this block, the next one may be full */
+        BlockEnd = (BITMAP_INDEX)min((ULONGLONG)(Block + 1) << Summary->BlockShift, (ULONGLONG)Margin);
+        CurrentBit += RtlpGetLengthOfRunSet(BitMapHeader,
+                                            CurrentBit,
+                                            BlockEnd - CurrentBit);
+        if (CurrentBit >= BlockEnd)
+            continue;
+
+        /* Get length of the clear bit run */
+        CurrentLength = RtlpGetLengthOfRunClear(BitMapHeader,
+                                                CurrentBit,
+                                                NumberToFind);
+
+        /* Is this long enough? */
+        if (CurrentLength >= NumberToFind)
+        {
+            /* It is */
+            return CurrentBit;
+        }
+
+        CurrentBit += CurrentLength;
+    }
+
+    /* Did we start at a hint? */
+    if (HintIndex)
+    {
+        /* Retry at the start */
+        Margin = min(HintIndex + NumberToFind, BitMapHeader->SizeOfBitMap);
+        HintIndex = 0;
+        goto retry;
+    }
+
+    /* Nothing found */
+    return MAXINDEX;
+}
+
+BITMAP_INDEX
+NTAPI
+RtlFindClearBitsAndSetSummary(
+    _In_ PRTL_BITMAP_SUMMARY Summary,
+    _In_ BITMAP_INDEX NumberToFind,
+    _In_ BITMAP_INDEX HintIndex)
+{
+    BITMAP_INDEX Position;
+
+    /* Try to find clear bits */
+    Position = RtlFindClearBitsSummary(Summary, NumberToFind, HintIndex);
+
+    /* Did we get something? */
+    if (Position != MAXINDEX)
+    {
+        /* Yes, set the bits */
+        RtlSetBitsSummary(Summary, Position, NumberToFind);
+    }
+
+    /* Return what we found */
+    return Position;
+}
+
+BITMAP_INDEX
+NTAPI
+RtlNumberOfClearBitsSummary(
+    _In_ PRTL_BITMAP_SUMMARY Summary)
+{
+    BITMAP_INDEX Block, ClearBits = 0;
+
+    for (Block = 0; Block < Summary->NumberOfBlocks; Block++)
+    {
+        ClearBits += Summary->ClearCount[Block];
+    }
+
+    return ClearBits;
+}
@@ -216,28 +216,240 @@ out:
 }
 
 
+/* LZNT1 compressor
+ *
+ * The input is split into 4 KB chunks which are compressed independently. Matches are
+ * found through hash chains over 3-byte prefixes; the hash heads and chain links live in
+ * the caller-supplied workspace (see RtlpWorkSpaceSizeLZNT1). The standard engine follows
+ * a short chain and takes the first acceptable match, the maximum engine searches the
+ * whole window and additionally uses lazy matching. Chunks which do not shrink are stored
+ * uncompressed, exactly like before. */
+
+#define LZNT1_CHUNK_SIZE        0x1000
+#define LZNT1_HASH_BITS         12
+#define LZNT1_HASH_SIZE         (1 << LZNT1_HASH_BITS)
+#define LZNT1_NIL               0xFFFF
+#define LZNT1_MIN_MATCH         3
+
+#define LZNT1_STANDARD_CHAIN    16
+#define LZNT1_STANDARD_NICE     18
+#define LZNT1_MAXIMUM_CHAIN     LZNT1_CHUNK_SIZE
+#define LZNT1_MAXIMUM_NICE      LZNT1_CHUNK_SIZE
+
+typedef struct _LZNT1_WORKSPACE
+{
+    USHORT HashHead[LZNT1_HASH_SIZE];
+    USHORT HashPrev[LZNT1_CHUNK_SIZE];
+} LZNT1_WORKSPACE, *PLZNT1_WORKSPACE;
+
+#define LZNT1_WORKSPACE_SIZE    0x8010
+C_ASSERT(sizeof(LZNT1_WORKSPACE) <= LZNT1_WORKSPACE_SIZE);
+
+typedef struct _LZNT1_CHUNK_STATE
+{
+    PLZNT1_WORKSPACE Workspace;
+    const UCHAR *Src;
+    ULONG Size;
+    ULONG Hashed;
+    ULONG MaxChain;
+    ULONG NiceLength;
+} LZNT1_CHUNK_STATE, *PLZNT1_CHUNK_STATE;
+
+static inline ULONG lznt1_hash(const UCHAR *p)
+{
+    ULONG value = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (value * 2654435761U) >> (32 - LZNT1_HASH_BITS);
+}
+
+/* number of displacement bits the decoder uses at the given position inside a chunk */
+static inline ULONG lznt1_displacement_bits(ULONG pos)
+{
+    ULONG bits = 4;
+    while (bits < 12 && pos > (1U << bits)) bits++;
+    return bits;
+}
+
+/* insert all positions below limit into the hash chains */
+static inline void lznt1_insert(PLZNT1_CHUNK_STATE state, ULONG limit)
+{
+    PLZNT1_WORKSPACE ws = state->Workspace;
+    ULONG hash;
+
+    if (limit + LZNT1_MIN_MATCH - 1 > state->Size)
+        limit = state->Size >= LZNT1_MIN_MATCH ? state->Size - LZNT1_MIN_MATCH + 1 : 0;
+
+    while (state->Hashed < limit)
+    {
+        hash = lznt1_hash(state->Src + state->Hashed);
+        ws->HashPrev[state->Hashed] = ws->HashHead[hash];
+        ws->HashHead[hash] = (USHORT)state->Hashed;
+        state->Hashed++;
+    }
+}
+
+/* find the longest match for the data at pos; pos must not be inserted yet */
+static ULONG lznt1_find_match(PLZNT1_CHUNK_STATE state, ULONG pos, ULONG *displacement)
+{
+    PLZNT1_WORKSPACE ws = state->Workspace;
+    const UCHAR *src = state->Src, *cur = src + pos, *ref;
+    ULONG bits, max_length, max_displacement, chain;
+    ULONG best_length = 0, length, candidate;
+
+    if (state->Size - pos < LZNT1_MIN_MATCH)
+        return 0;
+
+    bits             = lznt1_displacement_bits(pos);
+    max_length       = min((1U << (16 - bits)) - 1 + LZNT1_MIN_MATCH, state->Size - pos);
+    max_displacement = 1U << bits;
+
+    candidate = ws->HashHead[lznt1_hash(cur)];
+    for (chain = state->MaxChain; candidate != LZNT1_NIL && chain; chain--)
+    {
+        /* chains are ordered by position, everything further down is out of reach */
+        if (pos - candidate > max_displacement)
+            break;
+
+        ref = src + candidate;
+        if (ref[best_length] == cur[best_length] && ref[0] == cur[0] && ref[1] == cur[1])
+        {
+            /* source and match may overlap, the decoder copies byte by byte as well */
+            for (length = 2; length < max_length && ref[length] == cur[length]; length++);
+
+            if (length > best_length)
+            {
+                best_length   = length;
+                *displacement = pos - candidate;
+                if (length >= state->NiceLength || length == max_length)
+                    break;
+            }
+        }
+
+        candidate = ws->HashPrev[candidate];
+    }
+
+    return best_length >= LZNT1_MIN_MATCH ? best_length : 0;
+}
+
+/* compress a single LZNT1 chunk, returns the compressed size or 0 if it does not fit */
+static ULONG lznt1_compress_chunk(const UCHAR *src, ULONG src_size, UCHAR *dst, ULONG dst_size,
+                                  USHORT engine, PLZNT1_WORKSPACE workspace)
+{
+    UCHAR *dst_cur = dst, *dst_end = dst + dst_size, *flags = NULL;
+    ULONG pos = 0, flag_bit = 8, length, displacement = 0;
+    ULONG next_length, next_displacement = 0, bits;
+    BOOLEAN lazy = (engine == COMPRESSION_ENGINE_MAXIMUM);
+    LZNT1_CHUNK_STATE state;
+    WORD code;
+
+    state.Workspace  = workspace;
+    state.Src        = src;
+    state.Size       = src_size;
+    state.Hashed     = 0;
+    state.MaxChain   = lazy ? LZNT1_MAXIMUM_CHAIN : LZNT1_STANDARD_CHAIN;
+    state.NiceLength = lazy ? LZNT1_MAXIMUM_NICE : LZNT1_STANDARD_NICE;
+    memset(workspace->HashHead, 0xFF, sizeof(workspace->HashHead));
+
+    length = lznt1_find_match(&state, pos, &displacement);
+    lznt1_insert(&state, pos + 1);
+
+    while (pos < src_size)
+    {
+        /* start a new group of 8 entities */
+        if (flag_bit == 8)
+        {
+            if (dst_cur >= dst_end) return 0;
+            flags = dst_cur++;
+            *flags = 0;
+            flag_bit = 0;
+        }
+
+        /* lazy matching: prefer a literal if the next position has a longer match */
+        if (lazy && length && length < state.NiceLength && pos + 1 < src_size)
+        {
+            next_length = lznt1_find_match(&state, pos + 1, &next_displacement);
+            lznt1_insert(&state, pos + 2);
+            if (next_length > length)
+            {
+                if (dst_cur >= dst_end) return 0;
+                *dst_cur++ = src[pos++];
+                flag_bit++;
+                length       = next_length;
+                displacement = next_displacement;
+                continue;
+            }
+        }
+
+        if (length)
+        {
+            /* backwards reference */
+            if (dst_cur + sizeof(WORD) > dst_end) return 0;
+            bits = lznt1_displacement_bits(pos);
+            code = (WORD)(((displacement - 1) << (16 - bits)) | (length - LZNT1_MIN_MATCH));
+            *(WORD *)dst_cur = code;
+            dst_cur += sizeof(WORD);
+            *flags |= 1 << flag_bit;
+            pos += length;
+            lznt1_insert(&state, pos);
+        }
+        else
+        {
+            /* uncompressed data */
+            if (dst_cur >= dst_end) return 0;
+            *dst_cur++ = src[pos++];
+        }
+        flag_bit++;
+
+        length = lznt1_find_match(&state, pos, &displacement);
+        lznt1_insert(&state, pos + 1);
+    }
+
+    return dst_cur - dst;
+}
+
 static NTSTATUS
 RtlpCompressBufferLZNT1(UCHAR *src, ULONG src_size, UCHAR *dst, ULONG dst_size,
-                        ULONG chunk_size, ULONG *final_size, UCHAR *workspace)
+                        ULONG chunk_size, ULONG *final_size, USHORT engine, UCHAR *workspace)
 {
         UCHAR *src_cur = src, *src_end = src + src_size;
         UCHAR *dst_cur = dst, *dst_end = dst + dst_size;
-        ULONG block_size;
+        ULONG block_size, compressed_size, available;
+
+        if (engine != COMPRESSION_ENGINE_STANDARD && engine != COMPRESSION_ENGINE_MAXIMUM)
+            return STATUS_NOT_SUPPORTED;
+
+        if (!workspace)
+            return STATUS_ACCESS_VIOLATION;
 
         while (src_cur < src_end)
         {
             /* determine size of current chunk */
-            block_size = min(0x1000, src_end - src_cur);
-            if (dst_cur + sizeof(WORD) + block_size > dst_end)
+            block_size = min(LZNT1_CHUNK_SIZE, src_end - src_cur);
+            if (dst_cur + sizeof(WORD) >= dst_end)
                 return STATUS_BUFFER_TOO_SMALL;
 
-            /* write (uncompressed) chunk header */
-            *(WORD *)dst_cur = 0x3000 | (block_size - 1);
-            dst_cur += sizeof(WORD);
+            /* only keep the compressed chunk if it is smaller than the raw data */
+            available = min(block_size - 1, (ULONG)(dst_end - dst_cur) - sizeof(WORD));
+            compressed_size = lznt1_compress_chunk(src_cur, block_size, dst_cur + sizeof(WORD),
+                                                   available, engine, (PLZNT1_WORKSPACE)workspace);
+            if (compressed_size)
+            {
+                /* write (compressed) chunk header */
+                *(WORD *)dst_cur = 0xB000 | (compressed_size - 1);
+                dst_cur += sizeof(WORD) + compressed_size;
+            }
+            else
+            {
+                if (dst_cur + sizeof(WORD) + block_size > dst_end)
+                    return STATUS_BUFFER_TOO_SMALL;
 
-            /* write chunk content */
-            memcpy(dst_cur, src_cur, block_size);
-            dst_cur += block_size;
+                /* write (uncompressed) chunk header */
+                *(WORD *)dst_cur = 0x3000 | (block_size - 1);
+                dst_cur += sizeof(WORD);
+
+                /* write chunk content */
+                memcpy(dst_cur, src_cur, block_size);
+                dst_cur += block_size;
+            }
             src_cur += block_size;
         }
 
@@ -248,21 +460,105 @@ RtlpCompressBufferLZNT1(UCHAR *src, ULONG src_size, UCHAR *dst, ULONG dst_size,
 }
 
 
+/* LZNT1 chunk which expands to LZNT1_CHUNK_SIZE zero bytes: one literal and one long match */
+static const UCHAR lznt1_zero_chunk[] = { 0x03, 0xB0, 0x02, 0x00, 0xFC, 0x0F };
+
+static NTSTATUS
+RtlpDescribeChunkLZNT1(IN OUT PUCHAR *CompressedBuffer,
+                       IN PUCHAR EndOfCompressedBufferPlus1,
+                       OUT PUCHAR *ChunkBuffer,
+                       OUT PULONG ChunkSize)
+{
+    PUCHAR Buffer = *CompressedBuffer;
+    ULONG Size;
+    WORD Header;
+
+    *ChunkBuffer = Buffer;
+    *ChunkSize = 0;
+
+    /* a missing or zero header terminates the chunk stream */
+    if (Buffer + sizeof(WORD) > EndOfCompressedBufferPlus1)
+        return STATUS_NO_MORE_ENTRIES;
+
+    Header = *(WORD *)Buffer;
+    if (!Header)
+        return STATUS_NO_MORE_ENTRIES;
+
+    Size = (Header & 0xFFF) + 1 + sizeof(WORD);
+    if (Buffer + Size > EndOfCompressedBufferPlus1)
+        return STATUS_BAD_COMPRESSION_BUFFER;
+
+    if (!(Header & 0x8000))
+    {
+        /* uncompressed chunk, describe the raw data */
+        *ChunkBuffer = Buffer + sizeof(WORD);
+        *ChunkSize = Size - sizeof(WORD);
+    }
+    else if (Size != sizeof(lznt1_zero_chunk) ||
+             RtlCompareMemory(Buffer, lznt1_zero_chunk, Size) != Size)
+    {
+        /* compressed chunk, describe it including its header */
+        *ChunkSize = Size;
+    }
+
+    *CompressedBuffer = Buffer + Size;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+RtlpReserveChunkLZNT1(IN OUT PUCHAR *CompressedBuffer,
+                      IN PUCHAR EndOfCompressedBufferPlus1,
+                      OUT PUCHAR *ChunkBuffer,
+                      IN ULONG ChunkSize)
+{
+    PUCHAR Buffer = *CompressedBuffer;
+    ULONG Size;
+
+    if (ChunkSize == 0)
+        Size = sizeof(lznt1_zero_chunk);
+    else if (ChunkSize == LZNT1_CHUNK_SIZE)
+        Size = LZNT1_CHUNK_SIZE + sizeof(WORD);
+    else if (ChunkSize > sizeof(WORD) && ChunkSize <= LZNT1_CHUNK_SIZE + sizeof(WORD))
+        Size = ChunkSize;
+    else
+        return STATUS_INVALID_PARAMETER;
+
+    if (Buffer + Size > EndOfCompressedBufferPlus1)
+        return STATUS_BUFFER_TOO_SMALL;
+
+    if (ChunkSize == 0)
+    {
+        /* all-zero chunks are stored as their canonical compressed form */
+        RtlCopyMemory(Buffer, lznt1_zero_chunk, Size);
+        *ChunkBuffer = Buffer;
+    }
+    else if (ChunkSize == LZNT1_CHUNK_SIZE)
+    {
+        /* the caller copies the raw data behind an uncompressed chunk header */
+        *(WORD *)Buffer = 0x3000 | (LZNT1_CHUNK_SIZE - 1);
+        *ChunkBuffer = Buffer + sizeof(WORD);
+    }
+    else
+    {
+        /* the caller copies a complete compressed chunk including its header */
+        *ChunkBuffer = Buffer;
+    }
+
+    *CompressedBuffer = Buffer + Size;
+    return STATUS_SUCCESS;
+}
+
+
 static NTSTATUS
 RtlpWorkSpaceSizeLZNT1(USHORT Engine,
                        PULONG BufferAndWorkSpaceSize,
                        PULONG FragmentWorkSpaceSize)
 {
-   if (Engine == COMPRESSION_ENGINE_STANDARD)
-   {
-      *BufferAndWorkSpaceSize = 0x8010;
-      *FragmentWorkSpaceSize = 0x1000;
-      return(STATUS_SUCCESS);
-   }
-   else if (Engine == COMPRESSION_ENGINE_MAXIMUM)
+   if (Engine == COMPRESSION_ENGINE_STANDARD ||
+       Engine == COMPRESSION_ENGINE_MAXIMUM)
    {
-      *BufferAndWorkSpaceSize = 0x10;
-      *FragmentWorkSpaceSize = 0x1000;
+      *BufferAndWorkSpaceSize = LZNT1_WORKSPACE_SIZE;
+      *FragmentWorkSpaceSize = LZNT1_CHUNK_SIZE;
       return(STATUS_SUCCESS);
    }
 
@@ -284,7 +580,7 @@ RtlCompressBuffer(IN USHORT CompressionFormatAndEngine,
                   IN PVOID WorkSpace)
 {
    USHORT Format = CompressionFormatAndEngine & COMPRESSION_FORMAT_MASK;
-   /* USHORT Engine = CompressionFormatAndEngine & COMPRESSION_ENGINE_MASK; */
+   USHORT Engine = CompressionFormatAndEngine & COMPRESSION_ENGINE_MASK;
 
    if ((Format == COMPRESSION_FORMAT_NONE) ||
          (Format == COMPRESSION_FORMAT_DEFAULT))
@@ -297,14 +593,44 @@ RtlCompressBuffer(IN USHORT CompressionFormatAndEngine,
                                      CompressedBufferSize,
                                      UncompressedChunkSize,
                                      FinalCompressedSize,
+                                     Engine,
                                      WorkSpace));
 
+   if (Format == COMPRESSION_FORMAT_XPRESS ||
+       Format == COMPRESSION_FORMAT_XPRESS_HUFF)
+      return(RtlpCompressBufferXpress(Format,
+                                      Engine,
+                                      UncompressedBuffer,
+                                      UncompressedBufferSize,
+                                      CompressedBuffer,
+                                      CompressedBufferSize,
+                                      FinalCompressedSize,
+                                      WorkSpace));
+
    return(STATUS_UNSUPPORTED_COMPRESSION);
 }
 
 
+static BOOLEAN
+RtlpIsZeroBuffer(IN PUCHAR Buffer,
+                 IN ULONG Size)
+{
+    ULONG Aligned = Size & ~(sizeof(ULONG) - 1);
+
+    if (RtlCompareMemoryUlong(Buffer, Aligned, 0) != Aligned)
+        return FALSE;
+
+    for (; Aligned < Size; Aligned++)
+    {
+        if (Buffer[Aligned])
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
 /*
- * @unimplemented
+ * @implemented
  */
 NTSTATUS NTAPI
 RtlCompressChunks(IN PUCHAR UncompressedBuffer,
@@ -315,12 +641,78 @@ RtlCompressChunks(IN PUCHAR UncompressedBuffer,
                   IN ULONG CompressedDataInfoLength,
                   IN PVOID WorkSpace)
 {
-    UNIMPLEMENTED;
-    return STATUS_NOT_IMPLEMENTED;
+    PUCHAR UncompressedEnd = UncompressedBuffer + UncompressedBufferSize;
+    PUCHAR CompressedEnd = CompressedBuffer + CompressedBufferSize;
+    ULONG ChunkSize, NumberOfChunks, Length, FinalSize, i;
+    NTSTATUS Status;
+
+    if (CompressedDataInfo->ChunkShift < 9 || CompressedDataInfo->ChunkShift > 16)
+        return STATUS_INVALID_PARAMETER;
+
+    ChunkSize = 1 << CompressedDataInfo->ChunkShift;
+    NumberOfChunks = (UncompressedBufferSize + ChunkSize - 1) >> CompressedDataInfo->ChunkShift;
+    if (NumberOfChunks > MAXUSHORT)
+        return STATUS_INVALID_PARAMETER;
+
+    if (CompressedDataInfoLength < FIELD_OFFSET(COMPRESSED_DATA_INFO, CompressedChunkSizes) +
+                                   NumberOfChunks * sizeof(ULONG))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    for (i = 0; i < NumberOfChunks; i++)
+    {
+        Length = min(ChunkSize, (ULONG)(UncompressedEnd - UncompressedBuffer));
+
+        if (RtlpIsZeroBuffer(UncompressedBuffer, Length))
+        {
+            /* all-zero chunks take no space at all */
+            FinalSize = 0;
+        }
+        else
+        {
+            Status = RtlCompressBuffer(CompressedDataInfo->CompressionFormatAndEngine,
+                                       UncompressedBuffer,
+                                       Length,
+                                       CompressedBuffer,
+                                       min(ChunkSize - 1, (ULONG)(CompressedEnd - CompressedBuffer)),
+                                       ChunkSize,
+                                       &FinalSize,
+                                       WorkSpace);
+            if (Status == STATUS_BUFFER_TOO_SMALL)
+            {
+                /* the chunk does not shrink, store it as raw data */
+                if (CompressedBuffer + Length > CompressedEnd)
+                    return STATUS_BUFFER_TOO_SMALL;
+
+                RtlCopyMemory(CompressedBuffer, UncompressedBuffer, Length);
+                FinalSize = ChunkSize;
+                CompressedBuffer += Length;
+            }
+            else if (!NT_SUCCESS(Status))
+            {
+                return Status;
+            }
+            else if (FinalSize >= Length)
+            {
+                RtlCopyMemory(CompressedBuffer, UncompressedBuffer, Length);
+                FinalSize = ChunkSize;
+                CompressedBuffer += Length;
+            }
+            else
+            {
+                CompressedBuffer += FinalSize;
+            }
+        }
+
+        CompressedDataInfo->CompressedChunkSizes[i] = FinalSize;
+        UncompressedBuffer += Length;
+    }
+
+    CompressedDataInfo->NumberOfChunks = (USHORT)NumberOfChunks;
+    return STATUS_SUCCESS;
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 NTSTATUS NTAPI
 RtlDecompressChunks(OUT PUCHAR UncompressedBuffer,
@@ -331,8 +723,103 @@ RtlDecompressChunks(OUT PUCHAR UncompressedBuffer,
                     IN ULONG CompressedTailSize,
                     IN PCOMPRESSED_DATA_INFO CompressedDataInfo)
 {
-    UNIMPLEMENTED;
-    return STATUS_NOT_IMPLEMENTED;
+    PUCHAR UncompressedEnd = UncompressedBuffer + UncompressedBufferSize;
+    PUCHAR CompressedEnd = CompressedBuffer + CompressedBufferSize;
+    ULONG ChunkSize, Length, Size, Available, FinalSize, i;
+    PUCHAR Source, Joined;
+    BOOLEAN Raw;
+    NTSTATUS Status;
+
+    if (CompressedDataInfo->ChunkShift < 9 || CompressedDataInfo->ChunkShift > 16)
+        return STATUS_INVALID_PARAMETER;
+
+    ChunkSize = 1 << CompressedDataInfo->ChunkShift;
+
+    for (i = 0;
+         i < CompressedDataInfo->NumberOfChunks && UncompressedBuffer < UncompressedEnd;
+         i++)
+    {
+        Length = min(ChunkSize, (ULONG)(UncompressedEnd - UncompressedBuffer));
+        Size = CompressedDataInfo->CompressedChunkSizes[i];
+        if (Size > ChunkSize)
+            return STATUS_BAD_COMPRESSION_BUFFER;
+
+        /* raw chunks only carry the bytes that are actually in use */
+        Raw = (Size == ChunkSize);
+        if (Raw)
+            Size = Length;
+
+        /* switch to the tail once the first buffer is used up */
+        Available = (ULONG)(CompressedEnd - CompressedBuffer);
+        if (!Available && CompressedTail)
+        {
+            CompressedBuffer = CompressedTail;
+            CompressedEnd = CompressedTail + CompressedTailSize;
+            CompressedTail = NULL;
+            Available = CompressedTailSize;
+        }
+
+        Joined = NULL;
+        Source = CompressedBuffer;
+        if (Size > Available)
+        {
+            /* the chunk straddles the end of the first buffer */
+            if (!CompressedTail || Size - Available > CompressedTailSize)
+                return STATUS_BAD_COMPRESSION_BUFFER;
+
+            Joined = RtlpAllocateMemory(Size, TAG_COMPRESS);
+            if (!Joined)
+                return STATUS_INSUFFICIENT_RESOURCES;
+
+            RtlCopyMemory(Joined, CompressedBuffer, Available);
+            RtlCopyMemory(Joined + Available, CompressedTail, Size - Available);
+            Source = Joined;
+
+            CompressedBuffer = CompressedTail + (Size - Available);
+            CompressedEnd = CompressedTail + CompressedTailSize;
+            CompressedTail = NULL;
+        }
+        else
+        {
+            CompressedBuffer += Size;
+        }
+
+        if (Size == 0)
+        {
+            RtlZeroMemory(UncompressedBuffer, Length);
+        }
+        else if (Raw)
+        {
+            RtlCopyMemory(UncompressedBuffer, Source, Length);
+        }
+        else
+        {
+            Status = RtlDecompressBuffer(CompressedDataInfo->CompressionFormatAndEngine & COMPRESSION_FORMAT_MASK,
+                                         UncompressedBuffer,
+                                         Length,
+                                         Source,
+                                         Size,
+                                         &FinalSize);
+            if (!NT_SUCCESS(Status))
+            {
+                if (Joined) RtlpFreeMemory(Joined, TAG_COMPRESS);
+                return Status;
+            }
+
+            /* short chunks are implicitly zero-padded */
+            if (FinalSize < Length)
+                RtlZeroMemory(UncompressedBuffer + FinalSize, Length - FinalSize);
+        }
+
+        if (Joined) RtlpFreeMemory(Joined, TAG_COMPRESS);
+        UncompressedBuffer += Length;
+    }
+
+    /* chunks missing from the table are all zero */
+    if (UncompressedBuffer < UncompressedEnd)
+        RtlZeroMemory(UncompressedBuffer, UncompressedEnd - UncompressedBuffer);
+
+    return STATUS_SUCCESS;
 }
 
 /*
@@ -357,6 +844,15 @@ RtlDecompressFragment(IN USHORT format,
             return lznt1_decompress(uncompressed, uncompressed_size, compressed,
                                     compressed_size, offset, final_size, workspace);
 
+        case COMPRESSION_FORMAT_XPRESS:
+        case COMPRESSION_FORMAT_XPRESS_HUFF:
+            /* these formats are not chunked, there is no way to start in the middle */
+            if (offset)
+                return STATUS_NOT_SUPPORTED;
+            return RtlpDecompressBufferXpress(format & COMPRESSION_FORMAT_MASK, uncompressed,
+                                              uncompressed_size, compressed, compressed_size,
+                                              final_size, workspace);
+
         case COMPRESSION_FORMAT_NONE:
         case COMPRESSION_FORMAT_DEFAULT:
             return STATUS_INVALID_PARAMETER;
@@ -383,7 +879,7 @@ RtlDecompressBuffer(IN USHORT CompressionFormat,
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 NTSTATUS NTAPI
 RtlDescribeChunk(IN USHORT CompressionFormat,
@@ -392,8 +888,19 @@ RtlDescribeChunk(IN USHORT CompressionFormat,
                  OUT PUCHAR *ChunkBuffer,
                  OUT PULONG ChunkSize)
 {
-    UNIMPLEMENTED;
-    return STATUS_NOT_IMPLEMENTED;
+    switch (CompressionFormat & COMPRESSION_FORMAT_MASK)
+    {
+        case COMPRESSION_FORMAT_LZNT1:
+            return RtlpDescribeChunkLZNT1(CompressedBuffer, EndOfCompressedBufferPlus1,
+                                          ChunkBuffer, ChunkSize);
+
+        case COMPRESSION_FORMAT_NONE:
+        case COMPRESSION_FORMAT_DEFAULT:
+            return STATUS_INVALID_PARAMETER;
+
+        default:
+            return STATUS_UNSUPPORTED_COMPRESSION;
+    }
 }
 
 
@@ -417,13 +924,20 @@ RtlGetCompressionWorkSpaceSize(IN USHORT CompressionFormatAndEngine,
                                     CompressBufferAndWorkSpaceSize,
                                     CompressFragmentWorkSpaceSize));
 
+   if (Format == COMPRESSION_FORMAT_XPRESS ||
+       Format == COMPRESSION_FORMAT_XPRESS_HUFF)
+      return(RtlpWorkSpaceSizeXpress(Format,
+                                     Engine,
+                                     CompressBufferAndWorkSpaceSize,
+                                     CompressFragmentWorkSpaceSize));
+
    return(STATUS_UNSUPPORTED_COMPRESSION);
 }
 
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 NTSTATUS NTAPI
 RtlReserveChunk(IN USHORT CompressionFormat,
@@ -432,8 +946,19 @@ RtlReserveChunk(IN USHORT CompressionFormat,
                 OUT PUCHAR *ChunkBuffer,
                 IN ULONG ChunkSize)
 {
-    UNIMPLEMENTED;
-    return STATUS_NOT_IMPLEMENTED;
+    switch (CompressionFormat & COMPRESSION_FORMAT_MASK)
+    {
+        case COMPRESSION_FORMAT_LZNT1:
+            return RtlpReserveChunkLZNT1(CompressedBuffer, EndOfCompressedBufferPlus1,
+                                         ChunkBuffer, ChunkSize);
+
+        case COMPRESSION_FORMAT_NONE:
+        case COMPRESSION_FORMAT_DEFAULT:
+            return STATUS_INVALID_PARAMETER;
+
+        default:
+            return STATUS_UNSUPPORTED_COMPRESSION;
+    }
 }
 
 /* EOF */
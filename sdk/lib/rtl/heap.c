@@ -433,6 +433,107 @@ RtlpGetSizeOfBigBlock(PHEAP_ENTRY HeapEntry)
     return VirtualEntry->CommitSize - HeapEntry->Size;
 }
 
+static
+SIZE_T NTAPI
+RtlpGetBlockUnits(PHEAP_ENTRY HeapEntry)
+{
+    PHEAP_VIRTUAL_ALLOC_ENTRY VirtualEntry;
+
+    /* The size field of a big block holds its unused bytes, use the commit size instead */
+    if (HeapEntry->Flags & HEAP_ENTRY_VIRTUAL_ALLOC)
+    {
+        VirtualEntry = CONTAINING_RECORD(HeapEntry, HEAP_VIRTUAL_ALLOC_ENTRY, BusyBlock);
+        return VirtualEntry->CommitSize >> HEAP_ENTRY_SHIFT;
+    }
+
+    return HeapEntry->Size;
+}
+
+static
+USHORT NTAPI
+RtlpGetTagIndex(PHEAP_ENTRY HeapEntry)
+{
+    PHEAP_ENTRY_EXTRA Extra;
+
+    /* Tags which don't fit into the entry itself live in the extra stuff */
+    if (HeapEntry->Flags & HEAP_ENTRY_EXTRA_PRESENT)
+    {
+        Extra = RtlpGetExtraStuffPointer(HeapEntry);
+        if (Extra->TagIndex & HEAP_PSEUDO_TAG_FLAG) return 0;
+        return Extra->TagIndex;
+    }
+
+    return HeapEntry->SmallTagIndex;
+}
+
+static
+VOID NTAPI
+RtlpUpdateTagEntry(PHEAP Heap,
+                   USHORT TagIndex,
+                   SIZE_T OldSize,
+                   SIZE_T NewSize)
+{
+    PHEAP_TAG_ENTRY TagEntry;
+
+    /* Untagged blocks and tags which were never created aren't accounted */
+    if (!TagIndex ||
+        !Heap->TagEntries ||
+        TagIndex >= Heap->NextAvailableTagIndex)
+    {
+        return;
+    }
+
+    TagEntry = &Heap->TagEntries[TagIndex];
+
+    /* Counters are updated outside of the heap lock on the allocation paths */
+    if (!OldSize)
+        InterlockedIncrement((PLONG)&TagEntry->Allocs);
+    else if (!NewSize)
+        InterlockedIncrement((PLONG)&TagEntry->Frees);
+
+    InterlockedExchangeAdd((PLONG)&TagEntry->Size, (LONG)(NewSize - OldSize));
+}
+
+static
+VOID NTAPI
+RtlpSetTagIndex(PHEAP Heap,
+                ULONG Flags,
+                PHEAP_ENTRY HeapEntry)
+{
+    USHORT TagIndex = (USHORT)((Flags & HEAP_TAG_MASK) >> HEAP_TAG_SHIFT);
+
+    /* Ignore tags this heap doesn't know about */
+    if (!Heap->TagEntries || TagIndex >= Heap->NextAvailableTagIndex)
+        return;
+
+    /* Tags above 0xFF force extra stuff to be present, so a small tag always fits */
+    if (HeapEntry->Flags & HEAP_ENTRY_EXTRA_PRESENT)
+        RtlpGetExtraStuffPointer(HeapEntry)->TagIndex = TagIndex;
+    else
+        HeapEntry->SmallTagIndex = (UCHAR)TagIndex;
+
+    RtlpUpdateTagEntry(Heap, TagIndex, 0, RtlpGetBlockUnits(HeapEntry));
+}
+
+static
+VOID NTAPI
+RtlpDestroyTags(PHEAP Heap)
+{
+    PVOID BaseAddress = Heap->TagEntries;
+    SIZE_T Size = 0;
+
+    if (!BaseAddress) return;
+
+    Heap->TagEntries = NULL;
+    Heap->NextAvailableTagIndex = 0;
+    Heap->MaximumTagIndex = 0;
+
+    ZwFreeVirtualMemory(NtCurrentProcess(),
+                        &BaseAddress,
+                        &Size,
+                        MEM_RELEASE);
+}
+
 PHEAP_UCR_DESCRIPTOR NTAPI
 RtlpCreateUnCommittedRange(PHEAP_SEGMENT Segment)
 {
@@ -1577,12 +1678,12 @@ RtlDestroyHeap(HANDLE HeapPtr) /* [in] Handle of heap */
                             MEM_RELEASE);
     }
 
-    /* Delete tags and remove heap from the process heaps list in user mode */
+    /* Delete tags */
+    RtlpDestroyTags(Heap);
+
+    /* Remove heap from the process heaps list in user mode */
     if (RtlpGetMode() == UserMode)
-    {
-        // FIXME DestroyTags
         RtlpRemoveHeapFromProcessList(Heap);
-    }
 
     /* Delete the heap lock */
     if (!(Heap->Flags & HEAP_NO_SERIALIZE))
@@ -1614,6 +1715,9 @@ RtlDestroyHeap(HANDLE HeapPtr) /* [in] Handle of heap */
                             MEM_RELEASE);
     }
 
+    /* Release the front end, its subsegments go away with the segments */
+    if (Heap->FrontEndHeap) RtlpLfhDestroy(Heap);
+
     /* Go through segments and destroy them */
     for (i = HEAP_SEGMENTS - 1; i >= 0; i--)
     {
@@ -1823,10 +1927,12 @@ RtlpAllocateNonDedicated(PHEAP Heap,
                     {
                         Extra = RtlpGetExtraStuffPointer(InUseEntry);
                         RtlZeroMemory(Extra, sizeof(HEAP_ENTRY_EXTRA));
-
-                        // TODO: Tagging
                     }
 
+                    /* Charge the block to its tag */
+                    if (Flags & HEAP_TAG_MASK)
+                        RtlpSetTagIndex(Heap, Flags, InUseEntry);
+
                     /* Return pointer to the */
                     return InUseEntry + 1;
                 }
@@ -1872,10 +1978,12 @@ RtlpAllocateNonDedicated(PHEAP Heap,
         {
             Extra = RtlpGetExtraStuffPointer(InUseEntry);
             RtlZeroMemory(Extra, sizeof(HEAP_ENTRY_EXTRA));
-
-            // TODO: Tagging
         }
 
+        /* Charge the block to its tag */
+        if (Flags & HEAP_TAG_MASK)
+            RtlpSetTagIndex(Heap, Flags, InUseEntry);
+
         /* Return pointer to the */
         return InUseEntry + 1;
     }
@@ -1928,6 +2036,7 @@ RtlAllocateHeap(IN PVOID HeapPtr,
     BOOLEAN HeapLocked = FALSE;
     PHEAP_VIRTUAL_ALLOC_ENTRY VirtualBlock = NULL;
     PHEAP_ENTRY_EXTRA Extra;
+    PVOID FrontEndBlock;
     NTSTATUS Status;
 
     /* Force flags */
@@ -1977,6 +2086,13 @@ RtlAllocateHeap(IN PVOID HeapPtr,
 
     Index = AllocationSize >> HEAP_ENTRY_SHIFT;
 
+    /* Small untagged blocks without extra stuff may be served by the LFH without taking the heap lock */
+    if (Heap->FrontEndHeap && !(EntryFlags & HEAP_ENTRY_EXTRA_PRESENT) && !(Flags & HEAP_TAG_MASK))
+    {
+        FrontEndBlock = RtlpLfhAllocate(Heap, Flags, Size, AllocationSize, EntryFlags);
+        if (FrontEndBlock) return FrontEndBlock;
+    }
+
     /* Acquire the lock if necessary */
     if (!(Flags & HEAP_NO_SERIALIZE))
     {
@@ -2076,10 +2192,12 @@ RtlAllocateHeap(IN PVOID HeapPtr,
         {
             Extra = RtlpGetExtraStuffPointer(InUseEntry);
             RtlZeroMemory(Extra, sizeof(HEAP_ENTRY_EXTRA));
-
-            // TODO: Tagging
         }
 
+        /* Charge the block to its tag */
+        if (Flags & HEAP_TAG_MASK)
+            RtlpSetTagIndex(Heap, Flags, InUseEntry);
+
         /* User data starts right after the entry's header */
         return InUseEntry + 1;
     }
@@ -2116,6 +2234,10 @@ RtlAllocateHeap(IN PVOID HeapPtr,
         VirtualBlock->CommitSize = AllocationSize;
         VirtualBlock->ReserveSize = AllocationSize;
 
+        /* Charge the block to its tag */
+        if (Flags & HEAP_TAG_MASK)
+            RtlpSetTagIndex(Heap, Flags, &VirtualBlock->BusyBlock);
+
         /* Insert it into the list of virtual allocations */
         InsertTailList(&Heap->VirtualAllocdBlocks, &VirtualBlock->Entry);
 
@@ -2180,6 +2302,10 @@ BOOLEAN NTAPI RtlFreeHeap(
     if (RtlpHeapIsSpecial(Flags))
         return RtlDebugFreeHeap(Heap, Flags, Ptr);
 
+    /* LFH blocks are returned to their subsegment without taking the heap lock */
+    if (Heap->FrontEndHeap && RtlpIsLfhEntry((PHEAP_ENTRY)Ptr - 1))
+        return RtlpLfhFree(Heap, (PHEAP_ENTRY)Ptr - 1);
+
     /* Lock if necessary */
     if (!(Flags & HEAP_NO_SERIALIZE))
     {
@@ -2212,7 +2338,9 @@ BOOLEAN NTAPI RtlFreeHeap(
         /* Remove it from the list */
         RemoveEntryList(&VirtualEntry->Entry);
 
-        // TODO: Tagging
+        /* Release it from its tag */
+        if (Heap->TagEntries)
+            RtlpUpdateTagEntry(Heap, RtlpGetTagIndex(HeapEntry), RtlpGetBlockUnits(HeapEntry), 0);
 
         BlockSize = 0;
         Status = ZwFreeVirtualMemory(NtCurrentProcess(),
@@ -2232,7 +2360,12 @@ BOOLEAN NTAPI RtlFreeHeap(
         /* Normal allocation */
         BlockSize = HeapEntry->Size;
 
-        // TODO: Tagging
+        /* Release it from its tag before coalescing destroys the header */
+        if (Heap->TagEntries)
+        {
+            TagIndex = RtlpGetTagIndex(HeapEntry);
+            RtlpUpdateTagEntry(Heap, TagIndex, BlockSize, 0);
+        }
 
         /* Coalesce in kernel mode, and in usermode if it's not disabled */
         if (RtlpGetMode() == KernelMode ||
@@ -2268,14 +2401,6 @@ BOOLEAN NTAPI RtlFreeHeap(
                 /* Increase the free size */
                 Heap->TotalFreeSize += BlockSize;
             }
-
-
-            if (RtlpGetMode() == UserMode &&
-                TagIndex != 0)
-            {
-                // FIXME: Tagging
-                UNIMPLEMENTED;
-            }
         }
         else
         {
@@ -2373,6 +2498,10 @@ RtlpGrowBlockInPlace (IN PHEAP Heap,
         FreeSize = 0;
     }
 
+    /* Move the tag's byte count along with the block */
+    if (Heap->TagEntries)
+        RtlpUpdateTagEntry(Heap, RtlpGetTagIndex(InUseEntry), InUseEntry->Size, Index);
+
     /* Process extra stuff */
     if (EntryFlags & HEAP_ENTRY_EXTRA_PRESENT)
     {
@@ -2382,8 +2511,6 @@ RtlpGrowBlockInPlace (IN PHEAP Heap,
 
         /* Copy contents */
         *NewExtra = *OldExtra;
-
-        // FIXME Tagging
     }
 
     /* Update sizes */
@@ -2590,6 +2717,10 @@ RtlReAllocateHeap(HANDLE HeapPtr,
         return NULL;
     }
 
+    /* LFH blocks are resized by the front end */
+    if (Heap->FrontEndHeap && RtlpIsLfhEntry((PHEAP_ENTRY)Ptr - 1))
+        return RtlpLfhReAllocate(Heap, Flags, Ptr, Size);
+
     /* Calculate allocation size and index */
     if (Size)
         AllocationSize = Size;
@@ -2660,6 +2791,10 @@ RtlReAllocateHeap(HANDLE HeapPtr,
             AllocationSize += sizeof(HEAP_ENTRY);
         }
 
+        /* Move the tag's byte count along with the block */
+        if (Heap->TagEntries && Index != OldIndex)
+            RtlpUpdateTagEntry(Heap, RtlpGetTagIndex(InUseEntry), OldIndex, Index);
+
         /* Calculate new size */
         if (InUseEntry->Flags & HEAP_ENTRY_VIRTUAL_ALLOC)
         {
@@ -2674,14 +2809,11 @@ RtlReAllocateHeap(HANDLE HeapPtr,
             NewExtra = (PHEAP_ENTRY_EXTRA)(InUseEntry + Index - 1);
             *NewExtra = *OldExtra;
 
-            // FIXME Tagging, TagIndex
-
             /* Update unused bytes count */
             InUseEntry->UnusedBytes = (UCHAR)(AllocationSize - Size);
         }
         else
         {
-            // FIXME Tagging, SmallTagIndex
             InUseEntry->UnusedBytes = (UCHAR)(AllocationSize - Size);
         }
 
@@ -2736,8 +2868,6 @@ RtlReAllocateHeap(HANDLE HeapPtr,
                 /* This is a virtual block allocation */
                 VirtualAllocBlock = CONTAINING_RECORD(InUseEntry, HEAP_VIRTUAL_ALLOC_ENTRY, BusyBlock);
 
-                // FIXME Tagging!
-
                 DecommitBase = (PCHAR)VirtualAllocBlock + AllocationSize;
                 DecommitSize = (OldIndex << HEAP_ENTRY_SHIFT) - AllocationSize;
 
@@ -2953,14 +3083,61 @@ RtlReAllocateHeap(HANDLE HeapPtr,
 /***********************************************************************
  *           RtlCompactHeap
  *
- * @unimplemented
+ * Free blocks are already coalesced when they are freed, so this only
+ * reports the size of the largest committed free block, which is the
+ * last entry of the sorted non-dedicated list or the highest dedicated
+ * list in use.
+ *
+ * @implemented
  */
 ULONG NTAPI
-RtlCompactHeap(HANDLE Heap,
-		ULONG Flags)
+RtlCompactHeap(HANDLE HeapPtr,
+               ULONG Flags)
 {
-   UNIMPLEMENTED;
-   return 0;
+    PHEAP Heap = (PHEAP)HeapPtr;
+    PHEAP_FREE_ENTRY FreeEntry;
+    SIZE_T LargestSize = 0;
+    BOOLEAN HeapLocked = FALSE;
+    ULONG Index;
+
+    if (Heap->ForceFlags & HEAP_FLAG_PAGE_ALLOCS)
+        return 0;
+
+    /* Force flags */
+    Flags |= Heap->ForceFlags;
+
+    /* Lock if it's lockable */
+    if (!(Flags & HEAP_NO_SERIALIZE))
+    {
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        HeapLocked = TRUE;
+    }
+
+    if (!IsListEmpty(&Heap->FreeLists[0]))
+    {
+        FreeEntry = CONTAINING_RECORD(Heap->FreeLists[0].Blink, HEAP_FREE_ENTRY, FreeList);
+        LargestSize = FreeEntry->Size;
+    }
+    else
+    {
+        for (Index = HEAP_FREELISTS - 1; Index > 0; Index--)
+        {
+            if (Heap->u.FreeListsInUseBytes[Index / 8] & (1 << (Index % 8)))
+            {
+                LargestSize = Index;
+                break;
+            }
+        }
+    }
+
+    /* Release the heap lock if it was acquired */
+    if (HeapLocked)
+        RtlLeaveHeapLock(Heap->LockVariable);
+
+    if (!LargestSize)
+        return 0;
+
+    return (ULONG)((LargestSize << HEAP_ENTRY_SHIFT) - sizeof(HEAP_ENTRY));
 }
 
 
@@ -3154,6 +3331,10 @@ RtlpValidateHeapEntry(
     if ((ULONG_PTR)HeapEntry & (HEAP_ENTRY_SIZE - 1)) goto invalid_entry;
     if (!(HeapEntry->Flags & HEAP_ENTRY_BUSY)) goto invalid_entry;
 
+    /* LFH blocks live inside a busy back end block, let the front end check them */
+    if (Heap->FrontEndHeap && RtlpIsLfhEntry(HeapEntry))
+        return RtlpLfhValidateEntry(Heap, HeapEntry);
+
     BigAllocation = HeapEntry->Flags & HEAP_ENTRY_VIRTUAL_ALLOC;
     Segment = Heap->Segments[HeapEntry->SegmentOffset];
 
@@ -3832,19 +4013,89 @@ RtlGetUserInfoHeap(IN PVOID HeapHandle,
 }
 
 /*
- * @unimplemented
+ * Reports committed, reserved and in-use bytes of the heap. Only the
+ * segment headers and the big block list are visited, so this is cheap
+ * enough to sample a live heap. Blocks cached by the LFH front end count
+ * as in use.
+ *
+ * @implemented
  */
 NTSTATUS
 NTAPI
-RtlUsageHeap(IN HANDLE Heap,
+RtlUsageHeap(IN HANDLE HeapHandle,
              IN ULONG Flags,
              OUT PRTL_HEAP_USAGE Usage)
 {
-    /* TODO */
-    UNIMPLEMENTED;
-    return STATUS_NOT_IMPLEMENTED;
+    PHEAP Heap = (PHEAP)HeapHandle;
+    PHEAP_SEGMENT Segment;
+    PHEAP_VIRTUAL_ALLOC_ENTRY VirtualEntry;
+    PLIST_ENTRY Current;
+    BOOLEAN HeapLocked = FALSE;
+    ULONG Index;
+
+    if (Usage->Length != sizeof(RTL_HEAP_USAGE))
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    /* The page heap keeps its own books */
+    if (Heap->ForceFlags & HEAP_FLAG_PAGE_ALLOCS)
+    {
+        DPRINT1("HEAP: RtlUsageHeap is not supported for the page heap\n");
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    /* Force flags */
+    Flags |= Heap->ForceFlags;
+
+    /* Lock if it's lockable */
+    if (!(Flags & HEAP_NO_SERIALIZE))
+    {
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        HeapLocked = TRUE;
+    }
+
+    Usage->BytesCommitted = 0;
+    Usage->BytesReserved = 0;
+
+    for (Index = 0; Index < HEAP_SEGMENTS; Index++)
+    {
+        Segment = Heap->Segments[Index];
+        if (!Segment) continue;
+
+        Usage->BytesReserved += (SIZE_T)Segment->NumberOfPages << PAGE_SHIFT;
+        Usage->BytesCommitted += (SIZE_T)(Segment->NumberOfPages - Segment->NumberOfUnCommittedPages) << PAGE_SHIFT;
+    }
+
+    /* Whatever is committed in the segments and not on a free list is in use, headers included */
+    Usage->BytesAllocated = Usage->BytesCommitted - (Heap->TotalFreeSize << HEAP_ENTRY_SHIFT);
+
+    /* Big blocks are entirely in use */
+    for (Current = Heap->VirtualAllocdBlocks.Flink;
+         Current != &Heap->VirtualAllocdBlocks;
+         Current = Current->Flink)
+    {
+        VirtualEntry = CONTAINING_RECORD(Current, HEAP_VIRTUAL_ALLOC_ENTRY, Entry);
+
+        Usage->BytesAllocated += VirtualEntry->CommitSize;
+        Usage->BytesCommitted += VirtualEntry->CommitSize;
+        Usage->BytesReserved += VirtualEntry->ReserveSize;
+    }
+
+    /* No reservation ceiling is tracked, and per-block usage lists are not supported */
+    Usage->BytesReservedMaximum = Usage->BytesReserved;
+    Usage->Entries = NULL;
+    Usage->AddedEntries = NULL;
+    Usage->RemovedEntries = NULL;
+
+    /* Release the heap lock if it was acquired */
+    if (HeapLocked)
+        RtlLeaveHeapLock(Heap->LockVariable);
+
+    return STATUS_SUCCESS;
 }
 
+/*
+ * @implemented
+ */
 PWSTR
 NTAPI
 RtlQueryTagHeap(IN PVOID HeapHandle,
@@ -3853,98 +4104,572 @@ RtlQueryTagHeap(IN PVOID HeapHandle,
                 IN BOOLEAN ResetCounters,
                 OUT PRTL_HEAP_TAG_INFO HeapTagInfo)
 {
-    /* TODO */
-    UNIMPLEMENTED;
-    return NULL;
-}
-
-ULONG
-NTAPI
-RtlExtendHeap(IN HANDLE Heap,
-              IN ULONG Flags,
-              IN PVOID P,
-              IN SIZE_T Size)
-{
-    /* TODO */
-    UNIMPLEMENTED;
-    return 0;
-}
+    PHEAP Heap = (PHEAP)HeapHandle;
+    PHEAP_TAG_ENTRY TagEntry;
+    PWSTR TagName = NULL;
+    BOOLEAN HeapLocked = FALSE;
 
-ULONG
-NTAPI
-RtlCreateTagHeap(IN HANDLE HeapHandle,
-                 IN ULONG Flags,
-                 IN PWSTR TagName,
-                 IN PWSTR TagSubName)
-{
-    /* TODO */
-    UNIMPLEMENTED;
-    return 0;
-}
+    if (!Heap || (Heap->ForceFlags & HEAP_FLAG_PAGE_ALLOCS))
+        return NULL;
 
-NTSTATUS
-NTAPI
-RtlWalkHeap(IN HANDLE HeapHandle,
-            IN PVOID HeapEntry)
-{
-    UNIMPLEMENTED;
-    return STATUS_NOT_IMPLEMENTED;
-}
+    /* Force flags */
+    Flags |= Heap->ForceFlags;
 
-PVOID
-NTAPI
-RtlProtectHeap(IN PVOID HeapHandle,
-               IN BOOLEAN ReadOnly)
-{
-    UNIMPLEMENTED;
-    return NULL;
-}
+    /* Lock if it's lockable */
+    if (!(Flags & HEAP_NO_SERIALIZE))
+    {
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        HeapLocked = TRUE;
+    }
 
-NTSTATUS
-NTAPI
-RtlSetHeapInformation(IN HANDLE HeapHandle OPTIONAL,
-                      IN HEAP_INFORMATION_CLASS HeapInformationClass,
-                      IN PVOID HeapInformation,
-                      IN SIZE_T HeapInformationLength)
-{
-    /* Setting heap information is not really supported except for enabling LFH */
-    if (HeapInformationClass == HeapCompatibilityInformation)
+    if (Heap->TagEntries && TagIndex < Heap->NextAvailableTagIndex)
     {
-        /* Check buffer length */
-        if (HeapInformationLength < sizeof(ULONG))
+        TagEntry = &Heap->TagEntries[TagIndex];
+
+        if (HeapTagInfo)
         {
-            /* The provided buffer is too small */
-            return STATUS_BUFFER_TOO_SMALL;
+            HeapTagInfo->NumberOfAllocations = TagEntry->Allocs;
+            HeapTagInfo->NumberOfFrees = TagEntry->Frees;
+            HeapTagInfo->BytesAllocated = (SIZE_T)TagEntry->Size << HEAP_ENTRY_SHIFT;
         }
 
-        /* Check for a special magic value for enabling LFH */
-        if (*(PULONG)HeapInformation != 2)
+        /* The size is what the tag holds right now, so only the event counters start over */
+        if (ResetCounters)
         {
-            return STATUS_UNSUCCESSFUL;
+            InterlockedExchange((PLONG)&TagEntry->Allocs, 0);
+            InterlockedExchange((PLONG)&TagEntry->Frees, 0);
         }
 
-        DPRINT1("RtlSetHeapInformation() needs to enable LFH\n");
-        return STATUS_SUCCESS;
+        TagName = TagEntry->TagName;
     }
 
-    return STATUS_SUCCESS;
+    /* Release the heap lock if it was acquired */
+    if (HeapLocked)
+        RtlLeaveHeapLock(Heap->LockVariable);
+
+    return TagName;
 }
 
+/*
+ * Adds caller supplied memory to the heap as a new segment. The memory
+ * must be page aligned and committed or reserved, and it stays owned by
+ * the caller when the heap is destroyed.
+ *
+ * @implemented
+ */
 NTSTATUS
 NTAPI
-RtlQueryHeapInformation(HANDLE HeapHandle,
-                        HEAP_INFORMATION_CLASS HeapInformationClass,
-                        PVOID HeapInformation,
-                        SIZE_T HeapInformationLength,
-                        PSIZE_T ReturnLength OPTIONAL)
+RtlExtendHeap(IN HANDLE HeapHandle,
+              IN ULONG Flags,
+              IN PVOID P,
+              IN SIZE_T Size)
 {
     PHEAP Heap = (PHEAP)HeapHandle;
+    MEMORY_BASIC_INFORMATION MemoryInfo;
+    PVOID BaseAddress = P;
+    SIZE_T CommitSize;
+    BOOLEAN HeapLocked = FALSE;
+    UCHAR Index;
+    NTSTATUS Status;
 
-    /* Only HeapCompatibilityInformation is supported */
-    if (HeapInformationClass == HeapCompatibilityInformation)
-    {
-        /* Set result length */
-        if (ReturnLength)
+    if (Heap->ForceFlags & HEAP_FLAG_PAGE_ALLOCS)
+        return STATUS_NOT_IMPLEMENTED;
+
+    /* A segment consists of whole pages */
+    if (((ULONG_PTR)P & (PAGE_SIZE - 1)) || Size < PAGE_SIZE)
+        return STATUS_INVALID_PARAMETER;
+
+    Size = ROUND_DOWN(Size, PAGE_SIZE);
+
+    /* Find out how much of it is committed already */
+    Status = ZwQueryVirtualMemory(NtCurrentProcess(),
+                                  P,
+                                  MemoryBasicInformation,
+                                  &MemoryInfo,
+                                  sizeof(MemoryInfo),
+                                  NULL);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    if (MemoryInfo.State == MEM_FREE)
+        return STATUS_INVALID_PARAMETER;
+
+    if (MemoryInfo.State == MEM_COMMIT)
+    {
+        CommitSize = min(MemoryInfo.RegionSize, Size);
+    }
+    else
+    {
+        /* Only reserved, commit the page holding the segment header */
+        CommitSize = PAGE_SIZE;
+        Status = ZwAllocateVirtualMemory(NtCurrentProcess(),
+                                         &BaseAddress,
+                                         0,
+                                         &CommitSize,
+                                         MEM_COMMIT,
+                                         PAGE_READWRITE);
+        if (!NT_SUCCESS(Status))
+            return Status;
+    }
+
+    /* Force flags */
+    Flags |= Heap->ForceFlags;
+
+    /* Lock if it's lockable */
+    if (!(Flags & HEAP_NO_SERIALIZE))
+    {
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        HeapLocked = TRUE;
+    }
+
+    /* Find an empty segment slot */
+    for (Index = 0; Index < HEAP_SEGMENTS; Index++)
+    {
+        if (!Heap->Segments[Index]) break;
+    }
+
+    if (Index == HEAP_SEGMENTS)
+    {
+        DPRINT1("HEAP: No free segment slot to extend heap %p\n", Heap);
+        Status = STATUS_NO_MEMORY;
+    }
+    else
+    {
+        Status = RtlpInitializeHeapSegment(Heap,
+                                           (PHEAP_SEGMENT)P,
+                                           Index,
+                                           HEAP_USER_ALLOCATED,
+                                           Size,
+                                           CommitSize);
+    }
+
+    /* Release the heap lock if it was acquired */
+    if (HeapLocked)
+        RtlLeaveHeapLock(Heap->LockVariable);
+
+    return Status;
+}
+
+/*
+ * Creates a tag named TagName followed by TagSubName and returns its
+ * index shifted into heap flags, ready to be passed to RtlAllocateHeap.
+ * Index 0 stands for untagged blocks and carries the TagName of the
+ * first call.
+ *
+ * @implemented
+ */
+ULONG
+NTAPI
+RtlCreateTagHeap(IN HANDLE HeapHandle,
+                 IN ULONG Flags,
+                 IN PWSTR TagName,
+                 IN PWSTR TagSubName)
+{
+    PHEAP Heap = (PHEAP)HeapHandle;
+    PHEAP_TAG_ENTRY TagEntry;
+    PVOID BaseAddress;
+    SIZE_T Size;
+    PWSTR Name;
+    ULONG Length;
+    USHORT TagIndex = 0;
+    BOOLEAN HeapLocked = FALSE;
+    NTSTATUS Status;
+
+    if (!Heap)
+    {
+        DPRINT1("HEAP: Global heap tags are not supported\n");
+        return 0;
+    }
+
+    if (Heap->ForceFlags & HEAP_FLAG_PAGE_ALLOCS)
+        return 0;
+
+    /* Force flags */
+    Flags |= Heap->ForceFlags;
+
+    /* Lock if it's lockable */
+    if (!(Flags & HEAP_NO_SERIALIZE))
+    {
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        HeapLocked = TRUE;
+    }
+
+    /* Reserve the whole table at once, so that entries never move under the unlocked counter updates */
+    if (!Heap->TagEntries)
+    {
+        BaseAddress = NULL;
+        Size = HEAP_GLOBAL_TAG * sizeof(HEAP_TAG_ENTRY);
+        Status = ZwAllocateVirtualMemory(NtCurrentProcess(),
+                                         &BaseAddress,
+                                         0,
+                                         &Size,
+                                         MEM_RESERVE,
+                                         PAGE_READWRITE);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("HEAP: Failed to reserve the tag table with status 0x%08X\n", Status);
+            goto Quit;
+        }
+
+        Heap->TagEntries = BaseAddress;
+        Heap->NextAvailableTagIndex = 0;
+        Heap->MaximumTagIndex = 0;
+    }
+
+    /* Commit entries a page at a time */
+    if (Heap->NextAvailableTagIndex >= Heap->MaximumTagIndex)
+    {
+        if (Heap->MaximumTagIndex >= HEAP_GLOBAL_TAG)
+        {
+            DPRINT1("HEAP: Out of tags in heap %p\n", Heap);
+            goto Quit;
+        }
+
+        BaseAddress = &Heap->TagEntries[Heap->MaximumTagIndex];
+        Size = PAGE_SIZE;
+        Status = ZwAllocateVirtualMemory(NtCurrentProcess(),
+                                         &BaseAddress,
+                                         0,
+                                         &Size,
+                                         MEM_COMMIT,
+                                         PAGE_READWRITE);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("HEAP: Failed to commit tag entries with status 0x%08X\n", Status);
+            goto Quit;
+        }
+
+        Heap->MaximumTagIndex += (USHORT)(PAGE_SIZE / sizeof(HEAP_TAG_ENTRY));
+    }
+
+    /* The first entry names the untagged blocks after the heap */
+    if (!Heap->NextAvailableTagIndex)
+    {
+        TagEntry = &Heap->TagEntries[0];
+        for (Length = 0, Name = TagName;
+             Name && *Name && Length < RTL_NUMBER_OF(TagEntry->TagName) - 1;
+             Name++)
+        {
+            TagEntry->TagName[Length++] = *Name;
+        }
+
+        Heap->NextAvailableTagIndex = 1;
+    }
+
+    TagEntry = &Heap->TagEntries[Heap->NextAvailableTagIndex];
+    RtlZeroMemory(TagEntry, sizeof(HEAP_TAG_ENTRY));
+    TagEntry->TagIndex = Heap->NextAvailableTagIndex;
+
+    /* The tag name is the prefix followed by the sub name, truncated to fit */
+    Length = 0;
+    for (Name = TagName; Name && *Name && Length < RTL_NUMBER_OF(TagEntry->TagName) - 1; Name++)
+        TagEntry->TagName[Length++] = *Name;
+    for (Name = TagSubName; Name && *Name && Length < RTL_NUMBER_OF(TagEntry->TagName) - 1; Name++)
+        TagEntry->TagName[Length++] = *Name;
+
+    /* Publish the entry only once it's initialized */
+    TagIndex = Heap->NextAvailableTagIndex++;
+
+Quit:
+    /* Release the heap lock if it was acquired */
+    if (HeapLocked)
+        RtlLeaveHeapLock(Heap->LockVariable);
+
+    return (ULONG)TagIndex << HEAP_TAG_SHIFT;
+}
+
+static
+VOID NTAPI
+RtlpWalkFillBlock(PHEAP_ENTRY HeapEntry,
+                  UCHAR SegmentIndex,
+                  PRTL_HEAP_WALK_ENTRY Entry)
+{
+    PHEAP_ENTRY_EXTRA Extra;
+
+    Entry->DataAddress = HeapEntry + 1;
+    Entry->SegmentIndex = SegmentIndex;
+    RtlZeroMemory(&Entry->Block, sizeof(Entry->Block));
+
+    if (!(HeapEntry->Flags & HEAP_ENTRY_BUSY))
+    {
+        Entry->DataSize = (HeapEntry->Size << HEAP_ENTRY_SHIFT) - sizeof(HEAP_ENTRY);
+        Entry->OverheadBytes = sizeof(HEAP_ENTRY);
+        Entry->Flags = 0;
+        return;
+    }
+
+    /* The settable entry flags have the same values as the walk ones */
+    Entry->Flags = RTL_HEAP_BUSY | (HeapEntry->Flags & HEAP_ENTRY_SETTABLE_FLAGS);
+
+    if (HeapEntry->Flags & HEAP_ENTRY_VIRTUAL_ALLOC)
+    {
+        Entry->DataSize = RtlpGetSizeOfBigBlock(HeapEntry);
+        Entry->OverheadBytes = sizeof(HEAP_VIRTUAL_ALLOC_ENTRY);
+    }
+    else
+    {
+        Entry->DataSize = (HeapEntry->Size << HEAP_ENTRY_SHIFT) - HeapEntry->UnusedBytes;
+        Entry->OverheadBytes = HeapEntry->UnusedBytes;
+    }
+
+    if (HeapEntry->Flags & HEAP_ENTRY_EXTRA_PRESENT)
+    {
+        Extra = RtlpGetExtraStuffPointer(HeapEntry);
+        Entry->Flags |= RTL_HEAP_SETTABLE_VALUE;
+        Entry->Block.Settable = Extra->Settable;
+        Entry->Block.AllocatorBackTraceIndex = Extra->AllocatorBackTraceIndex;
+    }
+
+    Entry->Block.TagIndex = RtlpGetTagIndex(HeapEntry);
+}
+
+static
+NTSTATUS NTAPI
+RtlpWalkVirtualBlock(PHEAP Heap,
+                     PLIST_ENTRY Next,
+                     PRTL_HEAP_WALK_ENTRY Entry)
+{
+    PHEAP_VIRTUAL_ALLOC_ENTRY VirtualEntry;
+
+    if (Next == &Heap->VirtualAllocdBlocks)
+        return STATUS_NO_MORE_ENTRIES;
+
+    /* Big blocks don't belong to any segment */
+    VirtualEntry = CONTAINING_RECORD(Next, HEAP_VIRTUAL_ALLOC_ENTRY, Entry);
+    RtlpWalkFillBlock(&VirtualEntry->BusyBlock, HEAP_SEGMENTS, Entry);
+    return STATUS_SUCCESS;
+}
+
+static
+NTSTATUS NTAPI
+RtlpWalkSegment(PHEAP Heap,
+                ULONG SegmentIndex,
+                PRTL_HEAP_WALK_ENTRY Entry)
+{
+    PHEAP_SEGMENT Segment;
+
+    for (; SegmentIndex < HEAP_SEGMENTS; SegmentIndex++)
+    {
+        Segment = Heap->Segments[SegmentIndex];
+        if (!Segment) continue;
+
+        Entry->DataAddress = Segment->BaseAddress;
+        Entry->DataSize = (SIZE_T)Segment->NumberOfPages << PAGE_SHIFT;
+        Entry->OverheadBytes = 0;
+        Entry->SegmentIndex = (UCHAR)SegmentIndex;
+        Entry->Flags = RTL_HEAP_SEGMENT;
+        Entry->Segment.CommittedSize = (SIZE_T)(Segment->NumberOfPages - Segment->NumberOfUnCommittedPages) << PAGE_SHIFT;
+        Entry->Segment.UnCommittedSize = (SIZE_T)Segment->NumberOfUnCommittedPages << PAGE_SHIFT;
+        Entry->Segment.FirstEntry = Segment->FirstEntry;
+        Entry->Segment.LastEntry = Segment->LastValidEntry;
+        return STATUS_SUCCESS;
+    }
+
+    /* Big blocks come after all the segments */
+    return RtlpWalkVirtualBlock(Heap, Heap->VirtualAllocdBlocks.Flink, Entry);
+}
+
+/*
+ * Returns the entry following the one described by HeapEntry, which is a
+ * RTL_HEAP_WALK_ENTRY. Start with a zeroed DataAddress; every segment is
+ * reported first, followed by its entries and uncommitted ranges in
+ * address order, and the big blocks come last. The heap should be locked
+ * by the caller for the duration of the walk.
+ *
+ * @implemented
+ */
+NTSTATUS
+NTAPI
+RtlWalkHeap(IN HANDLE HeapHandle,
+            IN PVOID HeapEntry)
+{
+    PHEAP Heap = (PHEAP)HeapHandle;
+    PRTL_HEAP_WALK_ENTRY Entry = (PRTL_HEAP_WALK_ENTRY)HeapEntry;
+    PHEAP_SEGMENT Segment;
+    PHEAP_ENTRY CurrentEntry;
+    PHEAP_UCR_DESCRIPTOR UcrDescriptor;
+    PLIST_ENTRY Current;
+    BOOLEAN HeapLocked = FALSE;
+    UCHAR EntryFlags;
+    NTSTATUS Status;
+
+    if (Heap->ForceFlags & HEAP_FLAG_PAGE_ALLOCS)
+    {
+        DPRINT1("HEAP: RtlWalkHeap is not supported for the page heap\n");
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    /* Lock if it's lockable */
+    if (!(Heap->Flags & HEAP_NO_SERIALIZE))
+    {
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        HeapLocked = TRUE;
+    }
+
+    /* A fresh walk starts with the first segment */
+    if (!Entry->DataAddress)
+    {
+        Status = RtlpWalkSegment(Heap, 0, Entry);
+        goto Quit;
+    }
+
+    /* Continue with the next big block */
+    if (Entry->SegmentIndex >= HEAP_SEGMENTS)
+    {
+        CurrentEntry = (PHEAP_ENTRY)Entry->DataAddress - 1;
+        Status = RtlpWalkVirtualBlock(Heap,
+                                      CONTAINING_RECORD(CurrentEntry, HEAP_VIRTUAL_ALLOC_ENTRY, BusyBlock)->Entry.Flink,
+                                      Entry);
+        goto Quit;
+    }
+
+    Segment = Heap->Segments[Entry->SegmentIndex];
+    if (!Segment)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+        goto Quit;
+    }
+
+    if (Entry->Flags & RTL_HEAP_SEGMENT)
+    {
+        CurrentEntry = Segment->FirstEntry;
+    }
+    else if (Entry->Flags & RTL_HEAP_UNCOMMITTED_RANGE)
+    {
+        CurrentEntry = (PHEAP_ENTRY)((PCHAR)Entry->DataAddress + Entry->DataSize);
+    }
+    else
+    {
+        CurrentEntry = (PHEAP_ENTRY)Entry->DataAddress - 1;
+        if (!CurrentEntry->Size)
+        {
+            Status = STATUS_INVALID_PARAMETER;
+            goto Quit;
+        }
+
+        EntryFlags = CurrentEntry->Flags;
+        CurrentEntry += CurrentEntry->Size;
+
+        /* The last committed entry is followed by an uncommitted range, unless the segment ends there */
+        if ((EntryFlags & HEAP_ENTRY_LAST_ENTRY) &&
+            CurrentEntry < Segment->LastValidEntry)
+        {
+            Status = STATUS_INVALID_PARAMETER;
+
+            for (Current = Segment->UCRSegmentList.Flink;
+                 Current != &Segment->UCRSegmentList;
+                 Current = Current->Flink)
+            {
+                UcrDescriptor = CONTAINING_RECORD(Current, HEAP_UCR_DESCRIPTOR, SegmentEntry);
+                if (UcrDescriptor->Address != CurrentEntry) continue;
+
+                Entry->DataAddress = UcrDescriptor->Address;
+                Entry->DataSize = UcrDescriptor->Size;
+                Entry->OverheadBytes = 0;
+                Entry->Flags = RTL_HEAP_UNCOMMITTED_RANGE;
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+            goto Quit;
+        }
+    }
+
+    if (CurrentEntry >= Segment->LastValidEntry)
+    {
+        /* This segment is done */
+        Status = RtlpWalkSegment(Heap, Entry->SegmentIndex + 1, Entry);
+    }
+    else
+    {
+        RtlpWalkFillBlock(CurrentEntry, Entry->SegmentIndex, Entry);
+        Status = STATUS_SUCCESS;
+    }
+
+Quit:
+    /* Release the heap lock if it was acquired */
+    if (HeapLocked)
+        RtlLeaveHeapLock(Heap->LockVariable);
+
+    return Status;
+}
+
+PVOID
+NTAPI
+RtlProtectHeap(IN PVOID HeapHandle,
+               IN BOOLEAN ReadOnly)
+{
+    UNIMPLEMENTED;
+    return NULL;
+}
+
+NTSTATUS
+NTAPI
+RtlSetHeapInformation(IN HANDLE HeapHandle OPTIONAL,
+                      IN HEAP_INFORMATION_CLASS HeapInformationClass,
+                      IN PVOID HeapInformation,
+                      IN SIZE_T HeapInformationLength)
+{
+    PHEAP Heap = (PHEAP)HeapHandle;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    /* Setting heap information is not really supported except for enabling LFH */
+    if (HeapInformationClass == HeapCompatibilityInformation)
+    {
+        /* Check buffer length */
+        if (HeapInformationLength < sizeof(ULONG))
+        {
+            /* The provided buffer is too small */
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        /* Check for a special magic value for enabling LFH */
+        if (*(PULONG)HeapInformation != HEAP_FRONT_END_LFH)
+        {
+            return STATUS_UNSUCCESSFUL;
+        }
+
+        /* The LFH relies on the heap lock and plain block headers, so it
+           is not available to unserialized, debug or kernel mode heaps */
+        if (!Heap ||
+            RtlpGetMode() == KernelMode ||
+            (Heap->ForceFlags & HEAP_FLAG_PAGE_ALLOCS) ||
+            RtlpHeapIsSpecial(Heap->Flags) ||
+            (Heap->Flags & (HEAP_NO_SERIALIZE |
+                            HEAP_TAIL_CHECKING_ENABLED |
+                            HEAP_FREE_CHECKING_ENABLED |
+                            HEAP_CREATE_ALIGN_16)))
+        {
+            return STATUS_UNSUCCESSFUL;
+        }
+
+        /* Create the front end, unless it's already there */
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        if (!Heap->FrontEndHeap)
+            Status = RtlpLfhCreate(Heap);
+        RtlLeaveHeapLock(Heap->LockVariable);
+
+        return Status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+RtlQueryHeapInformation(HANDLE HeapHandle,
+                        HEAP_INFORMATION_CLASS HeapInformationClass,
+                        PVOID HeapInformation,
+                        SIZE_T HeapInformationLength,
+                        PSIZE_T ReturnLength OPTIONAL)
+{
+    PHEAP Heap = (PHEAP)HeapHandle;
+
+    /* Only HeapCompatibilityInformation is supported */
+    if (HeapInformationClass == HeapCompatibilityInformation)
+    {
+        /* Set result length */
+        if (ReturnLength)
             *ReturnLength = sizeof(ULONG);
 
         /* Check buffer length */
@@ -3963,7 +4688,79 @@ RtlQueryHeapInformation(HANDLE HeapHandle,
     return STATUS_UNSUCCESSFUL;
 }
 
-NTSTATUS
+/* Takes a free block which can hold Need entries off the free lists, extending
+   the heap if necessary. Falls back to any block of at least Minimum entries */
+static
+PHEAP_FREE_ENTRY
+RtlpFindBatchFreeBlock(PHEAP Heap,
+                       SIZE_T Need,
+                       SIZE_T Minimum)
+{
+    PLIST_ENTRY FreeListHead, Next;
+    PHEAP_FREE_ENTRY FreeBlock;
+    ULONG FreeListsInUseUlong;
+    SIZE_T i;
+
+    /* Smallest dedicated list which fits */
+    for (i = Need >> 5; i < HEAP_FREELISTS / 32; i++)
+    {
+        FreeListsInUseUlong = Heap->u.FreeListsInUseUlong[i];
+
+        /* Disable the sizes which are too small in the first word */
+        if (i == (Need >> 5))
+            FreeListsInUseUlong &= ~((1 << ((ULONG)Need & 0x1f)) - 1);
+
+        if (FreeListsInUseUlong)
+        {
+            FreeListHead = &Heap->FreeLists[i * 32 + RtlpFindLeastSetBit(FreeListsInUseUlong)];
+            FreeBlock = CONTAINING_RECORD(FreeListHead->Blink, HEAP_FREE_ENTRY, FreeList);
+            RtlpRemoveFreeBlock(Heap, FreeBlock, TRUE, FALSE);
+            return FreeBlock;
+        }
+    }
+
+    /* Smallest fitting entry of the non-dedicated list, it's sorted by size */
+    FreeListHead = &Heap->FreeLists[0];
+    for (Next = FreeListHead->Flink; Next != FreeListHead; Next = Next->Flink)
+    {
+        FreeBlock = CONTAINING_RECORD(Next, HEAP_FREE_ENTRY, FreeList);
+        if (FreeBlock->Size >= Need)
+        {
+            RtlpRemoveFreeBlock(Heap, FreeBlock, FALSE, FALSE);
+            return FreeBlock;
+        }
+    }
+
+    /* Nothing fits the whole batch, try to extend the heap */
+    if (Need <= HEAP_MAX_BLOCK_SIZE)
+    {
+        FreeBlock = RtlpExtendHeap(Heap, Need << HEAP_ENTRY_SHIFT);
+        if (FreeBlock)
+        {
+            RtlpRemoveFreeBlock(Heap, FreeBlock, FALSE, FALSE);
+            return FreeBlock;
+        }
+    }
+
+    /* Settle for a part of the batch */
+    if (Need > Minimum)
+        return RtlpFindBatchFreeBlock(Heap, Minimum, Minimum);
+
+    return NULL;
+}
+
+/***********************************************************************
+ *           RtlMultipleAllocateHeap
+ *
+ * Allocates Count blocks of the same size, carving them out of as few
+ * free blocks as possible while holding the heap lock once.
+ *
+ * RETURNS
+ * Number of blocks allocated and stored in Array
+ *
+ * @implemented
+ */
+ULONG
 NTAPI
 RtlMultipleAllocateHeap(IN PVOID HeapHandle,
                         IN ULONG Flags,
@@ -3971,19 +4768,258 @@ RtlMultipleAllocateHeap(IN PVOID HeapHandle,
                         IN ULONG Count,
                         OUT PVOID *Array)
 {
-    UNIMPLEMENTED;
-    return 0;
+    PHEAP Heap = (PHEAP)HeapHandle;
+    SIZE_T AllocationSize, Index, FreeSize, Carve, i;
+    PHEAP_FREE_ENTRY FreeBlock, RestBlock;
+    PHEAP_ENTRY InUseEntry;
+    PHEAP_ENTRY_EXTRA Extra;
+    UCHAR EntryFlags = HEAP_ENTRY_BUSY;
+    EXCEPTION_RECORD ExceptionRecord;
+    BOOLEAN HeapLocked = FALSE;
+    ULONG Allocated = 0, First;
+
+    /* Force flags */
+    Flags |= Heap->ForceFlags;
+
+    /* Calculate allocation size and index, same as RtlAllocateHeap */
+    AllocationSize = (Size ? Size : 1);
+    AllocationSize = (AllocationSize + Heap->AlignRound) & Heap->AlignMask;
+
+    if ((Flags & HEAP_EXTRA_FLAGS_MASK) ||
+        Heap->PseudoTagEntries)
+    {
+        EntryFlags |= HEAP_ENTRY_EXTRA_PRESENT;
+        AllocationSize += sizeof(HEAP_ENTRY_EXTRA);
+    }
+
+    EntryFlags |= (Flags & HEAP_SETTABLE_USER_FLAGS) >> 4;
+    Index = AllocationSize >> HEAP_ENTRY_SHIFT;
+
+    /* Special heaps, big blocks and blocks the LFH takes are allocated one by one */
+    if (RtlpHeapIsSpecial(Flags) ||
+        (Heap->ForceFlags & HEAP_FLAG_PAGE_ALLOCS) ||
+        Size >= 0x80000000 ||
+        Index > Heap->VirtualMemoryThreshold ||
+        Index > HEAP_MAX_BLOCK_SIZE ||
+        (Heap->FrontEndHeap && !(EntryFlags & HEAP_ENTRY_EXTRA_PRESENT) &&
+         !(Flags & HEAP_TAG_MASK) && Index <= HEAP_LFH_MAX_BLOCK_UNITS))
+    {
+        while (Allocated < Count)
+        {
+            Array[Allocated] = RtlAllocateHeap(Heap, Flags, Size);
+            if (!Array[Allocated]) break;
+            Allocated++;
+        }
+
+        return Allocated;
+    }
+
+    /* Acquire the lock once for the whole batch */
+    if (!(Flags & HEAP_NO_SERIALIZE))
+    {
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        HeapLocked = TRUE;
+    }
+
+    while (Allocated < Count)
+    {
+        FreeBlock = RtlpFindBatchFreeBlock(Heap, min(Index * (Count - Allocated), HEAP_MAX_BLOCK_SIZE), Index);
+        if (!FreeBlock) break;
+
+        /* Carve all but the last block off the front, it's the free block's tail */
+        FreeSize = FreeBlock->Size;
+        Carve = min(Count - Allocated, FreeSize / Index);
+        ASSERT(Carve != 0);
+
+        Heap->TotalFreeSize -= (Carve - 1) * Index;
+        RestBlock = (PHEAP_FREE_ENTRY)((PHEAP_ENTRY)FreeBlock + (Carve - 1) * Index);
+
+        if (Carve > 1)
+        {
+            RestBlock->Flags = FreeBlock->Flags;
+            RestBlock->SegmentOffset = FreeBlock->SegmentOffset;
+            RestBlock->Size = (USHORT)(FreeSize - (Carve - 1) * Index);
+            RestBlock->PreviousSize = (USHORT)Index;
+
+            /* Keep the next entry's back link intact for RtlpSplitEntry */
+            if (!(RestBlock->Flags & HEAP_ENTRY_LAST_ENTRY))
+                ((PHEAP_ENTRY)RestBlock + RestBlock->Size)->PreviousSize = RestBlock->Size;
+
+            for (i = 0; i < Carve - 1; i++)
+            {
+                InUseEntry = (PHEAP_ENTRY)FreeBlock + i * Index;
+                InUseEntry->Size = (USHORT)Index;
+                InUseEntry->Flags = EntryFlags;
+                InUseEntry->SmallTagIndex = 0;
+                InUseEntry->UnusedBytes = (UCHAR)(AllocationSize - Size);
+                InUseEntry->SegmentOffset = RestBlock->SegmentOffset;
+                if (i) InUseEntry->PreviousSize = (USHORT)Index;
+
+                Array[Allocated++] = InUseEntry + 1;
+            }
+        }
+
+        /* The last one splits off whatever is left */
+        InUseEntry = RtlpSplitEntry(Heap, Flags, RestBlock, AllocationSize, Index, Size);
+        Array[Allocated++] = InUseEntry + 1;
+    }
+
+    /* Release the lock */
+    if (HeapLocked) RtlLeaveHeapLock(Heap->LockVariable);
+
+    /* Prepare the blocks, the same way RtlAllocateHeap does */
+    for (First = 0; First < Allocated; First++)
+    {
+        InUseEntry = (PHEAP_ENTRY)Array[First] - 1;
+
+        if (Flags & HEAP_ZERO_MEMORY)
+            RtlZeroMemory(InUseEntry + 1, Size);
+        else if (Heap->Flags & HEAP_FREE_CHECKING_ENABLED)
+            RtlFillMemoryUlong(InUseEntry + 1, Size & ~0x3, ARENA_INUSE_FILLER);
+
+        if (Heap->Flags & HEAP_TAIL_CHECKING_ENABLED)
+        {
+            RtlFillMemory((PCHAR)(InUseEntry + 1) + Size, sizeof(HEAP_ENTRY), HEAP_TAIL_FILL);
+            InUseEntry->Flags |= HEAP_ENTRY_FILL_PATTERN;
+        }
+
+        if (InUseEntry->Flags & HEAP_ENTRY_EXTRA_PRESENT)
+        {
+            Extra = RtlpGetExtraStuffPointer(InUseEntry);
+            RtlZeroMemory(Extra, sizeof(HEAP_ENTRY_EXTRA));
+        }
+
+        if (Flags & HEAP_TAG_MASK)
+            RtlpSetTagIndex(Heap, Flags, InUseEntry);
+    }
+
+    if (Allocated < Count)
+    {
+        DPRINT1("HEAP: Batch allocation failed after %lu of %lu blocks!\n", Allocated, Count);
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_NO_MEMORY);
+
+        /* Generate an exception */
+        if (Flags & HEAP_GENERATE_EXCEPTIONS)
+        {
+            ExceptionRecord.ExceptionCode = STATUS_NO_MEMORY;
+            ExceptionRecord.ExceptionRecord = NULL;
+            ExceptionRecord.NumberParameters = 1;
+            ExceptionRecord.ExceptionFlags = 0;
+            ExceptionRecord.ExceptionInformation[0] = AllocationSize;
+
+            RtlRaiseException(&ExceptionRecord);
+        }
+    }
+
+    return Allocated;
 }
 
-NTSTATUS
+/***********************************************************************
+ *           RtlMultipleFreeHeap
+ *
+ * Frees Count blocks while holding the heap lock once. Runs of blocks
+ * which are adjacent in memory, as handed out by RtlMultipleAllocateHeap,
+ * are joined and go through coalescing only once.
+ *
+ * RETURNS
+ * Number of blocks freed
+ *
+ * @implemented
+ */
+ULONG
 NTAPI
 RtlMultipleFreeHeap(IN PVOID HeapHandle,
                     IN ULONG Flags,
                     IN ULONG Count,
-                    OUT PVOID *Array)
+                    IN PVOID *Array)
 {
-    UNIMPLEMENTED;
-    return 0;
+    PHEAP Heap = (PHEAP)HeapHandle;
+    PHEAP_ENTRY RunEntry, HeapEntry, NextEntry;
+    SIZE_T RunSize;
+    BOOLEAN HeapLocked = FALSE;
+    ULONG Freed = 0, i, RunLength;
+
+    /* Force flags */
+    Flags |= Heap->ForceFlags;
+
+    /* Special heaps free one by one */
+    if (RtlpHeapIsSpecial(Flags) ||
+        (Heap->ForceFlags & HEAP_FLAG_PAGE_ALLOCS))
+    {
+        for (i = 0; i < Count; i++)
+        {
+            if (RtlFreeHeap(Heap, Flags, Array[i])) Freed++;
+        }
+
+        return Freed;
+    }
+
+    /* Acquire the lock once for the whole batch */
+    if (!(Flags & HEAP_NO_SERIALIZE))
+    {
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        HeapLocked = TRUE;
+    }
+
+    i = 0;
+    while (i < Count)
+    {
+        RunEntry = Array[i] ? (PHEAP_ENTRY)Array[i] - 1 : NULL;
+        RunLength = 1;
+
+        /* Only plain back end blocks can be joined, and only if no tag needs per-block accounting */
+        if (RunEntry &&
+            !Heap->TagEntries &&
+            ((ULONG_PTR)Array[i] & (HEAP_ENTRY_SIZE - 1)) == 0 &&
+            (RunEntry->Flags & (HEAP_ENTRY_BUSY | HEAP_ENTRY_VIRTUAL_ALLOC)) == HEAP_ENTRY_BUSY &&
+            RunEntry->SegmentOffset < HEAP_SEGMENTS &&
+            !(Heap->Flags & HEAP_DISABLE_COALESCE_ON_FREE))
+        {
+            RunSize = RunEntry->Size;
+            HeapEntry = RunEntry;
+
+            /* Extend the run while the next pointer is the block right behind it */
+            while (i + RunLength < Count &&
+                   !(HeapEntry->Flags & HEAP_ENTRY_LAST_ENTRY) &&
+                   Array[i + RunLength] == (PVOID)(HeapEntry + HeapEntry->Size + 1))
+            {
+                NextEntry = HeapEntry + HeapEntry->Size;
+
+                if ((NextEntry->Flags & (HEAP_ENTRY_BUSY | HEAP_ENTRY_VIRTUAL_ALLOC)) != HEAP_ENTRY_BUSY ||
+                    NextEntry->SegmentOffset != RunEntry->SegmentOffset ||
+                    NextEntry->PreviousSize != HeapEntry->Size ||
+                    RunSize + NextEntry->Size > HEAP_MAX_BLOCK_SIZE)
+                {
+                    break;
+                }
+
+                HeapEntry = NextEntry;
+                RunSize += HeapEntry->Size;
+                RunLength++;
+            }
+
+            /* Turn the run into a single busy block */
+            if (RunLength > 1)
+            {
+                RunEntry->Size = (USHORT)RunSize;
+                RunEntry->Flags = (RunEntry->Flags & ~HEAP_ENTRY_LAST_ENTRY) |
+                                  (HeapEntry->Flags & HEAP_ENTRY_LAST_ENTRY);
+
+                if (!(RunEntry->Flags & HEAP_ENTRY_LAST_ENTRY))
+                    (RunEntry + RunSize)->PreviousSize = (USHORT)RunSize;
+            }
+        }
+
+        /* Free it through the usual path, the lock is already held */
+        if (RtlFreeHeap(Heap, Flags | HEAP_NO_SERIALIZE, Array[i])) Freed += RunLength;
+
+        i += RunLength;
+    }
+
+    /* Release the lock */
+    if (HeapLocked) RtlLeaveHeapLock(Heap->LockVariable);
+
+    return Freed;
 }
 
 /* EOF */
@@ -327,6 +327,65 @@ typedef struct _HEAP_VIRTUAL_ALLOC_ENTRY
     HEAP_ENTRY BusyBlock;
 } HEAP_VIRTUAL_ALLOC_ENTRY, *PHEAP_VIRTUAL_ALLOC_ENTRY;
 
+/* Front end heap types, as reported through HeapCompatibilityInformation */
+#define HEAP_FRONT_END_NONE      0
+#define HEAP_FRONT_END_LOOKASIDE 1
+#define HEAP_FRONT_END_LFH       2
+
+/* Low-fragmentation heap definitions */
+#define HEAP_LFH_BUCKETS               128
+#define HEAP_LFH_MAX_BLOCK_UNITS       256
+#define HEAP_LFH_AFFINITY_SLOTS        8
+#define HEAP_LFH_ACTIVATION_THRESHOLD  16
+#define HEAP_LFH_SUBSEGMENT_SIZE       0x4000
+#define HEAP_LFH_MIN_BLOCKS            8
+#define HEAP_LFH_MAX_BLOCKS            256
+#define HEAP_LFH_SUBSEGMENT_SIGNATURE  0x48464c53
+
+/* LFHFlags value which marks a block as owned by the LFH, see RtlpIsLfhEntry */
+#define HEAP_LFH_INDEX                 0xFF
+
+typedef struct _HEAP_LFH_SUBSEGMENT
+{
+    ULONG Signature;
+    USHORT BlockUnits;
+    USHORT BlockCount;
+    PHEAP Heap;
+    struct _HEAP_LFH_BUCKET *Bucket;
+    LIST_ENTRY ListEntry;
+    BOOLEAN Listed;
+    volatile LONG Active;
+    volatile LONG FreeCount;
+    volatile LONG Hint;
+    volatile LONG FreeMap[HEAP_LFH_MAX_BLOCKS / 32];
+} HEAP_LFH_SUBSEGMENT, *PHEAP_LFH_SUBSEGMENT;
+
+#define HEAP_LFH_BLOCKS_OFFSET ROUND_UP(sizeof(HEAP_LFH_SUBSEGMENT), HEAP_ENTRY_SIZE)
+
+typedef struct _HEAP_LFH_BUCKET
+{
+    PHEAP_LFH_SUBSEGMENT volatile ActiveSubSegment[HEAP_LFH_AFFINITY_SLOTS];
+    LIST_ENTRY PartialList;
+    volatile LONG UsageCount;
+    volatile LONG Users;
+    USHORT BlockUnits;
+    volatile BOOLEAN Enabled;
+} HEAP_LFH_BUCKET, *PHEAP_LFH_BUCKET;
+
+typedef struct _HEAP_LFH
+{
+    PHEAP Heap;
+    ULONG AffinitySlots;
+    HEAP_LFH_BUCKET Buckets[HEAP_LFH_BUCKETS];
+} HEAP_LFH, *PHEAP_LFH;
+
+FORCEINLINE BOOLEAN
+RtlpIsLfhEntry(PHEAP_ENTRY HeapEntry)
+{
+    return (HeapEntry->Flags & (HEAP_ENTRY_BUSY | HEAP_ENTRY_VIRTUAL_ALLOC)) == HEAP_ENTRY_BUSY &&
+           HeapEntry->LFHFlags == HEAP_LFH_INDEX;
+}
+
 /* Global variables */
 extern RTL_CRITICAL_SECTION RtlpProcessHeapsListLock;
 extern BOOLEAN RtlpPageHeapEnabled;
@@ -352,6 +411,34 @@ RtlpValidateHeapEntry(PHEAP Heap, PHEAP_ENTRY HeapEntry);
 BOOLEAN NTAPI
 RtlpValidateHeapHeaders(PHEAP Heap, BOOLEAN Recalculate);
 
+/* heaplfh.c */
+NTSTATUS NTAPI
+RtlpLfhCreate(PHEAP Heap);
+
+VOID NTAPI
+RtlpLfhDestroy(PHEAP Heap);
+
+PVOID NTAPI
+RtlpLfhAllocate(PHEAP Heap,
+                ULONG Flags,
+                SIZE_T Size,
+                SIZE_T AllocationSize,
+                UCHAR EntryFlags);
+
+BOOLEAN NTAPI
+RtlpLfhFree(PHEAP Heap,
+            PHEAP_ENTRY HeapEntry);
+
+PVOID NTAPI
+RtlpLfhReAllocate(PHEAP Heap,
+                  ULONG Flags,
+                  PVOID Ptr,
+                  SIZE_T Size);
+
+BOOLEAN NTAPI
+RtlpLfhValidateEntry(PHEAP Heap,
+                     PHEAP_ENTRY HeapEntry);
+
 /* heapdbg.c */
 HANDLE NTAPI
 RtlDebugCreateHeap(ULONG Flags,
@@ -0,0 +1,545 @@
+/*
+ * COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         ReactOS system libraries
+ * FILE:            lib/rtl/heaplfh.c
+ * PURPOSE:         RTL Heap low-fragmentation front end allocator
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include <rtl.h>
+#include <heap.h>
+
+#define NDEBUG
+#include <debug.h>
+
+/*
+ * The front end serves small blocks out of fixed-size subsegments which are
+ * carved from the back end heap. Every size class (bucket) keeps one active
+ * subsegment per affinity slot, and blocks are claimed from its free bitmap
+ * with interlocked operations only. The heap lock is taken when a slot has to
+ * be refilled, or when a subsegment which left its slot regains a free block
+ * and has to be put back on the bucket's partial list.
+ *
+ * An allocating thread may still hold a stale pointer taken from a slot, so a
+ * subsegment which became empty is only handed back to the back end when it
+ * left its slot and no other thread is inside the front end for its bucket.
+ * Those which can't be released yet stay on the partial list for reuse.
+ */
+
+/* FUNCTIONS *****************************************************************/
+
+FORCEINLINE
+ULONG
+RtlpLfhBucketIndex(SIZE_T Index)
+{
+    /* 1 entry granularity up to 64 entries, then 2 up to 128, then 4 up to 256 */
+    if (Index <= 64)
+        return (ULONG)Index - 1;
+    else if (Index <= 128)
+        return 64 + (ULONG)(Index - 65) / 2;
+    else
+        return 96 + (ULONG)(Index - 129) / 4;
+}
+
+FORCEINLINE
+USHORT
+RtlpLfhBucketUnits(ULONG Bucket)
+{
+    if (Bucket < 64)
+        return (USHORT)(Bucket + 1);
+    else if (Bucket < 96)
+        return (USHORT)(64 + (Bucket - 63) * 2);
+    else
+        return (USHORT)(128 + (Bucket - 95) * 4);
+}
+
+FORCEINLINE
+ULONG
+RtlpLfhGetAffinitySlot(PHEAP_LFH Lfh)
+{
+    /* Spread threads over the slots, thread ids are multiples of 4 */
+    return (ULONG)(((ULONG_PTR)NtCurrentTeb()->ClientId.UniqueThread >> 2) % Lfh->AffinitySlots);
+}
+
+FORCEINLINE
+PHEAP_ENTRY
+RtlpLfhGetBlock(PHEAP_LFH_SUBSEGMENT SubSegment, ULONG Index)
+{
+    return (PHEAP_ENTRY)((PUCHAR)SubSegment + HEAP_LFH_BLOCKS_OFFSET +
+                         ((SIZE_T)Index * SubSegment->BlockUnits << HEAP_ENTRY_SHIFT));
+}
+
+FORCEINLINE
+PHEAP_LFH_SUBSEGMENT
+RtlpLfhGetSubSegment(PHEAP_ENTRY HeapEntry)
+{
+    /* The block index is kept in PreviousSize, which LFH blocks have no use for */
+    return (PHEAP_LFH_SUBSEGMENT)((PUCHAR)HeapEntry - HEAP_LFH_BLOCKS_OFFSET -
+                                  ((SIZE_T)HeapEntry->PreviousSize * HeapEntry->Size << HEAP_ENTRY_SHIFT));
+}
+
+static
+BOOLEAN
+RtlpLfhCheckEntry(PHEAP Heap,
+                  PHEAP_LFH_SUBSEGMENT SubSegment,
+                  PHEAP_ENTRY HeapEntry)
+{
+    if (HeapEntry->PreviousSize >= HEAP_LFH_MAX_BLOCKS ||
+        HeapEntry->Size == 0 ||
+        HeapEntry->Size > HEAP_LFH_MAX_BLOCK_UNITS)
+    {
+        return FALSE;
+    }
+
+    return SubSegment->Signature == HEAP_LFH_SUBSEGMENT_SIGNATURE &&
+           SubSegment->Heap == Heap &&
+           SubSegment->BlockUnits == HeapEntry->Size &&
+           HeapEntry->PreviousSize < SubSegment->BlockCount;
+}
+
+/* Must be called with the heap lock held */
+static
+VOID
+RtlpLfhUpdateSubSegment(PHEAP_LFH_SUBSEGMENT SubSegment)
+{
+    /* A subsegment outside of any slot must be findable as long as it has a free block */
+    if (!SubSegment->Active && !SubSegment->Listed && SubSegment->FreeCount > 0)
+    {
+        InsertHeadList(&SubSegment->Bucket->PartialList, &SubSegment->ListEntry);
+        SubSegment->Listed = TRUE;
+    }
+}
+
+/* Must be called with the heap lock held, by a thread counted in the bucket users */
+static
+BOOLEAN
+RtlpLfhReleaseSubSegment(PHEAP Heap,
+                         PHEAP_LFH_SUBSEGMENT SubSegment)
+{
+    /* Nobody else may reach the subsegment: it isn't in a slot, all its
+       blocks are free, and the partial list is protected by the heap lock */
+    if (SubSegment->Active ||
+        SubSegment->FreeCount != SubSegment->BlockCount ||
+        SubSegment->Bucket->Users != 1)
+    {
+        return FALSE;
+    }
+
+    if (SubSegment->Listed)
+    {
+        RemoveEntryList(&SubSegment->ListEntry);
+        SubSegment->Listed = FALSE;
+    }
+
+    DPRINT("LFH: releasing subsegment %p\n", SubSegment);
+    SubSegment->Signature = 0;
+    RtlFreeHeap(Heap, HEAP_NO_SERIALIZE, SubSegment);
+    return TRUE;
+}
+
+static
+VOID
+RtlpLfhReleaseCount(PHEAP Heap,
+                    PHEAP_LFH_SUBSEGMENT SubSegment)
+{
+    LONG FreeCount;
+
+    /* The interlocked increment orders the read of Active after it, the
+       refill path orders them the other way round, so at least one side
+       sees the other and puts the subsegment back on the partial list */
+    FreeCount = InterlockedIncrement(&SubSegment->FreeCount);
+    if ((FreeCount == 1 || FreeCount == SubSegment->BlockCount) && !SubSegment->Active)
+    {
+        RtlEnterHeapLock(Heap->LockVariable, TRUE);
+        if (!RtlpLfhReleaseSubSegment(Heap, SubSegment))
+            RtlpLfhUpdateSubSegment(SubSegment);
+        RtlLeaveHeapLock(Heap->LockVariable);
+    }
+}
+
+static
+PHEAP_LFH_SUBSEGMENT
+RtlpLfhCreateSubSegment(PHEAP Heap,
+                        PHEAP_LFH_BUCKET Bucket)
+{
+    PHEAP_LFH_SUBSEGMENT SubSegment;
+    SIZE_T BlockSize;
+    ULONG BlockCount, i;
+
+    BlockSize = (SIZE_T)Bucket->BlockUnits << HEAP_ENTRY_SHIFT;
+    BlockCount = (ULONG)(HEAP_LFH_SUBSEGMENT_SIZE / BlockSize);
+    BlockCount = max(BlockCount, HEAP_LFH_MIN_BLOCKS);
+    BlockCount = min(BlockCount, HEAP_LFH_MAX_BLOCKS);
+
+    /* The heap lock is already held. The size is always beyond the LFH range,
+       so this is served by the back end */
+    SubSegment = RtlAllocateHeap(Heap,
+                                 HEAP_NO_SERIALIZE,
+                                 HEAP_LFH_BLOCKS_OFFSET + BlockCount * BlockSize);
+    if (!SubSegment) return NULL;
+
+    RtlZeroMemory(SubSegment, sizeof(HEAP_LFH_SUBSEGMENT));
+    SubSegment->Signature = HEAP_LFH_SUBSEGMENT_SIGNATURE;
+    SubSegment->BlockUnits = Bucket->BlockUnits;
+    SubSegment->BlockCount = (USHORT)BlockCount;
+    SubSegment->Heap = Heap;
+    SubSegment->Bucket = Bucket;
+    SubSegment->FreeCount = BlockCount;
+
+    /* All blocks start free */
+    for (i = 0; i < BlockCount / 32; i++)
+        SubSegment->FreeMap[i] = (LONG)0xFFFFFFFF;
+    if (BlockCount & 31)
+        SubSegment->FreeMap[i] = (LONG)((1UL << (BlockCount & 31)) - 1);
+
+    DPRINT("LFH: new subsegment %p, %lu blocks of %lu bytes\n", SubSegment, BlockCount, (ULONG)BlockSize);
+    return SubSegment;
+}
+
+static
+BOOLEAN
+RtlpLfhRefill(PHEAP Heap,
+              PHEAP_LFH_BUCKET Bucket,
+              ULONG Slot,
+              PHEAP_LFH_SUBSEGMENT Exhausted)
+{
+    PHEAP_LFH_SUBSEGMENT SubSegment = NULL, Candidate;
+    PLIST_ENTRY Entry;
+    BOOLEAN Result = TRUE;
+
+    RtlEnterHeapLock(Heap->LockVariable, TRUE);
+
+    /* Somebody else may have refilled this slot already */
+    if (Bucket->ActiveSubSegment[Slot] == Exhausted)
+    {
+        /* Retire the exhausted subsegment, it goes back to the partial list
+           if blocks were freed in the meantime */
+        if (Exhausted)
+        {
+            InterlockedExchange(&Exhausted->Active, FALSE);
+            RtlpLfhUpdateSubSegment(Exhausted);
+        }
+
+        /* Prefer a partially used subsegment over a new one */
+        while (!IsListEmpty(&Bucket->PartialList))
+        {
+            Entry = RemoveHeadList(&Bucket->PartialList);
+            Candidate = CONTAINING_RECORD(Entry, HEAP_LFH_SUBSEGMENT, ListEntry);
+            Candidate->Listed = FALSE;
+
+            if (Candidate->FreeCount > 0)
+            {
+                SubSegment = Candidate;
+                break;
+            }
+        }
+
+        if (!SubSegment)
+            SubSegment = RtlpLfhCreateSubSegment(Heap, Bucket);
+
+        if (SubSegment)
+            InterlockedExchange(&SubSegment->Active, TRUE);
+        else
+            Result = FALSE;
+
+        InterlockedExchangePointer((PVOID *)&Bucket->ActiveSubSegment[Slot], SubSegment);
+    }
+
+    RtlLeaveHeapLock(Heap->LockVariable);
+    return Result;
+}
+
+static
+PHEAP_ENTRY
+RtlpLfhClaimBlock(PHEAP_LFH_SUBSEGMENT SubSegment)
+{
+    ULONG Words = (SubSegment->BlockCount + 31) / 32;
+    ULONG Word = (ULONG)SubSegment->Hint;
+    LONG Old;
+    ULONG Bit;
+    PHEAP_ENTRY HeapEntry;
+
+    /* The caller reserved a block through FreeCount, so a set bit is guaranteed to show up */
+    for (;;)
+    {
+        if (Word >= Words) Word = 0;
+
+        Old = SubSegment->FreeMap[Word];
+        if (!Old)
+        {
+            Word++;
+            continue;
+        }
+
+        BitScanForward(&Bit, (ULONG)Old);
+        if (InterlockedCompareExchange(&SubSegment->FreeMap[Word], Old & ~(LONG)(1UL << Bit), Old) == Old)
+            break;
+    }
+
+    SubSegment->Hint = Word;
+
+    HeapEntry = RtlpLfhGetBlock(SubSegment, Word * 32 + Bit);
+    HeapEntry->PreviousSize = (USHORT)(Word * 32 + Bit);
+    return HeapEntry;
+}
+
+NTSTATUS NTAPI
+RtlpLfhCreate(PHEAP Heap)
+{
+    PHEAP_LFH Lfh = NULL;
+    SIZE_T Size = sizeof(HEAP_LFH);
+    NTSTATUS Status;
+    ULONG i;
+
+    Status = ZwAllocateVirtualMemory(NtCurrentProcess(),
+                                     (PVOID *)&Lfh,
+                                     0,
+                                     &Size,
+                                     MEM_RESERVE | MEM_COMMIT,
+                                     PAGE_READWRITE);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Lfh->Heap = Heap;
+    Lfh->AffinitySlots = min(max(NtCurrentPeb()->NumberOfProcessors, 1), HEAP_LFH_AFFINITY_SLOTS);
+
+    for (i = 0; i < HEAP_LFH_BUCKETS; i++)
+    {
+        InitializeListHead(&Lfh->Buckets[i].PartialList);
+        Lfh->Buckets[i].BlockUnits = RtlpLfhBucketUnits(i);
+    }
+
+    /* Publish the front end, allocations start using it right away */
+    InterlockedExchangePointer(&Heap->FrontEndHeap, Lfh);
+    Heap->FrontEndHeapType = HEAP_FRONT_END_LFH;
+
+    return STATUS_SUCCESS;
+}
+
+VOID NTAPI
+RtlpLfhDestroy(PHEAP Heap)
+{
+    PVOID BaseAddress = Heap->FrontEndHeap;
+    SIZE_T Size = 0;
+
+    /* Subsegments live in the back end segments and go away with them */
+    Heap->FrontEndHeapType = HEAP_FRONT_END_NONE;
+    Heap->FrontEndHeap = NULL;
+
+    ZwFreeVirtualMemory(NtCurrentProcess(),
+                        &BaseAddress,
+                        &Size,
+                        MEM_RELEASE);
+}
+
+PVOID NTAPI
+RtlpLfhAllocate(PHEAP Heap,
+                ULONG Flags,
+                SIZE_T Size,
+                SIZE_T AllocationSize,
+                UCHAR EntryFlags)
+{
+    PHEAP_LFH Lfh = (PHEAP_LFH)Heap->FrontEndHeap;
+    PHEAP_LFH_BUCKET Bucket;
+    PHEAP_LFH_SUBSEGMENT SubSegment;
+    PHEAP_ENTRY InUseEntry;
+    SIZE_T Index = AllocationSize >> HEAP_ENTRY_SHIFT;
+    ULONG Slot;
+
+    if (Index > HEAP_LFH_MAX_BLOCK_UNITS)
+        return NULL;
+
+    Bucket = &Lfh->Buckets[RtlpLfhBucketIndex(Index)];
+
+    /* Leave rarely used sizes to the back end, a whole subsegment would be wasted on them */
+    if (!Bucket->Enabled)
+    {
+        if (InterlockedIncrement(&Bucket->UsageCount) < HEAP_LFH_ACTIVATION_THRESHOLD)
+            return NULL;
+
+        Bucket->Enabled = TRUE;
+    }
+
+    Slot = RtlpLfhGetAffinitySlot(Lfh);
+
+    /* Keep the subsegments we may pick up from a slot alive */
+    InterlockedIncrement(&Bucket->Users);
+
+    for (;;)
+    {
+        /* Reserve a block in the active subsegment of our slot */
+        SubSegment = Bucket->ActiveSubSegment[Slot];
+        if (SubSegment)
+        {
+            if (InterlockedDecrement(&SubSegment->FreeCount) >= 0)
+                break;
+
+            /* It's exhausted, undo the reservation */
+            RtlpLfhReleaseCount(Heap, SubSegment);
+        }
+
+        /* Fall back to the back end if no subsegment could be obtained */
+        if (!RtlpLfhRefill(Heap, Bucket, Slot, SubSegment))
+        {
+            InterlockedDecrement(&Bucket->Users);
+            return NULL;
+        }
+    }
+
+    InUseEntry = RtlpLfhClaimBlock(SubSegment);
+    InterlockedDecrement(&Bucket->Users);
+
+    /* Initialize the block header */
+    InUseEntry->Size = SubSegment->BlockUnits;
+    InUseEntry->Flags = EntryFlags;
+    InUseEntry->SmallTagIndex = 0;
+    InUseEntry->LFHFlags = HEAP_LFH_INDEX;
+    InUseEntry->UnusedBytes = (UCHAR)(((SIZE_T)SubSegment->BlockUnits << HEAP_ENTRY_SHIFT) - Size);
+
+    if (Flags & HEAP_ZERO_MEMORY)
+        RtlZeroMemory(InUseEntry + 1, Size);
+
+    return InUseEntry + 1;
+}
+
+BOOLEAN NTAPI
+RtlpLfhFree(PHEAP Heap,
+            PHEAP_ENTRY HeapEntry)
+{
+    PHEAP_LFH_SUBSEGMENT SubSegment = RtlpLfhGetSubSegment(HeapEntry);
+    PHEAP_LFH_BUCKET Bucket;
+    ULONG Index = HeapEntry->PreviousSize;
+    LONG Old, Mask = (LONG)(1UL << (Index & 31));
+    volatile LONG *FreeMap;
+
+    if (!RtlpLfhCheckEntry(Heap, SubSegment, HeapEntry))
+    {
+        DPRINT1("HEAP: Trying to free an invalid LFH address %p!\n", HeapEntry + 1);
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    FreeMap = &SubSegment->FreeMap[Index / 32];
+    if (!(HeapEntry->Flags & HEAP_ENTRY_BUSY) || (*FreeMap & Mask))
+    {
+        DPRINT1("HEAP: LFH block %p is already free!\n", HeapEntry + 1);
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    /* The subsegment may be released as soon as the block is marked free */
+    Bucket = SubSegment->Bucket;
+    InterlockedIncrement(&Bucket->Users);
+
+    /* Mark the block free before anyone else can claim it */
+    HeapEntry->Flags = 0;
+
+    do
+    {
+        Old = *FreeMap;
+        if (Old & Mask)
+        {
+            /* Lost a race against another free of the same block */
+            DPRINT1("HEAP: LFH block %p is already free!\n", HeapEntry + 1);
+            InterlockedDecrement(&Bucket->Users);
+            RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_INVALID_PARAMETER);
+            return FALSE;
+        }
+    } while (InterlockedCompareExchange(FreeMap, Old | Mask, Old) != Old);
+
+    RtlpLfhReleaseCount(Heap, SubSegment);
+    InterlockedDecrement(&Bucket->Users);
+    return TRUE;
+}
+
+PVOID NTAPI
+RtlpLfhReAllocate(PHEAP Heap,
+                  ULONG Flags,
+                  PVOID Ptr,
+                  SIZE_T Size)
+{
+    PHEAP_ENTRY InUseEntry = (PHEAP_ENTRY)Ptr - 1;
+    SIZE_T BlockSize, OldSize, AllocationSize;
+    PVOID NewBaseAddress;
+    EXCEPTION_RECORD ExceptionRecord;
+
+    if (!RtlpLfhValidateEntry(Heap, InUseEntry))
+    {
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_INVALID_PARAMETER);
+        return NULL;
+    }
+
+    BlockSize = (SIZE_T)InUseEntry->Size << HEAP_ENTRY_SHIFT;
+    OldSize = BlockSize - InUseEntry->UnusedBytes;
+    AllocationSize = ((Size ? Size : 1) + Heap->AlignRound) & Heap->AlignMask;
+
+    /* Resize within the block if it still fits and the slack is representable */
+    if (!(Flags & HEAP_EXTRA_FLAGS_MASK) &&
+        AllocationSize <= BlockSize &&
+        BlockSize - Size <= MAXUCHAR)
+    {
+        if (Size > OldSize && (Flags & HEAP_ZERO_MEMORY))
+            RtlZeroMemory((PCHAR)Ptr + OldSize, Size - OldSize);
+
+        InUseEntry->UnusedBytes = (UCHAR)(BlockSize - Size);
+        return Ptr;
+    }
+
+    if (Flags & HEAP_REALLOC_IN_PLACE_ONLY)
+    {
+        DPRINT1("Realloc in place failed, but it was the only option\n");
+        NewBaseAddress = NULL;
+    }
+    else
+    {
+        /* Move the block, keeping its settable user flags */
+        Flags &= ~HEAP_SETTABLE_USER_FLAGS;
+        Flags |= (InUseEntry->Flags & HEAP_ENTRY_SETTABLE_FLAGS) << 4;
+
+        NewBaseAddress = RtlAllocateHeap(Heap, Flags & ~HEAP_ZERO_MEMORY, Size);
+        if (NewBaseAddress)
+        {
+            RtlMoveMemory(NewBaseAddress, Ptr, min(Size, OldSize));
+
+            if (Size > OldSize && (Flags & HEAP_ZERO_MEMORY))
+                RtlZeroMemory((PCHAR)NewBaseAddress + OldSize, Size - OldSize);
+
+            RtlpLfhFree(Heap, InUseEntry);
+        }
+    }
+
+    /* Generate an exception if required */
+    if (!NewBaseAddress && (Flags & HEAP_GENERATE_EXCEPTIONS))
+    {
+        ExceptionRecord.ExceptionCode = STATUS_NO_MEMORY;
+        ExceptionRecord.ExceptionRecord = NULL;
+        ExceptionRecord.NumberParameters = 1;
+        ExceptionRecord.ExceptionFlags = 0;
+        ExceptionRecord.ExceptionInformation[0] = AllocationSize;
+
+        RtlRaiseException(&ExceptionRecord);
+    }
+
+    return NewBaseAddress;
+}
+
+BOOLEAN NTAPI
+RtlpLfhValidateEntry(PHEAP Heap,
+                     PHEAP_ENTRY HeapEntry)
+{
+    PHEAP_LFH_SUBSEGMENT SubSegment = RtlpLfhGetSubSegment(HeapEntry);
+    ULONG Index = HeapEntry->PreviousSize;
+
+    if (!RtlpLfhCheckEntry(Heap, SubSegment, HeapEntry) ||
+        RtlpLfhGetBlock(SubSegment, Index) != HeapEntry ||
+        (SubSegment->FreeMap[Index / 32] & (LONG)(1UL << (Index & 31))))
+    {
+        DPRINT1("HEAP: Invalid LFH entry %p in heap %p\n", HeapEntry, Heap);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* EOF */
@@ -210,6 +210,9 @@ DebugService2(
 #define TAG_ASTR        'RTSA'
 #define TAG_OSTR        'RTSO'
 
+/* Tag for the compression helpers */
+#define TAG_COMPRESS    'PMOC'
+
 /* Timer Queue */
 
 extern HANDLE TimerThreadHandle;
@@ -230,6 +233,46 @@ typedef struct _RTL_BITMAP_RUN64
     ULONG64 NumberOfBits;
 } RTL_BITMAP_RUN64, *PRTL_BITMAP_RUN64;
 
+typedef struct _RTL_BITMAP_SUMMARY64
+{
+    PRTL_BITMAP64 BitMap;
+    PULONG ClearCount;
+    ULONG BlockShift;
+    ULONG64 NumberOfBlocks;
+} RTL_BITMAP_SUMMARY64, *PRTL_BITMAP_SUMMARY64;
+
+/* xpress.c */
+NTSTATUS
+NTAPI
+RtlpWorkSpaceSizeXpress(
+    IN USHORT Format,
+    IN USHORT Engine,
+    OUT PULONG BufferAndWorkSpaceSize,
+    OUT PULONG FragmentWorkSpaceSize);
+
+NTSTATUS
+NTAPI
+RtlpCompressBufferXpress(
+    IN USHORT Format,
+    IN USHORT Engine,
+    IN PUCHAR UncompressedBuffer,
+    IN ULONG UncompressedBufferSize,
+    OUT PUCHAR CompressedBuffer,
+    IN ULONG CompressedBufferSize,
+    OUT PULONG FinalCompressedSize,
+    IN PVOID WorkSpace);
+
+NTSTATUS
+NTAPI
+RtlpDecompressBufferXpress(
+    IN USHORT Format,
+    OUT PUCHAR UncompressedBuffer,
+    IN ULONG UncompressedBufferSize,
+    IN PUCHAR CompressedBuffer,
+    IN ULONG CompressedBufferSize,
+    OUT PULONG FinalUncompressedSize,
+    IN PVOID WorkSpace);
+
 /* nls.c */
 WCHAR
 NTAPI
@@ -0,0 +1,1176 @@
+/*
+ * PROJECT:         ReactOS system libraries
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            lib/rtl/xpress.c
+ * PURPOSE:         XPRESS (plain LZ77 and LZ77+Huffman) compression, see [MS-XCA]
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include <rtl.h>
+
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS *******************************************************************/
+
+#define XPRESS_MIN_MATCH            3
+#define XPRESS_HASH_BITS            14
+#define XPRESS_HASH_SIZE            (1 << XPRESS_HASH_BITS)
+#define XPRESS_BLOCK_SIZE           0x10000
+
+#define XPRESS_PLAIN_WINDOW         0x2000
+#define XPRESS_HUFF_WINDOW          0x10000
+#define XPRESS_HUFF_MAX_OFFSET      (XPRESS_HUFF_WINDOW - 1)
+
+#define XPRESS_HUFF_SYMBOLS         512
+#define XPRESS_HUFF_EOF             256
+#define XPRESS_HUFF_MAX_BITS        15
+#define XPRESS_HUFF_TABLE_BYTES     (XPRESS_HUFF_SYMBOLS / 2)
+#define XPRESS_HUFF_MAX_DEPTH       32
+
+/* Decoding tables: an 11-bit primary table, longer codes go to 4-bit secondary tables */
+#define XPRESS_HUFF_PRIMARY_BITS    11
+#define XPRESS_HUFF_SECONDARY_BITS  (XPRESS_HUFF_MAX_BITS - XPRESS_HUFF_PRIMARY_BITS)
+#define XPRESS_HUFF_PRIMARY_SIZE    (1 << XPRESS_HUFF_PRIMARY_BITS)
+#define XPRESS_HUFF_SECONDARY_SIZE  (1 << XPRESS_HUFF_SECONDARY_BITS)
+#define XPRESS_HUFF_SUBTABLE        0x8000
+
+/* Parsed tokens: either a literal byte or a (length, offset) pair */
+#define XPRESS_TOKEN_MATCH          0x80000000
+#define XPRESS_MAX_TOKEN_LENGTH     (0x7FFF + XPRESS_MIN_MATCH)
+#define XPRESS_MATCH_TOKEN(Length, Offset) \
+    (XPRESS_TOKEN_MATCH | (((Length) - XPRESS_MIN_MATCH) << 16) | (Offset))
+#define XPRESS_TOKEN_LENGTH(Token)  ((((Token) >> 16) & 0x7FFF) + XPRESS_MIN_MATCH)
+#define XPRESS_TOKEN_OFFSET(Token)  ((Token) & 0xFFFF)
+
+#define XPRESS_STANDARD_CHAIN       16
+#define XPRESS_STANDARD_NICE        32
+#define XPRESS_MAXIMUM_CHAIN        256
+#define XPRESS_MAXIMUM_NICE         258
+
+typedef struct _XPRESS_HUFF_SYMBOL
+{
+    ULONG Key;
+    ULONG Symbol;
+} XPRESS_HUFF_SYMBOL, *PXPRESS_HUFF_SYMBOL;
+
+typedef struct _XPRESS_WORKSPACE
+{
+    ULONG Tokens[XPRESS_BLOCK_SIZE];
+    ULONG Frequency[XPRESS_HUFF_SYMBOLS];
+    XPRESS_HUFF_SYMBOL Sorted[XPRESS_HUFF_SYMBOLS];
+    USHORT Code[XPRESS_HUFF_SYMBOLS];
+    UCHAR Length[XPRESS_HUFF_SYMBOLS];
+    ULONG HashHead[XPRESS_HASH_SIZE];
+    ULONG HashPrev[ANYSIZE_ARRAY];
+} XPRESS_WORKSPACE, *PXPRESS_WORKSPACE;
+
+typedef struct _XPRESS_HUFF_DECODE_TABLE
+{
+    USHORT Primary[XPRESS_HUFF_PRIMARY_SIZE];
+    USHORT Secondary[XPRESS_HUFF_SYMBOLS][XPRESS_HUFF_SECONDARY_SIZE];
+} XPRESS_HUFF_DECODE_TABLE, *PXPRESS_HUFF_DECODE_TABLE;
+
+/* Spare decoding table for callers without a workspace, kept across calls */
+static PXPRESS_HUFF_DECODE_TABLE RtlpXpressSpareDecodeTable;
+
+typedef struct _XPRESS_MATCH_FINDER
+{
+    PXPRESS_WORKSPACE WorkSpace;
+    PUCHAR Source;
+    ULONG SourceSize;
+    ULONG Hashed;
+    ULONG WindowMask;
+    ULONG MaxOffset;
+    ULONG MaxChain;
+    ULONG NiceLength;
+    BOOLEAN Lazy;
+} XPRESS_MATCH_FINDER, *PXPRESS_MATCH_FINDER;
+
+typedef struct _XPRESS_WRITER
+{
+    PUCHAR Current;
+    PUCHAR End;
+    BOOLEAN Overflow;
+
+    /* plain LZ77: flag word and shared length nibble */
+    PUCHAR FlagSlot;
+    PUCHAR HalfByte;
+    ULONG Flags;
+    ULONG FlagCount;
+
+    /* LZ77+Huffman: the two 16-bit words the decoder has buffered */
+    PUCHAR Slot[2];
+    ULONG BitBuffer;
+    ULONG BitCount;
+} XPRESS_WRITER, *PXPRESS_WRITER;
+
+/* FUNCTIONS *****************************************************************/
+
+static
+ULONG
+RtlpXpressWindowSize(
+    IN USHORT Format)
+{
+    return (Format == COMPRESSION_FORMAT_XPRESS) ? XPRESS_PLAIN_WINDOW : XPRESS_HUFF_WINDOW;
+}
+
+FORCEINLINE
+ULONG
+RtlpXpressHash(
+    IN PUCHAR Data)
+{
+    ULONG Value = Data[0] | (Data[1] << 8) | (Data[2] << 16);
+    return (Value * 2654435761U) >> (32 - XPRESS_HASH_BITS);
+}
+
+FORCEINLINE
+ULONG
+RtlpXpressHighBit(
+    IN ULONG Value)
+{
+    ULONG Bit = 0;
+    while (Value >>= 1) Bit++;
+    return Bit;
+}
+
+/* Insert all positions below Limit into the hash chains */
+FORCEINLINE
+VOID
+RtlpXpressInsert(
+    IN PXPRESS_MATCH_FINDER Finder,
+    IN ULONG Limit)
+{
+    PXPRESS_WORKSPACE WorkSpace = Finder->WorkSpace;
+    ULONG Hash;
+
+    if (Finder->SourceSize < XPRESS_MIN_MATCH)
+        return;
+
+    Limit = min(Limit, Finder->SourceSize - XPRESS_MIN_MATCH + 1);
+    while (Finder->Hashed < Limit)
+    {
+        Hash = RtlpXpressHash(Finder->Source + Finder->Hashed);
+        WorkSpace->HashPrev[Finder->Hashed & Finder->WindowMask] = WorkSpace->HashHead[Hash];
+        WorkSpace->HashHead[Hash] = Finder->Hashed + 1;
+        Finder->Hashed++;
+    }
+}
+
+/* Find the longest match for Position; Position must not be inserted yet */
+static
+ULONG
+RtlpXpressFindMatch(
+    IN PXPRESS_MATCH_FINDER Finder,
+    IN ULONG Position,
+    IN ULONG MaxLength,
+    OUT PULONG Offset)
+{
+    PXPRESS_WORKSPACE WorkSpace = Finder->WorkSpace;
+    PUCHAR Current = Finder->Source + Position, Reference;
+    ULONG Entry, Candidate, Chain, Length, BestLength = 0;
+
+    if (MaxLength < XPRESS_MIN_MATCH)
+        return 0;
+    MaxLength = min(MaxLength, XPRESS_MAX_TOKEN_LENGTH);
+
+    Entry = WorkSpace->HashHead[RtlpXpressHash(Current)];
+    for (Chain = Finder->MaxChain; Entry && Chain; Chain--)
+    {
+        /* Chains are ordered by position, everything further down is out of reach */
+        Candidate = Entry - 1;
+        if (Position - Candidate > Finder->MaxOffset)
+            break;
+
+        Reference = Finder->Source + Candidate;
+        if (Reference[BestLength] == Current[BestLength] &&
+            Reference[0] == Current[0] && Reference[1] == Current[1])
+        {
+            for (Length = 2; Length < MaxLength && Reference[Length] == Current[Length]; Length++);
+
+            if (Length > BestLength)
+            {
+                BestLength = Length;
+                *Offset = Position - Candidate;
+                if (Length >= Finder->NiceLength || Length == MaxLength)
+                    break;
+            }
+        }
+
+        Entry = WorkSpace->HashPrev[Candidate & Finder->WindowMask];
+    }
+
+    return (BestLength >= XPRESS_MIN_MATCH) ? BestLength : 0;
+}
+
+/* Turn Source[Start, End) into literal and match tokens, returns the token count */
+static
+ULONG
+RtlpXpressParse(
+    IN PXPRESS_MATCH_FINDER Finder,
+    IN ULONG Start,
+    IN ULONG End)
+{
+    PULONG Tokens = Finder->WorkSpace->Tokens;
+    ULONG Position = Start, Count = 0;
+    ULONG Length, Offset = 0, NextLength, NextOffset = 0;
+
+    if (Start >= End)
+        return 0;
+
+    Length = RtlpXpressFindMatch(Finder, Position, End - Position, &Offset);
+    RtlpXpressInsert(Finder, Position + 1);
+
+    while (Position < End)
+    {
+        /* Lazy matching: prefer a literal if the next position has a longer match */
+        if (Finder->Lazy && Length && Length < Finder->NiceLength && Position + 1 < End)
+        {
+            NextLength = RtlpXpressFindMatch(Finder, Position + 1, End - Position - 1, &NextOffset);
+            RtlpXpressInsert(Finder, Position + 2);
+            if (NextLength > Length)
+            {
+                Tokens[Count++] = Finder->Source[Position++];
+                Length = NextLength;
+                Offset = NextOffset;
+                continue;
+            }
+        }
+
+        if (Length)
+        {
+            Tokens[Count++] = XPRESS_MATCH_TOKEN(Length, Offset);
+            Position += Length;
+            RtlpXpressInsert(Finder, Position);
+        }
+        else
+        {
+            Tokens[Count++] = Finder->Source[Position++];
+        }
+
+        if (Position < End)
+        {
+            Length = RtlpXpressFindMatch(Finder, Position, End - Position, &Offset);
+            RtlpXpressInsert(Finder, Position + 1);
+        }
+    }
+
+    return Count;
+}
+
+FORCEINLINE
+PUCHAR
+RtlpXpressReserve(
+    IN PXPRESS_WRITER Writer,
+    IN ULONG Size)
+{
+    PUCHAR Pointer = Writer->Current;
+
+    if (Writer->Overflow || (ULONG)(Writer->End - Pointer) < Size)
+    {
+        Writer->Overflow = TRUE;
+        return NULL;
+    }
+
+    Writer->Current += Size;
+    return Pointer;
+}
+
+FORCEINLINE
+VOID
+RtlpXpressWriteByte(
+    IN PXPRESS_WRITER Writer,
+    IN UCHAR Value)
+{
+    PUCHAR Pointer = RtlpXpressReserve(Writer, sizeof(UCHAR));
+    if (Pointer) *Pointer = Value;
+}
+
+FORCEINLINE
+VOID
+RtlpXpressWriteUshort(
+    IN PXPRESS_WRITER Writer,
+    IN USHORT Value)
+{
+    PUCHAR Pointer = RtlpXpressReserve(Writer, sizeof(USHORT));
+    if (Pointer) *(PUSHORT)Pointer = Value;
+}
+
+FORCEINLINE
+VOID
+RtlpXpressWriteUlong(
+    IN PXPRESS_WRITER Writer,
+    IN ULONG Value)
+{
+    PUCHAR Pointer = RtlpXpressReserve(Writer, sizeof(ULONG));
+    if (Pointer) *(PULONG)Pointer = Value;
+}
+
+/* Plain LZ77 ****************************************************************/
+
+static
+VOID
+RtlpXpressPlainPutFlag(
+    IN PXPRESS_WRITER Writer,
+    IN ULONG Flag)
+{
+    Writer->Flags = (Writer->Flags << 1) | Flag;
+    if (++Writer->FlagCount == 32)
+    {
+        if (Writer->FlagSlot) *(PULONG)Writer->FlagSlot = Writer->Flags;
+        Writer->FlagSlot = RtlpXpressReserve(Writer, sizeof(ULONG));
+        Writer->Flags = 0;
+        Writer->FlagCount = 0;
+    }
+}
+
+static
+VOID
+RtlpXpressPlainEncode(
+    IN PXPRESS_WRITER Writer,
+    IN PULONG Tokens,
+    IN ULONG Count)
+{
+    ULONG Token, Length, Nibble, i;
+
+    for (i = 0; i < Count && !Writer->Overflow; i++)
+    {
+        Token = Tokens[i];
+        if (!(Token & XPRESS_TOKEN_MATCH))
+        {
+            RtlpXpressWriteByte(Writer, (UCHAR)Token);
+            RtlpXpressPlainPutFlag(Writer, 0);
+            continue;
+        }
+
+        Length = XPRESS_TOKEN_LENGTH(Token) - XPRESS_MIN_MATCH;
+        if (Length < 7)
+        {
+            RtlpXpressWriteUshort(Writer, (USHORT)(((XPRESS_TOKEN_OFFSET(Token) - 1) << 3) | Length));
+        }
+        else
+        {
+            RtlpXpressWriteUshort(Writer, (USHORT)(((XPRESS_TOKEN_OFFSET(Token) - 1) << 3) | 7));
+
+            /* Two consecutive long matches share one byte for their length nibbles */
+            Length -= 7;
+            Nibble = min(Length, 15);
+            if (!Writer->HalfByte)
+            {
+                Writer->HalfByte = RtlpXpressReserve(Writer, sizeof(UCHAR));
+                if (Writer->HalfByte) *Writer->HalfByte = (UCHAR)Nibble;
+            }
+            else
+            {
+                *Writer->HalfByte |= (UCHAR)(Nibble << 4);
+                Writer->HalfByte = NULL;
+            }
+
+            if (Length >= 15)
+            {
+                Length -= 15;
+                if (Length < 255)
+                {
+                    RtlpXpressWriteByte(Writer, (UCHAR)Length);
+                }
+                else
+                {
+                    RtlpXpressWriteByte(Writer, 255);
+                    RtlpXpressWriteUshort(Writer, (USHORT)(Length + 15 + 7));
+                }
+            }
+        }
+
+        RtlpXpressPlainPutFlag(Writer, 1);
+    }
+}
+
+static
+VOID
+RtlpXpressPlainFinish(
+    IN PXPRESS_WRITER Writer)
+{
+    ULONG Remaining = 32 - Writer->FlagCount;
+
+    /* The unused flags are set, a match flag without input terminates decoding */
+    if (Writer->FlagSlot)
+    {
+        *(PULONG)Writer->FlagSlot = (ULONG)(((ULONGLONG)Writer->Flags << Remaining) |
+                                            ((1ULL << Remaining) - 1));
+    }
+}
+
+static
+NTSTATUS
+RtlpDecompressXpressPlain(
+    OUT PUCHAR UncompressedBuffer,
+    IN ULONG UncompressedBufferSize,
+    IN PUCHAR CompressedBuffer,
+    IN ULONG CompressedBufferSize,
+    OUT PULONG FinalUncompressedSize)
+{
+    PUCHAR In = CompressedBuffer, InEnd = CompressedBuffer + CompressedBufferSize;
+    PUCHAR Out = UncompressedBuffer, OutEnd = UncompressedBuffer + UncompressedBufferSize;
+    PUCHAR HalfByte = NULL;
+    ULONG Flags = 0, FlagCount = 0, Length, Offset;
+    USHORT MatchBytes;
+
+    while (Out < OutEnd)
+    {
+        if (!FlagCount)
+        {
+            if (In == InEnd)
+                break;
+            if (InEnd - In < sizeof(ULONG))
+                return STATUS_BAD_COMPRESSION_BUFFER;
+            Flags = *(PULONG)In;
+            In += sizeof(ULONG);
+            FlagCount = 32;
+        }
+        FlagCount--;
+
+        if (!(Flags & (1 << FlagCount)))
+        {
+            /* Literal */
+            if (In == InEnd)
+                break;
+            *Out++ = *In++;
+            continue;
+        }
+
+        /* Match, or the end of the stream */
+        if (In == InEnd)
+            break;
+        if (InEnd - In < sizeof(USHORT))
+            return STATUS_BAD_COMPRESSION_BUFFER;
+        MatchBytes = *(PUSHORT)In;
+        In += sizeof(USHORT);
+
+        Length = MatchBytes & 7;
+        Offset = (MatchBytes >> 3) + 1;
+        if (Length == 7)
+        {
+            if (!HalfByte)
+            {
+                if (In == InEnd)
+                    return STATUS_BAD_COMPRESSION_BUFFER;
+                HalfByte = In++;
+                Length = *HalfByte & 15;
+            }
+            else
+            {
+                Length = *HalfByte >> 4;
+                HalfByte = NULL;
+            }
+
+            if (Length == 15)
+            {
+                if (In == InEnd)
+                    return STATUS_BAD_COMPRESSION_BUFFER;
+                Length = *In++;
+                if (Length == 255)
+                {
+                    if (InEnd - In < sizeof(USHORT))
+                        return STATUS_BAD_COMPRESSION_BUFFER;
+                    Length = *(PUSHORT)In;
+                    In += sizeof(USHORT);
+                    if (!Length)
+                    {
+                        if (InEnd - In < sizeof(ULONG))
+                            return STATUS_BAD_COMPRESSION_BUFFER;
+                        Length = *(PULONG)In;
+                        In += sizeof(ULONG);
+                    }
+                    if (Length < 15 + 7)
+                        return STATUS_BAD_COMPRESSION_BUFFER;
+                    Length -= 15 + 7;
+                }
+                Length += 15;
+            }
+            Length += 7;
+        }
+        Length += XPRESS_MIN_MATCH;
+
+        if (Offset > (ULONG)(Out - UncompressedBuffer))
+            return STATUS_BAD_COMPRESSION_BUFFER;
+
+        /* Source and destination may overlap, copy byte by byte */
+        Length = min(Length, (ULONG)(OutEnd - Out));
+        while (Length--)
+        {
+            *Out = *(Out - Offset);
+            Out++;
+        }
+    }
+
+    *FinalUncompressedSize = (ULONG)(Out - UncompressedBuffer);
+    return STATUS_SUCCESS;
+}
+
+/* LZ77+Huffman **************************************************************/
+
+/* Sort symbols by ascending frequency */
+static
+VOID
+RtlpXpressHuffSort(
+    IN OUT PXPRESS_HUFF_SYMBOL Symbols,
+    IN ULONG Count)
+{
+    static const ULONG Gaps[] = { 132, 57, 23, 10, 4, 1 };
+    XPRESS_HUFF_SYMBOL Temp;
+    ULONG g, i, j, Gap;
+
+    for (g = 0; g < RTL_NUMBER_OF(Gaps); g++)
+    {
+        Gap = Gaps[g];
+        for (i = Gap; i < Count; i++)
+        {
+            Temp = Symbols[i];
+            for (j = i; j >= Gap && Symbols[j - Gap].Key > Temp.Key; j -= Gap)
+                Symbols[j] = Symbols[j - Gap];
+            Symbols[j] = Temp;
+        }
+    }
+}
+
+/* In-place minimum redundancy code lengths for symbols sorted by frequency (Moffat-Katajainen) */
+static
+VOID
+RtlpXpressHuffMinimumRedundancy(
+    IN OUT PXPRESS_HUFF_SYMBOL A,
+    IN ULONG Count)
+{
+    LONG Root, Leaf, Next, Available, Used, Depth, n = (LONG)Count;
+
+    if (n == 0) return;
+    if (n == 1) { A[0].Key = 1; return; }
+
+    A[0].Key += A[1].Key;
+    Root = 0;
+    Leaf = 2;
+    for (Next = 1; Next < n - 1; Next++)
+    {
+        if (Leaf >= n || A[Root].Key < A[Leaf].Key)
+        {
+            A[Next].Key = A[Root].Key;
+            A[Root++].Key = Next;
+        }
+        else
+        {
+            A[Next].Key = A[Leaf++].Key;
+        }
+
+        if (Leaf >= n || (Root < Next && A[Root].Key < A[Leaf].Key))
+        {
+            A[Next].Key += A[Root].Key;
+            A[Root++].Key = Next;
+        }
+        else
+        {
+            A[Next].Key += A[Leaf++].Key;
+        }
+    }
+
+    A[n - 2].Key = 0;
+    for (Next = n - 3; Next >= 0; Next--)
+        A[Next].Key = A[A[Next].Key].Key + 1;
+
+    Available = 1;
+    Used = Depth = 0;
+    Root = n - 2;
+    Next = n - 1;
+    while (Available > 0)
+    {
+        while (Root >= 0 && (LONG)A[Root].Key == Depth)
+        {
+            Used++;
+            Root--;
+        }
+        while (Available > Used)
+        {
+            A[Next--].Key = Depth;
+            Available--;
+        }
+        Available = 2 * Used;
+        Depth++;
+        Used = 0;
+    }
+}
+
+/* Build length-limited canonical codes from WorkSpace->Frequency */
+static
+VOID
+RtlpXpressHuffBuildCodes(
+    IN PXPRESS_WORKSPACE WorkSpace)
+{
+    PXPRESS_HUFF_SYMBOL Sorted = WorkSpace->Sorted;
+    ULONG NumCodes[XPRESS_HUFF_MAX_DEPTH + 1];
+    ULONG Count = 0, Total, Code, Length, i, j;
+
+    RtlZeroMemory(WorkSpace->Length, sizeof(WorkSpace->Length));
+    RtlZeroMemory(NumCodes, sizeof(NumCodes));
+
+    for (i = 0; i < XPRESS_HUFF_SYMBOLS; i++)
+    {
+        if (WorkSpace->Frequency[i])
+        {
+            Sorted[Count].Key = WorkSpace->Frequency[i];
+            Sorted[Count].Symbol = i;
+            Count++;
+        }
+    }
+
+    /* A single symbol still gets a complete code */
+    if (Count == 1)
+    {
+        Sorted[1].Key = 0;
+        Sorted[1].Symbol = Sorted[0].Symbol ? 0 : 1;
+        Count = 2;
+    }
+
+    RtlpXpressHuffSort(Sorted, Count);
+    RtlpXpressHuffMinimumRedundancy(Sorted, Count);
+
+    for (i = 0; i < Count; i++)
+        NumCodes[min(Sorted[i].Key, XPRESS_HUFF_MAX_DEPTH)]++;
+
+    /* Limit the code lengths, keeping the Kraft sum at exactly one */
+    for (i = XPRESS_HUFF_MAX_BITS + 1; i <= XPRESS_HUFF_MAX_DEPTH; i++)
+        NumCodes[XPRESS_HUFF_MAX_BITS] += NumCodes[i];
+
+    Total = 0;
+    for (i = XPRESS_HUFF_MAX_BITS; i > 0; i--)
+        Total += NumCodes[i] << (XPRESS_HUFF_MAX_BITS - i);
+
+    while (Total != (1UL << XPRESS_HUFF_MAX_BITS))
+    {
+        NumCodes[XPRESS_HUFF_MAX_BITS]--;
+        for (i = XPRESS_HUFF_MAX_BITS - 1; i > 0; i--)
+        {
+            if (NumCodes[i])
+            {
+                NumCodes[i]--;
+                NumCodes[i + 1] += 2;
+                break;
+            }
+        }
+        Total--;
+    }
+
+    /* The most frequent symbols get the shortest codes */
+    for (i = 1, j = Count; i <= XPRESS_HUFF_MAX_BITS; i++)
+    {
+        for (Length = NumCodes[i]; Length > 0; Length--)
+            WorkSpace->Length[Sorted[--j].Symbol] = (UCHAR)i;
+    }
+
+    /* Canonical codes, ordered by length and then by symbol */
+    Code = 0;
+    for (Length = 1; Length <= XPRESS_HUFF_MAX_BITS; Length++)
+    {
+        for (i = 0; i < XPRESS_HUFF_SYMBOLS; i++)
+        {
+            if (WorkSpace->Length[i] == Length)
+                WorkSpace->Code[i] = (USHORT)Code++;
+        }
+        Code <<= 1;
+    }
+}
+
+static
+VOID
+RtlpXpressHuffWriteBits(
+    IN PXPRESS_WRITER Writer,
+    IN ULONG Value,
+    IN ULONG Count)
+{
+    ULONG Spill;
+
+    if (Writer->BitCount + Count <= 16)
+    {
+        Writer->BitBuffer = (Writer->BitBuffer << Count) | Value;
+        Writer->BitCount += Count;
+        return;
+    }
+
+    /* The current word is full; the decoder fetches the next one at this point */
+    Spill = Writer->BitCount + Count - 16;
+    if (Writer->Slot[0])
+    {
+        *(PUSHORT)Writer->Slot[0] = (USHORT)((Writer->BitBuffer << (16 - Writer->BitCount)) |
+                                             (Value >> Spill));
+    }
+    Writer->Slot[0] = Writer->Slot[1];
+    Writer->Slot[1] = RtlpXpressReserve(Writer, sizeof(USHORT));
+    Writer->BitBuffer = Value & ((1 << Spill) - 1);
+    Writer->BitCount = Spill;
+}
+
+/*
+ * Symbol 256 doubles as the end-of-stream marker once the input is consumed. Spell out
+ * (offset 1, length 3) matches near the end of the stream as literals, so that the decoder
+ * cannot mistake them for the marker.
+ */
+static
+VOID
+RtlpXpressHuffFixTail(
+    IN PXPRESS_WORKSPACE WorkSpace,
+    IN OUT PULONG Count,
+    IN PUCHAR Source,
+    IN ULONG End)
+{
+    PULONG Tokens = WorkSpace->Tokens;
+    ULONG Position = End, Token, i;
+
+    for (i = *Count; i > 0 && *Count - i < 32; i--)
+    {
+        Token = Tokens[i - 1];
+        if (!(Token & XPRESS_TOKEN_MATCH))
+        {
+            Position--;
+            continue;
+        }
+
+        Position -= XPRESS_TOKEN_LENGTH(Token);
+        if (XPRESS_TOKEN_OFFSET(Token) == 1 && XPRESS_TOKEN_LENGTH(Token) == XPRESS_MIN_MATCH)
+        {
+            /* A 3-byte match covers at least three positions, so the tokens still fit */
+            RtlMoveMemory(&Tokens[i + 2], &Tokens[i], (*Count - i) * sizeof(ULONG));
+            Tokens[i - 1] = Tokens[i] = Tokens[i + 1] = Source[Position];
+            *Count += 2;
+        }
+    }
+}
+
+static
+VOID
+RtlpXpressHuffEncodeBlock(
+    IN PXPRESS_WRITER Writer,
+    IN PXPRESS_WORKSPACE WorkSpace,
+    IN ULONG Count,
+    IN BOOLEAN LastBlock)
+{
+    PULONG Tokens = WorkSpace->Tokens;
+    ULONG Token, Symbol, Length, Offset, OffsetBits, i;
+    PUCHAR Table;
+
+    /* Gather the symbol statistics for this block */
+    RtlZeroMemory(WorkSpace->Frequency, sizeof(WorkSpace->Frequency));
+    for (i = 0; i < Count; i++)
+    {
+        Token = Tokens[i];
+        if (Token & XPRESS_TOKEN_MATCH)
+        {
+            Length = XPRESS_TOKEN_LENGTH(Token) - XPRESS_MIN_MATCH;
+            Symbol = 256 + (RtlpXpressHighBit(XPRESS_TOKEN_OFFSET(Token)) << 4) + min(Length, 15);
+        }
+        else
+        {
+            Symbol = Token;
+        }
+        WorkSpace->Frequency[Symbol]++;
+    }
+    if (LastBlock)
+        WorkSpace->Frequency[XPRESS_HUFF_EOF]++;
+
+    RtlpXpressHuffBuildCodes(WorkSpace);
+
+    /* 512 code lengths, two per byte */
+    Table = RtlpXpressReserve(Writer, XPRESS_HUFF_TABLE_BYTES);
+    if (!Table)
+        return;
+    for (i = 0; i < XPRESS_HUFF_TABLE_BYTES; i++)
+        Table[i] = WorkSpace->Length[2 * i] | (WorkSpace->Length[2 * i + 1] << 4);
+
+    Writer->Slot[0] = RtlpXpressReserve(Writer, sizeof(USHORT));
+    Writer->Slot[1] = RtlpXpressReserve(Writer, sizeof(USHORT));
+    Writer->BitBuffer = 0;
+    Writer->BitCount = 0;
+
+    for (i = 0; i < Count && !Writer->Overflow; i++)
+    {
+        Token = Tokens[i];
+        if (!(Token & XPRESS_TOKEN_MATCH))
+        {
+            RtlpXpressHuffWriteBits(Writer, WorkSpace->Code[Token], WorkSpace->Length[Token]);
+            continue;
+        }
+
+        Length = XPRESS_TOKEN_LENGTH(Token) - XPRESS_MIN_MATCH;
+        Offset = XPRESS_TOKEN_OFFSET(Token);
+        OffsetBits = RtlpXpressHighBit(Offset);
+        Symbol = 256 + (OffsetBits << 4) + min(Length, 15);
+        RtlpXpressHuffWriteBits(Writer, WorkSpace->Code[Symbol], WorkSpace->Length[Symbol]);
+
+        /* Long lengths are stored as raw bytes between the bit stream words */
+        if (Length >= 15)
+        {
+            if (Length - 15 < 255)
+            {
+                RtlpXpressWriteByte(Writer, (UCHAR)(Length - 15));
+            }
+            else
+            {
+                RtlpXpressWriteByte(Writer, 255);
+                RtlpXpressWriteUshort(Writer, (USHORT)Length);
+            }
+        }
+
+        RtlpXpressHuffWriteBits(Writer, Offset & ((1 << OffsetBits) - 1), OffsetBits);
+    }
+
+    if (LastBlock)
+        RtlpXpressHuffWriteBits(Writer, WorkSpace->Code[XPRESS_HUFF_EOF], WorkSpace->Length[XPRESS_HUFF_EOF]);
+
+    /* Flush both buffered words, the next block starts behind them */
+    if (Writer->Slot[0])
+        *(PUSHORT)Writer->Slot[0] = (USHORT)(Writer->BitBuffer << (16 - Writer->BitCount));
+    if (Writer->Slot[1])
+        *(PUSHORT)Writer->Slot[1] = 0;
+}
+
+static
+NTSTATUS
+RtlpXpressHuffBuildDecodeTable(
+    IN PUCHAR Table,
+    OUT PXPRESS_HUFF_DECODE_TABLE DecodeTable)
+{
+    ULONG Length, Symbol, Code, Count, First, Prefix, Subtables = 0, i;
+    USHORT Entry;
+
+    RtlZeroMemory(DecodeTable->Primary, sizeof(DecodeTable->Primary));
+
+    Code = 0;
+    for (Length = 1; Length <= XPRESS_HUFF_MAX_BITS; Length++)
+    {
+        for (Symbol = 0; Symbol < XPRESS_HUFF_SYMBOLS; Symbol++)
+        {
+            if (((Table[Symbol / 2] >> ((Symbol & 1) * 4)) & 15) != Length)
+                continue;
+
+            /* Over-subscribed code */
+            if (Code >= (1UL << Length))
+                return STATUS_BAD_COMPRESSION_BUFFER;
+
+            Entry = (USHORT)((Symbol << 4) | Length);
+            if (Length <= XPRESS_HUFF_PRIMARY_BITS)
+            {
+                First = Code << (XPRESS_HUFF_PRIMARY_BITS - Length);
+                Count = 1 << (XPRESS_HUFF_PRIMARY_BITS - Length);
+                for (i = 0; i < Count; i++)
+                    DecodeTable->Primary[First + i] = Entry;
+            }
+            else
+            {
+                Prefix = Code >> (Length - XPRESS_HUFF_PRIMARY_BITS);
+                if (!(DecodeTable->Primary[Prefix] & XPRESS_HUFF_SUBTABLE))
+                {
+                    RtlZeroMemory(DecodeTable->Secondary[Subtables], sizeof(DecodeTable->Secondary[0]));
+                    DecodeTable->Primary[Prefix] = (USHORT)(XPRESS_HUFF_SUBTABLE | Subtables++);
+                }
+
+                First = (Code << (XPRESS_HUFF_MAX_BITS - Length)) & (XPRESS_HUFF_SECONDARY_SIZE - 1);
+                Count = 1 << (XPRESS_HUFF_MAX_BITS - Length);
+                for (i = 0; i < Count; i++)
+                    DecodeTable->Secondary[DecodeTable->Primary[Prefix] & ~XPRESS_HUFF_SUBTABLE][First + i] = Entry;
+            }
+            Code++;
+        }
+        Code <<= 1;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/* Takes the next 16 bits of the stream. Past the end of the input they read
+ * as zero and are counted in Overrun instead of moving the input pointer. */
+FORCEINLINE
+ULONG
+RtlpXpressHuffRead16(
+    IN OUT PUCHAR *In,
+    IN PUCHAR InEnd,
+    IN OUT PULONG Overrun)
+{
+    ULONG Bits;
+
+    if (InEnd - *In >= sizeof(USHORT))
+    {
+        Bits = *(PUSHORT)*In;
+        *In += sizeof(USHORT);
+        return Bits;
+    }
+
+    *Overrun += sizeof(USHORT) - (ULONG)(InEnd - *In);
+    *In = InEnd;
+    return 0;
+}
+
+static
+NTSTATUS
+RtlpDecompressXpressHuff(
+    OUT PUCHAR UncompressedBuffer,
+    IN ULONG UncompressedBufferSize,
+    IN PUCHAR CompressedBuffer,
+    IN ULONG CompressedBufferSize,
+    OUT PULONG FinalUncompressedSize,
+    IN PXPRESS_HUFF_DECODE_TABLE DecodeTable)
+{
+    PUCHAR In = CompressedBuffer, InEnd = CompressedBuffer + CompressedBufferSize;
+    PUCHAR Out = UncompressedBuffer, OutEnd = UncompressedBuffer + UncompressedBufferSize;
+    PUCHAR BlockEnd;
+    ULONG NextBits, Entry, Symbol, Length, Offset, OffsetBits, Overrun;
+    LONG ExtraBits;
+    NTSTATUS Status;
+
+    while (Out < OutEnd)
+    {
+        /* Every 64 KB block starts with its own code length table */
+        if (InEnd - In < XPRESS_HUFF_TABLE_BYTES)
+            break;
+
+        Status = RtlpXpressHuffBuildDecodeTable(In, DecodeTable);
+        if (!NT_SUCCESS(Status))
+            return Status;
+        In += XPRESS_HUFF_TABLE_BYTES;
+
+        Overrun = 0;
+        NextBits = RtlpXpressHuffRead16(&In, InEnd, &Overrun) << 16;
+        NextBits |= RtlpXpressHuffRead16(&In, InEnd, &Overrun);
+        ExtraBits = 16;
+
+        BlockEnd = Out + min(XPRESS_BLOCK_SIZE, (ULONG)(OutEnd - Out));
+        while (Out < BlockEnd)
+        {
+            Entry = DecodeTable->Primary[NextBits >> (32 - XPRESS_HUFF_PRIMARY_BITS)];
+            if (Entry & XPRESS_HUFF_SUBTABLE)
+            {
+                Entry = DecodeTable->Secondary[Entry & ~XPRESS_HUFF_SUBTABLE]
+                                              [(NextBits >> (32 - XPRESS_HUFF_MAX_BITS)) & (XPRESS_HUFF_SECONDARY_SIZE - 1)];
+            }
+
+            Length = Entry & 15;
+            if (!Length)
+                return STATUS_BAD_COMPRESSION_BUFFER;
+            Symbol = Entry >> 4;
+
+            NextBits <<= Length;
+            ExtraBits -= Length;
+            if (ExtraBits < 0)
+            {
+                NextBits |= RtlpXpressHuffRead16(&In, InEnd, &Overrun) << -ExtraBits;
+                ExtraBits += 16;
+
+                /* Both buffered words are past the input, a stream without EOF symbol */
+                if (Overrun > sizeof(ULONG))
+                    goto Done;
+            }
+
+            if (Symbol < 256)
+            {
+                *Out++ = (UCHAR)Symbol;
+                continue;
+            }
+
+            /* The end-of-stream symbol is only special once the input is consumed */
+            if (Symbol == XPRESS_HUFF_EOF && In >= InEnd)
+                goto Done;
+
+            Symbol -= 256;
+            Length = Symbol & 15;
+            OffsetBits = Symbol >> 4;
+            if (Length == 15)
+            {
+                if (In >= InEnd)
+                    return STATUS_BAD_COMPRESSION_BUFFER;
+                Length = *In++;
+                if (Length == 255)
+                {
+                    if (InEnd - In < sizeof(USHORT))
+                        return STATUS_BAD_COMPRESSION_BUFFER;
+                    Length = *(PUSHORT)In;
+                    In += sizeof(USHORT);
+                    if (Length < 15)
+                        return STATUS_BAD_COMPRESSION_BUFFER;
+                    Length -= 15;
+                }
+                Length += 15;
+            }
+            Length += XPRESS_MIN_MATCH;
+
+            Offset = (1 << OffsetBits);
+            if (OffsetBits)
+            {
+                Offset |= NextBits >> (32 - OffsetBits);
+                NextBits <<= OffsetBits;
+                ExtraBits -= OffsetBits;
+                if (ExtraBits < 0)
+                {
+                    NextBits |= RtlpXpressHuffRead16(&In, InEnd, &Overrun) << -ExtraBits;
+                    ExtraBits += 16;
+                }
+            }
+
+            if (Offset > (ULONG)(Out - UncompressedBuffer))
+                return STATUS_BAD_COMPRESSION_BUFFER;
+
+            /* Source and destination may overlap, copy byte by byte */
+            Length = min(Length, (ULONG)(OutEnd - Out));
+            while (Length--)
+            {
+                *Out = *(Out - Offset);
+                Out++;
+            }
+        }
+
+    }
+
+Done:
+    *FinalUncompressedSize = (ULONG)(Out - UncompressedBuffer);
+    return STATUS_SUCCESS;
+}
+
+/* Dispatcher entry points ***************************************************/
+
+NTSTATUS
+NTAPI
+RtlpWorkSpaceSizeXpress(
+    IN USHORT Format,
+    IN USHORT Engine,
+    OUT PULONG BufferAndWorkSpaceSize,
+    OUT PULONG FragmentWorkSpaceSize)
+{
+    if (Engine != COMPRESSION_ENGINE_STANDARD && Engine != COMPRESSION_ENGINE_MAXIMUM)
+        return STATUS_NOT_SUPPORTED;
+
+    *BufferAndWorkSpaceSize = FIELD_OFFSET(XPRESS_WORKSPACE, HashPrev) +
+                              RtlpXpressWindowSize(Format) * sizeof(ULONG);
+    *FragmentWorkSpaceSize = (Format == COMPRESSION_FORMAT_XPRESS_HUFF) ?
+                             sizeof(XPRESS_HUFF_DECODE_TABLE) : 0;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+RtlpCompressBufferXpress(
+    IN USHORT Format,
+    IN USHORT Engine,
+    IN PUCHAR UncompressedBuffer,
+    IN ULONG UncompressedBufferSize,
+    OUT PUCHAR CompressedBuffer,
+    IN ULONG CompressedBufferSize,
+    OUT PULONG FinalCompressedSize,
+    IN PVOID WorkSpace)
+{
+    XPRESS_MATCH_FINDER Finder;
+    XPRESS_WRITER Writer;
+    ULONG Start = 0, End, Count;
+
+    if (Engine != COMPRESSION_ENGINE_STANDARD && Engine != COMPRESSION_ENGINE_MAXIMUM)
+        return STATUS_NOT_SUPPORTED;
+
+    if (!WorkSpace)
+        return STATUS_ACCESS_VIOLATION;
+
+    Finder.WorkSpace = WorkSpace;
+    Finder.Source = UncompressedBuffer;
+    Finder.SourceSize = UncompressedBufferSize;
+    Finder.Hashed = 0;
+    Finder.WindowMask = RtlpXpressWindowSize(Format) - 1;
+    Finder.MaxOffset = (Format == COMPRESSION_FORMAT_XPRESS) ? XPRESS_PLAIN_WINDOW : XPRESS_HUFF_MAX_OFFSET;
+    Finder.Lazy = (Engine == COMPRESSION_ENGINE_MAXIMUM);
+    Finder.MaxChain = Finder.Lazy ? XPRESS_MAXIMUM_CHAIN : XPRESS_STANDARD_CHAIN;
+    Finder.NiceLength = Finder.Lazy ? XPRESS_MAXIMUM_NICE : XPRESS_STANDARD_NICE;
+    RtlZeroMemory(Finder.WorkSpace->HashHead, sizeof(Finder.WorkSpace->HashHead));
+
+    RtlZeroMemory(&Writer, sizeof(Writer));
+    Writer.Current = CompressedBuffer;
+    Writer.End = CompressedBuffer + CompressedBufferSize;
+
+    if (Format == COMPRESSION_FORMAT_XPRESS)
+    {
+        Writer.FlagSlot = RtlpXpressReserve(&Writer, sizeof(ULONG));
+        while (Start < UncompressedBufferSize && !Writer.Overflow)
+        {
+            End = Start + min(XPRESS_BLOCK_SIZE, UncompressedBufferSize - Start);
+            Count = RtlpXpressParse(&Finder, Start, End);
+            RtlpXpressPlainEncode(&Writer, Finder.WorkSpace->Tokens, Count);
+            Start = End;
+        }
+        RtlpXpressPlainFinish(&Writer);
+    }
+    else
+    {
+        /* Matches never cross a block, but may reach back into the previous one */
+        do
+        {
+            End = Start + min(XPRESS_BLOCK_SIZE, UncompressedBufferSize - Start);
+            Count = RtlpXpressParse(&Finder, Start, End);
+            if (End == UncompressedBufferSize)
+                RtlpXpressHuffFixTail(Finder.WorkSpace, &Count, UncompressedBuffer, End);
+            RtlpXpressHuffEncodeBlock(&Writer, Finder.WorkSpace, Count, End == UncompressedBufferSize);
+            Start = End;
+        } while (Start < UncompressedBufferSize && !Writer.Overflow);
+    }
+
+    if (Writer.Overflow)
+        return STATUS_BUFFER_TOO_SMALL;
+
+    *FinalCompressedSize = (ULONG)(Writer.Current - CompressedBuffer);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+RtlpDecompressBufferXpress(
+    IN USHORT Format,
+    OUT PUCHAR UncompressedBuffer,
+    IN ULONG UncompressedBufferSize,
+    IN PUCHAR CompressedBuffer,
+    IN ULONG CompressedBufferSize,
+    OUT PULONG FinalUncompressedSize,
+    IN PVOID WorkSpace)
+{
+    PXPRESS_HUFF_DECODE_TABLE DecodeTable = WorkSpace;
+    ULONG FinalSize = 0;
+    NTSTATUS Status;
+
+    if (Format == COMPRESSION_FORMAT_XPRESS)
+    {
+        Status = RtlpDecompressXpressPlain(UncompressedBuffer, UncompressedBufferSize,
+                                           CompressedBuffer, CompressedBufferSize,
+                                           &FinalSize);
+    }
+    else
+    {
+        /* RtlDecompressBuffer has no workspace, take the spare decoding table.
+         * It is only allocated again when concurrent callers race for it. */
+        if (!DecodeTable)
+        {
+            DecodeTable = InterlockedExchangePointer((PVOID *)&RtlpXpressSpareDecodeTable, NULL);
+            if (!DecodeTable)
+            {
+                DecodeTable = RtlpAllocateMemory(sizeof(*DecodeTable), TAG_COMPRESS);
+                if (!DecodeTable)
+                    return STATUS_INSUFFICIENT_RESOURCES;
+            }
+        }
+
+        Status = RtlpDecompressXpressHuff(UncompressedBuffer, UncompressedBufferSize,
+                                          CompressedBuffer, CompressedBufferSize,
+                                          &FinalSize, DecodeTable);
+
+        if (DecodeTable != WorkSpace &&
+            InterlockedCompareExchangePointer((PVOID *)&RtlpXpressSpareDecodeTable, DecodeTable, NULL) != NULL)
+        {
+            RtlpFreeMemory(DecodeTable, TAG_COMPRESS);
+        }
+    }
+
+    if (NT_SUCCESS(Status) && FinalUncompressedSize)
+        *FinalUncompressedSize = FinalSize;
+
+    return Status;
+}
+
+/* EOF */